@@ -0,0 +1,114 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline utility to refresh the layer extent cache.
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+
+
+
+int main(int argc, char *argv[])
+{
+  mapObj *map=NULL;
+  char *cachepath = NULL;
+  int i, j, first, status = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  first = 1;
+  if(argc > 2 && strcmp(argv[1], "-c") == 0) {
+    cachepath = argv[2];
+    first = 3;
+  }
+
+  /* ---- check the number of arguments, return syntax if not correct ---- */
+  if( argc <= first ) {
+    fprintf(stdout,"Syntax: extentcache [-c cachepath] [mapfile] [layer ...]\n" );
+    fprintf(stdout,"Computes the extent of the layers without an EXTENT and stores it in\n"
+            "the directory given by -c or by the MS_EXTENT_CACHE_PATH config option.\n"
+            "All the layers are refreshed when no layer name is given.\n" );
+    exit(1);
+  }
+
+  map = msLoadMap(argv[first], NULL);
+  if(!map) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  if(cachepath)
+    msSetConfigOption(map, "MS_EXTENT_CACHE_PATH", cachepath);
+  if(!msGetConfigOption(map, "MS_EXTENT_CACHE_PATH")) {
+    fprintf(stderr, "No MS_EXTENT_CACHE_PATH configured.\n");
+    msFreeMap(map);
+    exit(1);
+  }
+
+  for(i=first+1; i<argc; i++) {
+    if(msGetLayerIndex(map, argv[i]) == -1) {
+      fprintf(stderr, "Layer %s not found.\n", argv[i]);
+      status = 1;
+    }
+  }
+
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *layer = GET_LAYER(map, i);
+    rectObj extent;
+    int rv;
+
+    if(argc > first+1) {
+      for(j=first+1; j<argc; j++)
+        if(layer->name && strcasecmp(layer->name, argv[j]) == 0) break;
+      if(j == argc) continue;
+    }
+
+    if(MS_VALID_EXTENT(layer->extent)) {
+      printf("%s: EXTENT set in the mapfile, skipped.\n", layer->name ? layer->name : "");
+      continue;
+    }
+
+    rv = msLayerUpdateCachedExtent(layer, &extent);
+    if(rv == MS_SUCCESS) {
+      printf("%s: %.15g %.15g %.15g %.15g\n", layer->name ? layer->name : "",
+             extent.minx, extent.miny, extent.maxx, extent.maxy);
+    } else if(rv == MS_DONE) {
+      printf("%s: extent is not cached for this layer type, skipped.\n", layer->name ? layer->name : "");
+    } else {
+      fprintf(stderr, "%s: unable to compute or store the extent.\n", layer->name ? layer->name : "");
+      msWriteError(stderr);
+      msResetErrorList();
+      status = 1;
+    }
+  }
+
+  msFreeMap(map);
+  msCleanup(0);
+  return(status);
+}
@@ -132,7 +132,6 @@ struct cluster_layer_info {
 };
 
 
-extern int yyparse(parseObj *p);
 
 /* evaluate the filter expression */
 int msClusterEvaluateFilter(expressionObj* expression, shapeObj *shape)
@@ -146,7 +145,7 @@ int msClusterEvaluateFilter(expressionObj* expression, shapeObj *shape)
     p.expr->curtoken = p.expr->tokens; /* reset */
     p.type = MS_PARSE_TYPE_BOOLEAN;
 
-    status = yyparse(&p);
+    status = msExecuteExpression(&p);
 
     if (status != 0) {
       msSetError(MS_PARSEERR, "Failed to parse expression: %s", "msClusterEvaluateFilter", expression->string);
@@ -178,7 +177,7 @@ char *msClusterGetGroupText(expressionObj* expression, shapeObj *shape)
         p.expr->curtoken = p.expr->tokens; /* reset */
         p.type = MS_PARSE_TYPE_STRING;
 
-        status = yyparse(&p);
+        status = msExecuteExpression(&p);
 
         if (status != 0) {
           msSetError(MS_PARSEERR, "Failed to process text expression: %s", "msClusterGetGroupText", expression->string);
@@ -0,0 +1,280 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Fast formatting of coordinates for vector output
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** GML, KML, GeoJSON and the template shpxy tag write every vertex of every
+** result as text, and going through printf for each coordinate shows up
+** at the top of the profile for large responses. The functions here
+** format a double with plain integer arithmetic whenever the result is
+** known to be exact, and fall back to the C library otherwise:
+**
+**   precision >= 0  gives exactly the same text as "%.*f"
+**   precision <  0  gives the shortest decimal that reads back as the same
+**                   double (negative zero is written as 0)
+*/
+
+#include <float.h>
+#include "mapserver.h"
+
+/* 2^52, below this every scaled value has a unit in the last place <= 1 */
+#define MS_COORD_MAX_EXACT 4503599627370496.0
+#define MS_COORD_MAX_PRECISION 15
+
+static const double msCoordPow10[MS_COORD_MAX_PRECISION+1] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+  1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+/* writes v with at least mindigits digits, zero padded */
+static int msCoordWriteUInt(char *out, unsigned int v, int mindigits)
+{
+  char digits[12];
+  int n = 0, i;
+
+  do {
+    digits[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while(v > 0);
+  while(n < mindigits)
+    digits[n++] = '0';
+  for(i=0; i<n; i++)
+    out[i] = digits[n-1-i];
+  return n;
+}
+
+/*
+** Same for the integer valued x (0 <= x < 2^53), split in two parts that
+** fit an unsigned int. The split is exact in double arithmetic.
+*/
+static int msCoordWriteInteger(char *out, double x, int mindigits)
+{
+  double hi, lo;
+  int n;
+
+  if(x < 1e9 && mindigits <= 9)
+    return msCoordWriteUInt(out, (unsigned int)x, mindigits);
+
+  hi = floor(x / 1e9);
+  lo = x - hi*1e9;
+  if(lo < 0) {
+    hi--;
+    lo += 1e9;
+  } else if(lo >= 1e9) {
+    hi++;
+    lo -= 1e9;
+  }
+  n = msCoordWriteUInt(out, (unsigned int)hi, mindigits-9);
+  return n + msCoordWriteUInt(out+n, (unsigned int)lo, 9);
+}
+
+/*
+** Writes r / 10^precision, r being a rounded integer valued magnitude.
+** Returns the length written to out, which must hold 40 bytes.
+*/
+static int msCoordWriteFixed(char *out, double r, int precision, int negative)
+{
+  double intpart, fracpart;
+  int n = 0;
+
+  intpart = floor(r / msCoordPow10[precision]);
+  fracpart = r - intpart*msCoordPow10[precision];
+  if(fracpart < 0) {
+    intpart--;
+    fracpart += msCoordPow10[precision];
+  } else if(fracpart >= msCoordPow10[precision]) {
+    intpart++;
+    fracpart -= msCoordPow10[precision];
+  }
+
+  if(negative)
+    out[n++] = '-';
+  n += msCoordWriteInteger(out+n, intpart, 1);
+  if(precision > 0) {
+    out[n++] = '.';
+    n += msCoordWriteInteger(out+n, fracpart, precision);
+  }
+  return n;
+}
+
+/* copies the formatted text like snprintf would, returns its full length */
+static int msCoordCopy(char *buffer, size_t size, const char *text, int n)
+{
+  if(size > 0) {
+    size_t copied = ((size_t)n < size) ? (size_t)n : size-1;
+    memcpy(buffer, text, copied);
+    buffer[copied] = '\0';
+  }
+  return n;
+}
+
+/*
+** The %.*f rounding of |value|, or -1 if the product value*10^precision
+** is too close to a rounding tie to decide without the exact decimal
+** expansion that printf works from.
+*/
+static double msCoordRoundFixed(double absvalue, int precision)
+{
+  double scaled, floored, fraction;
+
+  scaled = absvalue * msCoordPow10[precision];
+  if(scaled >= MS_COORD_MAX_EXACT)
+    return -1;
+  floored = floor(scaled);
+  fraction = scaled - floored;
+
+  /* the product is off the exact one by at most half an ulp, give it two */
+  if(fabs(fraction - 0.5) <= scaled * (2*DBL_EPSILON))
+    return -1;
+  return (fraction > 0.5) ? floored + 1 : floored;
+}
+
+/************************************************************************/
+/*                            msFormatDouble()                          */
+/*                                                                      */
+/*      Format value into buffer, see above for the precision. Like     */
+/*      snprintf the return value is the full length of the text, the  */
+/*      output is truncated if that does not fit in size.               */
+/************************************************************************/
+
+int msFormatDouble(char *buffer, size_t size, double value, int precision)
+{
+  char text[40];
+  double absvalue, r;
+  int negative, p, n;
+
+  /* nan and inf */
+  if(value != value || value - value != 0) {
+    if(precision >= 0)
+      return snprintf(buffer, size, "%.*f", precision, value);
+    return snprintf(buffer, size, "%.17g", value);
+  }
+
+  negative = (value < 0 || (value == 0 && 1/value < 0));
+  absvalue = fabs(value);
+
+  if(precision >= 0) {
+    if(precision <= MS_COORD_MAX_PRECISION) {
+      r = msCoordRoundFixed(absvalue, precision);
+      if(r >= 0) {
+        n = msCoordWriteFixed(text, r, precision, negative);
+        return msCoordCopy(buffer, size, text, n);
+      }
+    }
+    return snprintf(buffer, size, "%.*f", precision, value);
+  }
+
+  if(absvalue == 0)
+    return msCoordCopy(buffer, size, "0", 1);
+
+  /*
+  ** Shortest round trip: the fewest decimals whose rounded value reads
+  ** back as the same double. Both r and 10^p are exact doubles, so the
+  ** division is the correctly rounded decimal, just like strtod().
+  */
+  for(p=0; p<=MS_COORD_MAX_PRECISION; p++) {
+    double scaled = absvalue * msCoordPow10[p];
+    if(scaled >= MS_COORD_MAX_EXACT)
+      break;
+    r = floor(scaled + 0.5);
+    if(r / msCoordPow10[p] == absvalue) {
+      n = msCoordWriteFixed(text, r, p, negative);
+      /* a shorter p would have matched if the last digit was a zero, but be safe */
+      while(p > 0 && text[n-1] == '0') n--;
+      if(text[n-1] == '.') n--;
+      return msCoordCopy(buffer, size, text, n);
+    }
+  }
+
+  /* very large or very small values, let printf find the digits */
+  for(p=15; p<17; p++) {
+    n = snprintf(text, sizeof(text), "%.*g", p, value);
+    if(strtod(text, NULL) == value)
+      return msCoordCopy(buffer, size, text, n);
+  }
+  return snprintf(buffer, size, "%.17g", value);
+}
+
+/************************************************************************/
+/*                         msBufferAppendDouble()                       */
+/************************************************************************/
+
+void msBufferAppendDouble(bufferObj *buffer, double value, int precision)
+{
+  char text[64];
+  int n;
+
+  n = msFormatDouble(text, sizeof(text), value, precision);
+  if(n < (int)sizeof(text)) {
+    msBufferAppend(buffer, text, n);
+  } else {
+    /* %f of a huge value */
+    char *big = (char *)msSmallMalloc(n+1);
+    msFormatDouble(big, n+1, value, precision);
+    msBufferAppend(buffer, big, n);
+    free(big);
+  }
+}
+
+/************************************************************************/
+/*                       msBufferAppendLineCoords()                     */
+/*                                                                      */
+/*      Append all the vertices of a line, each written as              */
+/*      prefix x coordsep y suffix and with separator between two       */
+/*      vertices. Any of the strings can be NULL.                       */
+/************************************************************************/
+
+void msBufferAppendLineCoords(bufferObj *buffer, lineObj *line, int precision,
+                              const char *prefix, const char *coordsep,
+                              const char *suffix, const char *separator)
+{
+  size_t prefixlen = prefix ? strlen(prefix) : 0;
+  size_t coordseplen = coordsep ? strlen(coordsep) : 0;
+  size_t suffixlen = suffix ? strlen(suffix) : 0;
+  size_t separatorlen = separator ? strlen(separator) : 0;
+  int i;
+
+  if(line->numpoints <= 0) return;
+
+  /* one allocation for typical coordinates */
+  msBufferResize(buffer, buffer->size + line->numpoints *
+                 (prefixlen + coordseplen + suffixlen + separatorlen + 2*24));
+
+  for(i=0; i<line->numpoints; i++) {
+    if(i > 0 && separatorlen > 0)
+      msBufferAppend(buffer, (void *)separator, separatorlen);
+    if(prefixlen > 0)
+      msBufferAppend(buffer, (void *)prefix, prefixlen);
+    msBufferAppendDouble(buffer, line->point[i].x, precision);
+    if(coordseplen > 0)
+      msBufferAppend(buffer, (void *)coordsep, coordseplen);
+    msBufferAppendDouble(buffer, line->point[i].y, precision);
+    if(suffixlen > 0)
+      msBufferAppend(buffer, (void *)suffix, suffixlen);
+  }
+}
@@ -1093,6 +1093,7 @@ int msCopyMap(mapObj *dst, mapObj *src)
   MS_COPYSTELEM(resolution);
   MS_COPYSTRING(dst->shapepath, src->shapepath);
   MS_COPYSTRING(dst->mappath, src->mappath);
+  MS_COPYSTRING(dst->mapfile, src->mapfile);
 
   MS_COPYCOLOR(&(dst->imagecolor), &(src->imagecolor));
 
@@ -901,6 +901,64 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
   return(retcode);
 }
 
+/*
+** Replace the geometry of a line or polygon smaller than a pixel by a
+** one pixel square (or segment) at its center, so it is still drawn as a
+** dot without going through the whole transform/clip/rasterize path.
+*/
+static void msCollapseSubpixelShape(shapeObj *shape, double cellsize)
+{
+  pointObj points[5];
+  lineObj line;
+  double cx = (shape->bounds.minx + shape->bounds.maxx)/2.0;
+  double cy = (shape->bounds.miny + shape->bounds.maxy)/2.0;
+  double h = cellsize/2.0;
+  int i;
+
+#ifdef USE_POINT_Z_M
+  /* the collapsed points carry the z/m of the first source vertex */
+  double z = 0, m = 0;
+  if(shape->numlines > 0 && shape->line[0].numpoints > 0) {
+    z = shape->line[0].point[0].z;
+    m = shape->line[0].point[0].m;
+  }
+  for(i=0; i<5; i++) {
+    points[i].z = z;
+    points[i].m = m;
+  }
+#endif
+
+  for(i=0; i<shape->numlines; i++)
+    free(shape->line[i].point);
+  free(shape->line);
+  shape->line = NULL;
+  shape->numlines = 0;
+
+  points[0].x = cx-h;
+  points[0].y = cy-h;
+  if(shape->type == MS_SHAPE_POLYGON) {
+    points[1].x = cx+h;
+    points[1].y = cy-h;
+    points[2].x = cx+h;
+    points[2].y = cy+h;
+    points[3].x = cx-h;
+    points[3].y = cy+h;
+    points[4] = points[0];
+    line.numpoints = 5;
+  } else {
+    points[1].x = cx+h;
+    points[1].y = cy+h;
+    line.numpoints = 2;
+  }
+  line.point = points;
+  msAddLine(shape, &line);
+
+  shape->bounds.minx = cx-h;
+  shape->bounds.miny = cy-h;
+  shape->bounds.maxx = cx+h;
+  shape->bounds.maxy = cy+h;
+}
+
 int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
 {
   int         status, retcode=MS_SUCCESS;
@@ -916,6 +974,9 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   double minfeaturesize = -1;
   int maxfeatures=-1;
   int featuresdrawn=0;
+  int subpixelmode=MS_FALSE; /* MS_FALSE (draw), MS_DELETE (skip) or MS_ON (collapse) */
+  double pixelsize = -1;
+  int subpixelskipped=0, subpixelcollapsed=0;
 
   if (image)
     maxfeatures=msLayerGetMaxFeaturesToDraw(layer, image->format);
@@ -979,6 +1040,20 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if(layer->minfeaturesize > 0)
     minfeaturesize = Pix2LayerGeoref(map, layer, layer->minfeaturesize);
 
+  /*
+  ** PROCESSING "SUBPIXEL_FEATURES=SKIP|COLLAPSE" drops, or draws as a single
+  ** pixel, the lines and polygons whose bounds fit in one pixel.
+  */
+  if(layer->transform == MS_TRUE && (layer->type == MS_LAYER_LINE || layer->type == MS_LAYER_POLYGON)) {
+    const char *subpixel = msLayerGetProcessingKey(layer, "SUBPIXEL_FEATURES");
+    if(subpixel && strcasecmp(subpixel, "SKIP") == 0)
+      subpixelmode = MS_DELETE;
+    else if(subpixel && strcasecmp(subpixel, "COLLAPSE") == 0)
+      subpixelmode = MS_ON;
+    if(subpixelmode != MS_FALSE)
+      pixelsize = Pix2LayerGeoref(map, layer, 1);
+  }
+
   while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
 
     /* Check if the shape size is ok to be drawn */
@@ -995,6 +1070,17 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
       continue;
     }
 
+    if(subpixelmode != MS_FALSE && (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) &&
+        shape.bounds.maxx - shape.bounds.minx < pixelsize && shape.bounds.maxy - shape.bounds.miny < pixelsize) {
+      if(subpixelmode == MS_DELETE) {
+        subpixelskipped++;
+        msFreeShape(&shape);
+        continue;
+      }
+      msCollapseSubpixelShape(&shape, pixelsize);
+      subpixelcollapsed++;
+    }
+
     if(maxfeatures >=0 && featuresdrawn >= maxfeatures) {
       status = MS_DONE;
       break;
@@ -1002,7 +1088,9 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     featuresdrawn++;
 
     cache = MS_FALSE;
-    if(layer->type == MS_LAYER_LINE && (layer->class[shape.classindex]->numstyles > 1 || (layer->class[shape.classindex]->numstyles == 1 && layer->class[shape.classindex]->styles[0]->outlinewidth > 0))) {
+    /* utfgrid output needs every shape between its own startShape/endShape */
+    if(layer->type == MS_LAYER_LINE && !MS_RENDERER_UTFGRID(image->format) &&
+        (layer->class[shape.classindex]->numstyles > 1 || (layer->class[shape.classindex]->numstyles == 1 && layer->class[shape.classindex]->styles[0]->outlinewidth > 0))) {
       int i;
       cache = MS_TRUE; /* only line layers with multiple styles need be cached (I don't think POLYLINE layers need caching - SDL) */
 
@@ -1117,6 +1205,10 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if (classgroup)
     msFree(classgroup);
 
+  if(subpixelmode != MS_FALSE && layer->debug)
+    msDebug("msDrawVectorLayer(%s): %d features skipped and %d collapsed as smaller than a pixel\n",
+            layer->name, subpixelskipped, subpixelcollapsed);
+
   if(status != MS_DONE || retcode == MS_FAILURE) {
     msLayerClose(layer);
     if(shpcache) {
@@ -1340,7 +1432,7 @@ int msDrawQueryLayer(mapObj *map, layerObj *layer, imageObj *image)
     }
 
     cache = MS_FALSE;
-    if(layer->type == MS_LAYER_LINE && layer->class[shape.classindex]->numstyles > 1)
+    if(layer->type == MS_LAYER_LINE && layer->class[shape.classindex]->numstyles > 1 && !MS_RENDERER_UTFGRID(image->format))
       cache = MS_TRUE; /* only line layers with multiple styles need be cached (I don't think POLYLINE layers need caching - SDL) */
 
     /* RFC 77 TODO: check return value for msShapeGetAnnotation() */
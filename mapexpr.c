@@ -0,0 +1,981 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Compiled evaluation of logical, numeric and string expressions
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** Expressions are tokenized once per layer open (msTokenizeExpression) but
+** the token list used to be run through the yacc parser (mapparser.y) for
+** every feature and every class. msCompileExpression() turns the token list
+** into a small typed syntax tree with the item indexes of the bindings
+** resolved, constant sub-expressions folded and literal regular expressions
+** and IN lists prepared, and msExecuteExpression() evaluates that tree.
+**
+** The logical, numeric, string and time parts of the grammar are compiled,
+** with the same precedence and typing rules as mapparser.y, and so are the
+** spatial predicates between [shape] and fromText() literals that OGC
+** filters turn into. Those first compare the bounds of the two shapes,
+** most candidates of a filter are decided there without building any
+** geometry. Expressions using shape functions (buffer, area...) or
+** [map_cellsize] (or any construct the compiler does not accept) keep no
+** program and msExecuteExpression() falls back on yyparse().
+*/
+
+#include "mapserver.h"
+#include "maptime.h"
+#include "mapparser.h"
+
+extern int yyparse(parseObj *);
+
+enum exprType { EXPR_BOOLEAN, EXPR_NUMBER, EXPR_STRING, EXPR_TIME, EXPR_SHAPE };
+
+enum exprOp {
+  EXPR_LITERAL, EXPR_BINDING,
+  EXPR_OR, EXPR_AND, EXPR_NOT,
+  EXPR_EQ, EXPR_NE, EXPR_GT, EXPR_LT, EXPR_GE, EXPR_LE, EXPR_IEQ, EXPR_RE, EXPR_IRE, EXPR_IN,
+  EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_MOD, EXPR_POW, EXPR_NEG,
+  EXPR_CONCAT, EXPR_LENGTH, EXPR_ROUND, EXPR_TOSTRING, EXPR_COMMIFY,
+  EXPR_EQUALS, EXPR_INTERSECTS, EXPR_DISJOINT, EXPR_TOUCHES, EXPR_OVERLAPS,
+  EXPR_CROSSES, EXPR_WITHIN, EXPR_CONTAINS, EXPR_DWITHIN, EXPR_BEYOND
+};
+
+typedef struct {
+  int n;
+  char **strings;
+  double *numbers;
+} exprListObj;
+
+typedef struct {
+  int op;
+  int type;      /* type of the value of the node */
+  int args[2];   /* operand nodes, -1 when unused */
+  union {
+    int intval;
+    double dblval;
+    char *strval;
+    struct tm tmval;
+    shapeObj *shpval; /* owned by the token list */
+    int index;   /* item index of a binding */
+  } val;
+  ms_regex_t *regex;  /* pattern of a RE/IRE node with a constant pattern */
+  exprListObj *list;  /* values of an IN node with a constant list */
+  rectObj bounds;     /* of a shape literal */
+  int hasbounds;      /* MS_FALSE for an empty shape literal */
+} exprNodeObj;
+
+struct exprProgramObj {
+  exprNodeObj *nodes;
+  int numnodes;
+  int root;
+};
+
+/************************************************************************/
+/*                               compiler                               */
+/************************************************************************/
+
+typedef struct {
+  exprProgramObj *program;
+  int maxnodes;
+  tokenListNodeObjPtr token;
+} exprCompilerObj;
+
+static int exprEvalBoolean(exprProgramObj *program, int n, shapeObj *shape, int *result);
+static int exprEvalNumber(exprProgramObj *program, int n, shapeObj *shape, double *result);
+static int exprEvalString(exprProgramObj *program, int n, shapeObj *shape, const char **result, char **tofree);
+
+static int exprAddNode(exprCompilerObj *c, int op, int type, int arg0, int arg1)
+{
+  exprNodeObj *node;
+
+  if(c->program->numnodes == c->maxnodes) {
+    c->maxnodes = MS_MAX(16, c->maxnodes*2);
+    c->program->nodes = (exprNodeObj*)msSmallRealloc(c->program->nodes, sizeof(exprNodeObj)*c->maxnodes);
+  }
+  node = &(c->program->nodes[c->program->numnodes]);
+  memset(node, 0, sizeof(exprNodeObj));
+  node->op = op;
+  node->type = type;
+  node->args[0] = arg0;
+  node->args[1] = arg1;
+  return c->program->numnodes++;
+}
+
+static int exprIsLiteral(exprCompilerObj *c, int n)
+{
+  return n < 0 || c->program->nodes[n].op == EXPR_LITERAL;
+}
+
+/* split a comma separated IN list, keeping empty values like the parser */
+static exprListObj *exprCreateList(const char *values, int numeric)
+{
+  exprListObj *list = (exprListObj*)msSmallCalloc(1, sizeof(exprListObj));
+  const char *start = values, *delim;
+  int i;
+
+  list->strings = (char**)msSmallMalloc(sizeof(char*)*(msCountChars((char*)values, ',')+1));
+  do {
+    delim = strchr(start, ',');
+    i = delim ? (int)(delim-start) : (int)strlen(start);
+    list->strings[list->n] = (char*)msSmallMalloc(i+1);
+    memcpy(list->strings[list->n], start, i);
+    list->strings[list->n++][i] = '\0';
+    start = delim+1;
+  } while(delim);
+
+  if(numeric) {
+    list->numbers = (double*)msSmallMalloc(sizeof(double)*list->n);
+    for(i=0; i<list->n; i++)
+      list->numbers[i] = atof(list->strings[i]);
+  }
+  return list;
+}
+
+static void exprFreeList(exprListObj *list)
+{
+  if(!list) return;
+  msFreeCharArray(list->strings, list->n);
+  msFree(list->numbers);
+  free(list);
+}
+
+/* bounds of the vertices, shapes are not trusted to have theirs set */
+static int exprShapeBounds(shapeObj *shape, rectObj *bounds)
+{
+  int i, j, found = MS_FALSE;
+
+  for(i=0; i<shape->numlines; i++) {
+    lineObj *line = &(shape->line[i]);
+    for(j=0; j<line->numpoints; j++) {
+      if(!found) {
+        bounds->minx = bounds->maxx = line->point[j].x;
+        bounds->miny = bounds->maxy = line->point[j].y;
+        found = MS_TRUE;
+        continue;
+      }
+      if(line->point[j].x < bounds->minx) bounds->minx = line->point[j].x;
+      else if(line->point[j].x > bounds->maxx) bounds->maxx = line->point[j].x;
+      if(line->point[j].y < bounds->miny) bounds->miny = line->point[j].y;
+      else if(line->point[j].y > bounds->maxy) bounds->maxy = line->point[j].y;
+    }
+  }
+  return found;
+}
+
+/*
+** Replace a node whose operands are all constant by its value, and prepare
+** the constant pattern of regular expressions and the constant IN lists.
+*/
+static int exprFold(exprCompilerObj *c, int n)
+{
+  exprNodeObj *node = &(c->program->nodes[n]);
+
+  if(exprIsLiteral(c, node->args[0]) && exprIsLiteral(c, node->args[1])) {
+    int status = MS_FAILURE;
+    exprNodeObj folded = *node;
+
+    /* leave the errors to the evaluation */
+    if(node->op >= EXPR_EQUALS)
+      return n;
+    if((node->op == EXPR_DIV || node->op == EXPR_MOD) && (int)c->program->nodes[node->args[1]].val.dblval == 0)
+      return n;
+
+    switch(node->type) {
+      case EXPR_BOOLEAN:
+        status = exprEvalBoolean(c->program, n, NULL, &folded.val.intval);
+        break;
+      case EXPR_NUMBER:
+        status = exprEvalNumber(c->program, n, NULL, &folded.val.dblval);
+        break;
+      case EXPR_STRING: {
+        const char *value;
+        char *tofree;
+        status = exprEvalString(c->program, n, NULL, &value, &tofree);
+        if(status == MS_SUCCESS)
+          folded.val.strval = tofree ? tofree : msStrdup(value);
+        break;
+      }
+      default:
+        break;
+    }
+    if(status == MS_SUCCESS) {
+      folded.op = EXPR_LITERAL;
+      folded.args[0] = folded.args[1] = -1;
+      c->program->nodes[n] = folded;
+    }
+    return n;
+  }
+
+  if((node->op == EXPR_RE || node->op == EXPR_IRE) && exprIsLiteral(c, node->args[1])) {
+    ms_regex_t *regex = (ms_regex_t*)msSmallMalloc(sizeof(ms_regex_t));
+    int flags = MS_REG_EXTENDED|MS_REG_NOSUB|((node->op == EXPR_IRE) ? MS_REG_ICASE : 0);
+    if(ms_regcomp(regex, c->program->nodes[node->args[1]].val.strval, flags) != 0)
+      free(regex); /* compiled again, and rejected, at each evaluation */
+    else
+      node->regex = regex;
+  } else if(node->op == EXPR_IN && exprIsLiteral(c, node->args[1])) {
+    node->list = exprCreateList(c->program->nodes[node->args[1]].val.strval,
+                                c->program->nodes[node->args[0]].type == EXPR_NUMBER);
+  }
+  return n;
+}
+
+static int exprParseOr(exprCompilerObj *c);
+
+static int exprNextToken(exprCompilerObj *c, int token)
+{
+  if(!c->token || c->token->token != token) return MS_FALSE;
+  c->token = c->token->next;
+  return MS_TRUE;
+}
+
+#define EXPR_TYPE(c,n) ((c)->program->nodes[n].type)
+#define EXPR_LOGICAL(c,n) (EXPR_TYPE(c,n) == EXPR_BOOLEAN || EXPR_TYPE(c,n) == EXPR_NUMBER)
+
+static int exprParsePrimary(exprCompilerObj *c)
+{
+  tokenListNodeObjPtr token = c->token;
+  int n, a, b;
+
+  if(!token) return -1;
+  c->token = token->next;
+
+  switch(token->token) {
+    case MS_TOKEN_LITERAL_NUMBER:
+      n = exprAddNode(c, EXPR_LITERAL, EXPR_NUMBER, -1, -1);
+      c->program->nodes[n].val.dblval = token->tokenval.dblval;
+      return n;
+    case MS_TOKEN_LITERAL_STRING:
+      n = exprAddNode(c, EXPR_LITERAL, EXPR_STRING, -1, -1);
+      c->program->nodes[n].val.strval = msStrdup(token->tokenval.strval);
+      return n;
+    case MS_TOKEN_LITERAL_TIME:
+      n = exprAddNode(c, EXPR_LITERAL, EXPR_TIME, -1, -1);
+      c->program->nodes[n].val.tmval = token->tokenval.tmval;
+      return n;
+    case MS_TOKEN_LITERAL_SHAPE:
+      n = exprAddNode(c, EXPR_LITERAL, EXPR_SHAPE, -1, -1);
+      c->program->nodes[n].val.shpval = token->tokenval.shpval;
+      c->program->nodes[n].hasbounds = exprShapeBounds(token->tokenval.shpval, &(c->program->nodes[n].bounds));
+#ifdef USE_GEOS
+      msGEOSPrepare(token->tokenval.shpval); /* the msGEOS* predicates then use GEOSPrepared* */
+#endif
+      return n;
+    case MS_TOKEN_BINDING_SHAPE:
+      return exprAddNode(c, EXPR_BINDING, EXPR_SHAPE, -1, -1);
+    case MS_TOKEN_BINDING_DOUBLE:
+    case MS_TOKEN_BINDING_INTEGER:
+    case MS_TOKEN_BINDING_STRING:
+    case MS_TOKEN_BINDING_TIME:
+      n = exprAddNode(c, EXPR_BINDING, (token->token == MS_TOKEN_BINDING_STRING) ? EXPR_STRING :
+                      (token->token == MS_TOKEN_BINDING_TIME) ? EXPR_TIME : EXPR_NUMBER, -1, -1);
+      c->program->nodes[n].val.index = token->tokenval.bindval.index;
+      return n;
+    case '(':
+      if((n = exprParseOr(c)) < 0 || !exprNextToken(c, ')')) return -1;
+      return n;
+    case MS_TOKEN_FUNCTION_LENGTH:
+    case MS_TOKEN_FUNCTION_COMMIFY:
+      if(!exprNextToken(c, '(') || (a = exprParseOr(c)) < 0 || !exprNextToken(c, ')')) return -1;
+      if(EXPR_TYPE(c,a) != EXPR_STRING) return -1;
+      if(token->token == MS_TOKEN_FUNCTION_LENGTH)
+        return exprFold(c, exprAddNode(c, EXPR_LENGTH, EXPR_NUMBER, a, -1));
+      return exprFold(c, exprAddNode(c, EXPR_COMMIFY, EXPR_STRING, a, -1));
+    case MS_TOKEN_FUNCTION_ROUND:
+    case MS_TOKEN_FUNCTION_TOSTRING:
+      if(!exprNextToken(c, '(') || (a = exprParseOr(c)) < 0 || !exprNextToken(c, ',') ||
+          (b = exprParseOr(c)) < 0 || !exprNextToken(c, ')')) return -1;
+      if(EXPR_TYPE(c,a) != EXPR_NUMBER) return -1;
+      if(token->token == MS_TOKEN_FUNCTION_ROUND) {
+        if(EXPR_TYPE(c,b) != EXPR_NUMBER) return -1;
+        return exprFold(c, exprAddNode(c, EXPR_ROUND, EXPR_NUMBER, a, b));
+      }
+      if(EXPR_TYPE(c,b) != EXPR_STRING) return -1;
+      return exprFold(c, exprAddNode(c, EXPR_TOSTRING, EXPR_STRING, a, b));
+    default:
+      return -1; /* shape functions, [map_cellsize]... */
+  }
+}
+
+static int exprParseUnary(exprCompilerObj *c);
+
+/* '^' is right associative and binds tighter than the unary minus */
+static int exprParsePower(exprCompilerObj *c)
+{
+  int a, b;
+
+  if((a = exprParsePrimary(c)) < 0) return -1;
+  if(!exprNextToken(c, '^')) return a;
+  if((b = exprParseUnary(c)) < 0) return -1;
+  if(EXPR_TYPE(c,a) != EXPR_NUMBER || EXPR_TYPE(c,b) != EXPR_NUMBER) return -1;
+  return exprFold(c, exprAddNode(c, EXPR_POW, EXPR_NUMBER, a, b));
+}
+
+static int exprParseUnary(exprCompilerObj *c)
+{
+  int a;
+
+  if(!exprNextToken(c, '-')) return exprParsePower(c);
+  if((a = exprParseUnary(c)) < 0 || EXPR_TYPE(c,a) != EXPR_NUMBER) return -1;
+  return exprFold(c, exprAddNode(c, EXPR_NEG, EXPR_NUMBER, a, -1));
+}
+
+static int exprParseMultiplicative(exprCompilerObj *c)
+{
+  int a, b, op;
+
+  if((a = exprParseUnary(c)) < 0) return -1;
+  while(c->token && (c->token->token == '*' || c->token->token == '/' || c->token->token == '%')) {
+    op = (c->token->token == '*') ? EXPR_MUL : (c->token->token == '/') ? EXPR_DIV : EXPR_MOD;
+    c->token = c->token->next;
+    if((b = exprParseUnary(c)) < 0) return -1;
+    if(EXPR_TYPE(c,a) != EXPR_NUMBER || EXPR_TYPE(c,b) != EXPR_NUMBER) return -1;
+    a = exprFold(c, exprAddNode(c, op, EXPR_NUMBER, a, b));
+  }
+  return a;
+}
+
+static int exprParseAdditive(exprCompilerObj *c)
+{
+  int a, b, token;
+
+  if((a = exprParseMultiplicative(c)) < 0) return -1;
+  while(c->token && (c->token->token == '+' || c->token->token == '-')) {
+    token = c->token->token;
+    c->token = c->token->next;
+    if((b = exprParseMultiplicative(c)) < 0) return -1;
+    if(EXPR_TYPE(c,a) != EXPR_TYPE(c,b)) return -1;
+    if(EXPR_TYPE(c,a) == EXPR_NUMBER)
+      a = exprFold(c, exprAddNode(c, (token == '+') ? EXPR_ADD : EXPR_SUB, EXPR_NUMBER, a, b));
+    else if(EXPR_TYPE(c,a) == EXPR_STRING && token == '+')
+      a = exprFold(c, exprAddNode(c, EXPR_CONCAT, EXPR_STRING, a, b));
+    else
+      return -1;
+  }
+  return a;
+}
+
+static int exprParseComparison(exprCompilerObj *c)
+{
+  int a, b, op;
+
+  if((a = exprParseAdditive(c)) < 0) return -1;
+  while(c->token) {
+    switch(c->token->token) {
+      case MS_TOKEN_COMPARISON_EQ: op = EXPR_EQ; break;
+      case MS_TOKEN_COMPARISON_NE: op = EXPR_NE; break;
+      case MS_TOKEN_COMPARISON_GT: op = EXPR_GT; break;
+      case MS_TOKEN_COMPARISON_LT: op = EXPR_LT; break;
+      case MS_TOKEN_COMPARISON_GE: op = EXPR_GE; break;
+      case MS_TOKEN_COMPARISON_LE: op = EXPR_LE; break;
+      case MS_TOKEN_COMPARISON_IEQ: op = EXPR_IEQ; break;
+      case MS_TOKEN_COMPARISON_RE: op = EXPR_RE; break;
+      case MS_TOKEN_COMPARISON_IRE: op = EXPR_IRE; break;
+      case IN: op = EXPR_IN; break;
+      case MS_TOKEN_COMPARISON_INTERSECTS: op = EXPR_INTERSECTS; break;
+      case MS_TOKEN_COMPARISON_DISJOINT: op = EXPR_DISJOINT; break;
+      case MS_TOKEN_COMPARISON_TOUCHES: op = EXPR_TOUCHES; break;
+      case MS_TOKEN_COMPARISON_OVERLAPS: op = EXPR_OVERLAPS; break;
+      case MS_TOKEN_COMPARISON_CROSSES: op = EXPR_CROSSES; break;
+      case MS_TOKEN_COMPARISON_WITHIN: op = EXPR_WITHIN; break;
+      case MS_TOKEN_COMPARISON_CONTAINS: op = EXPR_CONTAINS; break;
+      case MS_TOKEN_COMPARISON_DWITHIN: op = EXPR_DWITHIN; break;
+      case MS_TOKEN_COMPARISON_BEYOND: op = EXPR_BEYOND; break;
+      default: return a;
+    }
+    c->token = c->token->next;
+    if((b = exprParseAdditive(c)) < 0) return -1;
+
+    /* shapes only compare with the spatial operators and EQ */
+    if(EXPR_TYPE(c,a) == EXPR_SHAPE || EXPR_TYPE(c,b) == EXPR_SHAPE || op >= EXPR_EQUALS) {
+      if(EXPR_TYPE(c,a) != EXPR_SHAPE || EXPR_TYPE(c,b) != EXPR_SHAPE) return -1;
+      if(op == EXPR_EQ)
+        op = EXPR_EQUALS;
+      else if(op < EXPR_EQUALS)
+        return -1;
+    } else if(op == EXPR_RE || op == EXPR_IRE) {
+      if(EXPR_TYPE(c,a) != EXPR_STRING || EXPR_TYPE(c,b) != EXPR_STRING) return -1;
+    } else if(op == EXPR_IN) {
+      if((EXPR_TYPE(c,a) != EXPR_STRING && EXPR_TYPE(c,a) != EXPR_NUMBER) || EXPR_TYPE(c,b) != EXPR_STRING) return -1;
+    } else if(EXPR_TYPE(c,a) != EXPR_TYPE(c,b) || EXPR_TYPE(c,a) == EXPR_BOOLEAN) {
+      return -1;
+    }
+    a = exprFold(c, exprAddNode(c, op, EXPR_BOOLEAN, a, b));
+  }
+  return a;
+}
+
+static int exprParseNot(exprCompilerObj *c)
+{
+  int a;
+
+  if(!exprNextToken(c, MS_TOKEN_LOGICAL_NOT)) return exprParseComparison(c);
+  if((a = exprParseNot(c)) < 0 || !EXPR_LOGICAL(c,a)) return -1;
+  return exprFold(c, exprAddNode(c, EXPR_NOT, EXPR_BOOLEAN, a, -1));
+}
+
+static int exprParseAnd(exprCompilerObj *c)
+{
+  int a, b;
+
+  if((a = exprParseNot(c)) < 0) return -1;
+  while(exprNextToken(c, MS_TOKEN_LOGICAL_AND)) {
+    if((b = exprParseNot(c)) < 0 || !EXPR_LOGICAL(c,a) || !EXPR_LOGICAL(c,b)) return -1;
+    a = exprFold(c, exprAddNode(c, EXPR_AND, EXPR_BOOLEAN, a, b));
+  }
+  return a;
+}
+
+static int exprParseOr(exprCompilerObj *c)
+{
+  int a, b;
+
+  if((a = exprParseAnd(c)) < 0) return -1;
+  while(exprNextToken(c, MS_TOKEN_LOGICAL_OR)) {
+    if((b = exprParseAnd(c)) < 0 || !EXPR_LOGICAL(c,a) || !EXPR_LOGICAL(c,b)) return -1;
+    a = exprFold(c, exprAddNode(c, EXPR_OR, EXPR_BOOLEAN, a, b));
+  }
+  return a;
+}
+
+/************************************************************************/
+/*                         msFreeExpressionProgram()                    */
+/************************************************************************/
+
+void msFreeExpressionProgram(expressionObj *expression)
+{
+  exprProgramObj *program = expression->program;
+  int i;
+
+  if(!program) return;
+  for(i=0; i<program->numnodes; i++) {
+    exprNodeObj *node = &(program->nodes[i]);
+    if(node->op == EXPR_LITERAL && node->type == EXPR_STRING)
+      msFree(node->val.strval);
+    if(node->regex) {
+      ms_regfree(node->regex);
+      free(node->regex);
+    }
+    exprFreeList(node->list);
+  }
+  msFree(program->nodes);
+  free(program);
+  expression->program = NULL;
+}
+
+/************************************************************************/
+/*                          msCompileExpression()                       */
+/*                                                                      */
+/*      Build the program of a tokenized MS_EXPRESSION. Leaves the      */
+/*      expression without program (and without error) if it uses      */
+/*      constructs that are only handled by yyparse().                  */
+/************************************************************************/
+
+int msCompileExpression(expressionObj *expression)
+{
+  exprCompilerObj c;
+  int root;
+
+  msFreeExpressionProgram(expression);
+  if(expression->type != MS_EXPRESSION || !expression->tokens)
+    return MS_SUCCESS;
+
+  c.program = (exprProgramObj*)msSmallCalloc(1, sizeof(exprProgramObj));
+  c.maxnodes = 0;
+  c.token = expression->tokens;
+  expression->program = c.program;
+
+  root = exprParseOr(&c);
+  if(root < 0 || c.token != NULL || EXPR_TYPE(&c,root) == EXPR_TIME || EXPR_TYPE(&c,root) == EXPR_SHAPE) {
+    msFreeExpressionProgram(expression);
+    return MS_SUCCESS;
+  }
+  c.program->root = root;
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                              evaluation                              */
+/************************************************************************/
+
+static const char *exprGetValue(shapeObj *shape, int index)
+{
+  if(!shape || index < 0 || index >= shape->numvalues || !shape->values[index]) {
+    msSetError(MS_MISCERR, "Invalid item index.", "msExecuteExpression()");
+    return NULL;
+  }
+  return shape->values[index];
+}
+
+static int exprEvalLogical(exprProgramObj *program, int n, shapeObj *shape, int *result)
+{
+  if(program->nodes[n].type == EXPR_NUMBER) {
+    double value;
+    if(exprEvalNumber(program, n, shape, &value) != MS_SUCCESS) return MS_FAILURE;
+    *result = (value != 0) ? MS_TRUE : MS_FALSE;
+    return MS_SUCCESS;
+  }
+  return exprEvalBoolean(program, n, shape, result);
+}
+
+static int exprEvalTime(exprProgramObj *program, int n, shapeObj *shape, struct tm *result)
+{
+  exprNodeObj *node = &(program->nodes[n]);
+  const char *value;
+
+  if(node->op == EXPR_LITERAL) {
+    *result = node->val.tmval;
+    return MS_SUCCESS;
+  }
+  if((value = exprGetValue(shape, node->val.index)) == NULL) return MS_FAILURE;
+  msTimeInit(result);
+  if(msParseTime(value, result) != MS_TRUE) {
+    msSetError(MS_PARSEERR, "Parsing time value failed.", "msExecuteExpression()");
+    return MS_FAILURE;
+  }
+  return MS_SUCCESS;
+}
+
+static int exprCompare(int op, int cmp)
+{
+  switch(op) {
+    case EXPR_EQ:
+    case EXPR_IEQ:
+      return cmp == 0;
+    case EXPR_NE:
+      return cmp != 0;
+    case EXPR_GT:
+      return cmp > 0;
+    case EXPR_LT:
+      return cmp < 0;
+    case EXPR_GE:
+      return cmp >= 0;
+    default: /* EXPR_LE */
+      return cmp <= 0;
+  }
+}
+
+/* same as mapparser.y: with NaN only != is true */
+static int exprCompareNumbers(int op, double x, double y)
+{
+  switch(op) {
+    case EXPR_EQ:
+    case EXPR_IEQ:
+      return x == y;
+    case EXPR_NE:
+      return x != y;
+    case EXPR_GT:
+      return x > y;
+    case EXPR_LT:
+      return x < y;
+    case EXPR_GE:
+      return x >= y;
+    default: /* EXPR_LE */
+      return x <= y;
+  }
+}
+
+static shapeObj *exprGetShape(exprProgramObj *program, int n, shapeObj *shape, rectObj *bounds, int *hasbounds)
+{
+  exprNodeObj *node = &(program->nodes[n]);
+
+  if(node->op == EXPR_LITERAL) {
+    *bounds = node->bounds;
+    *hasbounds = node->hasbounds;
+    return node->val.shpval;
+  }
+  if(!shape) {
+    msSetError(MS_MISCERR, "Invalid shape binding.", "msExecuteExpression()");
+    return NULL;
+  }
+  *hasbounds = exprShapeBounds(shape, bounds);
+  return shape;
+}
+
+/*
+** The predicates of mapparser.y, decided from the bounds alone when those
+** do not intersect, or when they rule out WITHIN, CONTAINS or EQ. The
+** fromText() literals are prepared when compiled, the msGEOS* predicates
+** test against that prepared form (except the distance of DWITHIN and
+** BEYOND, GEOS has no prepared distance).
+*/
+static int exprEvalSpatial(exprProgramObj *program, int n, shapeObj *shape, int *result)
+{
+  exprNodeObj *node = &(program->nodes[n]);
+  shapeObj *a, *b;
+  rectObj abounds, bbounds;
+  int ahasbounds, bhasbounds, rval;
+  const char *operation;
+
+  if((a = exprGetShape(program, node->args[0], shape, &abounds, &ahasbounds)) == NULL ||
+      (b = exprGetShape(program, node->args[1], shape, &bbounds, &bhasbounds)) == NULL)
+    return MS_FAILURE;
+
+  if(ahasbounds && bhasbounds) {
+    if(abounds.minx > bbounds.maxx || abounds.maxx < bbounds.minx ||
+        abounds.miny > bbounds.maxy || abounds.maxy < bbounds.miny) {
+      *result = (node->op == EXPR_DISJOINT || node->op == EXPR_BEYOND);
+      return MS_SUCCESS;
+    }
+    if((node->op == EXPR_WITHIN || node->op == EXPR_EQUALS) &&
+        (abounds.minx < bbounds.minx || abounds.maxx > bbounds.maxx ||
+         abounds.miny < bbounds.miny || abounds.maxy > bbounds.maxy)) {
+      *result = MS_FALSE;
+      return MS_SUCCESS;
+    }
+    if((node->op == EXPR_CONTAINS || node->op == EXPR_EQUALS) &&
+        (bbounds.minx < abounds.minx || bbounds.maxx > abounds.maxx ||
+         bbounds.miny < abounds.miny || bbounds.maxy > abounds.maxy)) {
+      *result = MS_FALSE;
+      return MS_SUCCESS;
+    }
+  }
+
+  switch(node->op) {
+    case EXPR_DWITHIN:
+      *result = (msGEOSDistance(a, b) == 0.0);
+      return MS_SUCCESS;
+    case EXPR_BEYOND:
+      *result = (msGEOSDistance(a, b) > 0.0);
+      return MS_SUCCESS;
+    case EXPR_EQUALS:
+      rval = msGEOSEquals(a, b);
+      operation = "Equals (EQ or ==) operator failed.";
+      break;
+    case EXPR_INTERSECTS:
+      rval = msGEOSIntersects(a, b);
+      operation = "Intersects operator failed.";
+      break;
+    case EXPR_DISJOINT:
+      rval = msGEOSDisjoint(a, b);
+      operation = "Disjoint operator failed.";
+      break;
+    case EXPR_TOUCHES:
+      rval = msGEOSTouches(a, b);
+      operation = "Touches operator failed.";
+      break;
+    case EXPR_OVERLAPS:
+      rval = msGEOSOverlaps(a, b);
+      operation = "Overlaps operator failed.";
+      break;
+    case EXPR_CROSSES:
+      rval = msGEOSCrosses(a, b);
+      operation = "Crosses operator failed.";
+      break;
+    case EXPR_WITHIN:
+      rval = msGEOSWithin(a, b);
+      operation = "Within operator failed.";
+      break;
+    default: /* EXPR_CONTAINS */
+      rval = msGEOSContains(a, b);
+      operation = "Contains operator failed.";
+      break;
+  }
+  if(rval == -1) {
+    msSetError(MS_PARSEERR, operation, "msExecuteExpression()");
+    return MS_FAILURE;
+  }
+  *result = rval;
+  return MS_SUCCESS;
+}
+
+static int exprEvalBoolean(exprProgramObj *program, int n, shapeObj *shape, int *result)
+{
+  exprNodeObj *node = &(program->nodes[n]);
+  int a;
+
+  switch(node->op) {
+    case EXPR_LITERAL:
+      *result = node->val.intval;
+      return MS_SUCCESS;
+    case EXPR_OR:
+    case EXPR_AND:
+      if(exprEvalLogical(program, node->args[0], shape, &a) != MS_SUCCESS) return MS_FAILURE;
+      if((node->op == EXPR_OR) == (a == MS_TRUE)) { /* decided by the first operand */
+        *result = a;
+        return MS_SUCCESS;
+      }
+      return exprEvalLogical(program, node->args[1], shape, result);
+    case EXPR_NOT:
+      if(exprEvalLogical(program, node->args[0], shape, &a) != MS_SUCCESS) return MS_FAILURE;
+      *result = !a;
+      return MS_SUCCESS;
+    default:
+      break;
+  }
+
+  /* comparisons */
+  switch(program->nodes[node->args[0]].type) {
+    case EXPR_SHAPE:
+      return exprEvalSpatial(program, n, shape, result);
+    case EXPR_NUMBER: {
+      double x, y;
+      int i;
+      if(exprEvalNumber(program, node->args[0], shape, &x) != MS_SUCCESS) return MS_FAILURE;
+      if(node->op == EXPR_IN) {
+        if(node->list) {
+          for(i=0; i<node->list->n && x != node->list->numbers[i]; i++);
+          *result = (i < node->list->n);
+        } else {
+          const char *values;
+          char *tofree;
+          exprListObj *list;
+          if(exprEvalString(program, node->args[1], shape, &values, &tofree) != MS_SUCCESS) return MS_FAILURE;
+          list = exprCreateList(values, MS_TRUE);
+          for(i=0; i<list->n && x != list->numbers[i]; i++);
+          *result = (i < list->n);
+          exprFreeList(list);
+          msFree(tofree);
+        }
+        return MS_SUCCESS;
+      }
+      if(exprEvalNumber(program, node->args[1], shape, &y) != MS_SUCCESS) return MS_FAILURE;
+      *result = exprCompareNumbers(node->op, x, y);
+      return MS_SUCCESS;
+    }
+    case EXPR_TIME: {
+      struct tm x, y;
+      if(exprEvalTime(program, node->args[0], shape, &x) != MS_SUCCESS ||
+          exprEvalTime(program, node->args[1], shape, &y) != MS_SUCCESS) return MS_FAILURE;
+      *result = exprCompare(node->op, msTimeCompare(&x, &y));
+      return MS_SUCCESS;
+    }
+    default: { /* EXPR_STRING */
+      const char *x, *y = NULL;
+      char *xfree, *yfree = NULL;
+      int i;
+
+      if(exprEvalString(program, node->args[0], shape, &x, &xfree) != MS_SUCCESS) return MS_FAILURE;
+      if(!(node->regex || node->list) && exprEvalString(program, node->args[1], shape, &y, &yfree) != MS_SUCCESS) {
+        msFree(xfree);
+        return MS_FAILURE;
+      }
+
+      switch(node->op) {
+        case EXPR_RE:
+        case EXPR_IRE:
+          if(node->regex) {
+            *result = (ms_regexec(node->regex, x, 0, NULL, 0) == 0);
+          } else {
+            ms_regex_t re;
+            *result = MS_FALSE;
+            if(ms_regcomp(&re, y, MS_REG_EXTENDED|MS_REG_NOSUB|((node->op == EXPR_IRE) ? MS_REG_ICASE : 0)) == 0) {
+              *result = (ms_regexec(&re, x, 0, NULL, 0) == 0);
+              ms_regfree(&re);
+            }
+          }
+          break;
+        case EXPR_IN: {
+          exprListObj *list = node->list ? node->list : exprCreateList(y, MS_FALSE);
+          for(i=0; i<list->n && strcmp(x, list->strings[i]) != 0; i++);
+          *result = (i < list->n);
+          if(list != node->list) exprFreeList(list);
+          break;
+        }
+        case EXPR_IEQ:
+          *result = (strcasecmp(x, y) == 0);
+          break;
+        default:
+          *result = exprCompare(node->op, strcmp(x, y));
+          break;
+      }
+      msFree(xfree);
+      msFree(yfree);
+      return MS_SUCCESS;
+    }
+  }
+}
+
+static int exprEvalNumber(exprProgramObj *program, int n, shapeObj *shape, double *result)
+{
+  exprNodeObj *node = &(program->nodes[n]);
+  double x, y;
+
+  switch(node->op) {
+    case EXPR_LITERAL:
+      *result = node->val.dblval;
+      return MS_SUCCESS;
+    case EXPR_BINDING: {
+      const char *value = exprGetValue(shape, node->val.index);
+      if(!value) return MS_FAILURE;
+      *result = atof(value);
+      return MS_SUCCESS;
+    }
+    case EXPR_LENGTH: {
+      const char *value;
+      char *tofree;
+      if(exprEvalString(program, node->args[0], shape, &value, &tofree) != MS_SUCCESS) return MS_FAILURE;
+      *result = strlen(value);
+      msFree(tofree);
+      return MS_SUCCESS;
+    }
+    case EXPR_NEG: /* the parser has always ignored the unary minus */
+      return exprEvalNumber(program, node->args[0], shape, result);
+    default:
+      break;
+  }
+
+  if(exprEvalNumber(program, node->args[0], shape, &x) != MS_SUCCESS ||
+      exprEvalNumber(program, node->args[1], shape, &y) != MS_SUCCESS) return MS_FAILURE;
+
+  switch(node->op) {
+    case EXPR_ADD:
+      *result = x + y;
+      break;
+    case EXPR_SUB:
+      *result = x - y;
+      break;
+    case EXPR_MUL:
+      *result = x * y;
+      break;
+    case EXPR_DIV:
+      if(y == 0.0) {
+        msSetError(MS_PARSEERR, "Division by zero.", "msExecuteExpression()");
+        return MS_FAILURE;
+      }
+      *result = x / y;
+      break;
+    case EXPR_MOD:
+      if((int)y == 0) {
+        msSetError(MS_PARSEERR, "Division by zero.", "msExecuteExpression()");
+        return MS_FAILURE;
+      }
+      *result = (int)x % (int)y;
+      break;
+    case EXPR_POW:
+      *result = pow(x, y);
+      break;
+    default: /* EXPR_ROUND */
+      *result = (MS_NINT(x/y))*y;
+      break;
+  }
+  return MS_SUCCESS;
+}
+
+/* the result is either borrowed (*tofree is NULL) or owned by the caller */
+static int exprEvalString(exprProgramObj *program, int n, shapeObj *shape, const char **result, char **tofree)
+{
+  exprNodeObj *node = &(program->nodes[n]);
+
+  *tofree = NULL;
+  switch(node->op) {
+    case EXPR_LITERAL:
+      *result = node->val.strval;
+      return MS_SUCCESS;
+    case EXPR_BINDING:
+      *result = exprGetValue(shape, node->val.index);
+      return *result ? MS_SUCCESS : MS_FAILURE;
+    case EXPR_CONCAT: {
+      const char *x, *y;
+      char *xfree, *yfree, *s;
+      if(exprEvalString(program, node->args[0], shape, &x, &xfree) != MS_SUCCESS) return MS_FAILURE;
+      if(exprEvalString(program, node->args[1], shape, &y, &yfree) != MS_SUCCESS) {
+        msFree(xfree);
+        return MS_FAILURE;
+      }
+      s = (char*)msSmallMalloc(strlen(x) + strlen(y) + 1);
+      strcpy(s, x);
+      strcat(s, y);
+      msFree(xfree);
+      msFree(yfree);
+      *result = *tofree = s;
+      return MS_SUCCESS;
+    }
+    case EXPR_TOSTRING: {
+      double x;
+      const char *format;
+      char *formatfree, *s;
+      if(exprEvalNumber(program, node->args[0], shape, &x) != MS_SUCCESS) return MS_FAILURE;
+      if(exprEvalString(program, node->args[1], shape, &format, &formatfree) != MS_SUCCESS) return MS_FAILURE;
+      s = (char*)msSmallMalloc(strlen(format) + 64);
+      snprintf(s, strlen(format) + 64, format, x);
+      msFree(formatfree);
+      *result = *tofree = s;
+      return MS_SUCCESS;
+    }
+    default: { /* EXPR_COMMIFY */
+      const char *x;
+      char *xfree;
+      if(exprEvalString(program, node->args[0], shape, &x, &xfree) != MS_SUCCESS) return MS_FAILURE;
+      *result = *tofree = msCommifyString(xfree ? xfree : msStrdup(x));
+      return MS_SUCCESS;
+    }
+  }
+}
+
+/************************************************************************/
+/*                          msExecuteExpression()                       */
+/*                                                                      */
+/*      Drop-in replacement for yyparse(p): evaluates the program of    */
+/*      p->expr, or parses its tokens if it has none. Returns 0 on      */
+/*      success.                                                        */
+/************************************************************************/
+
+int msExecuteExpression(parseObj *p)
+{
+  exprProgramObj *program = p->expr->program;
+  int root;
+
+  if(!program || (p->type != MS_PARSE_TYPE_BOOLEAN && p->type != MS_PARSE_TYPE_STRING))
+    return yyparse(p);
+
+  root = program->root;
+  switch(program->nodes[root].type) {
+    case EXPR_BOOLEAN: {
+      int value;
+      if(exprEvalBoolean(program, root, p->shape, &value) != MS_SUCCESS) return -1;
+      if(p->type == MS_PARSE_TYPE_BOOLEAN)
+        p->result.intval = value;
+      else
+        p->result.strval = msStrdup(value ? "true" : "false");
+      break;
+    }
+    case EXPR_NUMBER: {
+      double value;
+      if(exprEvalNumber(program, root, p->shape, &value) != MS_SUCCESS) return -1;
+      if(p->type == MS_PARSE_TYPE_BOOLEAN) {
+        p->result.intval = (value != 0) ? MS_TRUE : MS_FALSE;
+      } else {
+        p->result.strval = (char*)msSmallMalloc(64);
+        snprintf(p->result.strval, 64, "%g", value);
+      }
+      break;
+    }
+    default: { /* EXPR_STRING */
+      const char *value;
+      char *tofree;
+      if(exprEvalString(program, root, p->shape, &value, &tofree) != MS_SUCCESS) return -1;
+      if(p->type == MS_PARSE_TYPE_BOOLEAN) {
+        p->result.intval = MS_TRUE;
+        msFree(tofree);
+      } else {
+        p->result.strval = tofree ? tofree : msStrdup(value);
+      }
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Persistent cache of computed layer extents
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** Layers without an EXTENT have their extent computed from the data, which
+** means a full table scan for most databases and opening every tile of a
+** tile index. When the MS_EXTENT_CACHE_PATH config option names a directory
+** the computed extents are kept there, one small file per layer signature
+** (connection type, connection, data, tile index and filter). Files are
+** replaced atomically so any number of processes can share the directory.
+**
+** Cached extents do not expire unless MS_EXTENT_CACHE_MAXAGE is set to a
+** number of seconds. They are meant to be refreshed out of band with the
+** extentcache utility, e.g. from cron, after the data was updated.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "mapserver.h"
+#include "mapthread.h"
+
+#define MS_EXTENT_CACHE_SIGNATURE "MSEXTENTCACHE 1\n"
+
+/* the connection type the layer gets once opened, see msLayerOpen() */
+static int msExtentCacheConnectionType(layerObj *layer)
+{
+  int connectiontype = layer->connectiontype;
+
+  if(layer->features && connectiontype != MS_GRATICULE)
+    connectiontype = MS_INLINE;
+  if(layer->tileindex && connectiontype == MS_SHAPEFILE)
+    connectiontype = MS_TILED_SHAPEFILE;
+  if(layer->type == MS_LAYER_RASTER && connectiontype != MS_WMS)
+    connectiontype = MS_RASTER;
+  return connectiontype;
+}
+
+static void msExtentCacheHash(const char *text, unsigned int hash[4])
+{
+  const unsigned char *p;
+
+  hash[0] = 2166136261U; /* FNV-1a */
+  hash[1] = 5381;        /* djb2 */
+  hash[2] = 0;           /* sdbm */
+  hash[3] = 0x9e3779b9U; /* one-at-a-time */
+  for(p=(const unsigned char *)text; *p; p++) {
+    hash[0] = (hash[0] ^ *p) * 16777619U;
+    hash[1] = hash[1]*33 + *p;
+    hash[2] = *p + (hash[2] << 6) + (hash[2] << 16) - hash[2];
+    hash[3] += *p;
+    hash[3] += (hash[3] << 10);
+    hash[3] ^= (hash[3] >> 6);
+  }
+}
+
+/*
+** Returns the cache file of the layer, or NULL if extents are not cached.
+** The signature hash is returned as text in check, the file only holds
+** that and not the connection string itself, which may carry a password.
+*/
+static char *msExtentCacheGetPath(layerObj *layer, char *check, size_t checksize)
+{
+  mapObj *map = layer->map;
+  const char *directory;
+  char szPath[MS_MAXPATHLEN], filename[64], *signature;
+  unsigned int hash[4];
+  size_t size;
+  int connectiontype = msExtentCacheConnectionType(layer);
+
+  /* shapefiles have their extent in the header, inline features and graticules are not data */
+  if(connectiontype == MS_SHAPEFILE || connectiontype == MS_INLINE || connectiontype == MS_GRATICULE)
+    return NULL;
+
+  if(!map ||
+      (directory = msGetConfigOption(map, "MS_EXTENT_CACHE_PATH")) == NULL)
+    return NULL;
+
+  /* relative paths in DATA depend on the map and shape paths */
+  size = 256 + (layer->connection ? strlen(layer->connection) : 0) +
+         (layer->data ? strlen(layer->data) : 0) +
+         (layer->tileindex ? strlen(layer->tileindex) : 0) +
+         (layer->tileitem ? strlen(layer->tileitem) : 0) +
+         (layer->filteritem ? strlen(layer->filteritem) : 0) +
+         (layer->filter.string ? strlen(layer->filter.string) : 0) +
+         (map->mappath ? strlen(map->mappath) : 0) +
+         (map->shapepath ? strlen(map->shapepath) : 0);
+  signature = (char *)msSmallMalloc(size);
+  snprintf(signature, size,
+           "connectiontype=%d\nconnection=%s\ndata=%s\ntileindex=%s\ntileitem=%s\n"
+           "filteritem=%s\nfilter=%d:%s\nmappath=%s\nshapepath=%s\n",
+           connectiontype,
+           layer->connection ? layer->connection : "",
+           layer->data ? layer->data : "",
+           layer->tileindex ? layer->tileindex : "",
+           layer->tileitem ? layer->tileitem : "",
+           layer->filteritem ? layer->filteritem : "",
+           layer->filter.type,
+           layer->filter.string ? layer->filter.string : "",
+           map->mappath ? map->mappath : "",
+           map->shapepath ? map->shapepath : "");
+  msExtentCacheHash(signature, hash);
+  msFree(signature);
+
+  snprintf(filename, sizeof(filename), "extent_%08x%08x.cache", hash[0], hash[1]);
+  snprintf(check, checksize, "%08x%08x\n", hash[2], hash[3]);
+
+  if(msBuildPath3(szPath, map->mappath, directory, filename) == NULL)
+    return NULL;
+  return msStrdup(szPath);
+}
+
+/************************************************************************/
+/*                        msLayerGetCachedExtent()                      */
+/*                                                                      */
+/*      Returns MS_SUCCESS and sets extent if the layer extent is in    */
+/*      the cache and not too old, MS_DONE otherwise.                   */
+/************************************************************************/
+
+int msLayerGetCachedExtent(layerObj *layer, rectObj *extent)
+{
+  char check[32], line[256], *path;
+  const char *maxage;
+  struct stat st;
+  FILE *stream;
+  rectObj cached;
+  int status = MS_DONE;
+
+  if((path = msExtentCacheGetPath(layer, check, sizeof(check))) == NULL)
+    return MS_DONE;
+
+  if(stat(path, &st) != 0) {
+    msFree(path);
+    return MS_DONE;
+  }
+
+  maxage = msGetConfigOption(layer->map, "MS_EXTENT_CACHE_MAXAGE");
+  if(maxage && atol(maxage) > 0 && (long)(time(NULL) - st.st_mtime) > atol(maxage)) {
+    msFree(path);
+    return MS_DONE;
+  }
+
+  if((stream = fopen(path, "r")) != NULL) {
+    if(fgets(line, sizeof(line), stream) && strcmp(line, MS_EXTENT_CACHE_SIGNATURE) == 0 &&
+        fgets(line, sizeof(line), stream) && strcmp(line, check) == 0 &&
+        fgets(line, sizeof(line), stream) &&
+        sscanf(line, "%lf %lf %lf %lf", &cached.minx, &cached.miny, &cached.maxx, &cached.maxy) == 4 &&
+        MS_VALID_EXTENT(cached)) {
+      *extent = cached;
+      status = MS_SUCCESS;
+    }
+    fclose(stream);
+  }
+
+  if(status == MS_SUCCESS && layer->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msLayerGetCachedExtent(%s): using the extent cached in %s\n",
+            layer->name ? layer->name : "", path);
+
+  msFree(path);
+  return status;
+}
+
+/************************************************************************/
+/*                        msLayerSetCachedExtent()                      */
+/*                                                                      */
+/*      Stores the extent computed for the layer. Returns MS_DONE if    */
+/*      the extent of this layer is not cached.                         */
+/************************************************************************/
+
+int msLayerSetCachedExtent(layerObj *layer, rectObj *extent)
+{
+  char check[32], *path, *tmppath;
+  size_t tmppathlen;
+  FILE *stream;
+  int status;
+
+  if(!MS_VALID_EXTENT((*extent)) ||
+      (path = msExtentCacheGetPath(layer, check, sizeof(check))) == NULL)
+    return MS_DONE;
+
+  /* write under another name first, readers only ever see complete files */
+  tmppathlen = strlen(path)+32;
+  tmppath = (char *)msSmallMalloc(tmppathlen);
+  snprintf(tmppath, tmppathlen, "%s.%d.%d.tmp", path, (int)getpid(), msGetThreadId());
+
+  if((stream = fopen(tmppath, "w")) == NULL) {
+    msDebug("msLayerSetCachedExtent(): unable to write %s\n", tmppath);
+    msFree(tmppath);
+    msFree(path);
+    return MS_FAILURE;
+  }
+
+  status = (fprintf(stream, "%s%s%.17g %.17g %.17g %.17g\n", MS_EXTENT_CACHE_SIGNATURE, check,
+                    extent->minx, extent->miny, extent->maxx, extent->maxy) > 0);
+  status = (fclose(stream) == 0) && status;
+
+  if(status && rename(tmppath, path) != 0) {
+    /* rename() does not replace an existing file on windows */
+    remove(path);
+    status = (rename(tmppath, path) == 0);
+  }
+
+  if(!status) {
+    msDebug("msLayerSetCachedExtent(): unable to write %s\n", path);
+    remove(tmppath);
+  }
+
+  msFree(tmppath);
+  msFree(path);
+  return status ? MS_SUCCESS : MS_FAILURE;
+}
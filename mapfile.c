@@ -103,27 +103,81 @@ int msValidateParameter(char *value, char *pattern1, char *pattern2, char *patte
   return(MS_FAILURE);
 }
 
+/*
+** Validation and mapfile name patterns are few and evaluated over and over,
+** so their compiled form is kept in a small process-wide cache.
+*/
+#define REGEX_CACHE_SIZE 32
+
+typedef struct {
+  char *pattern;
+  ms_regex_t regex;
+} regexCacheEntry;
+
+static regexCacheEntry regex_cache[REGEX_CACHE_SIZE];
+static int regex_cache_next = 0;
+
 int msEvalRegex(char *e, char *s)
 {
-  ms_regex_t re;
+  int i, status;
 
   if(!e || !s) return(MS_FALSE);
 
-  if(ms_regcomp(&re, e, MS_REG_EXTENDED|MS_REG_NOSUB) != 0) {
-    msSetError(MS_REGEXERR, "Failed to compile expression (%s).", "msEvalRegex()", e);
-    return(MS_FALSE);
+  msAcquireLock(TLOCK_REGEX);
+
+  for(i=0; i<REGEX_CACHE_SIZE; i++) {
+    if(regex_cache[i].pattern && strcmp(regex_cache[i].pattern, e) == 0)
+      break;
   }
 
-  if(ms_regexec(&re, s, 0, NULL, 0) != 0) { /* no match */
-    ms_regfree(&re);
+  if(i == REGEX_CACHE_SIZE) { /* not cached yet, replace the oldest entry */
+    ms_regex_t re;
+
+    if(ms_regcomp(&re, e, MS_REG_EXTENDED|MS_REG_NOSUB) != 0) {
+      msReleaseLock(TLOCK_REGEX);
+      msSetError(MS_REGEXERR, "Failed to compile expression (%s).", "msEvalRegex()", e);
+      return(MS_FALSE);
+    }
+
+    i = regex_cache_next;
+    regex_cache_next = (regex_cache_next + 1) % REGEX_CACHE_SIZE;
+    if(regex_cache[i].pattern) {
+      ms_regfree(&(regex_cache[i].regex));
+      msFree(regex_cache[i].pattern);
+    }
+    regex_cache[i].pattern = msStrdup(e);
+    regex_cache[i].regex = re;
+  }
+
+  /* the builtin regex library is not reentrant, keep the lock */
+  status = ms_regexec(&(regex_cache[i].regex), s, 0, NULL, 0);
+
+  msReleaseLock(TLOCK_REGEX);
+
+  if(status != 0) { /* no match */
     msSetError(MS_REGEXERR, "String failed expression test.", "msEvalRegex()");
     return(MS_FALSE);
   }
-  ms_regfree(&re);
 
   return(MS_TRUE);
 }
 
+void msRegexCacheCleanup(void)
+{
+  int i;
+
+  msAcquireLock(TLOCK_REGEX);
+  for(i=0; i<REGEX_CACHE_SIZE; i++) {
+    if(regex_cache[i].pattern) {
+      ms_regfree(&(regex_cache[i].regex));
+      msFree(regex_cache[i].pattern);
+      regex_cache[i].pattern = NULL;
+    }
+  }
+  regex_cache_next = 0;
+  msReleaseLock(TLOCK_REGEX);
+}
+
 #ifdef USE_MSFREE
 void msFree(void *p)
 {
@@ -2228,6 +2282,7 @@ void initExpression(expressionObj *exp)
   exp->compiled = MS_FALSE;
   exp->flags = 0;
   exp->tokens = exp->curtoken = NULL;
+  exp->program = NULL;
 }
 
 void freeExpressionTokens(expressionObj *exp)
@@ -2237,6 +2292,8 @@ void freeExpressionTokens(expressionObj *exp)
 
   if(!exp) return;
 
+  msFreeExpressionProgram(exp);
+
   if(exp->tokens) {
     node = exp->tokens;
     while (node != NULL) {
@@ -3850,6 +3907,8 @@ int initLayer(layerObj *layer, mapObj *map)
 
   layer->items = NULL;
   layer->iteminfo = NULL;
+  layer->classtable = NULL;
+  layer->bindingplan = NULL;
   layer->numitems = 0;
 
   layer->resultcache= NULL;
@@ -3926,6 +3985,8 @@ int freeLayer(layerObj *layer)
 
   if(msLayerIsOpen(layer))
     msLayerClose(layer);
+  msFreeClassTable(layer);
+  msFreeBindingPlan(layer);
 
   msFree(layer->name);
   msFree(layer->group);
@@ -5783,6 +5844,7 @@ int initMap(mapObj *map)
   map->cellsize = 0;
   map->shapepath = NULL;
   map->mappath = NULL;
+  map->mapfile = NULL;
 
   MS_INIT_COLOR(map->imagecolor, 255,255,255,255); /* white */
 
@@ -6476,6 +6538,8 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
 
   msyybasepath = map->mappath; /* for INCLUDEs */
 
+  map->mapfile = msStrdup(msBuildPath(szPath, szCWDPath, filename));
+
   if(loadMapInternal(map) != MS_SUCCESS) {
     msFreeMap(map);
     msReleaseLock( TLOCK_PARSER );
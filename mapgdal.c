@@ -139,6 +139,44 @@ void CleanVSIDir( const char *pszDir )
   CSLDestroy( papszFiles );
 }
 
+/************************************************************************/
+/*                          msGDALStreamFile()                          */
+/*                                                                      */
+/*      Copy a temporary (possibly /vsimem/) file to stdout and         */
+/*      remove it.                                                      */
+/************************************************************************/
+
+int msGDALStreamFile( const char *filename, const char *pszCaller )
+
+{
+  FILE *fp;
+  unsigned char block[4000];
+  int bytes_read;
+
+  if( msIO_needBinaryStdout() == MS_FAILURE )
+    return MS_FAILURE;
+
+  /* We aren't sure how far back GDAL exports the VSI*L API, so
+     we only use it if we suspect we need it.  But we do need it if
+     holding temporary file in memory. */
+  fp = VSIFOpenL( filename, "rb" );
+  if( fp == NULL ) {
+    msSetError( MS_MISCERR,
+                "Failed to open %s for streaming to stdout.",
+                pszCaller, filename );
+    return MS_FAILURE;
+  }
+
+  while( (bytes_read = VSIFReadL(block, 1, sizeof(block), fp)) > 0 )
+    msIO_fwrite( block, 1, bytes_read, stdout );
+
+  VSIFCloseL( fp );
+
+  VSIUnlink( filename );
+
+  return MS_SUCCESS;
+}
+
 /************************************************************************/
 /*                          msSaveImageGDAL()                           */
 /************************************************************************/
@@ -181,17 +219,30 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   /* -------------------------------------------------------------------- */
   /*      We will need to write the output to a temporary file and        */
   /*      then stream to stdout if no filename is passed.  If the         */
-  /*      driver supports virtualio then we hold the temporary file in    */
+  /*      driver supports virtualio and the image is not larger than      */
+  /*      msTmpMemoryMaxSize() then we hold the temporary file in         */
   /*      memory, otherwise we try to put it in a reasonable temporary    */
   /*      file location.                                                  */
   /* -------------------------------------------------------------------- */
   if( filename == NULL ) {
     const char *pszExtension = format->extension;
+    /* uncompressed size, an upper bound for most drivers */
+    double dfSize = (double) image->width * image->height;
+
+    if( format->imagemode == MS_IMAGEMODE_INT16 )
+      dfSize *= 2 * format->bands;
+    else if( format->imagemode == MS_IMAGEMODE_FLOAT32 )
+      dfSize *= 4 * format->bands;
+    else if( format->imagemode == MS_IMAGEMODE_BYTE )
+      dfSize *= format->bands;
+    else
+      dfSize *= 4;
+
     if( pszExtension == NULL )
       pszExtension = "img.tmp";
 
     if( bUseXmp == MS_FALSE && GDALGetMetadataItem( hOutputDriver, GDAL_DCAP_VIRTUALIO, NULL )
-        != NULL ) {
+        != NULL && dfSize <= msTmpMemoryMaxSize(map) ) {
       CleanVSIDir( "/vsimem/msout" );
       filename = msTmpFile(map, NULL, "/vsimem/msout/", pszExtension );
     }
@@ -516,36 +567,194 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   /*      stdout and delete the file.                                     */
   /* -------------------------------------------------------------------- */
   if( bFileIsTemporary ) {
-    FILE *fp;
-    unsigned char block[4000];
-    int bytes_read;
-
-    if( msIO_needBinaryStdout() == MS_FAILURE )
+    if( msGDALStreamFile( filename, "msSaveImageGDAL()" ) != MS_SUCCESS )
       return MS_FAILURE;
 
-    /* We aren't sure how far back GDAL exports the VSI*L API, so
-       we only use it if we suspect we need it.  But we do need it if
-       holding temporary file in memory. */
-    fp = VSIFOpenL( filename, "rb" );
-    if( fp == NULL ) {
-      msSetError( MS_MISCERR,
-                  "Failed to open %s for streaming to stdout.",
-                  "msSaveImageGDAL()", filename );
-      return MS_FAILURE;
+    CleanVSIDir( "/vsimem/msout" );
+
+    free( filename );
+  }
+
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                        msSaveRasterLayerGDAL()                       */
+/*                                                                      */
+/*      Draw a raster layer straight into a file of the map output      */
+/*      format, nBlockLines lines at a time, so that the memory used    */
+/*      does not depend on the output size. Only the raw data modes     */
+/*      (BYTE, INT16, FLOAT32) of drivers with Create() support can be  */
+/*      written this way. The map must not be rotated. The file is      */
+/*      removed on failure. Callers streaming the result send their     */
+/*      headers once this succeeded, then use msGDALStreamFile().       */
+/************************************************************************/
+
+int msSaveRasterLayerGDAL( mapObj *map, layerObj *layer, int nBlockLines,
+                           char *filename )
+
+{
+  GDALDatasetH hOutputDS;
+  GDALDriverH  hOutputDriver;
+  GDALDataType eDataType;
+  outputFormatObj *format = map->outputformat;
+  char        **papszOptions = NULL;
+  rectObj      sFullExtent = map->extent;
+  geotransformObj sFullGT = map->gt;
+  int          nFullHeight = map->height;
+  int          iLine, iBand, nLines, nPixelSize;
+  int          status = MS_SUCCESS;
+
+  msGDALInitialize();
+
+  if( !MS_RENDERER_RAWDATA(format) || nFullHeight < 2 ) {
+    msSetError( MS_MISCERR, "Output format %s can not be written by blocks.",
+                "msSaveRasterLayerGDAL()", format->name );
+    return MS_FAILURE;
+  }
+
+  if( format->imagemode == MS_IMAGEMODE_INT16 ) {
+    eDataType = GDT_Int16;
+    nPixelSize = 2;
+  } else if( format->imagemode == MS_IMAGEMODE_FLOAT32 ) {
+    eDataType = GDT_Float32;
+    nPixelSize = 4;
+  } else {
+    eDataType = GDT_Byte;
+    nPixelSize = 1;
+  }
+
+  /* every block needs two lines to get a valid geotransform */
+  if( nBlockLines < 2 )
+    nBlockLines = 2;
+
+  /* -------------------------------------------------------------------- */
+  /*      Create the output dataset. It is never held in memory.          */
+  /* -------------------------------------------------------------------- */
+  msAcquireLock( TLOCK_GDAL );
+  hOutputDriver = GDALGetDriverByName( format->driver+5 );
+  if( hOutputDriver == NULL
+      || GDALGetMetadataItem( hOutputDriver, GDAL_DCAP_CREATE, NULL ) == NULL ) {
+    msReleaseLock( TLOCK_GDAL );
+    msSetError( MS_MISCERR, "Failed to find %s driver, or it does not support Create().",
+                "msSaveRasterLayerGDAL()", format->driver+5 );
+    return MS_FAILURE;
+  }
+
+  papszOptions = (char**)msSmallCalloc(sizeof(char *),(format->numformatoptions+1));
+  memcpy( papszOptions, format->formatoptions,
+          sizeof(char *) * format->numformatoptions );
+
+  hOutputDS = GDALCreate( hOutputDriver, filename, map->width, nFullHeight,
+                          format->bands, eDataType, papszOptions );
+  free( papszOptions );
+
+  if( hOutputDS == NULL ) {
+    msReleaseLock( TLOCK_GDAL );
+    msSetError( MS_MISCERR, "Failed to create output %s file.\n%s",
+                "msSaveRasterLayerGDAL()", format->driver+5,
+                CPLGetLastErrorMsg() );
+    return MS_FAILURE;
+  }
+
+  GDALSetGeoTransform( hOutputDS, map->gt.geotransform );
+  {
+    char *pszWKT = msProjectionObj2OGCWKT( &(map->projection) );
+    if( pszWKT != NULL ) {
+      GDALSetProjection( hOutputDS, pszWKT );
+      msFree( pszWKT );
     }
+  }
 
-    while( (bytes_read = VSIFReadL(block, 1, sizeof(block), fp)) > 0 )
-      msIO_fwrite( block, 1, bytes_read, stdout );
+  if( msGetOutputFormatOption(format,"NULLVALUE",NULL) != NULL ) {
+    const char *nullvalue = msGetOutputFormatOption(format,
+                            "NULLVALUE",NULL);
 
-    VSIFCloseL( fp );
+    for( iBand = 0; iBand < format->bands; iBand++ )
+      GDALSetRasterNoDataValue( GDALGetRasterBand( hOutputDS, iBand+1 ),
+                                atof(nullvalue) );
+  }
 
-    VSIUnlink( filename );
-    CleanVSIDir( "/vsimem/msout" );
+  /* same resolution tags as msSaveImageGDAL(), the raw data modes */
+  /* written here get no color interpretation there either */
+  if( map->resolution > 0 ) {
+    char res[30];
 
-    free( filename );
+    sprintf( res, "%lf", map->resolution );
+    GDALSetMetadataItem( hOutputDS, "TIFFTAG_XRESOLUTION", res, NULL );
+    GDALSetMetadataItem( hOutputDS, "TIFFTAG_YRESOLUTION", res, NULL );
+    GDALSetMetadataItem( hOutputDS, "TIFFTAG_RESOLUTIONUNIT", "2", NULL );
   }
+  msReleaseLock( TLOCK_GDAL );
 
-  return MS_SUCCESS;
+  /* -------------------------------------------------------------------- */
+  /*      Draw and write each block of lines. The map extent is           */
+  /*      narrowed to the block (extents are pixel centers).              */
+  /* -------------------------------------------------------------------- */
+  for( iLine = 0; iLine < nFullHeight && status == MS_SUCCESS; iLine += nLines ) {
+    imageObj *image;
+
+    nLines = MS_MIN(nBlockLines, nFullHeight - iLine);
+    if( nFullHeight - iLine - nLines == 1 )
+      nLines++; /* do not leave a single line block */
+
+    map->height = nLines;
+    map->extent.maxy = sFullExtent.maxy - iLine * map->cellsize;
+    map->extent.miny = map->extent.maxy - (nLines-1) * map->cellsize;
+    msMapComputeGeotransform( map );
+    map->projection.gt = map->gt;
+
+    image = msImageCreate( map->width, nLines, format, map->web.imagepath,
+                           map->web.imageurl, map->resolution,
+                           map->defresolution, NULL );
+    if( image == NULL ) {
+      status = MS_FAILURE;
+      break;
+    }
+
+    status = msDrawRasterLayerLow( map, layer, image, NULL );
+
+    if( status == MS_SUCCESS ) {
+      unsigned char *pabyData;
+
+      if( format->imagemode == MS_IMAGEMODE_INT16 )
+        pabyData = (unsigned char *) image->img.raw_16bit;
+      else if( format->imagemode == MS_IMAGEMODE_FLOAT32 )
+        pabyData = (unsigned char *) image->img.raw_float;
+      else
+        pabyData = image->img.raw_byte;
+
+      msAcquireLock( TLOCK_GDAL );
+      for( iBand = 0; iBand < format->bands && status == MS_SUCCESS; iBand++ ) {
+        if( GDALRasterIO( GDALGetRasterBand( hOutputDS, iBand+1 ), GF_Write,
+                          0, iLine, map->width, nLines,
+                          pabyData + (size_t)iBand * map->width * nLines * nPixelSize,
+                          map->width, nLines, eDataType, 0, 0 ) != CE_None ) {
+          msSetError( MS_MISCERR, "Failed to write lines %d to %d of %s.\n%s",
+                      "msSaveRasterLayerGDAL()", iLine, iLine+nLines-1,
+                      filename, CPLGetLastErrorMsg() );
+          status = MS_FAILURE;
+        }
+      }
+      msReleaseLock( TLOCK_GDAL );
+    }
+
+    msFreeImage( image );
+  }
+
+  map->extent = sFullExtent;
+  map->height = nFullHeight;
+  map->gt = sFullGT;
+  map->projection.gt = map->gt;
+
+  msAcquireLock( TLOCK_GDAL );
+  GDALClose( hOutputDS );
+  msReleaseLock( TLOCK_GDAL );
+
+  if( status != MS_SUCCESS )
+    VSIUnlink( filename );
+
+  return status;
 }
 
 /************************************************************************/
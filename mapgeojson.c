@@ -0,0 +1,473 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Native GeoJSON query output
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** The GEOJSON driver writes the results of a query as a single GeoJSON
+** FeatureCollection. Unlike the OGR output driver nothing goes through a
+** temporary datasource: every result is read, serialized into a scratch
+** buffer and written to the output stream before the next one is read.
+**
+** Supported FORMATOPTIONs:
+**   PRECISION=n  number of decimals written for coordinates (default is
+**                the shortest text that reads back as the same value)
+**   BBOX=TRUE    write a "bbox" member for the collection and each feature
+**   CRS=TRUE     write a named "crs" member for the map projection
+**
+** With WMS or WFS support the attributes follow the gml_include_items,
+** gml_exclude_items, gml_[item]_alias and gml_[item]_type layer metadata
+** as for GML and OGR output, items typed Integer or Real are written as
+** JSON numbers. Without it all the items are written as strings.
+*/
+
+#include <ctype.h>
+#include "mapserver.h"
+#include "mapows.h"
+#include "mapproject.h"
+
+typedef struct {
+  int precision;    /* decimals, or -1 for the shortest round trip */
+  bufferObj buf;    /* the feature being serialized */
+} geojsonWriter;
+
+typedef struct {
+  int index;        /* index in layer->items */
+  char *name;       /* escaped property name */
+  int numeric;      /* write the value unquoted when it is a JSON number */
+} geojsonItem;
+
+static void geojsonAppend(geojsonWriter *writer, const char *string)
+{
+  msBufferAppend(&writer->buf, (void *)string, strlen(string));
+}
+
+static void geojsonAppendNumber(geojsonWriter *writer, double value)
+{
+  size_t start = writer->buf.size;
+  char *number;
+
+  msBufferAppendDouble(&writer->buf, value, writer->precision);
+  if(writer->precision <= 0)
+    return; /* nothing to trim */
+
+  /* drop the trailing zeros of fixed precision output */
+  number = (char *)writer->buf.data + start;
+  while(writer->buf.size > start && number[writer->buf.size-start-1] == '0')
+    writer->buf.size--;
+  if(writer->buf.size > start && number[writer->buf.size-start-1] == '.')
+    writer->buf.size--;
+  if(writer->buf.size-start == 2 && number[0] == '-' && number[1] == '0') {
+    number[0] = '0';
+    writer->buf.size--;
+  }
+}
+
+static void geojsonAppendPosition(geojsonWriter *writer, pointObj *point)
+{
+  geojsonAppend(writer, "[");
+  geojsonAppendNumber(writer, point->x);
+  geojsonAppend(writer, ",");
+  geojsonAppendNumber(writer, point->y);
+  geojsonAppend(writer, "]");
+}
+
+static void geojsonAppendLine(geojsonWriter *writer, lineObj *line)
+{
+  int i;
+  geojsonAppend(writer, "[");
+  if(writer->precision < 0) {
+    /* shortest round trip output has no zeros to trim, do the line at once */
+    msBufferAppendLineCoords(&writer->buf, line, -1, "[", ",", "]", ",");
+    geojsonAppend(writer, "]");
+    return;
+  }
+  for(i=0; i<line->numpoints; i++) {
+    if(i > 0) geojsonAppend(writer, ",");
+    geojsonAppendPosition(writer, &(line->point[i]));
+  }
+  geojsonAppend(writer, "]");
+}
+
+static void geojsonAppendBBox(geojsonWriter *writer, rectObj *rect)
+{
+  geojsonAppend(writer, "\"bbox\":[");
+  geojsonAppendNumber(writer, rect->minx);
+  geojsonAppend(writer, ",");
+  geojsonAppendNumber(writer, rect->miny);
+  geojsonAppend(writer, ",");
+  geojsonAppendNumber(writer, rect->maxx);
+  geojsonAppend(writer, ",");
+  geojsonAppendNumber(writer, rect->maxy);
+  geojsonAppend(writer, "]");
+}
+
+/* appends a string value, escaped and quoted */
+static void geojsonAppendString(geojsonWriter *writer, const char *string)
+{
+  char *escaped = msEscapeJSONString(string);
+  geojsonAppend(writer, "\"");
+  geojsonAppend(writer, escaped);
+  geojsonAppend(writer, "\"");
+  msFree(escaped);
+}
+
+/* true if value can be written as is as a JSON number */
+static int geojsonIsNumber(const char *value)
+{
+  const char *p = value;
+
+  if(*p == '-') p++;
+  if(*p == '0') p++;
+  else if(isdigit((unsigned char)*p)) {
+    while(isdigit((unsigned char)*p)) p++;
+  } else
+    return MS_FALSE;
+  if(*p == '.') {
+    p++;
+    if(!isdigit((unsigned char)*p)) return MS_FALSE;
+    while(isdigit((unsigned char)*p)) p++;
+  }
+  if(*p == 'e' || *p == 'E') {
+    p++;
+    if(*p == '+' || *p == '-') p++;
+    if(!isdigit((unsigned char)*p)) return MS_FALSE;
+    while(isdigit((unsigned char)*p)) p++;
+  }
+  return (*p == '\0');
+}
+
+/************************************************************************/
+/*                         geojsonAppendGeometry()                      */
+/************************************************************************/
+
+static void geojsonAppendGeometry(geojsonWriter *writer, shapeObj *shape)
+{
+  int i, j, n;
+
+  n = 0;
+  for(i=0; i<shape->numlines; i++)
+    n += shape->line[i].numpoints;
+  if(n == 0) {
+    geojsonAppend(writer, "null");
+    return;
+  }
+
+  if(shape->type == MS_SHAPE_POINT) {
+    if(n == 1) {
+      geojsonAppend(writer, "{\"type\":\"Point\",\"coordinates\":");
+      for(i=0; i<shape->numlines; i++)
+        if(shape->line[i].numpoints > 0)
+          geojsonAppendPosition(writer, &(shape->line[i].point[0]));
+    } else {
+      n = 0;
+      geojsonAppend(writer, "{\"type\":\"MultiPoint\",\"coordinates\":[");
+      for(i=0; i<shape->numlines; i++) {
+        for(j=0; j<shape->line[i].numpoints; j++) {
+          if(n++ > 0) geojsonAppend(writer, ",");
+          geojsonAppendPosition(writer, &(shape->line[i].point[j]));
+        }
+      }
+      geojsonAppend(writer, "]");
+    }
+  } else if(shape->type == MS_SHAPE_LINE) {
+    if(shape->numlines == 1) {
+      geojsonAppend(writer, "{\"type\":\"LineString\",\"coordinates\":");
+      geojsonAppendLine(writer, &(shape->line[0]));
+    } else {
+      geojsonAppend(writer, "{\"type\":\"MultiLineString\",\"coordinates\":[");
+      for(i=0; i<shape->numlines; i++) {
+        if(i > 0) geojsonAppend(writer, ",");
+        geojsonAppendLine(writer, &(shape->line[i]));
+      }
+      geojsonAppend(writer, "]");
+    }
+  } else if(shape->type == MS_SHAPE_POLYGON) {
+    int *outerlist, *innerlist, numouter = 0;
+
+    outerlist = msGetOuterList(shape);
+    for(i=0; i<shape->numlines; i++)
+      if(outerlist[i] == MS_TRUE) numouter++;
+
+    if(numouter == 1)
+      geojsonAppend(writer, "{\"type\":\"Polygon\",\"coordinates\":");
+    else
+      geojsonAppend(writer, "{\"type\":\"MultiPolygon\",\"coordinates\":[");
+
+    n = 0;
+    for(i=0; i<shape->numlines; i++) {
+      if(outerlist[i] != MS_TRUE) continue;
+      if(n++ > 0) geojsonAppend(writer, ",");
+      geojsonAppend(writer, "[");
+      geojsonAppendLine(writer, &(shape->line[i]));
+      innerlist = msGetInnerList(shape, i, outerlist);
+      for(j=0; j<shape->numlines; j++) {
+        if(innerlist[j] != MS_TRUE) continue;
+        geojsonAppend(writer, ",");
+        geojsonAppendLine(writer, &(shape->line[j]));
+      }
+      msFree(innerlist);
+      geojsonAppend(writer, "]");
+    }
+    msFree(outerlist);
+
+    if(numouter != 1)
+      geojsonAppend(writer, "]");
+  } else {
+    geojsonAppend(writer, "null");
+    return;
+  }
+
+  geojsonAppend(writer, "}");
+}
+
+/************************************************************************/
+/*                           geojsonGetItems()                          */
+/*                                                                      */
+/*      Build the list of items written as feature properties.          */
+/************************************************************************/
+
+static geojsonItem *geojsonGetItems(layerObj *layer, int *numitems)
+{
+  geojsonItem *items;
+  int i, n = 0;
+#if defined(USE_WMS_SVR) || defined (USE_WFS_SVR)
+  gmlItemListObj *item_list = msGMLGetItems(layer, "G");
+#endif
+
+  items = (geojsonItem *)msSmallMalloc(sizeof(geojsonItem)*MS_MAX(layer->numitems,1));
+  for(i=0; i<layer->numitems; i++) {
+#if defined(USE_WMS_SVR) || defined (USE_WFS_SVR)
+    gmlItemObj *item = item_list->items + i;
+    if(!item->visible)
+      continue;
+    items[n].name = msEscapeJSONString(item->alias ? item->alias : item->name);
+    items[n].numeric = item->type && (strcasecmp(item->type, "Integer") == 0 ||
+                                      strcasecmp(item->type, "Real") == 0);
+#else
+    items[n].name = msEscapeJSONString(layer->items[i]);
+    items[n].numeric = MS_FALSE;
+#endif
+    items[n].index = i;
+    n++;
+  }
+
+#if defined(USE_WMS_SVR) || defined (USE_WFS_SVR)
+  msGMLFreeItems(item_list);
+#endif
+  *numitems = n;
+  return items;
+}
+
+static void geojsonFreeItems(geojsonItem *items, int numitems)
+{
+  int i;
+  for(i=0; i<numitems; i++)
+    msFree(items[i].name);
+  msFree(items);
+}
+
+/* returns the EPSG code of the map projection, NULL if there is none */
+static const char *geojsonGetEPSG(mapObj *map)
+{
+#if defined(USE_WMS_SVR) || defined (USE_WFS_SVR)
+  return msOWSGetEPSGProj(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
+#else
+  int i;
+  for(i=0; i<map->projection.numargs; i++) {
+    if(strncasecmp(map->projection.args[i], "init=epsg:", 10) == 0)
+      return map->projection.args[i] + 5;
+  }
+  return NULL;
+#endif
+}
+
+/************************************************************************/
+/*                       msGeoJSONWriteFromQuery()                      */
+/*                                                                      */
+/*      Write the query results of all layers as one GeoJSON            */
+/*      FeatureCollection to stdout.                                    */
+/************************************************************************/
+
+int msGeoJSONWriteFromQuery(mapObj *map, outputFormatObj *format, int sendheaders)
+{
+  int i, iLayer, status = MS_SUCCESS, numfeatures = 0;
+  int writebbox, reproject;
+  geojsonWriter writer;
+  const char *value;
+
+  value = msGetOutputFormatOption(format, "PRECISION", NULL);
+  writer.precision = value ? atoi(value) : -1;
+  if(writer.precision > 15)
+    writer.precision = 15;
+  else if(writer.precision < 0)
+    writer.precision = -1;
+  writebbox = (strcasecmp(msGetOutputFormatOption(format, "BBOX", "FALSE"), "TRUE") == 0);
+
+  msBufferInit(&writer.buf);
+
+  /* -------------------------------------------------------------------- */
+  /*      Collection header, the bbox comes from the result bounds.       */
+  /* -------------------------------------------------------------------- */
+  geojsonAppend(&writer, "{\"type\":\"FeatureCollection\"");
+
+  if(strcasecmp(msGetOutputFormatOption(format, "CRS", "FALSE"), "TRUE") == 0) {
+    const char *epsg = geojsonGetEPSG(map);
+    if(epsg && strncasecmp(epsg, "EPSG:", 5) == 0) {
+      geojsonAppend(&writer, ",\"crs\":{\"type\":\"name\",\"properties\":{\"name\":\"urn:ogc:def:crs:EPSG::");
+      geojsonAppend(&writer, epsg+5);
+      geojsonAppend(&writer, "\"}}");
+    }
+  }
+
+  if(writebbox) {
+    rectObj bounds;
+
+    /* the result cache bounds are already in the map projection */
+    if(msGetQueryResultBounds(map, &bounds) > 0) {
+      geojsonAppend(&writer, ",");
+      geojsonAppendBBox(&writer, &bounds);
+    }
+  }
+
+  geojsonAppend(&writer, ",\"features\":[");
+
+  if(sendheaders) {
+    msIO_setHeader("Content-Type", "%s", format->mimetype);
+    msIO_sendHeaders();
+  }
+  msIO_fwrite(writer.buf.data, 1, writer.buf.size, stdout);
+
+  /* -------------------------------------------------------------------- */
+  /*      Features, written one at a time as they are read.               */
+  /* -------------------------------------------------------------------- */
+  for(iLayer=0; iLayer<map->numlayers && status == MS_SUCCESS; iLayer++) {
+    layerObj *layer = GET_LAYER(map, iLayer);
+    geojsonItem *items;
+    int numitems;
+    const char *featureid;
+    int featureidindex = -1;
+    shapeObj shape;
+
+    if(!layer->resultcache || layer->resultcache->numresults == 0)
+      continue;
+
+    reproject = MS_FALSE;
+    if(layer->transform == MS_TRUE && layer->project &&
+        msProjectionsDiffer(&(layer->projection), &(map->projection)))
+      reproject = MS_TRUE;
+
+    items = geojsonGetItems(layer, &numitems);
+
+    featureid = msOWSLookupMetadata(&(layer->metadata), "OFG", "featureid");
+    if(featureid) {
+      for(i=0; i<layer->numitems; i++) {
+        if(strcasecmp(layer->items[i], featureid) == 0) {
+          featureidindex = i;
+          break;
+        }
+      }
+    }
+
+    msInitShape(&shape);
+
+    for(i=0; i<layer->resultcache->numresults; i++) {
+      int j, numprops = 0;
+
+      msFreeShape(&shape); /* init too */
+
+      status = msLayerGetShape(layer, &shape, &(layer->resultcache->results[i]));
+      if(status != MS_SUCCESS)
+        break;
+
+      if(reproject) {
+        status = msProjectShape(&(layer->projection), &(map->projection), &shape);
+        if(status != MS_SUCCESS)
+          break;
+      }
+
+      writer.buf.size = 0;
+      if(numfeatures++ > 0)
+        geojsonAppend(&writer, ",");
+      geojsonAppend(&writer, "{\"type\":\"Feature\"");
+
+      if(featureidindex >= 0 && featureidindex < shape.numvalues) {
+        geojsonAppend(&writer, ",\"id\":");
+        geojsonAppendString(&writer, shape.values[featureidindex]);
+      }
+
+      if(writebbox && shape.numlines > 0) {
+        msComputeBounds(&shape);
+        geojsonAppend(&writer, ",");
+        geojsonAppendBBox(&writer, &(shape.bounds));
+      }
+
+      geojsonAppend(&writer, ",\"geometry\":");
+      geojsonAppendGeometry(&writer, &shape);
+
+      geojsonAppend(&writer, ",\"properties\":{");
+      for(j=0; j<numitems; j++) {
+        const char *itemvalue;
+        if(items[j].index >= shape.numvalues) continue;
+        itemvalue = shape.values[items[j].index] ? shape.values[items[j].index] : "";
+        if(numprops++ > 0)
+          geojsonAppend(&writer, ",");
+        geojsonAppend(&writer, "\"");
+        geojsonAppend(&writer, items[j].name);
+        geojsonAppend(&writer, "\":");
+        if(items[j].numeric && geojsonIsNumber(itemvalue))
+          geojsonAppend(&writer, itemvalue);
+        else if(items[j].numeric && *itemvalue == '\0')
+          geojsonAppend(&writer, "null");
+        else
+          geojsonAppendString(&writer, itemvalue);
+      }
+      geojsonAppend(&writer, "}}");
+
+      msIO_fwrite(writer.buf.data, 1, writer.buf.size, stdout);
+    }
+
+    msFreeShape(&shape);
+    geojsonFreeItems(items, numitems);
+  }
+
+  /* the collection is always closed so that what was sent stays valid JSON */
+  msIO_fprintf(stdout, "]}\n");
+
+  msBufferFree(&writer.buf);
+  return status;
+}
+
+/************************************************************************/
+/*                   msPopulateRendererVTableGeoJSON()                  */
+/************************************************************************/
+
+int msPopulateRendererVTableGeoJSON( rendererVTableObj *renderer )
+{
+  /* like OGR output we aren't really a normal renderer, leave everything default */
+  return MS_SUCCESS;
+}
@@ -28,11 +28,20 @@
  *****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
 
 #ifdef USE_GEOS
 
 #include <geos_c.h>
 
+/* prepared geometries and their intersects/contains predicates came with GEOS 3.1, the others with 3.3 */
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 1)
+#define MS_GEOS_PREPARED
+#endif
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3)
+#define MS_GEOS_PREPARED_ALL
+#endif
+
 /*
 ** Error handling...
 */
@@ -608,7 +617,7 @@ shapeObj *msGEOSGeometry2Shape(GEOSGeom g)
 ** Maintenence functions exposed to MapServer/MapScript.
 */
 
-void msGEOSFreeGeometry(shapeObj *shape)
+static void msGEOSFreeGeometry_unlocked(shapeObj *shape)
 {
 #ifdef USE_GEOS
   GEOSGeom g=NULL;
@@ -616,18 +625,53 @@ void msGEOSFreeGeometry(shapeObj *shape)
   if(!shape || !shape->geometry)
     return;
 
+#ifdef MS_GEOS_PREPARED
+  if(shape->preparedgeometry) { /* refers to the geometry, goes first */
+    GEOSPreparedGeom_destroy((const GEOSPreparedGeometry *) shape->preparedgeometry);
+    shape->preparedgeometry = NULL;
+  }
+#endif
+
   g = (GEOSGeom) shape->geometry;
   GEOSGeom_destroy(g);
+  shape->geometry = NULL;
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSFreeGEOSGeom()");
   return;
 #endif
 }
 
+/*
+** Prepares the geometry of a shape that is going to be tested against many
+** others (a query shape, a filter literal). The binary predicates below then
+** use the prepared form, which indexes the shape once instead of for every test.
+*/
+static int msGEOSPrepare_unlocked(shapeObj *shape)
+{
+#ifdef USE_GEOS
+#ifdef MS_GEOS_PREPARED
+  if(!shape) return MS_FAILURE;
+  if(shape->preparedgeometry) return MS_SUCCESS;
+
+  if(!shape->geometry) /* if no geometry for the shape then build one */
+    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+  if(!shape->geometry) return MS_FAILURE;
+
+  shape->preparedgeometry = (void *) GEOSPrepare((GEOSGeom) shape->geometry);
+  return (shape->preparedgeometry) ? MS_SUCCESS : MS_FAILURE;
+#else
+  return MS_FAILURE; /* predicates simply use the plain geometry */
+#endif
+#else
+  msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSPrepare()");
+  return MS_FAILURE;
+#endif
+}
+
 /*
 ** WKT input and output functions
 */
-shapeObj *msGEOSShapeFromWKT(const char *wkt)
+static shapeObj *msGEOSShapeFromWKT_unlocked(const char *wkt)
 {
 #ifdef USE_GEOS
   GEOSGeom g;
@@ -650,7 +694,7 @@ shapeObj *msGEOSShapeFromWKT(const char *wkt)
 }
 
 /* Return should be freed with msGEOSFreeWKT */
-char *msGEOSShapeToWKT(shapeObj *shape)
+static char *msGEOSShapeToWKT_unlocked(shapeObj *shape)
 {
 #ifdef USE_GEOS
   GEOSGeom g;
@@ -659,7 +703,7 @@ char *msGEOSShapeToWKT(shapeObj *shape)
     return NULL;
 
   /* if we have a geometry, we should update it*/
-  msGEOSFreeGeometry(shape);
+  msGEOSFreeGeometry_unlocked(shape);
 
   shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
   g = (GEOSGeom) shape->geometry;
@@ -672,7 +716,7 @@ char *msGEOSShapeToWKT(shapeObj *shape)
 #endif
 }
 
-void msGEOSFreeWKT(char* pszGEOSWKT)
+static void msGEOSFreeWKT_unlocked(char* pszGEOSWKT)
 {
 #ifdef USE_GEOS
 #if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 2)
@@ -683,7 +727,7 @@ void msGEOSFreeWKT(char* pszGEOSWKT)
 #endif
 }
 
-shapeObj *msGEOSOffsetCurve(shapeObj *p, double offset) {
+static shapeObj *msGEOSOffsetCurve_unlocked(shapeObj *p, double offset) {
 #if defined USE_GEOS && (GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3))
    GEOSGeom g1, g2; 
 
@@ -708,7 +752,7 @@ shapeObj *msGEOSOffsetCurve(shapeObj *p, double offset) {
 ** Analytical functions exposed to MapServer/MapScript.
 */
 
-shapeObj *msGEOSBuffer(shapeObj *shape, double width)
+static shapeObj *msGEOSBuffer_unlocked(shapeObj *shape, double width)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -730,7 +774,7 @@ shapeObj *msGEOSBuffer(shapeObj *shape, double width)
 #endif
 }
 
-shapeObj *msGEOSSimplify(shapeObj *shape, double tolerance)
+static shapeObj *msGEOSSimplify_unlocked(shapeObj *shape, double tolerance)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -752,7 +796,7 @@ shapeObj *msGEOSSimplify(shapeObj *shape, double tolerance)
 #endif
 }
 
-shapeObj *msGEOSTopologyPreservingSimplify(shapeObj *shape, double tolerance)
+static shapeObj *msGEOSTopologyPreservingSimplify_unlocked(shapeObj *shape, double tolerance)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -774,7 +818,7 @@ shapeObj *msGEOSTopologyPreservingSimplify(shapeObj *shape, double tolerance)
 #endif
 }
 
-shapeObj *msGEOSConvexHull(shapeObj *shape)
+static shapeObj *msGEOSConvexHull_unlocked(shapeObj *shape)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -794,7 +838,7 @@ shapeObj *msGEOSConvexHull(shapeObj *shape)
 #endif
 }
 
-shapeObj *msGEOSBoundary(shapeObj *shape)
+static shapeObj *msGEOSBoundary_unlocked(shapeObj *shape)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -814,7 +858,7 @@ shapeObj *msGEOSBoundary(shapeObj *shape)
 #endif
 }
 
-pointObj *msGEOSGetCentroid(shapeObj *shape)
+static pointObj *msGEOSGetCentroid_unlocked(shapeObj *shape)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -847,7 +891,7 @@ pointObj *msGEOSGetCentroid(shapeObj *shape)
 #endif
 }
 
-shapeObj *msGEOSUnion(shapeObj *shape1, shapeObj *shape2)
+static shapeObj *msGEOSUnion_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2, g3;
@@ -873,7 +917,7 @@ shapeObj *msGEOSUnion(shapeObj *shape1, shapeObj *shape2)
 #endif
 }
 
-shapeObj *msGEOSIntersection(shapeObj *shape1, shapeObj *shape2)
+static shapeObj *msGEOSIntersection_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2, g3;
@@ -899,7 +943,7 @@ shapeObj *msGEOSIntersection(shapeObj *shape1, shapeObj *shape2)
 #endif
 }
 
-shapeObj *msGEOSDifference(shapeObj *shape1, shapeObj *shape2)
+static shapeObj *msGEOSDifference_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2, g3;
@@ -925,7 +969,7 @@ shapeObj *msGEOSDifference(shapeObj *shape1, shapeObj *shape2)
 #endif
 }
 
-shapeObj *msGEOSSymDifference(shapeObj *shape1, shapeObj *shape2)
+static shapeObj *msGEOSSymDifference_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2, g3;
@@ -958,7 +1002,7 @@ shapeObj *msGEOSSymDifference(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
 */
-int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSContains_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -977,6 +1021,19 @@ int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
   g2 = shape2->geometry;
   if(!g2) return -1;
 
+#ifdef MS_GEOS_PREPARED
+  if(shape1->preparedgeometry) {
+    result = GEOSPreparedContains((const GEOSPreparedGeometry *) shape1->preparedgeometry, g2);
+    return ((result==2) ? -1 : result);
+  }
+#endif
+#ifdef MS_GEOS_PREPARED_ALL
+  if(shape2->preparedgeometry) {
+    result = GEOSPreparedWithin((const GEOSPreparedGeometry *) shape2->preparedgeometry, g1);
+    return ((result==2) ? -1 : result);
+  }
+#endif
+
   result = GEOSContains(g1, g2);
   return ((result==2) ? -1 : result);
 #else
@@ -988,7 +1045,7 @@ int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Does shape1 overlap shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
 */
-int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSOverlaps_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -1007,6 +1064,16 @@ int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
   g2 = shape2->geometry;
   if(!g2) return -1;
 
+#ifdef MS_GEOS_PREPARED_ALL
+  if(shape1->preparedgeometry || shape2->preparedgeometry) {
+    if(shape1->preparedgeometry)
+      result = GEOSPreparedOverlaps((const GEOSPreparedGeometry *) shape1->preparedgeometry, g2);
+    else
+      result = GEOSPreparedOverlaps((const GEOSPreparedGeometry *) shape2->preparedgeometry, g1);
+    return ((result==2) ? -1 : result);
+  }
+#endif
+
   result = GEOSOverlaps(g1, g2);
   return ((result==2) ? -1 : result);
 #else
@@ -1018,7 +1085,7 @@ int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Is shape1 within shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
 */
-int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSWithin_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -1037,6 +1104,19 @@ int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
   g2 = shape2->geometry;
   if(!g2) return -1;
 
+#ifdef MS_GEOS_PREPARED_ALL
+  if(shape1->preparedgeometry) {
+    result = GEOSPreparedWithin((const GEOSPreparedGeometry *) shape1->preparedgeometry, g2);
+    return ((result==2) ? -1 : result);
+  }
+#endif
+#ifdef MS_GEOS_PREPARED
+  if(shape2->preparedgeometry) {
+    result = GEOSPreparedContains((const GEOSPreparedGeometry *) shape2->preparedgeometry, g1);
+    return ((result==2) ? -1 : result);
+  }
+#endif
+
   result = GEOSWithin(g1, g2);
   return ((result==2) ? -1 : result);
 #else
@@ -1048,7 +1128,7 @@ int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Does shape1 cross shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
 */
-int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSCrosses_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -1067,6 +1147,16 @@ int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
   g2 = shape2->geometry;
   if(!g2) return -1;
 
+#ifdef MS_GEOS_PREPARED_ALL
+  if(shape1->preparedgeometry || shape2->preparedgeometry) {
+    if(shape1->preparedgeometry)
+      result = GEOSPreparedCrosses((const GEOSPreparedGeometry *) shape1->preparedgeometry, g2);
+    else
+      result = GEOSPreparedCrosses((const GEOSPreparedGeometry *) shape2->preparedgeometry, g1);
+    return ((result==2) ? -1 : result);
+  }
+#endif
+
   result = GEOSCrosses(g1, g2);
   return ((result==2) ? -1 : result);
 #else
@@ -1078,7 +1168,7 @@ int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Does shape1 intersect shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
 */
-int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSIntersects_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -1097,6 +1187,16 @@ int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
   g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return -1;
 
+#ifdef MS_GEOS_PREPARED
+  if(shape1->preparedgeometry || shape2->preparedgeometry) {
+    if(shape1->preparedgeometry)
+      result = GEOSPreparedIntersects((const GEOSPreparedGeometry *) shape1->preparedgeometry, g2);
+    else
+      result = GEOSPreparedIntersects((const GEOSPreparedGeometry *) shape2->preparedgeometry, g1);
+    return ((result==2) ? -1 : result);
+  }
+#endif
+
   result = GEOSIntersects(g1, g2);
   return ((result==2) ? -1 : result);
 #else
@@ -1129,7 +1229,7 @@ int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Does shape1 touch shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
 */
-int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSTouches_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -1148,6 +1248,16 @@ int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
   g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return -1;
 
+#ifdef MS_GEOS_PREPARED_ALL
+  if(shape1->preparedgeometry || shape2->preparedgeometry) {
+    if(shape1->preparedgeometry)
+      result = GEOSPreparedTouches((const GEOSPreparedGeometry *) shape1->preparedgeometry, g2);
+    else
+      result = GEOSPreparedTouches((const GEOSPreparedGeometry *) shape2->preparedgeometry, g1);
+    return ((result==2) ? -1 : result);
+  }
+#endif
+
   result = GEOSTouches(g1, g2);
   return ((result==2) ? -1 : result);
 #else
@@ -1159,7 +1269,7 @@ int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Does shape1 equal shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
 */
-int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSEquals_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -1189,7 +1299,7 @@ int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Are shape1 and shape2 disjoint, returns MS_TRUE/MS_FALSE or -1 for an error.
 */
-int msGEOSDisjoint(shapeObj *shape1, shapeObj *shape2)
+static int msGEOSDisjoint_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -1208,6 +1318,16 @@ int msGEOSDisjoint(shapeObj *shape1, shapeObj *shape2)
   g2 = (GEOSGeom) shape2->geometry;
   if(!g2) return -1;
 
+#ifdef MS_GEOS_PREPARED
+  if(shape1->preparedgeometry || shape2->preparedgeometry) { /* disjoint is not intersects */
+    if(shape1->preparedgeometry)
+      result = GEOSPreparedIntersects((const GEOSPreparedGeometry *) shape1->preparedgeometry, g2);
+    else
+      result = GEOSPreparedIntersects((const GEOSPreparedGeometry *) shape2->preparedgeometry, g1);
+    return ((result==2) ? -1 : !result);
+  }
+#endif
+
   result = GEOSDisjoint(g1, g2);
   return ((result==2) ? -1 : result);
 #else
@@ -1219,7 +1339,7 @@ int msGEOSDisjoint(shapeObj *shape1, shapeObj *shape2)
 /*
 ** Useful misc. functions that return -1 on failure.
 */
-double msGEOSArea(shapeObj *shape)
+static double msGEOSArea_unlocked(shapeObj *shape)
 {
 #if defined(USE_GEOS) && defined(GEOS_CAPI_VERSION_MAJOR) && defined(GEOS_CAPI_VERSION_MINOR) && (GEOS_CAPI_VERSION_MAJOR > 1 || GEOS_CAPI_VERSION_MINOR >= 1)
   GEOSGeom g;
@@ -1244,7 +1364,7 @@ double msGEOSArea(shapeObj *shape)
 #endif
 }
 
-double msGEOSLength(shapeObj *shape)
+static double msGEOSLength_unlocked(shapeObj *shape)
 {
 #if defined(USE_GEOS) && defined(GEOS_CAPI_VERSION_MAJOR) && defined(GEOS_CAPI_VERSION_MINOR) && (GEOS_CAPI_VERSION_MAJOR > 1 || GEOS_CAPI_VERSION_MINOR >= 1)
 
@@ -1270,7 +1390,7 @@ double msGEOSLength(shapeObj *shape)
 #endif
 }
 
-double msGEOSDistance(shapeObj *shape1, shapeObj *shape2)
+static double msGEOSDistance_unlocked(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
   GEOSGeom g1, g2;
@@ -1296,3 +1416,273 @@ double msGEOSDistance(shapeObj *shape1, shapeObj *shape2)
   return msDistanceShapeToShape(shape1, shape2); /* fall back on brute force method (for MapScript) */
 #endif
 }
+
+/*
+** Entry points. GEOS is initialized once for the process (initGEOS()), so its
+** context and error handler are shared: queries run from several threads
+** (msRunThreadJobs()) go through GEOS one call at a time.
+*/
+
+void msGEOSFreeGeometry(shapeObj *shape)
+{
+  msAcquireLock(TLOCK_GEOS);
+  msGEOSFreeGeometry_unlocked(shape);
+  msReleaseLock(TLOCK_GEOS);
+}
+
+int msGEOSPrepare(shapeObj *shape)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSPrepare_unlocked(shape);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSShapeFromWKT(const char *wkt)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSShapeFromWKT_unlocked(wkt);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+char *msGEOSShapeToWKT(shapeObj *shape)
+{
+  char *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSShapeToWKT_unlocked(shape);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+void msGEOSFreeWKT(char* pszGEOSWKT)
+{
+  msAcquireLock(TLOCK_GEOS);
+  msGEOSFreeWKT_unlocked(pszGEOSWKT);
+  msReleaseLock(TLOCK_GEOS);
+}
+
+shapeObj *msGEOSOffsetCurve(shapeObj *p, double offset)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSOffsetCurve_unlocked(p, offset);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSBuffer(shapeObj *shape, double width)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSBuffer_unlocked(shape, width);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSSimplify(shapeObj *shape, double tolerance)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSSimplify_unlocked(shape, tolerance);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSTopologyPreservingSimplify(shapeObj *shape, double tolerance)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSTopologyPreservingSimplify_unlocked(shape, tolerance);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSConvexHull(shapeObj *shape)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSConvexHull_unlocked(shape);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSBoundary(shapeObj *shape)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSBoundary_unlocked(shape);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+pointObj *msGEOSGetCentroid(shapeObj *shape)
+{
+  pointObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSGetCentroid_unlocked(shape);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSUnion(shapeObj *shape1, shapeObj *shape2)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSUnion_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSIntersection(shapeObj *shape1, shapeObj *shape2)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSIntersection_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSDifference(shapeObj *shape1, shapeObj *shape2)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSDifference_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+shapeObj *msGEOSSymDifference(shapeObj *shape1, shapeObj *shape2)
+{
+  shapeObj *result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSSymDifference_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSContains_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSOverlaps_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSWithin_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSCrosses_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSIntersects_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSTouches_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSEquals_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+int msGEOSDisjoint(shapeObj *shape1, shapeObj *shape2)
+{
+  int result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSDisjoint_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+double msGEOSArea(shapeObj *shape)
+{
+  double result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSArea_unlocked(shape);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+double msGEOSLength(shapeObj *shape)
+{
+  double result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSLength_unlocked(shape);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
+
+double msGEOSDistance(shapeObj *shape1, shapeObj *shape2)
+{
+  double result;
+
+  msAcquireLock(TLOCK_GEOS);
+  result = msGEOSDistance_unlocked(shape1, shape2);
+  msReleaseLock(TLOCK_GEOS);
+  return result;
+}
@@ -39,6 +39,21 @@
 
 static int msGMLGeometryLookup(gmlGeometryListObj *geometryList, char *type);
 
+/*
+** Write the vertices of a line as "x,y x,y " (GML2 coordinates) or as
+** "x y x y " (GML3 posList), formatted like "%f".
+*/
+static void gmlWriteCoordinates(FILE *stream, lineObj *line, const char *coordsep)
+{
+  bufferObj buffer;
+
+  msBufferInit(&buffer);
+  msBufferAppendLineCoords(&buffer, line, 6, NULL, coordsep, " ", NULL);
+  if(buffer.size > 0)
+    msIO_fwrite(buffer.data, 1, buffer.size, stream);
+  msBufferFree(&buffer);
+}
+
 /*
 ** Functions that write the feature boundary geometry (i.e. a rectObj).
 */
@@ -212,8 +227,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s<gml:LineString>\n", tab);
 
           msIO_fprintf(stream, "%s  <gml:coordinates>", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), ",");
           msIO_fprintf(stream, "</gml:coordinates>\n");
 
           msIO_fprintf(stream, "%s</gml:LineString>\n", tab);
@@ -234,8 +248,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s    <gml:LineString>\n", tab); /* no srsname at this point */
 
           msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-          for(i=0; i<shape->line[j].numpoints; i++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[j].point[i].x, shape->line[j].point[i].y);
+          gmlWriteCoordinates(stream, &(shape->line[j]), ",");
           msIO_fprintf(stream, "</gml:coordinates>\n");
           msIO_fprintf(stream, "%s    </gml:LineString>\n", tab);
           msIO_fprintf(stream, "%s  </gml:lineStringMember>\n", tab);
@@ -283,8 +296,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s    <gml:LinearRing>\n", tab);
 
           msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), ",");
           msIO_fprintf(stream, "</gml:coordinates>\n");
 
           msIO_fprintf(stream, "%s    </gml:LinearRing>\n", tab);
@@ -296,8 +308,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
               msIO_fprintf(stream, "%s    <gml:LinearRing>\n", tab);
 
               msIO_fprintf(stream, "%s      <gml:coordinates>", tab);
-              for(j=0; j<shape->line[k].numpoints; j++)
-                msIO_fprintf(stream, "%f,%f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+              gmlWriteCoordinates(stream, &(shape->line[k]), ",");
               msIO_fprintf(stream, "</gml:coordinates>\n");
 
               msIO_fprintf(stream, "%s    </gml:LinearRing>\n", tab);
@@ -331,8 +342,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
             msIO_fprintf(stream, "%s        <gml:coordinates>", tab);
-            for(j=0; j<shape->line[i].numpoints; j++)
-              msIO_fprintf(stream, "%f,%f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+            gmlWriteCoordinates(stream, &(shape->line[i]), ",");
             msIO_fprintf(stream, "</gml:coordinates>\n");
 
             msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -344,8 +354,7 @@ static int gmlWriteGeometry_GML2(FILE *stream, gmlGeometryListObj *geometryList,
                 msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
                 msIO_fprintf(stream, "%s        <gml:coordinates>", tab);
-                for(j=0; j<shape->line[k].numpoints; j++)
-                  msIO_fprintf(stream, "%f,%f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+                gmlWriteCoordinates(stream, &(shape->line[k]), ",");
                 msIO_fprintf(stream, "</gml:coordinates>\n");
 
                 msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -472,8 +481,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s  <gml:LineString>\n", tab);
 
           msIO_fprintf(stream, "%s    <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), " ");
           msIO_fprintf(stream, "</gml:posList>\n");
 
           msIO_fprintf(stream, "%s  </gml:LineString>\n", tab);
@@ -494,8 +502,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s      <gml:LineString>\n", tab); /* no srsname at this point */
 
           msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), " ");
           msIO_fprintf(stream, "</gml:posList>\n");
           msIO_fprintf(stream, "%s      </gml:LineString>\n", tab);
         }
@@ -543,8 +550,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
           msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
           msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-          for(j=0; j<shape->line[i].numpoints; j++)
-            msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+          gmlWriteCoordinates(stream, &(shape->line[i]), " ");
           msIO_fprintf(stream, "</gml:posList>\n");
 
           msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -556,8 +562,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
               msIO_fprintf(stream, "%s      <gml:LinearRing>\n", tab);
 
               msIO_fprintf(stream, "%s        <gml:posList srsDimension=\"2\">", tab);
-              for(j=0; j<shape->line[k].numpoints; j++)
-                msIO_fprintf(stream, "%f %f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+              gmlWriteCoordinates(stream, &(shape->line[k]), " ");
               msIO_fprintf(stream, "</gml:posList>\n");
 
               msIO_fprintf(stream, "%s      </gml:LinearRing>\n", tab);
@@ -593,8 +598,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
             msIO_fprintf(stream, "%s          <gml:LinearRing>\n", tab);
 
             msIO_fprintf(stream, "%s            <gml:posList srsDimension=\"2\">", tab);
-            for(j=0; j<shape->line[i].numpoints; j++)
-              msIO_fprintf(stream, "%f %f ", shape->line[i].point[j].x, shape->line[i].point[j].y);
+            gmlWriteCoordinates(stream, &(shape->line[i]), " ");
             msIO_fprintf(stream, "</gml:posList>\n");
 
             msIO_fprintf(stream, "%s          </gml:LinearRing>\n", tab);
@@ -606,8 +610,7 @@ static int gmlWriteGeometry_GML3(FILE *stream, gmlGeometryListObj *geometryList,
                 msIO_fprintf(stream, "%s          <gml:LinearRing>\n", tab);
 
                 msIO_fprintf(stream, "%s            <gml:posList srsDimension=\"2\">", tab);
-                for(j=0; j<shape->line[k].numpoints; j++)
-                  msIO_fprintf(stream, "%f %f ", shape->line[k].point[j].x, shape->line[k].point[j].y);
+                gmlWriteCoordinates(stream, &(shape->line[k]), " ");
                 msIO_fprintf(stream, "</gml:posList>\n");
 
                 msIO_fprintf(stream, "%s          </gml:LinearRing>\n", tab);
@@ -1336,6 +1339,198 @@ void msAxisSwapShape(shapeObj *shape)
     shape->bounds.maxy = tmp;
   }
 }
+
+#ifdef USE_WFS_SVR
+/*
+** What it takes to write the features of a layer as WFS featureMembers.
+*/
+typedef struct {
+  layerObj *layer;
+  char *layerName;
+  char *namespace_prefix;
+  int featureIdIndex; /* -1 for no feature id */
+  gmlGroupListObj *groupList;
+  gmlItemListObj *itemList;
+  gmlConstantListObj *constantList;
+  gmlGeometryListObj *geometryList;
+} gmlWFSLayerObj;
+
+static int gmlWFSLayerInit(gmlWFSLayerObj *wfslayer, layerObj *lp, FILE *stream, char *default_namespace_prefix)
+{
+  int j;
+  const char *value;
+
+  memset(wfslayer, 0, sizeof(gmlWFSLayerObj));
+  wfslayer->layer = lp;
+  wfslayer->featureIdIndex = -1;
+
+  /* setup namespace, a layer can override the default */
+  wfslayer->namespace_prefix = (char*) msOWSLookupMetadata(&(lp->metadata), "OFG", "namespace_prefix");
+  if(!wfslayer->namespace_prefix) wfslayer->namespace_prefix = default_namespace_prefix;
+
+  value = msOWSLookupMetadata(&(lp->metadata), "OFG", "featureid");
+  if(value) { /* find the featureid amongst the items for this layer */
+    for(j=0; j<lp->numitems; j++) {
+      if(strcasecmp(lp->items[j], value) == 0) { /* found it */
+        wfslayer->featureIdIndex = j;
+        break;
+      }
+    }
+
+    /* Produce a warning if a featureid was set but the corresponding item is not found. */
+    if (wfslayer->featureIdIndex == -1)
+      msIO_fprintf(stream, "<!-- WARNING: FeatureId item '%s' not found in typename '%s'. -->\n", value, lp->name);
+  }
+
+  /* populate item and group metadata structures */
+  wfslayer->itemList = msGMLGetItems(lp, "G");
+  wfslayer->constantList = msGMLGetConstants(lp, "G");
+  wfslayer->groupList = msGMLGetGroups(lp, "G");
+  wfslayer->geometryList = msGMLGetGeometries(lp, "GFO");
+  if (wfslayer->itemList == NULL || wfslayer->constantList == NULL || wfslayer->groupList == NULL || wfslayer->geometryList == NULL) {
+    msSetError(MS_MISCERR, "Unable to populate item and group metadata structures", "msGMLWriteWFSQuery()");
+    return MS_FAILURE;
+  }
+
+  if (wfslayer->namespace_prefix) {
+    wfslayer->layerName = (char *) msSmallMalloc(strlen(wfslayer->namespace_prefix)+strlen(lp->name)+2);
+    sprintf(wfslayer->layerName, "%s:%s", wfslayer->namespace_prefix, lp->name);
+  } else {
+    wfslayer->layerName = msStrdup(lp->name);
+  }
+
+  return MS_SUCCESS;
+}
+
+static void gmlWFSLayerFree(gmlWFSLayerObj *wfslayer)
+{
+  msFree(wfslayer->layerName);
+
+  if(wfslayer->groupList) msGMLFreeGroups(wfslayer->groupList);
+  if(wfslayer->constantList) msGMLFreeConstants(wfslayer->constantList);
+  if(wfslayer->itemList) msGMLFreeItems(wfslayer->itemList);
+  if(wfslayer->geometryList) msGMLFreeGeometries(wfslayer->geometryList);
+
+  memset(wfslayer, 0, sizeof(gmlWFSLayerObj));
+}
+
+/* is the map projection to be written north-east? */
+static int gmlWFSSwapAxis(mapObj *map)
+{
+  int i;
+  const char *axis = NULL;
+
+  for( i = 0; i < map->projection.numargs; i++ ) {
+    if( strstr(map->projection.args[i],"epsgaxis=") != NULL ) {
+      axis = strstr(map->projection.args[i],"=") + 1;
+      break;
+    }
+  }
+
+  return (axis && strcasecmp(axis,"ne") == 0);
+}
+
+/*
+** Writes a feature of wfslayer, the shape being in the map projection.
+*/
+static void gmlWriteWFSFeature(FILE *stream, mapObj *map, gmlWFSLayerObj *wfslayer, shapeObj *shape, int outputformat, int bSwapAxis)
+{
+  int k;
+  layerObj *lp = wfslayer->layer;
+  char *layerName = wfslayer->layerName;
+  char *namespace_prefix = wfslayer->namespace_prefix;
+  gmlGroupListObj *groupList = wfslayer->groupList;
+  gmlItemListObj *itemList = wfslayer->itemList;
+  gmlConstantListObj *constantList = wfslayer->constantList;
+  gmlGeometryListObj *geometryList = wfslayer->geometryList;
+  gmlItemObj *item=NULL;
+  gmlConstantObj *constant=NULL;
+#ifdef USE_PROJ
+  const char *srsMap = NULL;
+#endif
+
+  /*
+  ** start this feature
+  */
+  msIO_fprintf(stream, "    <gml:featureMember>\n");
+  if(msIsXMLTagValid(layerName) == MS_FALSE)
+    msIO_fprintf(stream, "<!-- WARNING: The value '%s' is not valid in a XML tag context. -->\n", layerName);
+  if(wfslayer->featureIdIndex != -1) {
+    if(outputformat == OWS_GML2)
+      msIO_fprintf(stream, "      <%s fid=\"%s.%s\">\n", layerName, lp->name, shape->values[wfslayer->featureIdIndex]);
+    else  /* OWS_GML3 */
+      msIO_fprintf(stream, "      <%s gml:id=\"%s.%s\">\n", layerName, lp->name, shape->values[wfslayer->featureIdIndex]);
+  } else
+    msIO_fprintf(stream, "      <%s>\n", layerName);
+
+  if (bSwapAxis)
+    msAxisSwapShape(shape);
+
+  /* write the feature geometry and bounding box */
+  if(!(geometryList && geometryList->numgeometries == 1 && strcasecmp(geometryList->geometries[0].name, "none") == 0)) {
+#ifdef USE_PROJ
+    srsMap = msOWSGetEPSGProj(&(map->projection), NULL, "FGO", MS_TRUE);
+    if (!srsMap)
+      msOWSGetEPSGProj(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
+    if(srsMap) { /* use the map projection first*/
+      gmlWriteBounds(stream, outputformat, &(shape->bounds), srsMap, "        ");
+      gmlWriteGeometry(stream, geometryList, outputformat, shape, srsMap, namespace_prefix, "        ");
+    } else { /* then use the layer projection and/or metadata */
+      gmlWriteBounds(stream, outputformat, &(shape->bounds), msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE), "        ");
+      gmlWriteGeometry(stream, geometryList, outputformat, shape, msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE), namespace_prefix, "        ");
+    }
+#else
+    gmlWriteBounds(stream, outputformat, &(shape->bounds), NULL, "        "); /* no projection information */
+    gmlWriteGeometry(stream, geometryList, outputformat, shape, NULL, namespace_prefix, "        ");
+#endif
+  }
+
+  /* write any item/values */
+  for(k=0; k<itemList->numitems; k++) {
+    item = &(itemList->items[k]);
+    if(msItemInGroups(item->name, groupList) == MS_FALSE)
+      msGMLWriteItem(stream, item, shape->values[k], namespace_prefix, "        ");
+  }
+
+  /* write any constants */
+  for(k=0; k<constantList->numconstants; k++) {
+    constant = &(constantList->constants[k]);
+    if(msItemInGroups(constant->name, groupList) == MS_FALSE)
+      msGMLWriteConstant(stream, constant, namespace_prefix, "        ");
+  }
+
+  /* write any groups */
+  for(k=0; k<groupList->numgroups; k++)
+    msGMLWriteGroup(stream, &(groupList->groups[k]), shape, itemList, constantList, namespace_prefix, "        ");
+
+  /* end this feature */
+  msIO_fprintf(stream, "      </%s>\n", layerName);
+  msIO_fprintf(stream, "    </gml:featureMember>\n");
+}
+
+typedef struct {
+  FILE *stream;
+  char *default_namespace_prefix;
+  int outputformat;
+  int bSwapAxis;
+  gmlWFSLayerObj wfslayer; /* of the last feature written */
+} gmlWFSStreamObj;
+
+static int gmlWFSStreamFeature(mapObj *map, layerObj *lp, shapeObj *shape, void *data)
+{
+  gmlWFSStreamObj *wfsstream = (gmlWFSStreamObj *) data;
+
+  if(wfsstream->wfslayer.layer != lp) { /* first feature of this layer */
+    gmlWFSLayerFree(&(wfsstream->wfslayer));
+    if(gmlWFSLayerInit(&(wfsstream->wfslayer), lp, wfsstream->stream, wfsstream->default_namespace_prefix) != MS_SUCCESS)
+      return MS_FAILURE;
+  }
+
+  gmlWriteWFSFeature(wfsstream->stream, map, &(wfsstream->wfslayer), shape, wfsstream->outputformat, wfsstream->bSwapAxis);
+  return MS_SUCCESS;
+}
+#endif /* USE_WFS_SVR */
+
 /*
 ** msGMLWriteWFSQuery()
 **
@@ -1345,21 +1540,12 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
 {
 #ifdef USE_WFS_SVR
   int status;
-  int i,j,k;
+  int i,j;
   layerObj *lp=NULL;
   shapeObj shape;
   rectObj  resultBounds = {-1.0,-1.0,-1.0,-1.0};
-  int features = 0;
-
-  gmlGroupListObj *groupList=NULL;
-  gmlItemListObj *itemList=NULL;
-  gmlConstantListObj *constantList=NULL;
-  gmlGeometryListObj *geometryList=NULL;
-  gmlItemObj *item=NULL;
-  gmlConstantObj *constant=NULL;
+  gmlWFSLayerObj wfslayer;
 
-  char *namespace_prefix=NULL;
-  const char *axis = NULL;
   int bSwapAxis = 0;
   double tmp;
   const char *srsMap =  NULL;
@@ -1367,16 +1553,7 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
   msInitShape(&shape);
 
   /*add a check to see if the map projection is set to be north-east*/
-  for( i = 0; i < map->projection.numargs; i++ ) {
-    if( strstr(map->projection.args[i],"epsgaxis=") != NULL ) {
-      axis = strstr(map->projection.args[i],"=") + 1;
-      break;
-    }
-  }
-
-  if (axis && strcasecmp(axis,"ne") == 0 )
-    bSwapAxis = 1;
-
+  bSwapAxis = gmlWFSSwapAxis(map);
 
   /* Need to start with BBOX of the whole resultset */
   if (msGetQueryResultBounds(map, &resultBounds) > 0) {
@@ -1402,52 +1579,19 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
     lp = GET_LAYER(map, map->layerorder[i]);
 
     if(lp->resultcache && lp->resultcache->numresults > 0)  { /* found results */
-      char *layerName;
-      const char *value;
-      int featureIdIndex=-1; /* no feature id */
-
 
-      /* setup namespace, a layer can override the default */
-      namespace_prefix = (char*) msOWSLookupMetadata(&(lp->metadata), "OFG", "namespace_prefix");
-      if(!namespace_prefix) namespace_prefix = default_namespace_prefix;
-
-      value = msOWSLookupMetadata(&(lp->metadata), "OFG", "featureid");
-      if(value) { /* find the featureid amongst the items for this layer */
-        for(j=0; j<lp->numitems; j++) {
-          if(strcasecmp(lp->items[j], value) == 0) { /* found it */
-            featureIdIndex = j;
-            break;
-          }
-        }
-
-        /* Produce a warning if a featureid was set but the corresponding item is not found. */
-        if (featureIdIndex == -1)
-          msIO_fprintf(stream, "<!-- WARNING: FeatureId item '%s' not found in typename '%s'. -->\n", value, lp->name);
-      }
-
-      /* populate item and group metadata structures */
-      itemList = msGMLGetItems(lp, "G");
-      constantList = msGMLGetConstants(lp, "G");
-      groupList = msGMLGetGroups(lp, "G");
-      geometryList = msGMLGetGeometries(lp, "GFO");
-      if (itemList == NULL || constantList == NULL || groupList == NULL || geometryList == NULL) {
-        msSetError(MS_MISCERR, "Unable to populate item and group metadata structures", "msGMLWriteWFSQuery()");
+      if(gmlWFSLayerInit(&wfslayer, lp, stream, default_namespace_prefix) != MS_SUCCESS) {
+        gmlWFSLayerFree(&wfslayer);
         return MS_FAILURE;
       }
 
-
-      if (namespace_prefix) {
-        layerName = (char *) msSmallMalloc(strlen(namespace_prefix)+strlen(lp->name)+2);
-        sprintf(layerName, "%s:%s", namespace_prefix, lp->name);
-      } else {
-        layerName = msStrdup(lp->name);
-      }
-
       for(j=0; j<lp->resultcache->numresults; j++) {
 
         status = msLayerGetShape(lp, &shape, &(lp->resultcache->results[j]));
-        if(status != MS_SUCCESS)
+        if(status != MS_SUCCESS) {
+          gmlWFSLayerFree(&wfslayer);
           return(status);
+        }
 
 #ifdef USE_PROJ
         /* project the shape into the map projection (if necessary), note that this projects the bounds as well */
@@ -1455,76 +1599,13 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
           msProjectShape(&lp->projection, &map->projection, &shape);
 #endif
 
-        /*
-        ** start this feature
-        */
-        msIO_fprintf(stream, "    <gml:featureMember>\n");
-        if(msIsXMLTagValid(layerName) == MS_FALSE)
-          msIO_fprintf(stream, "<!-- WARNING: The value '%s' is not valid in a XML tag context. -->\n", layerName);
-        if(featureIdIndex != -1) {
-          if(outputformat == OWS_GML2)
-            msIO_fprintf(stream, "      <%s fid=\"%s.%s\">\n", layerName, lp->name, shape.values[featureIdIndex]);
-          else  /* OWS_GML3 */
-            msIO_fprintf(stream, "      <%s gml:id=\"%s.%s\">\n", layerName, lp->name, shape.values[featureIdIndex]);
-        } else
-          msIO_fprintf(stream, "      <%s>\n", layerName);
-
-        if (bSwapAxis)
-          msAxisSwapShape(&shape);
-
-        /* write the feature geometry and bounding box */
-        if(!(geometryList && geometryList->numgeometries == 1 && strcasecmp(geometryList->geometries[0].name, "none") == 0)) {
-#ifdef USE_PROJ
-          srsMap = msOWSGetEPSGProj(&(map->projection), NULL, "FGO", MS_TRUE);
-          if (!srsMap)
-            msOWSGetEPSGProj(&(map->projection), &(map->web.metadata), "FGO", MS_TRUE);
-          if(srsMap) { /* use the map projection first*/
-            gmlWriteBounds(stream, outputformat, &(shape.bounds), srsMap, "        ");
-            gmlWriteGeometry(stream, geometryList, outputformat, &(shape), srsMap, namespace_prefix, "        ");
-          } else { /* then use the layer projection and/or metadata */
-            gmlWriteBounds(stream, outputformat, &(shape.bounds), msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE), "        ");
-            gmlWriteGeometry(stream, geometryList, outputformat, &(shape), msOWSGetEPSGProj(&(lp->projection), &(lp->metadata), "FGO", MS_TRUE), namespace_prefix, "        ");
-          }
-#else
-          gmlWriteBounds(stream, outputformat, &(shape.bounds), NULL, "        "); /* no projection information */
-          gmlWriteGeometry(stream, geometryList, outputformat, &(shape), NULL, namespace_prefix, "        ");
-#endif
-        }
-
-        /* write any item/values */
-        for(k=0; k<itemList->numitems; k++) {
-          item = &(itemList->items[k]);
-          if(msItemInGroups(item->name, groupList) == MS_FALSE)
-            msGMLWriteItem(stream, item, shape.values[k], namespace_prefix, "        ");
-        }
-
-        /* write any constants */
-        for(k=0; k<constantList->numconstants; k++) {
-          constant = &(constantList->constants[k]);
-          if(msItemInGroups(constant->name, groupList) == MS_FALSE)
-            msGMLWriteConstant(stream, constant, namespace_prefix, "        ");
-        }
-
-        /* write any groups */
-        for(k=0; k<groupList->numgroups; k++)
-          msGMLWriteGroup(stream, &(groupList->groups[k]), &shape, itemList, constantList, namespace_prefix, "        ");
-
-        /* end this feature */
-        msIO_fprintf(stream, "      </%s>\n", layerName);
-        msIO_fprintf(stream, "    </gml:featureMember>\n");
+        gmlWriteWFSFeature(stream, map, &wfslayer, &shape, outputformat, bSwapAxis);
 
         msFreeShape(&shape); /* init too */
-
-        features++;
       }
 
       /* done with this layer, do a little clean-up */
-      msFree(layerName);
-
-      msGMLFreeGroups(groupList);
-      msGMLFreeConstants(constantList);
-      msGMLFreeItems(itemList);
-      msGMLFreeGeometries(geometryList);
+      gmlWFSLayerFree(&wfslayer);
 
       /* msLayerClose(lp); */
     }
@@ -1539,6 +1620,39 @@ int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *default_namespace_prefix
 #endif /* USE_WFS_SVR */
 }
 
+/*
+** msGMLWriteWFSQueryStream()
+**
+** Runs the rect query set in map->query and writes every feature it finds to
+** stream as it goes (see msQueryByRectStream()), rather than writing query
+** results afterwards like msGMLWriteWFSQuery() does. The collection bounds
+** can't be known upfront so they are up to the caller. numfeatures is set to
+** the number of features written.
+*/
+int msGMLWriteWFSQueryStream(mapObj *map, FILE *stream, char *default_namespace_prefix, int outputformat, int *numfeatures)
+{
+#ifdef USE_WFS_SVR
+  int status;
+  gmlWFSStreamObj wfsstream;
+
+  memset(&wfsstream, 0, sizeof(gmlWFSStreamObj));
+  wfsstream.stream = stream;
+  wfsstream.default_namespace_prefix = default_namespace_prefix;
+  wfsstream.outputformat = outputformat;
+  wfsstream.bSwapAxis = gmlWFSSwapAxis(map);
+
+  status = msQueryByRectStream(map, gmlWFSStreamFeature, &wfsstream, numfeatures);
+
+  gmlWFSLayerFree(&(wfsstream.wfslayer));
+
+  return status;
+
+#else /* Stub for mapscript */
+  msSetError(MS_MISCERR, "WFS server support not enabled", "msGMLWriteWFSQueryStream()");
+  return MS_FAILURE;
+#endif /* USE_WFS_SVR */
+}
+
 
 #ifdef USE_LIBXML2
 
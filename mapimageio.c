@@ -32,7 +32,11 @@
 #include "setjmp.h"
 #include <assert.h>
 #include "jpeglib.h"
+#include "zlib.h"
+#include "mapthread.h"
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifdef USE_GIF
 #include "gif_lib.h"
@@ -40,15 +44,66 @@
 
 
 
+/* size of the chunks in which encoded images are handed to their stream */
+#define STREAM_CHUNK_SIZE 65536
+
 typedef struct _streamInfo {
   FILE *fp;
   bufferObj *buffer;
+  msIOContext *context; /* msIO handler of fp, NULL for a plain file */
+  unsigned char *pending; /* bytes not yet written to fp */
+  size_t pending_size;
 } streamInfo;
 
+/*
+** the encoders produce lots of small writes (4 per png chunk), which are
+** coalesced in STREAM_CHUNK_SIZE chunks and sent straight to the msIO
+** handler (e.g. the FastCGI stream) resolved once per image.
+*/
+static void initStreamInfo(streamInfo *info, FILE *fp, bufferObj *buffer)
+{
+  info->fp = fp;
+  info->buffer = buffer;
+  info->context = fp ? msIO_getHandler(fp) : NULL;
+  info->pending = NULL;
+  info->pending_size = 0;
+}
+
+static void streamWrite(streamInfo *info, const void *data, size_t length)
+{
+  if(info->context)
+    msIO_contextWrite(info->context, data, length);
+  else
+    fwrite(data, length, 1, info->fp);
+}
+
+static void flushStreamInfo(streamInfo *info)
+{
+  if(info->pending_size)
+    streamWrite(info, info->pending, info->pending_size);
+  info->pending_size = 0;
+}
+
+static void freeStreamInfo(streamInfo *info)
+{
+  flushStreamInfo(info);
+  msFree(info->pending);
+  info->pending = NULL;
+}
+
 void png_write_data_to_stream(png_structp png_ptr, png_bytep data, png_size_t length)
 {
-  FILE *fp = ((streamInfo*)png_get_io_ptr(png_ptr))->fp;
-  msIO_fwrite(data,length,1,fp);
+  streamInfo *info = (streamInfo*)png_get_io_ptr(png_ptr);
+  if(info->pending_size + length > STREAM_CHUNK_SIZE)
+    flushStreamInfo(info);
+  if(length >= STREAM_CHUNK_SIZE) {
+    streamWrite(info, data, length);
+    return;
+  }
+  if(!info->pending)
+    info->pending = (unsigned char*)msSmallMalloc(STREAM_CHUNK_SIZE);
+  memcpy(info->pending + info->pending_size, data, length);
+  info->pending_size += length;
 }
 
 void png_write_data_to_buffer(png_structp png_ptr, png_bytep data, png_size_t length)
@@ -62,6 +117,427 @@ void png_flush_data(png_structp png_ptr)
   /* do nothing */
 }
 
+/*
+** PNG encoding parameters, set through the COMPRESSION, PNG_FILTER and
+** PNG_THREADS format options.
+*/
+typedef struct {
+  int compression; /* zlib level, -1 for the zlib default */
+  int strategy;    /* zlib strategy */
+  int filters;     /* mask of PNG_FILTER_* values, adaptive if more than one */
+  int threads;     /* number of row bands to deflate in parallel */
+} pngEncodingOptions;
+
+/* minimal number of rows a band must contain for parallel encoding */
+#define PNG_MIN_BAND_ROWS 32
+#define PNG_MAX_BANDS 64
+
+static int getPNGEncodingOptions(outputFormatObj *format, pngEncodingOptions *options)
+{
+  const char *value;
+
+  options->compression = -1;
+  options->strategy = Z_DEFAULT_STRATEGY;
+  options->filters = PNG_FILTER_NONE;
+  options->threads = 1;
+
+  value = msGetOutputFormatOption( format, "COMPRESSION", NULL);
+  if(value && *value) {
+    if(!strcasecmp(value,"FAST")) {
+      /* cheap profile for tile serving: run-length matches only, at the lowest level */
+      options->compression = 1;
+      options->strategy = Z_RLE;
+    } else {
+      char *endptr;
+      options->compression = strtol(value,&endptr,10);
+      if(*endptr || options->compression<-1 || options->compression>9) {
+        msSetError(MS_MISCERR,"failed to parse FORMATOPTION \"COMPRESSION=%s\", expecting integer from 0 to 9 or FAST.","saveAsPNG()",value);
+        return MS_FAILURE;
+      }
+    }
+  }
+
+  value = msGetOutputFormatOption( format, "PNG_FILTER", NULL);
+  if(value && *value) {
+    if(!strcasecmp(value,"NONE"))
+      options->filters = PNG_FILTER_NONE;
+    else if(!strcasecmp(value,"SUB"))
+      options->filters = PNG_FILTER_SUB;
+    else if(!strcasecmp(value,"UP"))
+      options->filters = PNG_FILTER_UP;
+    else if(!strcasecmp(value,"AVG"))
+      options->filters = PNG_FILTER_AVG;
+    else if(!strcasecmp(value,"PAETH"))
+      options->filters = PNG_FILTER_PAETH;
+    else if(!strcasecmp(value,"ALL"))
+      options->filters = PNG_ALL_FILTERS;
+    else {
+      msSetError(MS_MISCERR,"failed to parse FORMATOPTION \"PNG_FILTER=%s\", expecting one of NONE, SUB, UP, AVG, PAETH or ALL.","saveAsPNG()",value);
+      return MS_FAILURE;
+    }
+  }
+
+  value = msGetOutputFormatOption( format, "PNG_THREADS", NULL);
+  if(value && *value) {
+    char *endptr;
+    options->threads = strtol(value,&endptr,10);
+    if(*endptr || options->threads<1) {
+      msSetError(MS_MISCERR,"failed to parse FORMATOPTION \"PNG_THREADS=%s\", expecting a positive integer.","saveAsPNG()",value);
+      return MS_FAILURE;
+    }
+  }
+  return MS_SUCCESS;
+}
+
+/* function filling the raw (unfiltered) bytes of a png row */
+typedef void (*pngRowFunc)(rasterBufferObj *rb, int row, unsigned char *out);
+
+/* png sample depth needed to index the palette of rb */
+static int getPNGPaletteDepth(rasterBufferObj *rb)
+{
+  if (rb->data.palette.num_entries <= 2)
+    return 1;
+  else if (rb->data.palette.num_entries <= 4)
+    return 2;
+  else if (rb->data.palette.num_entries <= 16)
+    return 4;
+  else
+    return 8;
+}
+
+static void getPNGPaletteRow(rasterBufferObj *rb, int row, unsigned char *out)
+{
+  unsigned char *pixels = &(rb->data.palette.pixels[row*rb->width]);
+  int depth = getPNGPaletteDepth(rb);
+  int col;
+  if(depth == 8) {
+    memcpy(out,pixels,rb->width);
+    return;
+  }
+  memset(out,0,(rb->width*depth+7)/8);
+  for(col=0; col<rb->width; col++) {
+    int bit = col*depth;
+    out[bit>>3] |= pixels[col] << (8-depth-(bit&7));
+  }
+}
+
+static void getPNGRGBARow(rasterBufferObj *rb, int row, unsigned char *out)
+{
+  int col;
+  unsigned char *a,*r,*g,*b;
+  r=rb->data.rgba.r+row*rb->data.rgba.row_step;
+  g=rb->data.rgba.g+row*rb->data.rgba.row_step;
+  b=rb->data.rgba.b+row*rb->data.rgba.row_step;
+  if(rb->data.rgba.a) {
+    a=rb->data.rgba.a+row*rb->data.rgba.row_step;
+    for(col=0; col<rb->width; col++) {
+      if(*a) {
+        double da = *a/255.0;
+        out[0] = *r/da;
+        out[1] = *g/da;
+        out[2] = *b/da;
+        out[3] = *a;
+      } else {
+        out[0] = out[1] = out[2] = out[3] = 0;
+      }
+      out+=4;
+      a+=rb->data.rgba.pixel_step;
+      r+=rb->data.rgba.pixel_step;
+      g+=rb->data.rgba.pixel_step;
+      b+=rb->data.rgba.pixel_step;
+    }
+  } else {
+    for(col=0; col<rb->width; col++) {
+      out[0] = *r;
+      out[1] = *g;
+      out[2] = *b;
+      out+=3;
+      r+=rb->data.rgba.pixel_step;
+      g+=rb->data.rgba.pixel_step;
+      b+=rb->data.rgba.pixel_step;
+    }
+  }
+}
+
+static int pngPaeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if(pa <= pb && pa <= pc) return a;
+  if(pb <= pc) return b;
+  return c;
+}
+
+/*
+** apply png filter "type" (a PNG_FILTER_VALUE_*) to row, writing the filter
+** byte followed by the filtered row to out. prev is NULL for the first row.
+** returns the sum of absolute differences used for adaptive selection.
+*/
+static unsigned long filterPNGRow(int type, const unsigned char *row, const unsigned char *prev,
+                                  int rowbytes, int bpp, unsigned char *out)
+{
+  unsigned long sum = 0;
+  int i;
+  *out++ = type;
+  for(i=0; i<rowbytes; i++) {
+    int left = (i>=bpp) ? row[i-bpp] : 0;
+    int up = prev ? prev[i] : 0;
+    int upleft = (prev && i>=bpp) ? prev[i-bpp] : 0;
+    unsigned char v;
+    switch(type) {
+      case PNG_FILTER_VALUE_SUB:
+        v = row[i] - left;
+        break;
+      case PNG_FILTER_VALUE_UP:
+        v = row[i] - up;
+        break;
+      case PNG_FILTER_VALUE_AVG:
+        v = row[i] - ((left + up) >> 1);
+        break;
+      case PNG_FILTER_VALUE_PAETH:
+        v = row[i] - pngPaeth(left,up,upleft);
+        break;
+      default:
+        v = row[i];
+    }
+    out[i] = v;
+    sum += (v < 128) ? v : 256 - v;
+  }
+  return sum;
+}
+
+/*
+** a band of rows deflated independently of the others. all bands but the
+** last end on a byte aligned sync flush, so that their concatenation is a
+** single valid deflate stream.
+*/
+typedef struct {
+  rasterBufferObj *rb;
+  pngRowFunc getrow;
+  pngEncodingOptions *options;
+  int first_row, last_row; /* last_row is excluded */
+  int rowbytes, bpp;
+  int is_last;
+  unsigned char *data; /* compressed bytes, data_offset bytes are reserved up front */
+  size_t data_offset, data_size, data_alloc;
+  uLong adler, length;
+  int status;
+} pngBandJob;
+
+static int deflatePNGBand(pngBandJob *job, z_stream *zs, int flush)
+{
+  int ret;
+  do {
+    if(zs->avail_out == 0) {
+      size_t used = job->data_alloc;
+      unsigned char *data = (unsigned char*)realloc(job->data, 2*job->data_alloc);
+      if(!data)
+        return MS_FAILURE; /* job->data is freed by the caller */
+      job->data = data;
+      job->data_alloc *= 2;
+      zs->next_out = job->data + used;
+      zs->avail_out = job->data_alloc - used;
+    }
+    ret = deflate(zs, flush);
+    if(ret == Z_STREAM_ERROR)
+      return MS_FAILURE;
+  } while(zs->avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+  return MS_SUCCESS;
+}
+
+static void encodePNGBand(void *arg)
+{
+  pngBandJob *job = (pngBandJob*)arg;
+  static const int filter_types[5] = {PNG_FILTER_VALUE_NONE, PNG_FILTER_VALUE_SUB,
+                                      PNG_FILTER_VALUE_UP, PNG_FILTER_VALUE_AVG, PNG_FILTER_VALUE_PAETH
+                                     };
+  static const int filter_masks[5] = {PNG_FILTER_NONE, PNG_FILTER_SUB,
+                                      PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH
+                                     };
+  unsigned char *cur, *prev, *filtered, *best;
+  z_stream zs;
+  int row, i;
+
+  job->status = MS_FAILURE;
+  job->adler = adler32(0L, Z_NULL, 0);
+  job->length = 0;
+
+  memset(&zs,0,sizeof(z_stream));
+  if(deflateInit2(&zs, job->options->compression, Z_DEFLATED, -MAX_WBITS, 8, job->options->strategy) != Z_OK)
+    return;
+
+  job->data_alloc = job->data_offset + deflateBound(&zs, (uLong)(job->last_row-job->first_row)*(job->rowbytes+1)) + 64;
+  job->data = (unsigned char*)malloc(job->data_alloc);
+  cur = (unsigned char*)malloc(job->rowbytes);
+  prev = (unsigned char*)malloc(job->rowbytes);
+  filtered = (unsigned char*)malloc(2*(job->rowbytes+1));
+  if(!job->data || !cur || !prev || !filtered)
+    goto cleanup;
+  zs.next_out = job->data + job->data_offset;
+  zs.avail_out = job->data_alloc - job->data_offset;
+
+  /* filters look one row up, which may belong to the previous band */
+  if(job->first_row > 0)
+    job->getrow(job->rb, job->first_row - 1, prev);
+
+  for(row=job->first_row; row<job->last_row; row++) {
+    unsigned char *tmp;
+    unsigned long best_sum = 0;
+    job->getrow(job->rb, row, cur);
+    best = NULL;
+    for(i=0; i<5; i++) {
+      unsigned char *out;
+      unsigned long sum;
+      if(!(job->options->filters & filter_masks[i]))
+        continue;
+      out = (best == filtered) ? filtered + job->rowbytes + 1 : filtered;
+      sum = filterPNGRow(filter_types[i], cur, (row>0)?prev:NULL, job->rowbytes, job->bpp, out);
+      if(!best || sum < best_sum) {
+        best = out;
+        best_sum = sum;
+      }
+    }
+    job->adler = adler32(job->adler, best, job->rowbytes + 1);
+    job->length += job->rowbytes + 1;
+    zs.next_in = best;
+    zs.avail_in = job->rowbytes + 1;
+    if(deflatePNGBand(job, &zs, Z_NO_FLUSH) != MS_SUCCESS)
+      goto cleanup;
+    tmp = prev;
+    prev = cur;
+    cur = tmp;
+  }
+  if(deflatePNGBand(job, &zs, job->is_last ? Z_FINISH : Z_SYNC_FLUSH) != MS_SUCCESS)
+    goto cleanup;
+  job->data_size = job->data_alloc - zs.avail_out;
+  job->status = MS_SUCCESS;
+
+cleanup:
+  deflateEnd(&zs);
+  free(cur);
+  free(prev);
+  free(filtered);
+}
+
+/*
+** write the image data of an image whose png header has already been
+** written, by splitting it in row bands that are filtered and deflated
+** concurrently, and stitched back into one zlib stream spread over
+** several IDAT chunks.
+*/
+static int writePNGBands(png_structp png_ptr, rasterBufferObj *rb, pngRowFunc getrow,
+                         int rowbytes, int bpp, pngEncodingOptions *options, int nbands)
+{
+  png_byte png_IDAT[5] = { 73,  68,  65,  84, '\0'};
+  png_byte png_IEND[5] = { 73,  69,  78,  68, '\0'};
+  pngBandJob *jobs;
+  void **args;
+  int i, level, status = MS_SUCCESS;
+  uLong adler;
+  unsigned char *p;
+
+  jobs = (pngBandJob*)msSmallCalloc(nbands,sizeof(pngBandJob));
+  args = (void**)msSmallMalloc(nbands*sizeof(void*));
+  for(i=0; i<nbands; i++) {
+    jobs[i].rb = rb;
+    jobs[i].getrow = getrow;
+    jobs[i].options = options;
+    jobs[i].first_row = (int)(((long)rb->height * i) / nbands);
+    jobs[i].last_row = (int)(((long)rb->height * (i+1)) / nbands);
+    jobs[i].rowbytes = rowbytes;
+    jobs[i].bpp = bpp;
+    jobs[i].is_last = (i == nbands-1);
+    jobs[i].data_offset = (i == 0) ? 2 : 0; /* room for the zlib header */
+    args[i] = jobs + i;
+  }
+
+  msRunThreadJobs(encodePNGBand, args, nbands, options->threads);
+
+  for(i=0; i<nbands; i++) {
+    if(jobs[i].status != MS_SUCCESS) {
+      msSetError(MS_MISCERR,"failed to compress png row band","saveAsPNG()");
+      status = MS_FAILURE;
+      goto cleanup;
+    }
+  }
+
+  /* zlib header: deflate with a 32K window, and the level hint */
+  level = options->compression;
+  if(level == -1) level = 6;
+  jobs[0].data[0] = 0x78;
+  jobs[0].data[1] = ((level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3) << 6;
+  jobs[0].data[1] += 31 - ((jobs[0].data[0] << 8) + jobs[0].data[1]) % 31;
+
+  /* zlib trailer: adler32 checksum of the whole uncompressed stream */
+  adler = jobs[0].adler;
+  for(i=1; i<nbands; i++)
+    adler = adler32_combine(adler, jobs[i].adler, jobs[i].length);
+  p = jobs[nbands-1].data + jobs[nbands-1].data_size;
+  if(jobs[nbands-1].data_alloc - jobs[nbands-1].data_size < 4) {
+    jobs[nbands-1].data = (unsigned char*)msSmallRealloc(jobs[nbands-1].data, jobs[nbands-1].data_size + 4);
+    p = jobs[nbands-1].data + jobs[nbands-1].data_size;
+  }
+  p[0] = (adler >> 24) & 0xff;
+  p[1] = (adler >> 16) & 0xff;
+  p[2] = (adler >> 8) & 0xff;
+  p[3] = adler & 0xff;
+  jobs[nbands-1].data_size += 4;
+
+  for(i=0; i<nbands; i++)
+    png_write_chunk(png_ptr, png_IDAT, jobs[i].data, jobs[i].data_size);
+  png_write_chunk(png_ptr, png_IEND, NULL, 0);
+
+cleanup:
+  for(i=0; i<nbands; i++)
+    free(jobs[i].data);
+  free(jobs);
+  free(args);
+  return status;
+}
+
+/*
+** key of the QUANTIZE_REUSE palette cache: the same palette is only used
+** again for the same mapfile (and version of it), format and drawn layers
+** with their styles. NULL if the mapfile can not be identified.
+*/
+static char *getPaletteCacheKey(mapObj *map, outputFormatObj *format, int num_entries)
+{
+  struct stat st;
+  char buffer[MS_MAXPATHLEN*2];
+  char *key;
+  int i;
+
+  if(!map->mapfile || stat(map->mapfile, &st) != 0)
+    return NULL;
+
+  snprintf(buffer, sizeof(buffer), "%s:%ld:%ld:%s:%s:%d", map->mapfile, (long)st.st_mtime, (long)st.st_size,
+           map->name?map->name:"", format->name?format->name:"", num_entries);
+  key = msStrdup(buffer);
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *lp = GET_LAYER(map, map->layerorder[i]);
+    if(lp->status == MS_OFF)
+      continue;
+    key = msStringConcatenate(key, ":");
+    key = msStringConcatenate(key, lp->name?lp->name:"");
+    key = msStringConcatenate(key, "/");
+    key = msStringConcatenate(key, lp->classgroup?lp->classgroup:"");
+  }
+  return key;
+}
+
+/* number of row bands to use for an image, 1 if it is not worth splitting */
+static int getPNGBandCount(rasterBufferObj *rb, pngEncodingOptions *options)
+{
+#ifdef USE_THREAD
+  int nbands = MS_MIN(options->threads, PNG_MAX_BANDS);
+  nbands = MS_MIN(nbands, rb->height / PNG_MIN_BAND_ROWS);
+  return MS_MAX(nbands, 1);
+#else
+  /* bands would be deflated one after the other, only losing compression */
+  return 1;
+#endif
+}
+
 typedef struct {
   struct jpeg_destination_mgr pub;
   unsigned char *data;
@@ -69,7 +545,7 @@ typedef struct {
 
 typedef struct {
   ms_destination_mgr mgr;
-  FILE *stream;
+  streamInfo *info;
 } ms_stream_destination_mgr;
 
 typedef struct {
@@ -77,7 +553,7 @@ typedef struct {
   bufferObj *buffer;
 } ms_buffer_destination_mgr;
 
-#define OUTPUT_BUF_SIZE 4096
+#define OUTPUT_BUF_SIZE STREAM_CHUNK_SIZE
 
 void
 jpeg_init_destination (j_compress_ptr cinfo)
@@ -96,23 +572,30 @@ jpeg_init_destination (j_compress_ptr cinfo)
 void jpeg_stream_term_destination (j_compress_ptr cinfo)
 {
   ms_stream_destination_mgr *dest = (ms_stream_destination_mgr*) cinfo->dest;
-  msIO_fwrite(dest->mgr.data, OUTPUT_BUF_SIZE-dest->mgr.pub.free_in_buffer, 1, dest->stream);
+  streamWrite(dest->info, dest->mgr.data, OUTPUT_BUF_SIZE-dest->mgr.pub.free_in_buffer);
   dest->mgr.pub.next_output_byte = dest->mgr.data;
   dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
 }
 
+/* the buffer destination lets libjpeg encode straight into the bufferObj */
+void jpeg_buffer_init_destination (j_compress_ptr cinfo)
+{
+  ms_buffer_destination_mgr *dest = (ms_buffer_destination_mgr*) cinfo->dest;
+  msBufferResize(dest->buffer, dest->buffer->size + OUTPUT_BUF_SIZE);
+  dest->mgr.pub.next_output_byte = dest->buffer->data + dest->buffer->size;
+  dest->mgr.pub.free_in_buffer = dest->buffer->available - dest->buffer->size;
+}
+
 void jpeg_buffer_term_destination (j_compress_ptr cinfo)
 {
   ms_buffer_destination_mgr *dest = (ms_buffer_destination_mgr*) cinfo->dest;
-  msBufferAppend(dest->buffer, dest->mgr.data, OUTPUT_BUF_SIZE-dest->mgr.pub.free_in_buffer);
-  dest->mgr.pub.next_output_byte = dest->mgr.data;
-  dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  dest->buffer->size = dest->buffer->available - dest->mgr.pub.free_in_buffer;
 }
 
 int jpeg_stream_empty_output_buffer (j_compress_ptr cinfo)
 {
   ms_stream_destination_mgr *dest = (ms_stream_destination_mgr*) cinfo->dest;
-  msIO_fwrite(dest->mgr.data, OUTPUT_BUF_SIZE, 1, dest->stream);
+  streamWrite(dest->info, dest->mgr.data, OUTPUT_BUF_SIZE);
   dest->mgr.pub.next_output_byte = dest->mgr.data;
   dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
   return TRUE;
@@ -121,13 +604,11 @@ int jpeg_stream_empty_output_buffer (j_compress_ptr cinfo)
 int jpeg_buffer_empty_output_buffer (j_compress_ptr cinfo)
 {
   ms_buffer_destination_mgr *dest = (ms_buffer_destination_mgr*) cinfo->dest;
-  msBufferAppend(dest->buffer, dest->mgr.data, OUTPUT_BUF_SIZE);
-  dest->mgr.pub.next_output_byte = dest->mgr.data;
-  dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  dest->buffer->size = dest->buffer->available;
+  jpeg_buffer_init_destination(cinfo);
   return TRUE;
 }
 
-
 int saveAsJPEG(mapObj *map /*not used*/, rasterBufferObj *rb, streamInfo *info,
                outputFormatObj *format)
 {
@@ -147,7 +628,7 @@ int saveAsJPEG(mapObj *map /*not used*/, rasterBufferObj *rb, streamInfo *info,
                                               sizeof (ms_stream_destination_mgr));
       ((ms_stream_destination_mgr*)cinfo.dest)->mgr.pub.empty_output_buffer = jpeg_stream_empty_output_buffer;
       ((ms_stream_destination_mgr*)cinfo.dest)->mgr.pub.term_destination = jpeg_stream_term_destination;
-      ((ms_stream_destination_mgr*)cinfo.dest)->stream = info->fp;
+      ((ms_stream_destination_mgr*)cinfo.dest)->info = info;
     } else {
 
       cinfo.dest = (struct jpeg_destination_mgr *)
@@ -159,7 +640,7 @@ int saveAsJPEG(mapObj *map /*not used*/, rasterBufferObj *rb, streamInfo *info,
     }
   }
   dest = (ms_destination_mgr*) cinfo.dest;
-  dest->pub.init_destination = jpeg_init_destination;
+  dest->pub.init_destination = info->fp ? jpeg_init_destination : jpeg_buffer_init_destination;
 
   cinfo.image_width = rb->width;
   cinfo.image_height = rb->height;
@@ -258,13 +739,13 @@ int remapPaletteForPNG(rasterBufferObj *rb, rgbPixel *rgb, unsigned char *a, int
   return MS_SUCCESS;
 }
 
-int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
+int savePalettePNG(rasterBufferObj *rb, streamInfo *info, pngEncodingOptions *options)
 {
   png_infop info_ptr;
   rgbPixel rgb[256];
   unsigned char a[256];
   int num_a;
-  int row,sample_depth;
+  int row,sample_depth,nbands;
   png_structp png_ptr = png_create_write_struct(
                           PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
 
@@ -273,8 +754,10 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
   if (!png_ptr)
     return (MS_FAILURE);
 
-  png_set_compression_level(png_ptr, compression);
-  png_set_filter (png_ptr,0, PNG_FILTER_NONE);
+  png_set_compression_level(png_ptr, options->compression);
+  png_set_compression_buffer_size(png_ptr, STREAM_CHUNK_SIZE);
+  png_set_compression_strategy(png_ptr, options->strategy);
+  png_set_filter (png_ptr,0, options->filters);
 
   info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
@@ -293,14 +776,7 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
     png_set_write_fn(png_ptr,info, png_write_data_to_buffer, png_flush_data);
 
 
-  if (rb->data.palette.num_entries <= 2)
-    sample_depth = 1;
-  else if (rb->data.palette.num_entries <= 4)
-    sample_depth = 2;
-  else if (rb->data.palette.num_entries <= 16)
-    sample_depth = 4;
-  else
-    sample_depth = 8;
+  sample_depth = getPNGPaletteDepth(rb);
 
   png_set_IHDR(png_ptr, info_ptr, rb->width, rb->height,
                sample_depth, PNG_COLOR_TYPE_PALETTE,
@@ -314,6 +790,15 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
     png_set_tRNS(png_ptr, info_ptr, a,num_a, NULL);
 
   png_write_info(png_ptr, info_ptr);
+
+  nbands = getPNGBandCount(rb,options);
+  if(nbands > 1) {
+    int ret = writePNGBands(png_ptr, rb, getPNGPaletteRow, (rb->width*sample_depth+7)/8, 1,
+                            options, nbands);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return ret;
+  }
+
   png_set_packing(png_ptr);
 
   for(row=0; row<rb->height; row++) {
@@ -378,19 +863,11 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
 
   int ret = MS_FAILURE;
 
-  const char *force_string,*zlib_compression;
-  int compression = -1;
-
-  zlib_compression = msGetOutputFormatOption( format, "COMPRESSION", NULL);
-  if(zlib_compression && *zlib_compression) {
-    char *endptr;
-    compression = strtol(zlib_compression,&endptr,10);
-    if(*endptr || compression<-1 || compression>9) {
-      msSetError(MS_MISCERR,"failed to parse FORMATOPTION \"COMPRESSION=%s\", expecting integer from 0 to 9.","saveAsPNG()",zlib_compression);
-      return MS_FAILURE;
-    }
-  }
+  const char *force_string;
+  pngEncodingOptions options;
 
+  if(getPNGEncodingOptions(format,&options) != MS_SUCCESS)
+    return MS_FAILURE;
 
   force_string = msGetOutputFormatOption( format, "QUANTIZE_FORCE", NULL );
   if( force_string && (strcasecmp(force_string,"on") == 0  || strcasecmp(force_string,"yes") == 0 || strcasecmp(force_string,"true") == 0) )
@@ -411,11 +888,33 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
     qrb.data.palette.pixels = (unsigned char*)malloc(qrb.width*qrb.height*sizeof(unsigned char));
     qrb.data.palette.scaling_maxval = 255;
     if(force_pc256) {
+      char *palette_key = NULL;
       qrb.data.palette.palette = palette;
       qrb.data.palette.num_entries = atoi(msGetOutputFormatOption( format, "QUANTIZE_COLORS", "256"));
-      ret = msQuantizeRasterBuffer(rb,&(qrb.data.palette.num_entries),qrb.data.palette.palette,
-                                   NULL, 0,
-                                   &qrb.data.palette.scaling_maxval);
+
+      /* reuse the palette computed by a previous request for this map and format */
+      force_string = msGetOutputFormatOption( format, "QUANTIZE_REUSE", NULL );
+      if( map && force_string && (strcasecmp(force_string,"on") == 0  || strcasecmp(force_string,"yes") == 0 || strcasecmp(force_string,"true") == 0) )
+        palette_key = getPaletteCacheKey(map, format, qrb.data.palette.num_entries);
+
+      if(palette_key && msGetCachedPalette(palette_key,qrb.data.palette.palette,&(qrb.data.palette.num_entries))) {
+        ret = MS_SUCCESS;
+      } else {
+        if(!strcasecmp(msGetOutputFormatOption( format, "QUANTIZE_METHOD", "MEDIANCUT"),"FAST")) {
+          ret = msQuantizeRasterBufferFast(rb,&(qrb.data.palette.num_entries),qrb.data.palette.palette,
+                                           &qrb.data.palette.scaling_maxval);
+        } else {
+          ret = msQuantizeRasterBuffer(rb,&(qrb.data.palette.num_entries),qrb.data.palette.palette,
+                                       NULL, 0,
+                                       &qrb.data.palette.scaling_maxval);
+        }
+        /* a palette computed from a rescaled image could not be applied to another one,
+           and one with free entries (e.g. of a blank image) would not suit the next ones */
+        if(palette_key && ret == MS_SUCCESS && qrb.data.palette.scaling_maxval == 255 &&
+            qrb.data.palette.num_entries == atoi(msGetOutputFormatOption( format, "QUANTIZE_COLORS", "256")))
+          msSetCachedPalette(palette_key,qrb.data.palette.palette,qrb.data.palette.num_entries);
+      }
+      msFree(palette_key);
     } else {
       int colorsWanted = atoi(msGetOutputFormatOption( format, "QUANTIZE_COLORS", "0"));
       const char *palettePath = msGetOutputFormatOption( format, "PALETTE", "palette.txt");
@@ -445,23 +944,25 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
     }
     if(ret != MS_FAILURE) {
       ret = msClassifyRasterBuffer(rb,&qrb);
-      ret = savePalettePNG(&qrb,info,compression);
+      ret = savePalettePNG(&qrb,info,&options);
     }
     msFree(qrb.data.palette.pixels);
     return ret;
   } else if(rb->type == MS_BUFFER_BYTE_RGBA) {
     png_infop info_ptr;
-    int color_type;
+    int color_type, channels, nbands;
     int row;
-    unsigned int *rowdata;
+    unsigned char *rowdata;
     png_structp png_ptr = png_create_write_struct(
                             PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
 
     if (!png_ptr)
       return (MS_FAILURE);
 
-    png_set_compression_level(png_ptr, compression);
-    png_set_filter (png_ptr,0, PNG_FILTER_NONE);
+    png_set_compression_level(png_ptr, options.compression);
+    png_set_compression_buffer_size(png_ptr, STREAM_CHUNK_SIZE);
+    png_set_compression_strategy(png_ptr, options.strategy);
+    png_set_filter (png_ptr,0, options.filters);
 
     info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) {
@@ -479,10 +980,13 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
     else
       png_set_write_fn(png_ptr,info, png_write_data_to_buffer, png_flush_data);
 
-    if(rb->data.rgba.a)
+    if(rb->data.rgba.a) {
       color_type = PNG_COLOR_TYPE_RGB_ALPHA;
-    else
+      channels = 4;
+    } else {
       color_type = PNG_COLOR_TYPE_RGB;
+      channels = 3;
+    }
 
     png_set_IHDR(png_ptr, info_ptr, rb->width, rb->height,
                  8, color_type, PNG_INTERLACE_NONE,
@@ -490,51 +994,18 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
 
     png_write_info(png_ptr, info_ptr);
 
-    if(!rb->data.rgba.a && rb->data.rgba.pixel_step==4)
-      png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
+    nbands = getPNGBandCount(rb,&options);
+    if(nbands > 1) {
+      ret = writePNGBands(png_ptr, rb, getPNGRGBARow, rb->width*channels, channels,
+                          &options, nbands);
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      return ret;
+    }
 
-    rowdata = (unsigned int*)malloc(rb->width*sizeof(unsigned int));
+    rowdata = (unsigned char*)malloc(rb->width*channels);
     for(row=0; row<rb->height; row++) {
-      unsigned int *pixptr = rowdata;
-      int col;
-      unsigned char *a,*r,*g,*b;
-      r=rb->data.rgba.r+row*rb->data.rgba.row_step;
-      g=rb->data.rgba.g+row*rb->data.rgba.row_step;
-      b=rb->data.rgba.b+row*rb->data.rgba.row_step;
-      if(rb->data.rgba.a) {
-        a=rb->data.rgba.a+row*rb->data.rgba.row_step;
-        for(col=0; col<rb->width; col++) {
-          if(*a) {
-            double da = *a/255.0;
-            unsigned char *pix = (unsigned char*)pixptr;
-            pix[0] = *r/da;
-            pix[1] = *g/da;
-            pix[2] = *b/da;
-            pix[3] = *a;
-          } else {
-            *pixptr=0;
-          }
-          pixptr++;
-          a+=rb->data.rgba.pixel_step;
-          r+=rb->data.rgba.pixel_step;
-          g+=rb->data.rgba.pixel_step;
-          b+=rb->data.rgba.pixel_step;
-        }
-      } else {
-        for(col=0; col<rb->width; col++) {
-          unsigned char *pix = (unsigned char*)pixptr;
-          pix[0] = *r;
-          pix[1] = *g;
-          pix[2] = *b;
-          pixptr++;
-          r+=rb->data.rgba.pixel_step;
-          g+=rb->data.rgba.pixel_step;
-          b+=rb->data.rgba.pixel_step;
-        }
-      }
-
+      getPNGRGBARow(rb,row,rowdata);
       png_write_row(png_ptr,(png_bytep)rowdata);
-
     }
     png_write_end(png_ptr, info_ptr);
     free(rowdata);
@@ -953,14 +1424,14 @@ int msSaveRasterBuffer(mapObj *map, rasterBufferObj *rb, FILE *stream,
 #endif
   if(strcasestr(format->driver,"/png")) {
     streamInfo info;
-    info.fp = stream;
-    info.buffer = NULL;
-
-    return saveAsPNG(map, rb,&info,format);
+    int ret;
+    initStreamInfo(&info,stream,NULL);
+    ret = saveAsPNG(map, rb,&info,format);
+    freeStreamInfo(&info);
+    return ret;
   } else if(strcasestr(format->driver,"/jpeg")) {
     streamInfo info;
-    info.fp = stream;
-    info.buffer=NULL;
+    initStreamInfo(&info,stream,NULL);
     return saveAsJPEG(map, rb,&info,format);
   } else {
     msSetError(MS_MISCERR,"unsupported image format\n", "msSaveRasterBuffer()");
@@ -980,13 +1451,11 @@ int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer,
 #endif
   if(strcasestr(format->driver,"/png")) {
     streamInfo info;
-    info.fp = NULL;
-    info.buffer = buffer;
+    initStreamInfo(&info,NULL,buffer);
     return saveAsPNG(NULL, data,&info,format);
   } else if(strcasestr(format->driver,"/jpeg")) {
     streamInfo info;
-    info.fp = NULL;
-    info.buffer=buffer;
+    initStreamInfo(&info,NULL,buffer);
     return saveAsJPEG(NULL, data,&info,format);
   } else {
     msSetError(MS_MISCERR,"unsupported image format\n", "msSaveRasterBuffer()");
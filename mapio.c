@@ -163,11 +163,18 @@ msIOContext *msIO_getHandler( FILE * fp )
       return NULL;
   }
 
-  if( fp == stdin || fp == NULL || strcmp((const char *)fp,"stdin") == 0 )
+  /* compare the pointers first, fp is usually a real FILE */
+  if( fp == stdin || fp == NULL )
     return &(group->stdin_context);
-  else if( fp == stdout || strcmp((const char *)fp,"stdout") == 0 )
+  else if( fp == stdout )
     return &(group->stdout_context);
-  else if( fp == stderr || strcmp((const char *)fp,"stderr") == 0 )
+  else if( fp == stderr )
+    return &(group->stderr_context);
+  else if( strcmp((const char *)fp,"stdin") == 0 )
+    return &(group->stdin_context);
+  else if( strcmp((const char *)fp,"stdout") == 0 )
+    return &(group->stdout_context);
+  else if( strcmp((const char *)fp,"stderr") == 0 )
     return &(group->stderr_context);
   else
     return NULL;
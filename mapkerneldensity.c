@@ -0,0 +1,386 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Kernel density (heatmap) raster layers
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** A RASTER layer with a KERNELDENSITY_SOURCE processing key is drawn from
+** the features of another (vector) layer instead of from a file: every
+** vertex of the source features is binned into a grid at the output
+** resolution, the grid is convolved with a gaussian kernel and the result
+** is scaled to 0-255 and drawn through the usual raster classification
+** (CLASS EXPRESSION ([pixel] ...) / COLORRANGE) code. Supported keys:
+**
+**   KERNELDENSITY_SOURCE=layer         name of the layer providing the points
+**   KERNELDENSITY_RADIUS=10            kernel radius in pixels
+**   KERNELDENSITY_WEIGHT=item          optional item holding a point weight
+**   KERNELDENSITY_NORMALIZATION=AUTO   density value drawn as 255, AUTO uses
+**                                      the maximum of the request
+**   KERNELDENSITY_COMPUTE_BORDERS=ON   also use the points outside of the
+**                                      extent, needed for seamless tiles
+**   KERNELDENSITY_THREADS=1            threads used for the convolution
+*/
+
+#include "mapserver.h"
+#include "mapthread.h"
+
+#ifdef USE_GDAL
+#include "gdal.h"
+#include "cpl_string.h"
+#endif
+
+/* minimal number of rows (or columns) handled by a convolution job */
+#define KERNELDENSITY_MIN_BAND 16
+
+typedef struct {
+  const float *src;
+  float *dst;
+  int stride;          /* row length of src and dst */
+  const float *kernel; /* 2*half+1 weights */
+  int half;
+  int first, last;     /* rows to convolve */
+  int col0, ncols;     /* columns to convolve */
+} kernelDensityBlurJob;
+
+/* convolve rows first..last horizontally */
+static void kernelDensityBlurRows(void *arg)
+{
+  kernelDensityBlurJob *job = (kernelDensityBlurJob*)arg;
+  int row, col, k;
+
+  for(row=job->first; row<=job->last; row++) {
+    const float *in = job->src + (size_t)row*job->stride;
+    float *out = job->dst + (size_t)row*job->stride;
+    for(col=job->col0; col<job->col0+job->ncols; col++) {
+      float sum = 0;
+      for(k=-job->half; k<=job->half; k++)
+        sum += in[col+k] * job->kernel[k+job->half];
+      out[col] = sum;
+    }
+  }
+}
+
+/* convolve rows first..last vertically, walking the source row by row */
+static void kernelDensityBlurColumns(void *arg)
+{
+  kernelDensityBlurJob *job = (kernelDensityBlurJob*)arg;
+  int row, col, k;
+
+  for(row=job->first; row<=job->last; row++) {
+    float *out = job->dst + (size_t)row*job->stride;
+    for(col=job->col0; col<job->col0+job->ncols; col++)
+      out[col] = 0;
+    for(k=-job->half; k<=job->half; k++) {
+      const float *in = job->src + (size_t)(row+k)*job->stride;
+      float w = job->kernel[k+job->half];
+      if(w == 0) continue;
+      for(col=job->col0; col<job->col0+job->ncols; col++)
+        out[col] += in[col] * w;
+    }
+  }
+}
+
+/* split rows first..last in bands and run func on them */
+static void kernelDensityRunBlur(msThreadJobFunc func, kernelDensityBlurJob *model, int first, int last, int threads)
+{
+  kernelDensityBlurJob *jobs;
+  void **args;
+  int i, njobs, nrows = last-first+1;
+
+  njobs = MS_MAX(1, MS_MIN(threads, nrows/KERNELDENSITY_MIN_BAND));
+  jobs = (kernelDensityBlurJob*)msSmallMalloc(sizeof(kernelDensityBlurJob)*njobs);
+  args = (void**)msSmallMalloc(sizeof(void*)*njobs);
+  for(i=0; i<njobs; i++) {
+    jobs[i] = *model;
+    jobs[i].first = first + (int)((double)nrows*i/njobs);
+    jobs[i].last = first + (int)((double)nrows*(i+1)/njobs) - 1;
+    args[i] = &jobs[i];
+  }
+  msRunThreadJobs(func, args, njobs, threads);
+  free(args);
+  free(jobs);
+}
+
+/************************************************************************/
+/*                       msComputeKernelDensity()                       */
+/*                                                                      */
+/*      Fill values (width*height bytes) with the scaled density of     */
+/*      the KERNELDENSITY_SOURCE layer of layer over the map extent.   */
+/************************************************************************/
+
+int msComputeKernelDensity(mapObj *map, layerObj *layer, int width, int height, unsigned char *values)
+{
+  const char *source, *weightitem, *normalization, *value;
+  layerObj *src;
+  double radius = 10, sigma, scale, maxdensity = 0;
+  int half, margin, gw, gh, threads = 1, computeborders = MS_TRUE;
+  int i, j, status, weightindex = -1, nclasses = 0, *classgroup = NULL;
+  float *grid, *tmp, *kernel, ksum = 0;
+  rectObj searchrect;
+  shapeObj shape;
+  kernelDensityBlurJob job;
+
+  source = msLayerGetProcessingKey(layer, "KERNELDENSITY_SOURCE");
+  if(!source || (i = msGetLayerIndex(map, (char*)source)) == -1 || GET_LAYER(map, i) == layer) {
+    msSetError(MS_MISCERR, "Layer (%s) has an invalid KERNELDENSITY_SOURCE (%s).", "msComputeKernelDensity()", layer->name, source ? source : "");
+    return MS_FAILURE;
+  }
+  src = GET_LAYER(map, i);
+
+  if((value = msLayerGetProcessingKey(layer, "KERNELDENSITY_RADIUS")) != NULL) {
+    radius = atof(value);
+    if(radius <= 0) {
+      msSetError(MS_MISCERR, "Invalid KERNELDENSITY_RADIUS (%s), expecting a positive number of pixels.", "msComputeKernelDensity()", value);
+      return MS_FAILURE;
+    }
+  }
+  if((value = msLayerGetProcessingKey(layer, "KERNELDENSITY_THREADS")) != NULL) {
+    threads = atoi(value);
+    if(threads < 1) {
+      msSetError(MS_MISCERR, "Invalid KERNELDENSITY_THREADS (%s), expecting a positive integer.", "msComputeKernelDensity()", value);
+      return MS_FAILURE;
+    }
+  }
+  if((value = msLayerGetProcessingKey(layer, "KERNELDENSITY_COMPUTE_BORDERS")) != NULL)
+    computeborders = (strcasecmp(value, "OFF") != 0 && strcasecmp(value, "FALSE") != 0);
+  weightitem = msLayerGetProcessingKey(layer, "KERNELDENSITY_WEIGHT");
+  normalization = msLayerGetProcessingKey(layer, "KERNELDENSITY_NORMALIZATION");
+
+  /* gaussian kernel truncated at the radius */
+  half = (int)ceil(radius);
+  sigma = radius/3.0;
+  kernel = (float*)msSmallMalloc(sizeof(float)*(2*half+1));
+  for(i=-half; i<=half; i++) {
+    kernel[i+half] = (float)exp(-(i*i)/(2*sigma*sigma));
+    ksum += kernel[i+half];
+  }
+  for(i=0; i<=2*half; i++)
+    kernel[i] /= ksum;
+
+  /*
+  ** The grid has a margin of half pixels on every side: points up to a
+  ** radius away from the extent contribute to the border pixels, and the
+  ** convolution never has to test its bounds.
+  */
+  margin = half;
+  gw = width + 2*margin;
+  gh = height + 2*margin;
+  grid = (float*)msSmallCalloc((size_t)gw*gh, sizeof(float));
+
+  /* bin the source features */
+  searchrect = map->extent;
+  if(computeborders) {
+    searchrect.minx -= (half+0.5)*map->cellsize;
+    searchrect.miny -= (half+0.5)*map->cellsize;
+    searchrect.maxx += (half+0.5)*map->cellsize;
+    searchrect.maxy += (half+0.5)*map->cellsize;
+  }
+#ifdef USE_PROJ
+  if((map->projection.numargs > 0) && (src->projection.numargs > 0))
+    msProjectRect(&map->projection, &src->projection, &searchrect);
+#endif
+
+  status = msLayerOpen(src);
+  if(status == MS_SUCCESS)
+    status = msLayerWhichItems(src, MS_FALSE, (char*)weightitem);
+  if(status != MS_SUCCESS) {
+    msLayerClose(src);
+    free(grid);
+    free(kernel);
+    return MS_FAILURE;
+  }
+  if(weightitem) {
+    for(i=0; i<src->numitems; i++) {
+      if(strcasecmp(src->items[i], weightitem) == 0) {
+        weightindex = i;
+        break;
+      }
+    }
+  }
+
+  status = msLayerWhichShapes(src, searchrect, MS_FALSE);
+  if(status == MS_SUCCESS) {
+    if(src->classgroup && src->numclasses > 0)
+      classgroup = msAllocateValidClassGroups(src, &nclasses);
+
+    msInitShape(&shape);
+    while((status = msLayerNextShape(src, &shape)) == MS_SUCCESS) {
+      float weight = 1;
+
+      /* a source layer with classes only contributes its classified features */
+      if(src->numclasses > 0) {
+        shape.classindex = msShapeGetClass(src, map, &shape, classgroup, nclasses);
+        if(shape.classindex == -1 || src->class[shape.classindex]->status == MS_OFF) {
+          msFreeShape(&shape);
+          continue;
+        }
+      }
+      if(weightindex >= 0 && weightindex < shape.numvalues && shape.values[weightindex])
+        weight = (float)atof(shape.values[weightindex]);
+
+#ifdef USE_PROJ
+      if(src->project && msProjectionsDiffer(&(src->projection), &(map->projection)))
+        msProjectShape(&src->projection, &map->projection, &shape);
+      else
+        src->project = MS_FALSE;
+#endif
+
+      for(i=0; i<shape.numlines; i++) {
+        for(j=0; j<shape.line[i].numpoints; j++) {
+          int x = MS_NINT((shape.line[i].point[j].x - map->extent.minx)/map->cellsize) + margin;
+          int y = MS_NINT((map->extent.maxy - shape.line[i].point[j].y)/map->cellsize) + margin;
+          if(x >= 0 && x < gw && y >= 0 && y < gh)
+            grid[(size_t)y*gw+x] += weight;
+        }
+      }
+      msFreeShape(&shape);
+    }
+    msFree(classgroup);
+  }
+  msLayerClose(src);
+  if(status == MS_FAILURE) {
+    free(grid);
+    free(kernel);
+    return MS_FAILURE;
+  }
+
+  /*
+  ** Separable convolution: the horizontal pass only produces the output
+  ** columns but all the rows, the vertical pass then only the output rows.
+  */
+  tmp = (float*)msSmallCalloc((size_t)gw*gh, sizeof(float));
+  job.stride = gw;
+  job.kernel = kernel;
+  job.half = half;
+  job.col0 = margin;
+  job.ncols = width;
+
+  job.src = grid;
+  job.dst = tmp;
+  kernelDensityRunBlur(kernelDensityBlurRows, &job, 0, gh-1, threads);
+  job.src = tmp;
+  job.dst = grid;
+  kernelDensityRunBlur(kernelDensityBlurColumns, &job, margin, margin+height-1, threads);
+  free(tmp);
+  free(kernel);
+
+  /* scale to bytes, 0 is kept for areas without any point */
+  if(normalization && strcasecmp(normalization, "AUTO") != 0) {
+    maxdensity = atof(normalization);
+    if(maxdensity <= 0) {
+      msSetError(MS_MISCERR, "Invalid KERNELDENSITY_NORMALIZATION (%s), expecting AUTO or a positive number.", "msComputeKernelDensity()", normalization);
+      free(grid);
+      return MS_FAILURE;
+    }
+  } else {
+    for(j=0; j<height; j++)
+      for(i=0; i<width; i++)
+        maxdensity = MS_MAX(maxdensity, grid[(size_t)(j+margin)*gw+i+margin]);
+  }
+  scale = (maxdensity > 0) ? 255.0/maxdensity : 0;
+
+  for(j=0; j<height; j++) {
+    const float *row = grid + (size_t)(j+margin)*gw + margin;
+    unsigned char *out = values + (size_t)j*width;
+    for(i=0; i<width; i++) {
+      double v = row[i]*scale;
+      if(v <= 0)
+        out[i] = 0;
+      else
+        out[i] = (v >= 255) ? 255 : MS_MAX(1, MS_NINT(v));
+    }
+  }
+
+  free(grid);
+  return MS_SUCCESS;
+}
+
+#ifdef USE_GDAL
+
+/************************************************************************/
+/*                    msComputeKernelDensityDataset()                   */
+/*                                                                      */
+/*      Wrap the density of the layer in a one band GDAL memory         */
+/*      dataset georeferenced on the map extent.                        */
+/************************************************************************/
+
+int msComputeKernelDensityDataset(mapObj *map, imageObj *image, layerObj *layer, void **hDSvoid, void **cleanup_ptr)
+{
+  unsigned char *values;
+  char pointer[64], memDSPointer[128];
+  char *pszWKT;
+  double adfGeoTransform[6];
+  GDALDatasetH hDS;
+
+  *hDSvoid = NULL;
+  *cleanup_ptr = NULL;
+
+  values = (unsigned char*)msSmallMalloc((size_t)image->width*image->height);
+  if(msComputeKernelDensity(map, layer, image->width, image->height, values) != MS_SUCCESS) {
+    free(values);
+    return MS_FAILURE;
+  }
+
+  memset(pointer, 0, sizeof(pointer));
+  CPLPrintPointer(pointer, values, sizeof(pointer));
+  sprintf(memDSPointer, "MEM:::DATAPOINTER=%s,PIXELS=%d,LINES=%d,BANDS=1,DATATYPE=Byte",
+          pointer, image->width, image->height);
+  hDS = GDALOpen(memDSPointer, GA_ReadOnly);
+  if(hDS == NULL) {
+    msSetError(MS_IMGERR, "Unable to open GDAL Memory dataset.", "msComputeKernelDensityDataset()");
+    free(values);
+    return MS_FAILURE;
+  }
+
+  /* the map extent is given from pixel center to pixel center */
+  adfGeoTransform[0] = map->extent.minx - map->cellsize*0.5;
+  adfGeoTransform[1] = map->cellsize;
+  adfGeoTransform[2] = 0;
+  adfGeoTransform[3] = map->extent.maxy + map->cellsize*0.5;
+  adfGeoTransform[4] = 0;
+  adfGeoTransform[5] = -map->cellsize;
+  GDALSetGeoTransform(hDS, adfGeoTransform);
+
+  /* the density is computed in the map projection */
+  pszWKT = msProjectionObj2OGCWKT(&(map->projection));
+  if(pszWKT != NULL) {
+    GDALSetProjection(hDS, pszWKT);
+    msFree(pszWKT);
+  }
+
+  *hDSvoid = hDS;
+  *cleanup_ptr = values;
+  return MS_SUCCESS;
+}
+
+int msCleanupKernelDensityDataset(mapObj *map, imageObj *image, layerObj *layer, void *cleanup_ptr)
+{
+  free(cleanup_ptr);
+  return MS_SUCCESS;
+}
+
+#endif /* USE_GDAL */
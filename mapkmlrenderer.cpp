@@ -665,26 +665,43 @@ void KmlRenderer::renderPolygon(imageObj*, shapeObj *p, colorObj *color)
 
 void KmlRenderer::addCoordsNode(xmlNodePtr parentNode, pointObj *pts, int numPts)
 {
-  char lineBuf[128];
+  bufferObj coords;
 
   xmlNodePtr coordsNode = xmlNewChild(parentNode, NULL, BAD_CAST "coordinates", NULL);
-  xmlNodeAddContent(coordsNode, BAD_CAST "\n");
 
-  for (int i=0; i<numPts; i++) {
-    if( mElevationFromAttribute ) {
-      sprintf(lineBuf, "\t%.8f,%.8f,%.8f\n", pts[i].x, pts[i].y, mCurrentElevationValue);
-    } else if (AltitudeMode == relativeToGround || AltitudeMode == absolute) {
+  /* build the whole coordinate list, then add it to the node at once */
+  msBufferInit(&coords);
+  msBufferAppend(&coords, (void *)"\n", 1);
+
+  if( mElevationFromAttribute || AltitudeMode == relativeToGround || AltitudeMode == absolute ) {
+    for (int i=0; i<numPts; i++) {
+      double z = mCurrentElevationValue;
+      if( !mElevationFromAttribute ) {
 #ifdef USE_POINT_Z_M
-      sprintf(lineBuf, "\t%.8f,%.8f,%.8f\n", pts[i].x, pts[i].y, pts[i].z);
+        z = pts[i].z;
 #else
-      msSetError(MS_MISCERR, "Z coordinates support not available  (mapserver not compiled with USE_POINT_Z_M option)", "KmlRenderer::addCoordsNode()");
+        msSetError(MS_MISCERR, "Z coordinates support not available  (mapserver not compiled with USE_POINT_Z_M option)", "KmlRenderer::addCoordsNode()");
+        break;
 #endif
-    } else
-      sprintf(lineBuf, "\t%.8f,%.8f\n", pts[i].x, pts[i].y);
-
-    xmlNodeAddContent(coordsNode, BAD_CAST lineBuf);
+      }
+      msBufferAppend(&coords, (void *)"\t", 1);
+      msBufferAppendDouble(&coords, pts[i].x, 8);
+      msBufferAppend(&coords, (void *)",", 1);
+      msBufferAppendDouble(&coords, pts[i].y, 8);
+      msBufferAppend(&coords, (void *)",", 1);
+      msBufferAppendDouble(&coords, z, 8);
+      msBufferAppend(&coords, (void *)"\n", 1);
+    }
+  } else {
+    lineObj line;
+    line.numpoints = numPts;
+    line.point = pts;
+    msBufferAppendLineCoords(&coords, &line, 8, "\t", ",", "\n", NULL);
   }
-  xmlNodeAddContent(coordsNode, BAD_CAST "\t");
+
+  msBufferAppend(&coords, (void *)"\t", 2); /* with the terminating nul */
+  xmlNodeAddContent(coordsNode, BAD_CAST coords.data);
+  msBufferFree(&coords);
 }
 
 void KmlRenderer::renderGlyphs(imageObj*, double x, double y, labelStyleObj *style, char *text)
@@ -60,6 +60,10 @@ int msLayerInitItemInfo(layerObj *layer)
 
 void msLayerFreeItemInfo(layerObj *layer)
 {
+  /* the class lookup table and the binding plan refer to item indexes */
+  msFreeClassTable(layer);
+  msFreeBindingPlan(layer);
+
   if ( ! layer->vtable) {
     int rv =  msInitializeVirtualTable(layer);
     if (rv != MS_SUCCESS)
@@ -255,6 +259,40 @@ int msLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   return layer->vtable->LayerWhichShapes(layer, rect, isQuery);
 }
 
+/*
+** Same as msLayerWhichShapes() (for a query) but asks for the candidate features to be returned by
+** msLayerNextShape in order of increasing distance to point, none further away than maxdistance (-1
+** for no limit). maxresults, if positive, tells drivers that run a query how many features the caller
+** is going to use at most. *ordered is set to MS_TRUE when the connection type honours the ordering,
+** otherwise this is a plain msLayerWhichShapes() and the features come back in their natural order.
+**
+** Shapefiles walk their .qix index best-first, PostGIS pushes an ORDER BY distance to the database.
+*/
+int msLayerWhichShapesNearest(layerObj *layer, rectObj rect, pointObj *point, double maxdistance, int maxresults, int *ordered)
+{
+  *ordered = MS_FALSE;
+
+  if ( ! layer->vtable) {
+    int rv =  msInitializeVirtualTable(layer);
+    if (rv != MS_SUCCESS)
+      return rv;
+  }
+
+  switch(layer->connectiontype) {
+    case MS_SHAPEFILE:
+      if(!layer->layerinfo) break;
+      *ordered = MS_TRUE;
+      return msShapefileWhichShapesNearest((shapefileObj *) layer->layerinfo, rect, point, maxdistance, layer->debug);
+    case MS_POSTGIS:
+      *ordered = MS_TRUE;
+      return msPostGISLayerWhichShapesNearest(layer, rect, point, maxresults);
+    default:
+      break;
+  }
+
+  return layer->vtable->LayerWhichShapes(layer, rect, MS_TRUE);
+}
+
 /*
 ** Called after msWhichShapes has been called to actually retrieve shapes within a given area
 ** and matching a vendor specific filter (i.e. layer FILTER attribute).
@@ -414,15 +452,10 @@ int msLayerGetItems(layerObj *layer)
 **
 ** Returns MS_SUCCESS/MS_FAILURE.
 */
-int msLayerGetExtent(layerObj *layer, rectObj *extent)
+static int msLayerComputeExtent(layerObj *layer, rectObj *extent)
 {
   int need_to_close = MS_FALSE, status = MS_SUCCESS;
 
-  if (MS_VALID_EXTENT(layer->extent)) {
-    *extent = layer->extent;
-    return MS_SUCCESS;
-  }
-
   if (!msLayerIsOpen(layer)) {
     if (msLayerOpen(layer) != MS_SUCCESS)
       return MS_FAILURE;
@@ -445,6 +478,45 @@ int msLayerGetExtent(layerObj *layer, rectObj *extent)
   return(status);
 }
 
+/*
+** Returns the layer EXTENT, or the extent of its data. The latter comes
+** from the extent cache when one is configured (see mapextentcache.c).
+*/
+int msLayerGetExtent(layerObj *layer, rectObj *extent)
+{
+  int status;
+
+  if (MS_VALID_EXTENT(layer->extent)) {
+    *extent = layer->extent;
+    return MS_SUCCESS;
+  }
+
+  if (msLayerGetCachedExtent(layer, extent) == MS_SUCCESS)
+    return MS_SUCCESS;
+
+  status = msLayerComputeExtent(layer, extent);
+  if (status == MS_SUCCESS)
+    msLayerSetCachedExtent(layer, extent);
+
+  return(status);
+}
+
+/*
+** Computes the extent of the layer data and replaces the cached one, used
+** to refresh the cache after the data changed. Returns MS_DONE if the
+** extent of this layer is not cached.
+*/
+int msLayerUpdateCachedExtent(layerObj *layer, rectObj *extent)
+{
+  int status;
+
+  status = msLayerComputeExtent(layer, extent);
+  if (status != MS_SUCCESS)
+    return status;
+
+  return msLayerSetCachedExtent(layer, extent);
+}
+
 int msLayerGetItemIndex(layerObj *layer, char *item)
 {
   int i;
@@ -555,6 +627,10 @@ int msTokenizeExpression(expressionObj *expression, char **list, int *listsize)
           goto parse_error;
         }
 
+#ifdef USE_GEOS
+        msGEOSPrepare(node->tokenval.shpval); /* it is going to be tested against every feature */
+#endif
+
         /* todo: perhaps process optional args (e.g. projection) */
 
         if((token = msyylex()) != 41) { /* ) */
@@ -584,6 +660,11 @@ int msTokenizeExpression(expressionObj *expression, char **list, int *listsize)
   expression->curtoken = expression->tokens; /* point at the first token */
 
   msReleaseLock(TLOCK_PARSER);
+
+  /* with the item indexes known the expression can be compiled, see mapexpr.c */
+  if(list && expression->type == MS_EXPRESSION)
+    msCompileExpression(expression);
+
   return MS_SUCCESS;
 
 parse_error:
@@ -680,7 +761,8 @@ int msLayerWhichItems(layerObj *layer, int get_all, char *metadata)
 
   /* always retrieve all items in some cases */
   if(layer->connectiontype == MS_INLINE || get_all == MS_TRUE ||
-      (layer->map->outputformat && layer->map->outputformat->renderer == MS_RENDER_WITH_KML)) {
+      (layer->map->outputformat && (layer->map->outputformat->renderer == MS_RENDER_WITH_KML ||
+                                     layer->map->outputformat->renderer == MS_RENDER_WITH_UTFGRID))) {
     msLayerGetItems(layer);
     if(nt > 0) /* need to realloc the array to accept the possible new items*/
       layer->items = (char **)msSmallRealloc(layer->items, sizeof(char *)*(layer->numitems + nt));
@@ -1452,6 +1534,18 @@ char *LayerDefaultEscapeSQLParam(layerObj *layer, const char* pszString)
   return pszEscapedStr;
 }
 
+/************************************************************************/
+/*                       LayerDefaultBuildSQLSpatialFilter              */
+/*                                                                      */
+/*      Default function used to push a spatial operator of a filter    */
+/*      (Intersects, DWithin, BBOX...) down to the database, NULL      */
+/*      when the driver has no SQL for it and MapServer evaluates it.   */
+/************************************************************************/
+char *LayerDefaultBuildSQLSpatialFilter(layerObj *layer, const char *pszOperator, shapeObj *shape, double dfDistance)
+{
+  return NULL;
+}
+
 /************************************************************************/
 /*                          LayerDefaultEscapePropertyName              */
 /*                                                                      */
@@ -1554,6 +1648,8 @@ static int populateVirtualTable(layerVTableObj *vtable)
   vtable->LayerEnablePaging = msLayerDefaultEnablePaging;
   vtable->LayerGetPaging = msLayerDefaultGetPaging;
 
+  vtable->LayerBuildSQLSpatialFilter = LayerDefaultBuildSQLSpatialFilter;
+
   return MS_SUCCESS;
 }
 
@@ -1758,6 +1854,21 @@ char  *msLayerEscapePropertyName(layerObj *layer, const char*pszString)
   return layer->vtable->LayerEscapePropertyName(layer, pszString);
 }
 
+/*
+Returns the SQL for the spatial operator pszOperator between the layer
+geometry and shape (in the layer projection), or NULL if the driver
+cannot push it down
+*/
+char *msLayerBuildSQLSpatialFilter(layerObj *layer, const char *pszOperator, shapeObj *shape, double dfDistance)
+{
+  if ( ! layer->vtable) {
+    int rv =  msInitializeVirtualTable(layer);
+    if (rv != MS_SUCCESS)
+      return NULL;
+  }
+  return layer->vtable->LayerBuildSQLSpatialFilter(layer, pszOperator, shape, dfDistance);
+}
+
 
 int
 msINLINELayerInitializeVirtualTable(layerObj *layer)
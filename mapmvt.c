@@ -0,0 +1,827 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Mapbox Vector Tile (MVT) output
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** The MVT driver does not rasterize anything: the features selected for
+** the map extent are transformed to the tile grid, clipped against the
+** tile plus a small buffer, snapped to integer tile units and written as
+** a version 2 vector tile. The protobuf encoding is simple enough that we
+** write it by hand rather than depend on a protobuf library.
+**
+** Supported FORMATOPTIONs:
+**   EXTENT=n   number of tile units across a tile (default 4096)
+**   BUFFER=n   number of tile units kept around the tile edge (default 16)
+**
+** The attributes written for each layer are controlled by the
+** "mvt_include_items" layer metadata, either "all" (the default) or a
+** comma separated list of item names.
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include "mapserver.h"
+#include "mapproject.h"
+
+#define MVT_DEFAULT_EXTENT 4096
+#define MVT_DEFAULT_BUFFER 16
+
+/* protobuf wire types */
+#define MVT_WIRE_VARINT 0
+#define MVT_WIRE_64BIT  1
+#define MVT_WIRE_LENGTH 2
+
+/* Tile, Layer, Feature and Value message fields (vector_tile.proto 2.1) */
+#define MVT_TILE_LAYERS       3
+#define MVT_LAYER_NAME        1
+#define MVT_LAYER_FEATURES    2
+#define MVT_LAYER_KEYS        3
+#define MVT_LAYER_VALUES      4
+#define MVT_LAYER_EXTENT      5
+#define MVT_LAYER_VERSION     15
+#define MVT_FEATURE_ID        1
+#define MVT_FEATURE_TAGS      2
+#define MVT_FEATURE_TYPE      3
+#define MVT_FEATURE_GEOMETRY  4
+#define MVT_VALUE_STRING      1
+#define MVT_VALUE_DOUBLE      3
+#define MVT_VALUE_SINT        6
+
+#define MVT_GEOM_POINT      1
+#define MVT_GEOM_LINESTRING 2
+#define MVT_GEOM_POLYGON    3
+
+#define MVT_CMD_MOVETO    1
+#define MVT_CMD_LINETO    2
+#define MVT_CMD_CLOSEPATH 7
+
+#define MVT_COMMAND(id,count) (((unsigned long)(count) << 3) | (id))
+#define MVT_ZIGZAG(v) ((((unsigned long)(v)) << 1) ^ (unsigned long)((v) < 0 ? -1L : 0L))
+
+/************************************************************************/
+/*                         protobuf primitives                          */
+/************************************************************************/
+
+static void mvtWriteVarint(bufferObj *buf, unsigned long value)
+{
+  unsigned char bytes[10];
+  int n = 0;
+
+  while(value >= 0x80) {
+    bytes[n++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  bytes[n++] = (unsigned char)value;
+  msBufferAppend(buf, bytes, n);
+}
+
+static void mvtWriteKey(bufferObj *buf, int field, int wiretype)
+{
+  mvtWriteVarint(buf, ((unsigned long)field << 3) | wiretype);
+}
+
+static void mvtWriteBytes(bufferObj *buf, int field, const void *data, size_t length)
+{
+  mvtWriteKey(buf, field, MVT_WIRE_LENGTH);
+  mvtWriteVarint(buf, length);
+  if(length > 0)
+    msBufferAppend(buf, (void *)data, length);
+}
+
+static void mvtWriteDouble(bufferObj *buf, int field, double value)
+{
+  unsigned char bytes[8];
+  int one = 1, i;
+
+  /* protobuf doubles are little endian */
+  memcpy(bytes, &value, 8);
+  if(*((unsigned char *)&one) == 0) {
+    for(i=0; i<4; i++) {
+      unsigned char t = bytes[i];
+      bytes[i] = bytes[7-i];
+      bytes[7-i] = t;
+    }
+  }
+  mvtWriteKey(buf, field, MVT_WIRE_64BIT);
+  msBufferAppend(buf, bytes, 8);
+}
+
+/************************************************************************/
+/*                         layer value dictionary                       */
+/*                                                                      */
+/*      Values are shared between the features of a layer, so every     */
+/*      distinct encoded Value message is stored once and referenced    */
+/*      by index from the feature tags.                                 */
+/************************************************************************/
+
+typedef struct {
+  bufferObj data;      /* concatenated encoded Value messages */
+  size_t *offsets;     /* start of value i in data, offsets[numvalues] is the end */
+  int numvalues;
+  int *slots;          /* open addressing table of value indexes, -1 if free */
+  unsigned int *hashes;
+  int numslots;
+} mvtValueDict;
+
+static unsigned int mvtHashBytes(const unsigned char *data, size_t length)
+{
+  unsigned int hash = 2166136261U;
+  size_t i;
+  for(i=0; i<length; i++) {
+    hash ^= data[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static void mvtInitValueDict(mvtValueDict *dict)
+{
+  int i;
+  msBufferInit(&dict->data);
+  dict->numvalues = 0;
+  dict->offsets = (size_t *)msSmallMalloc(sizeof(size_t));
+  dict->offsets[0] = 0;
+  dict->numslots = 256;
+  dict->slots = (int *)msSmallMalloc(sizeof(int)*dict->numslots);
+  dict->hashes = NULL;
+  for(i=0; i<dict->numslots; i++)
+    dict->slots[i] = -1;
+}
+
+static void mvtFreeValueDict(mvtValueDict *dict)
+{
+  msBufferFree(&dict->data);
+  msFree(dict->offsets);
+  msFree(dict->slots);
+  msFree(dict->hashes);
+}
+
+static void mvtGrowValueDict(mvtValueDict *dict)
+{
+  int i, j;
+
+  msFree(dict->slots);
+  dict->numslots *= 2;
+  dict->slots = (int *)msSmallMalloc(sizeof(int)*dict->numslots);
+  for(i=0; i<dict->numslots; i++)
+    dict->slots[i] = -1;
+  for(i=0; i<dict->numvalues; i++) {
+    j = dict->hashes[i] & (dict->numslots-1);
+    while(dict->slots[j] != -1)
+      j = (j+1) & (dict->numslots-1);
+    dict->slots[j] = i;
+  }
+}
+
+/* returns the index of the encoded value, adding it if it is new */
+static int mvtValueDictIndex(mvtValueDict *dict, bufferObj *value)
+{
+  unsigned int hash = mvtHashBytes(value->data, value->size);
+  int j = hash & (dict->numslots-1), index;
+
+  while((index = dict->slots[j]) != -1) {
+    if(dict->hashes[index] == hash &&
+        dict->offsets[index+1] - dict->offsets[index] == value->size &&
+        memcmp(dict->data.data + dict->offsets[index], value->data, value->size) == 0)
+      return index;
+    j = (j+1) & (dict->numslots-1);
+  }
+
+  index = dict->numvalues++;
+  dict->slots[j] = index;
+  dict->hashes = (unsigned int *)msSmallRealloc(dict->hashes, sizeof(unsigned int)*dict->numvalues);
+  dict->hashes[index] = hash;
+  msBufferAppend(&dict->data, value->data, value->size);
+  dict->offsets = (size_t *)msSmallRealloc(dict->offsets, sizeof(size_t)*(dict->numvalues+1));
+  dict->offsets[dict->numvalues] = dict->data.size;
+
+  if(dict->numvalues*2 > dict->numslots)
+    mvtGrowValueDict(dict);
+  return index;
+}
+
+/*
+** Returns 1 if value is a plain decimal integer, 2 if it is a decimal
+** number with a fraction or an exponent, 0 otherwise. Only an optional sign,
+** digits, fraction and exponent are accepted: no white space, hexadecimal,
+** inf or nan that strtod() would take. Numbers with leading zeros (codes,
+** zip codes) are not numbers either so they survive the round trip.
+*/
+static int mvtNumberSyntax(const char *value)
+{
+  const char *p = value;
+  int type = 1;
+
+  if(*p == '-' || *p == '+')
+    p++;
+  if(!isdigit((unsigned char)*p))
+    return 0;
+  if(p[0] == '0' && p[1] != '\0' && p[1] != '.')
+    return 0;
+  while(isdigit((unsigned char)*p))
+    p++;
+  if(*p == '.') {
+    p++;
+    if(!isdigit((unsigned char)*p))
+      return 0;
+    while(isdigit((unsigned char)*p))
+      p++;
+    type = 2;
+  }
+  if(*p == 'e' || *p == 'E') {
+    p++;
+    if(*p == '-' || *p == '+')
+      p++;
+    if(!isdigit((unsigned char)*p))
+      return 0;
+    while(isdigit((unsigned char)*p))
+      p++;
+    type = 2;
+  }
+  return (*p == '\0') ? type : 0;
+}
+
+/*
+** Encode an attribute as a Value message, using a numeric type when the
+** whole string is a number (see mvtNumberSyntax()).
+*/
+static void mvtEncodeValue(bufferObj *buf, const char *value)
+{
+  int type = mvtNumberSyntax(value);
+
+  buf->size = 0;
+  if(type == 1) {
+    long lvalue;
+    errno = 0;
+    lvalue = strtol(value, NULL, 10);
+    if(errno == 0) {
+      mvtWriteKey(buf, MVT_VALUE_SINT, MVT_WIRE_VARINT);
+      mvtWriteVarint(buf, MVT_ZIGZAG(lvalue));
+      return;
+    }
+    type = 2; /* out of range integers are kept as doubles */
+  }
+  if(type == 2) {
+    double dvalue;
+    errno = 0;
+    dvalue = strtod(value, NULL);
+    if(errno != ERANGE) { /* e.g. 1e999 */
+      mvtWriteDouble(buf, MVT_VALUE_DOUBLE, dvalue);
+      return;
+    }
+  }
+  mvtWriteBytes(buf, MVT_VALUE_STRING, value, strlen(value));
+}
+
+/************************************************************************/
+/*                          geometry encoding                           */
+/************************************************************************/
+
+typedef struct {
+  bufferObj *buf; /* packed geometry commands and parameters */
+  int x, y;       /* cursor, geometry parameters are relative to it */
+} mvtGeometryWriter;
+
+static void mvtWritePoints(mvtGeometryWriter *writer, const int *xy, int npoints)
+{
+  int i;
+  for(i=0; i<npoints; i++) {
+    int dx = xy[2*i] - writer->x;
+    int dy = xy[2*i+1] - writer->y;
+    mvtWriteVarint(writer->buf, MVT_ZIGZAG(dx));
+    mvtWriteVarint(writer->buf, MVT_ZIGZAG(dy));
+    writer->x = xy[2*i];
+    writer->y = xy[2*i+1];
+  }
+}
+
+/*
+** Snap a line to integer tile units, dropping repeated points and the
+** middle points of straight runs. This is the simplification to tile
+** resolution: nothing that is removed can be seen at the tile grid.
+** Returns the number of points left in xy.
+*/
+static int mvtSnapLine(lineObj *line, int *xy, int closed)
+{
+  int i, n = 0;
+
+  for(i=0; i<line->numpoints; i++) {
+    int x = MS_NINT(line->point[i].x);
+    int y = MS_NINT(line->point[i].y);
+
+    if(n > 0 && xy[2*n-2] == x && xy[2*n-1] == y)
+      continue;
+    if(n > 1) {
+      /* drop the previous point if it lies on the straight segment to this one */
+      double ax = xy[2*n-4], ay = xy[2*n-3];
+      double bx = xy[2*n-2], by = xy[2*n-1];
+      if((bx-ax)*(y-by) - (by-ay)*(x-bx) == 0 &&
+          (bx-ax)*(x-bx) + (by-ay)*(y-by) > 0)
+        n--;
+    }
+    xy[2*n] = x;
+    xy[2*n+1] = y;
+    n++;
+  }
+
+  if(closed) {
+    /* rings are closed implicitly by the ClosePath command */
+    while(n > 1 && xy[0] == xy[2*n-2] && xy[1] == xy[2*n-1])
+      n--;
+  }
+  return n;
+}
+
+/* twice the signed ring area, positive is clockwise in the y-down tile grid */
+static double mvtRingArea(const int *xy, int n)
+{
+  double area = 0;
+  int i, j;
+  for(i=0, j=n-1; i<n; j=i++)
+    area += (double)xy[2*j] * xy[2*i+1] - (double)xy[2*i] * xy[2*j+1];
+  return area;
+}
+
+static void mvtWriteRing(mvtGeometryWriter *writer, int *xy, int n, int exterior)
+{
+  double area = mvtRingArea(xy, n);
+
+  if((exterior && area < 0) || (!exterior && area > 0)) {
+    int i;
+    for(i=0; i<n/2; i++) {
+      int tx = xy[2*i], ty = xy[2*i+1];
+      xy[2*i] = xy[2*(n-1-i)];
+      xy[2*i+1] = xy[2*(n-1-i)+1];
+      xy[2*(n-1-i)] = tx;
+      xy[2*(n-1-i)+1] = ty;
+    }
+  }
+
+  mvtWriteVarint(writer->buf, MVT_COMMAND(MVT_CMD_MOVETO, 1));
+  mvtWritePoints(writer, xy, 1);
+  mvtWriteVarint(writer->buf, MVT_COMMAND(MVT_CMD_LINETO, n-1));
+  mvtWritePoints(writer, xy+2, n-1);
+  mvtWriteVarint(writer->buf, MVT_COMMAND(MVT_CMD_CLOSEPATH, 1));
+}
+
+/*
+** Encode a shape already expressed in tile units. Returns the MVT geometry
+** type, or 0 if nothing of the shape is left inside the buffered tile.
+*/
+static int mvtEncodeGeometry(shapeObj *shape, rectObj *cliprect, bufferObj *buf)
+{
+  mvtGeometryWriter writer;
+  int i, j, n, maxpoints = 0, type = 0;
+  int *xy;
+
+  writer.buf = buf;
+  writer.x = writer.y = 0;
+  buf->size = 0;
+
+  for(i=0; i<shape->numlines; i++)
+    maxpoints = MS_MAX(maxpoints, shape->line[i].numpoints);
+  if(shape->type == MS_SHAPE_POINT) {
+    maxpoints = 0;
+    for(i=0; i<shape->numlines; i++)
+      maxpoints += shape->line[i].numpoints;
+  }
+  if(maxpoints == 0)
+    return 0;
+  xy = (int *)msSmallMalloc(sizeof(int)*2*maxpoints);
+
+  if(shape->type == MS_SHAPE_POINT) {
+    n = 0;
+    for(i=0; i<shape->numlines; i++) {
+      for(j=0; j<shape->line[i].numpoints; j++) {
+        pointObj *p = &(shape->line[i].point[j]);
+        if(p->x < cliprect->minx || p->x > cliprect->maxx ||
+            p->y < cliprect->miny || p->y > cliprect->maxy)
+          continue;
+        xy[2*n] = MS_NINT(p->x);
+        xy[2*n+1] = MS_NINT(p->y);
+        n++;
+      }
+    }
+    if(n > 0) {
+      mvtWriteVarint(buf, MVT_COMMAND(MVT_CMD_MOVETO, n));
+      mvtWritePoints(&writer, xy, n);
+      type = MVT_GEOM_POINT;
+    }
+  } else if(shape->type == MS_SHAPE_LINE) {
+    msClipPolylineRect(shape, *cliprect);
+    for(i=0; i<shape->numlines; i++) {
+      n = mvtSnapLine(&(shape->line[i]), xy, MS_FALSE);
+      if(n < 2) continue;
+      mvtWriteVarint(buf, MVT_COMMAND(MVT_CMD_MOVETO, 1));
+      mvtWritePoints(&writer, xy, 1);
+      mvtWriteVarint(buf, MVT_COMMAND(MVT_CMD_LINETO, n-1));
+      mvtWritePoints(&writer, xy+2, n-1);
+      type = MVT_GEOM_LINESTRING;
+    }
+  } else if(shape->type == MS_SHAPE_POLYGON) {
+    shapeObj rings;
+    lineObj ring;
+    int *outerlist, *innerlist;
+
+    /* snap the clipped rings first, the exterior/interior test needs the survivors */
+    msClipPolygonRect(shape, *cliprect);
+    msInitShape(&rings);
+    rings.type = MS_SHAPE_POLYGON;
+    for(i=0; i<shape->numlines; i++) {
+      n = mvtSnapLine(&(shape->line[i]), xy, MS_TRUE);
+      if(n < 3 || mvtRingArea(xy, n) == 0) continue;
+      ring.numpoints = n;
+      ring.point = (pointObj *)msSmallMalloc(sizeof(pointObj)*n);
+      for(j=0; j<n; j++) {
+        ring.point[j].x = xy[2*j];
+        ring.point[j].y = xy[2*j+1];
+#ifdef USE_POINT_Z_M
+        ring.point[j].z = ring.point[j].m = 0;
+#endif
+      }
+      msAddLineDirectly(&rings, &ring);
+    }
+
+    if(rings.numlines > 0) {
+      outerlist = msGetOuterList(&rings);
+      for(i=0; outerlist && i<rings.numlines; i++) {
+        if(outerlist[i] != MS_TRUE) continue;
+        n = rings.line[i].numpoints;
+        for(j=0; j<n; j++) {
+          xy[2*j] = (int)rings.line[i].point[j].x;
+          xy[2*j+1] = (int)rings.line[i].point[j].y;
+        }
+        mvtWriteRing(&writer, xy, n, MS_TRUE);
+
+        innerlist = msGetInnerList(&rings, i, outerlist);
+        for(j=0; innerlist && j<rings.numlines; j++) {
+          int k;
+          if(innerlist[j] != MS_TRUE) continue;
+          n = rings.line[j].numpoints;
+          for(k=0; k<n; k++) {
+            xy[2*k] = (int)rings.line[j].point[k].x;
+            xy[2*k+1] = (int)rings.line[j].point[k].y;
+          }
+          mvtWriteRing(&writer, xy, n, MS_FALSE);
+        }
+        msFree(innerlist);
+        type = MVT_GEOM_POLYGON;
+      }
+      msFree(outerlist);
+    }
+    msFreeShape(&rings);
+  }
+
+  free(xy);
+  return type;
+}
+
+/************************************************************************/
+/*                           mvtWriteLayer()                            */
+/*                                                                      */
+/*      Append one layer to the tile. Layers without any feature in     */
+/*      the tile are not written.                                       */
+/************************************************************************/
+
+typedef struct {
+  rectObj extent;    /* edge to edge map extent covered by the tile */
+  int tileextent;    /* tile units across the tile */
+  int buffer;        /* tile units kept outside the tile edge */
+  bufferObj layer;   /* scratch buffers, reused between layers/features */
+  bufferObj keys;
+  bufferObj features;
+  bufferObj feature;
+  bufferObj geometry;
+  bufferObj tags;
+  bufferObj value;
+} mvtContext;
+
+static int mvtWriteLayer(mapObj *map, layerObj *layer, mvtContext *ctx, bufferObj *tile)
+{
+  int status, i, j, type;
+  int nitems = 0, *itemindexes = NULL;
+  int nclasses = 0, *classgroup = NULL;
+  int maxfeatures, numfeatures = 0;
+  const char *include_items;
+  double sx, sy, ox, oy;
+  rectObj searchrect, cliprect;
+  shapeObj shape;
+  mvtValueDict values;
+
+  /* open this layer */
+  status = msLayerOpen(layer);
+  if(status != MS_SUCCESS) return MS_FAILURE;
+
+  /* build item list, the attributes we write plus what the classes need */
+  include_items = msLookupHashTable(&(layer->metadata), "mvt_include_items");
+  if(include_items == NULL || strcasecmp(include_items, "all") == 0) {
+    status = msLayerWhichItems(layer, MS_TRUE, NULL);
+    if(status == MS_SUCCESS) {
+      nitems = layer->numitems;
+      itemindexes = (int *)msSmallMalloc(sizeof(int)*MS_MAX(nitems,1));
+      for(i=0; i<nitems; i++)
+        itemindexes[i] = i;
+    }
+  } else {
+    int ntokens = 0;
+    char *items = NULL;
+    char **tokens = msStringSplit(include_items, ',', &ntokens);
+
+    /* keep the items the layer has, spelled as the layer spells them */
+    status = msLayerGetItems(layer);
+    for(i=0; status == MS_SUCCESS && i<ntokens; i++) {
+      msStringTrim(tokens[i]);
+      for(j=0; j<layer->numitems; j++) {
+        if(strcasecmp(tokens[i], layer->items[j]) == 0) {
+          if(items) items = msStringConcatenate(items, ",");
+          items = msStringConcatenate(items, layer->items[j]);
+          break;
+        }
+      }
+    }
+    msFreeCharArray(tokens, ntokens);
+
+    if(status == MS_SUCCESS)
+      status = msLayerWhichItems(layer, MS_FALSE, items);
+    if(status == MS_SUCCESS && items) {
+      tokens = msStringSplit(items, ',', &ntokens);
+      itemindexes = (int *)msSmallMalloc(sizeof(int)*ntokens);
+      for(i=0; i<ntokens; i++) {
+        for(j=0; j<layer->numitems; j++) {
+          if(strcmp(tokens[i], layer->items[j]) == 0) {
+            itemindexes[nitems++] = j;
+            break;
+          }
+        }
+      }
+      msFreeCharArray(tokens, ntokens);
+    }
+    msFree(items);
+  }
+  if(status != MS_SUCCESS) {
+    msLayerClose(layer);
+    return MS_FAILURE;
+  }
+
+  /* the keys are the item names, encode them while the item list is around */
+  ctx->keys.size = 0;
+  for(i=0; i<nitems; i++) {
+    const char *key = layer->items[itemindexes[i]];
+    mvtWriteBytes(&ctx->keys, MVT_LAYER_KEYS, key, strlen(key));
+  }
+
+  /* transformation from layer coordinates to tile units */
+  if(layer->transform == MS_TRUE) {
+    sx = ctx->tileextent / (ctx->extent.maxx - ctx->extent.minx);
+    sy = ctx->tileextent / (ctx->extent.maxy - ctx->extent.miny);
+    ox = ctx->extent.minx;
+    oy = ctx->extent.maxy;
+    searchrect.minx = ctx->extent.minx - ctx->buffer / sx;
+    searchrect.maxx = ctx->extent.maxx + ctx->buffer / sx;
+    searchrect.miny = ctx->extent.miny - ctx->buffer / sy;
+    searchrect.maxy = ctx->extent.maxy + ctx->buffer / sy;
+#ifdef USE_PROJ
+    if((map->projection.numargs > 0) && (layer->projection.numargs > 0))
+      msProjectRect(&map->projection, &layer->projection, &searchrect); /* project the searchrect to source coords */
+#endif
+  } else {
+    /* pixel coordinates, y already points down */
+    sx = (double)ctx->tileextent / map->width;
+    sy = -(double)ctx->tileextent / map->height;
+    ox = oy = 0;
+    searchrect.minx = searchrect.miny = 0;
+    searchrect.maxx = map->width-1;
+    searchrect.maxy = map->height-1;
+  }
+  cliprect.minx = cliprect.miny = -ctx->buffer;
+  cliprect.maxx = cliprect.maxy = ctx->tileextent + ctx->buffer;
+
+  status = msLayerWhichShapes(layer, searchrect, MS_FALSE);
+  if(status == MS_DONE) { /* no overlap */
+    msLayerClose(layer);
+    free(itemindexes);
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    msLayerClose(layer);
+    free(itemindexes);
+    return MS_FAILURE;
+  }
+
+  if(layer->classgroup && layer->numclasses > 0)
+    classgroup = msAllocateValidClassGroups(layer, &nclasses);
+  maxfeatures = msLayerGetMaxFeaturesToDraw(layer, map->outputformat);
+
+  mvtInitValueDict(&values);
+  ctx->features.size = 0;
+  msInitShape(&shape);
+
+  while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+
+    shape.classindex = msShapeGetClass(layer, map, &shape, classgroup, nclasses);
+    if((shape.classindex == -1) || (layer->class[shape.classindex]->status == MS_OFF)) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    if(maxfeatures >= 0 && numfeatures >= maxfeatures) {
+      msFreeShape(&shape);
+      status = MS_DONE;
+      break;
+    }
+
+#ifdef USE_PROJ
+    if(layer->project && layer->transform == MS_TRUE && msProjectionsDiffer(&(layer->projection), &(map->projection)))
+      msProjectShape(&layer->projection, &map->projection, &shape);
+    else
+      layer->project = MS_FALSE;
+#endif
+
+    for(i=0; i<shape.numlines; i++) {
+      for(j=0; j<shape.line[i].numpoints; j++) {
+        shape.line[i].point[j].x = (shape.line[i].point[j].x - ox) * sx;
+        shape.line[i].point[j].y = (oy - shape.line[i].point[j].y) * sy;
+      }
+    }
+    msComputeBounds(&shape);
+
+    type = mvtEncodeGeometry(&shape, &cliprect, &ctx->geometry);
+    if(type == 0) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    ctx->tags.size = 0;
+    for(i=0; i<nitems; i++) {
+      const char *value;
+      if(itemindexes[i] >= shape.numvalues) continue;
+      value = shape.values[itemindexes[i]];
+      if(!value || !*value) continue;
+      mvtEncodeValue(&ctx->value, value);
+      mvtWriteVarint(&ctx->tags, i);
+      mvtWriteVarint(&ctx->tags, mvtValueDictIndex(&values, &ctx->value));
+    }
+
+    ctx->feature.size = 0;
+    if(shape.index >= 0) {
+      mvtWriteKey(&ctx->feature, MVT_FEATURE_ID, MVT_WIRE_VARINT);
+      mvtWriteVarint(&ctx->feature, shape.index);
+    }
+    if(ctx->tags.size > 0)
+      mvtWriteBytes(&ctx->feature, MVT_FEATURE_TAGS, ctx->tags.data, ctx->tags.size);
+    mvtWriteKey(&ctx->feature, MVT_FEATURE_TYPE, MVT_WIRE_VARINT);
+    mvtWriteVarint(&ctx->feature, type);
+    mvtWriteBytes(&ctx->feature, MVT_FEATURE_GEOMETRY, ctx->geometry.data, ctx->geometry.size);
+
+    mvtWriteBytes(&ctx->features, MVT_LAYER_FEATURES, ctx->feature.data, ctx->feature.size);
+    numfeatures++;
+
+    msFreeShape(&shape);
+  }
+
+  msLayerClose(layer);
+  msFree(classgroup);
+
+  if(status != MS_DONE) {
+    mvtFreeValueDict(&values);
+    free(itemindexes);
+    return MS_FAILURE;
+  }
+
+  if(numfeatures > 0) {
+    ctx->layer.size = 0;
+    mvtWriteKey(&ctx->layer, MVT_LAYER_VERSION, MVT_WIRE_VARINT);
+    mvtWriteVarint(&ctx->layer, 2);
+    mvtWriteBytes(&ctx->layer, MVT_LAYER_NAME, layer->name ? layer->name : "", layer->name ? strlen(layer->name) : 0);
+    msBufferAppend(&ctx->layer, ctx->features.data, ctx->features.size);
+    msBufferAppend(&ctx->layer, ctx->keys.data, ctx->keys.size);
+    for(i=0; i<values.numvalues; i++)
+      mvtWriteBytes(&ctx->layer, MVT_LAYER_VALUES, values.data.data + values.offsets[i],
+                    values.offsets[i+1] - values.offsets[i]);
+    mvtWriteKey(&ctx->layer, MVT_LAYER_EXTENT, MVT_WIRE_VARINT);
+    mvtWriteVarint(&ctx->layer, ctx->tileextent);
+
+    mvtWriteBytes(tile, MVT_TILE_LAYERS, ctx->layer.data, ctx->layer.size);
+  }
+
+  mvtFreeValueDict(&values);
+  free(itemindexes);
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                           msMVTWriteTile()                           */
+/*                                                                      */
+/*      Encode the visible vector layers of the map for the current     */
+/*      extent and write the tile to stdout.                            */
+/************************************************************************/
+
+int msMVTWriteTile(mapObj *map, int sendheaders)
+{
+  int i, status = MS_SUCCESS;
+  mvtContext ctx;
+  bufferObj tile;
+
+  if(map->width <= 0 || map->height <= 0) {
+    msSetError(MS_MISCERR, "Image dimensions not specified.", "msMVTWriteTile()");
+    return MS_FAILURE;
+  }
+
+  status = msValidateContexts(map); /* make sure there are no recursive REQUIRES or LABELREQUIRES expressions */
+  if(status != MS_SUCCESS) return MS_FAILURE;
+
+  map->cellsize = msAdjustExtent(&(map->extent), map->width, map->height);
+  status = msCalculateScale(map->extent, map->units, map->width, map->height, map->resolution, &map->scaledenom);
+  if(status != MS_SUCCESS) return MS_FAILURE;
+
+  ctx.tileextent = atoi(msGetOutputFormatOption(map->outputformat, "EXTENT", "4096"));
+  ctx.buffer = atoi(msGetOutputFormatOption(map->outputformat, "BUFFER", "16"));
+  if(ctx.tileextent <= 0)
+    ctx.tileextent = MVT_DEFAULT_EXTENT;
+  if(ctx.buffer < 0)
+    ctx.buffer = MVT_DEFAULT_BUFFER;
+
+  /* the map extent is from pixel center to pixel center, the tile covers whole pixels */
+  ctx.extent.minx = map->extent.minx - map->cellsize*0.5;
+  ctx.extent.maxx = map->extent.maxx + map->cellsize*0.5;
+  ctx.extent.miny = map->extent.miny - map->cellsize*0.5;
+  ctx.extent.maxy = map->extent.maxy + map->cellsize*0.5;
+
+  msBufferInit(&ctx.layer);
+  msBufferInit(&ctx.keys);
+  msBufferInit(&ctx.features);
+  msBufferInit(&ctx.feature);
+  msBufferInit(&ctx.geometry);
+  msBufferInit(&ctx.tags);
+  msBufferInit(&ctx.value);
+  msBufferInit(&tile);
+
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *lp = GET_LAYER(map, map->layerorder[i]);
+
+    if(lp->type != MS_LAYER_POINT && lp->type != MS_LAYER_LINE &&
+        lp->type != MS_LAYER_POLYGON && lp->type != MS_LAYER_ANNOTATION)
+      continue;
+    if(!msLayerIsVisible(map, lp))
+      continue;
+
+    if(mvtWriteLayer(map, lp, &ctx, &tile) != MS_SUCCESS) {
+      status = MS_FAILURE;
+      break;
+    }
+  }
+
+  if(status == MS_SUCCESS) {
+    if(sendheaders) {
+      msIO_setHeader("Content-Type", MS_IMAGE_MIME_TYPE(map->outputformat));
+      msIO_sendHeaders();
+    }
+    if(tile.size > 0)
+      msIO_fwrite(tile.data, 1, tile.size, stdout);
+  }
+
+  msBufferFree(&ctx.layer);
+  msBufferFree(&ctx.keys);
+  msBufferFree(&ctx.features);
+  msBufferFree(&ctx.feature);
+  msBufferFree(&ctx.geometry);
+  msBufferFree(&ctx.tags);
+  msBufferFree(&ctx.value);
+  msBufferFree(&tile);
+
+  return status;
+}
+
+/************************************************************************/
+/*                     msPopulateRendererVTableMVT()                    */
+/************************************************************************/
+
+int msPopulateRendererVTableMVT( rendererVTableObj *renderer )
+{
+  /* like OGR output we aren't really a normal renderer, leave everything default */
+  return MS_SUCCESS;
+}
@@ -493,8 +493,66 @@ int FLTIsSimpleFilterNoSpatial(FilterEncodingNode *psNode)
 
 
 
+/************************************************************************/
+/*                          FLTHasTopLevelBBOX                          */
+/*                                                                      */
+/*      A single BBOX, alone or under the top level AND, that can be    */
+/*      used as the query rectangle.                                    */
+/************************************************************************/
+static int FLTHasTopLevelBBOX(FilterEncodingNode *psNode)
+{
+  return (FLTNumberOfFilterType(psNode, "BBOX") == 1 &&
+          FLTValidForBBoxFilter(psNode));
+}
+
+/************************************************************************/
+/*                          FLTGetSQLFilterNode                         */
+/*                                                                      */
+/*      The part of the filter left to the SQL expression once the      */
+/*      top level BBOX went to the query rectangle. NULL if nothing is  */
+/*      left.                                                           */
+/************************************************************************/
+static FilterEncodingNode *FLTGetSQLFilterNode(FilterEncodingNode *psNode)
+{
+  if (!psNode || !FLTHasTopLevelBBOX(psNode))
+    return psNode;
+
+  if (strcasecmp(psNode->pszValue, "BBOX") == 0)
+    return NULL;
+
+  if (strcasecmp(psNode->psLeftNode->pszValue, "BBOX") == 0)
+    return psNode->psRightNode;
+  return psNode->psLeftNode;
+}
+
+/************************************************************************/
+/*                          FLTIsSQLFilter                              */
+/*                                                                      */
+/*      Can the database do all the filtering: every node, spatial      */
+/*      operators included, has a translation for this layer.          */
+/************************************************************************/
+static int FLTIsSQLFilter(FilterEncodingNode *psNode, layerObj *lp)
+{
+  FilterEncodingNode *psSQLNode = FLTGetSQLFilterNode(psNode);
+  char *pszExpression;
+
+  if (psSQLNode == NULL)
+    return MS_TRUE;
+
+  pszExpression = FLTGetSQLExpression(psSQLNode, lp);
+  if (pszExpression == NULL)
+    return MS_FALSE;
+
+  msFree(pszExpression);
+  return MS_TRUE;
+}
+
 /************************************************************************/
 /*                      FLTApplySimpleSQLFilter()                       */
+/*                                                                      */
+/*      Sets the filter of the layer to the SQL translation of the      */
+/*      filter encoding and runs the query, with the top level BBOX if  */
+/*      any as query rectangle.                                         */
 /************************************************************************/
 
 int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
@@ -513,11 +571,14 @@ int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
   char *pszTmp = NULL, *pszTmp2 = NULL;
   size_t bufferSize = 0;
   char *tmpfilename = NULL;
+  FilterEncodingNode *psSQLNode = NULL;
 
   lp = (GET_LAYER(map, iLayerIndex));
 
-  /* if there is a bbox use it */
-  szEPSG = FLTGetBBOX(psNode, &sQueryRect);
+  /* if there is a bbox use it, bboxes nested in the filter are part of the SQL */
+  if (FLTHasTopLevelBBOX(psNode))
+    szEPSG = FLTGetBBOX(psNode, &sQueryRect);
+  psSQLNode = FLTGetSQLFilterNode(psNode);
   if(szEPSG && map->projection.numargs > 0) {
 #ifdef USE_PROJ
     nTokens = 0;
@@ -574,7 +635,7 @@ int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
   bHasAWhere = 0;
   if (lp->connectiontype == MS_POSTGIS || lp->connectiontype ==  MS_ORACLESPATIAL ||
       lp->connectiontype == MS_SDE || lp->connectiontype == MS_PLUGIN) {
-    szExpression = FLTGetSQLExpression(psNode, lp);
+    szExpression = FLTGetSQLExpression(psSQLNode, lp);
     if (szExpression) {
       pszTmp = msStrdup("(");
       pszTmp = msStringConcatenate(pszTmp, szExpression);
@@ -590,11 +651,11 @@ int FLTApplySimpleSQLFilter(FilterEncodingNode *psNode, mapObj *map,
      type expression*/
   else if (lp->connectiontype == MS_OGR) {
     if (lp->filter.type != MS_EXPRESSION) {
-      szExpression = FLTGetSQLExpression(psNode, lp);
+      szExpression = FLTGetSQLExpression(psSQLNode, lp);
       bConcatWhere = 1;
     } else {
       if (lp->filter.string && EQUALN(lp->filter.string,"WHERE ",6)) {
-        szExpression = FLTGetSQLExpression(psNode, lp);
+        szExpression = FLTGetSQLExpression(psSQLNode, lp);
         bHasAWhere = 1;
         bConcatWhere =1;
       } else {
@@ -761,6 +822,15 @@ int FLTLayerApplyCondSQLFilterToLayer(FilterEncodingNode *psNode, mapObj *map,
     return FLTApplySimpleSQLFilter(psNode, map, iLayerIndex);
   }
 
+  /* ==================================================================== */
+  /*      Mixed spatial and attribute filters also go to the database    */
+  /*      when the driver can translate every spatial operator, instead  */
+  /*      of fetching all the features in the map extent.                 */
+  /* ==================================================================== */
+  if (FLTIsSQLFilter(psNode, GET_LAYER(map, iLayerIndex))) {
+    return FLTApplySimpleSQLFilter(psNode, map, iLayerIndex);
+  }
+
   return FLTLayerApplyPlainFilterToLayer(psNode, map, iLayerIndex);
 }
 
@@ -779,7 +849,7 @@ int FLTLayerApplyPlainFilterToLayer(FilterEncodingNode *psNode, mapObj *map,
   if(map->debug == MS_DEBUGLEVEL_VVV)
     msDebug("FLTLayerApplyPlainFilterToLayer(): %s\n", pszExpression);
   if (pszExpression) {
-    status = FLTApplyFilterToLayerCommonExpression(map, iLayerIndex, pszExpression);
+    status = FLTApplyFilterToLayerCommonExpression(psNode, map, iLayerIndex, pszExpression);
     msFree(pszExpression);
   }
 
@@ -2132,7 +2202,7 @@ char *FLTGetSQLExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
   }
 
   else if (psFilterNode->eType == FILTER_NODE_TYPE_SPATIAL) {
-    /* TODO */
+    pszExpression = FLTGetSpatialComparisonSQLExpression(psFilterNode, lp);
   } else if (psFilterNode->eType == FILTER_NODE_TYPE_FEATUREID) {
 #if defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR) || defined(USE_SOS_SVR)
     if (psFilterNode->pszValue) {
@@ -2226,28 +2296,11 @@ char *FLTGetLogicalComparisonSQLExpresssion(FilterEncodingNode *psFilterNode,
   if (lp == NULL)
     return NULL;
 
-  /* ==================================================================== */
-  /*      special case for BBOX node.                                     */
-  /* ==================================================================== */
-  if (psFilterNode->psLeftNode && psFilterNode->psRightNode &&
-      ((strcasecmp(psFilterNode->psLeftNode->pszValue, "BBOX") == 0) ||
-       (strcasecmp(psFilterNode->psRightNode->pszValue, "BBOX") == 0))) {
-    if (strcasecmp(psFilterNode->psLeftNode->pszValue, "BBOX") != 0)
-      pszTmp = FLTGetSQLExpression(psFilterNode->psLeftNode, lp);
-    else
-      pszTmp = FLTGetSQLExpression(psFilterNode->psRightNode, lp);
-
-    if (!pszTmp)
-      return NULL;
-
-    pszBuffer = (char *)malloc(sizeof(char) * (strlen(pszTmp) + 1));
-    sprintf(pszBuffer, "%s", pszTmp);
-  }
-
   /* -------------------------------------------------------------------- */
-  /*      OR and AND                                                      */
+  /*      OR and AND. A top level BBOX never gets here, it is the query   */
+  /*      rectangle (see FLTGetSQLFilterNode), the others are SQL too.    */
   /* -------------------------------------------------------------------- */
-  else if (psFilterNode->psLeftNode && psFilterNode->psRightNode) {
+  if (psFilterNode->psLeftNode && psFilterNode->psRightNode) {
     pszTmp = FLTGetSQLExpression(psFilterNode->psLeftNode, lp);
     if (!pszTmp)
       return NULL;
@@ -2266,8 +2319,10 @@ char *FLTGetLogicalComparisonSQLExpresssion(FilterEncodingNode *psFilterNode,
 
     nTmp = strlen(pszBuffer);
     pszTmp = FLTGetSQLExpression(psFilterNode->psRightNode, lp);
-    if (!pszTmp)
+    if (!pszTmp) {
+      free(pszBuffer);
       return NULL;
+    }
 
     pszBuffer = (char *)realloc(pszBuffer,
                                 sizeof(char) * (strlen(pszTmp) + nTmp +3));
@@ -3015,6 +3070,10 @@ char *FLTGetIsLikeComparisonSQLExpression(FilterEncodingNode *psFilterNode,
       } else if (c == '\\') {
         pszEscapedStr[j++] = '\\';
         pszEscapedStr[j++] = '\\';
+      } else if ((c == '%' || c == '_') && lp->connectiontype != MS_OGR) {
+        /* a plain % or _ of the filter, not an SQL wildcard */
+        pszEscapedStr[j++] = pszEscape[0];
+        pszEscapedStr[j++] = c;
       } else
         pszEscapedStr[j++] = c;
     } else if  (c == pszSingle[0]) {
@@ -3027,6 +3086,9 @@ char *FLTGetIsLikeComparisonSQLExpression(FilterEncodingNode *psFilterNode,
         if (nextC == '\'') {
           pszEscapedStr[j++] = '\'';
           pszEscapedStr[j++] = '\'';
+        } else if (nextC == '\\') {
+          pszEscapedStr[j++] = '\\';
+          pszEscapedStr[j++] = '\\';
         } else
           pszEscapedStr[j++] = nextC;
       }
@@ -3058,6 +3120,70 @@ char *FLTGetIsLikeComparisonSQLExpression(FilterEncodingNode *psFilterNode,
   return msStrdup(szBuffer);
 }
 
+/************************************************************************/
+/*                    FLTGetSpatialComparisonSQLExpression              */
+/*                                                                      */
+/*      Build an sql expression for a spatial filter (BBOX, Intersects, */
+/*      DWithin...) through the layer driver. The geometry is projected */
+/*      to the layer projection and the distance converted to its       */
+/*      units. NULL if the driver cannot translate the operator.        */
+/************************************************************************/
+char *FLTGetSpatialComparisonSQLExpression(FilterEncodingNode *psFilterNode,
+    layerObj *lp)
+{
+  char *pszExpression = NULL;
+  char *pszSRS = NULL;
+  shapeObj sShape, *psQueryShape = NULL;
+  rectObj sQueryRect;
+  projectionObj sProjTmp;
+  double dfDistance = -1;
+  int nUnit = -1, nLayerUnit = -1;
+
+  if (!psFilterNode || !lp || psFilterNode->eType != FILTER_NODE_TYPE_SPATIAL ||
+      !psFilterNode->pszValue)
+    return NULL;
+
+  msInitShape(&sShape);
+  if (FLTIsBBoxFilter(psFilterNode)) {
+    sQueryRect.minx = sQueryRect.miny = 1;
+    sQueryRect.maxx = sQueryRect.maxy = -1;
+    pszSRS = FLTGetBBOX(psFilterNode, &sQueryRect);
+    if (sQueryRect.minx > sQueryRect.maxx || sQueryRect.miny > sQueryRect.maxy)
+      return NULL;
+    msRectToPolygon(sQueryRect, &sShape);
+  } else {
+    psQueryShape = FLTGetShape(psFilterNode, &dfDistance, &nUnit);
+    if (!psQueryShape)
+      return NULL;
+    /* the shape belongs to the node, project a copy */
+    msCopyShape(psQueryShape, &sShape);
+    pszSRS = psFilterNode->pszSRS;
+  }
+
+  /* the distance is compared in the units of the layer geometry */
+  if (dfDistance > 0 && nUnit >= 0) {
+    nLayerUnit = lp->map->units;
+    if (lp->projection.numargs > 0 && GetMapserverUnitUsingProj(&lp->projection) >= 0)
+      nLayerUnit = GetMapserverUnitUsingProj(&lp->projection);
+    if (nUnit != nLayerUnit)
+      dfDistance *= msInchesPerUnit(nUnit,0)/msInchesPerUnit(nLayerUnit,0);
+  }
+
+  /* same as FLTGetSpatialComparisonCommonExpression: without srs the map projection is assumed */
+  if (lp->projection.numargs > 0) {
+    if (pszSRS && FLTParseEpsgString(pszSRS, &sProjTmp)) {
+      msProjectShape(&sProjTmp, &lp->projection, &sShape);
+      msFreeProjection(&sProjTmp);
+    } else if (lp->map->projection.numargs > 0)
+      msProjectShape(&lp->map->projection, &lp->projection, &sShape);
+  }
+
+  pszExpression = msLayerBuildSQLSpatialFilter(lp, psFilterNode->pszValue, &sShape, dfDistance);
+  msFreeShape(&sShape);
+
+  return pszExpression;
+}
+
 /************************************************************************/
 /*                           FLTHasSpatialFilter                        */
 /*                                                                      */
@@ -675,7 +675,50 @@ char *FLTGetCommonExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
 }
 
 
-int FLTApplyFilterToLayerCommonExpression(mapObj *map, int iLayerIndex, char *pszExpression)
+/************************************************************************/
+/*                        FLTGetCommonQueryRect                         */
+/*                                                                      */
+/*      The map extent, narrowed to the BBOX of the filter when every   */
+/*      result has to intersect it (the BBOX is alone or under the top  */
+/*      level AND). The rect is in the map projection, or in the layer  */
+/*      coordinates if the layer is not projected, the same as the      */
+/*      shape FLTGetSpatialComparisonCommonExpression compares with.    */
+/************************************************************************/
+static rectObj FLTGetCommonQueryRect(FilterEncodingNode *psFilterNode, mapObj *map, layerObj *lp)
+{
+  rectObj sQueryRect;
+  projectionObj sProjTmp;
+  char *pszEPSG = NULL;
+
+  if (psFilterNode == NULL || FLTNumberOfFilterType(psFilterNode, "BBOX") != 1 ||
+      !FLTValidForBBoxFilter(psFilterNode))
+    return map->extent;
+
+  sQueryRect.minx = sQueryRect.miny = 1;
+  sQueryRect.maxx = sQueryRect.maxy = -1;
+  pszEPSG = FLTGetBBOX(psFilterNode, &sQueryRect);
+  if (sQueryRect.minx > sQueryRect.maxx || sQueryRect.miny > sQueryRect.maxy)
+    return map->extent;
+
+  if (lp->projection.numargs > 0 && pszEPSG && FTLParseEpsgString(pszEPSG, &sProjTmp)) {
+    if (map->projection.numargs == 0) {
+      /* the layer is queried with the rect as is, not in the BBOX srs */
+      msFreeProjection(&sProjTmp);
+      return map->extent;
+    }
+    msProjectRect(&sProjTmp, &map->projection, &sQueryRect);
+    msFreeProjection(&sProjTmp);
+  }
+
+  /* never more candidates than the map extent alone would give */
+  if (!msRectOverlap(&sQueryRect, &map->extent))
+    return map->extent;
+  msRectIntersect(&sQueryRect, &map->extent);
+
+  return sQueryRect;
+}
+
+int FLTApplyFilterToLayerCommonExpression(FilterEncodingNode *psFilterNode, mapObj *map, int iLayerIndex, char *pszExpression)
 {
   int retval;
 
@@ -689,8 +732,8 @@ int FLTApplyFilterToLayerCommonExpression(mapObj *map, int iLayerIndex, char *ps
   map->query.filter->type = 2000;
   map->query.layer = iLayerIndex;
 
-  /*TODO: if there is a bbox in the node, get it and set the map extent*/
-  map->query.rect = map->extent;
+  /* only the shapes near the bbox are read, through the spatial index */
+  map->query.rect = FLTGetCommonQueryRect(psFilterNode, map, GET_LAYER(map, iLayerIndex));
 
   retval = msQueryByFilter(map);
 
@@ -478,26 +478,52 @@ static int msOGRWriteShape( layerObj *map_layer, OGRLayerH hOGRLayer,
     return MS_FAILURE;
 }
 
-#endif /* def USE_OGR */
+/************************************************************************/
+/*                        msOGRDataSourceSize()                         */
+/*                                                                      */
+/*      Total size of the files written so far in the directory of      */
+/*      the datasource.                                                 */
+/************************************************************************/
+
+static double msOGRDataSourceSize( const char *datasource_name )
+
+{
+  char **file_list;
+  double size = 0;
+  int i;
+
+  file_list = msOGRRecursiveFileList( CPLGetPath( datasource_name ) );
+
+  for( i = 0; file_list != NULL && file_list[i] != NULL; i++ ) {
+    VSIStatBufL  sStatBuf;
+
+    if( VSIStatL( file_list[i], &sStatBuf ) == 0 )
+      size += sStatBuf.st_size;
+  }
+
+  CSLDestroy( file_list );
+
+  return size;
+}
 
 /************************************************************************/
-/*                        msOGRWriteFromQuery()                         */
+/*                     msOGRWriteFromQueryStorage()                     */
+/*                                                                      */
+/*      Write the query results with the given STORAGE. If max_memory   */
+/*      is not negative and the files written get larger, everything    */
+/*      is removed and MS_DONE returned before anything is sent.        */
 /************************************************************************/
 
-int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
+static int msOGRWriteFromQueryStorage( mapObj *map, outputFormatObj *format,
+                                       int sendheaders, const char *storage,
+                                       double max_memory )
 
 {
-#ifndef USE_OGR
-  msSetError(MS_OGRERR, "OGR support is not available.",
-             "msOGRWriteFromQuery()");
-  return MS_FAILURE;
-#else
   /* -------------------------------------------------------------------- */
   /*      Variable declarations.                                          */
   /* -------------------------------------------------------------------- */
   OGRSFDriverH hDriver;
   OGRDataSourceH hDS;
-  const char *storage;
   const char *fo_filename;
   const char *form;
   char datasource_name[MS_MAXPATHLEN];
@@ -506,7 +532,7 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   char **ds_options = NULL;
   char **layer_options = NULL;
   char **file_list = NULL;
-  int iLayer, i;
+  int iLayer, i, nWritten = 0;
 
   /* -------------------------------------------------------------------- */
   /*      Fetch the output format driver.                                 */
@@ -532,11 +558,6 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
                                  format->formatoptions[i] + 5 );
   }
 
-  /* ==================================================================== */
-  /*      Determine the output datasource name to use.                    */
-  /* ==================================================================== */
-  storage = msGetOutputFormatOption( format, "STORAGE", "filesystem" );
-
   /* -------------------------------------------------------------------- */
   /*      Where are we putting stuff?                                     */
   /* -------------------------------------------------------------------- */
@@ -876,6 +897,19 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
         msOGRCleanupDS( datasource_name );
         return status;
       }
+
+      /*
+      ** Too large to be kept in memory? Let the caller start over.
+      */
+      if( max_memory >= 0 && (++nWritten % 100) == 0
+          && msOGRDataSourceSize( datasource_name ) > max_memory ) {
+        msGMLFreeItems(item_list);
+        msFreeShape(&resultshape);
+        OGR_DS_Destroy( hDS );
+        msOGRCleanupDS( datasource_name );
+        CSLDestroy( layer_options );
+        return MS_DONE;
+      }
     }
 
     msGMLFreeItems(item_list);
@@ -887,6 +921,18 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   /* -------------------------------------------------------------------- */
   OGR_DS_Destroy( hDS );
 
+  /* -------------------------------------------------------------------- */
+  /*      Closing flushes what the driver still buffered (indexes,        */
+  /*      headers), and fewer than 100 features were never checked:      */
+  /*      check the final size before anything is sent.                   */
+  /* -------------------------------------------------------------------- */
+  if( max_memory >= 0
+      && msOGRDataSourceSize( datasource_name ) > max_memory ) {
+    msOGRCleanupDS( datasource_name );
+    CSLDestroy( layer_options );
+    return MS_DONE;
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Get list of resulting files.                                    */
   /* -------------------------------------------------------------------- */
@@ -1050,6 +1096,7 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
       msIO_fwrite( buffer, 1, bytes_read, stdout );
     VSIFCloseL( fp );
 
+    VSIUnlink( zip_filename );
     msFree( zip_filename );
 #endif /* defined(CPL_ZIP_API_OFFERED) */
   }
@@ -1070,6 +1117,47 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   CSLDestroy( file_list );
 
   return MS_SUCCESS;
+}
+
+#endif /* def USE_OGR */
+
+/************************************************************************/
+/*                        msOGRWriteFromQuery()                         */
+/*                                                                      */
+/*      Without STORAGE format option, the datasource is written in     */
+/*      memory unless it gets larger than msTmpMemoryMaxSize(), in      */
+/*      which case it is written again in the temporary directory.      */
+/************************************************************************/
+
+int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
+
+{
+#ifndef USE_OGR
+  msSetError(MS_OGRERR, "OGR support is not available.",
+             "msOGRWriteFromQuery()");
+  return MS_FAILURE;
+#else
+  const char *storage;
+  double max_memory;
+  int status;
+
+  storage = msGetOutputFormatOption( format, "STORAGE", NULL );
+  if( storage != NULL )
+    return msOGRWriteFromQueryStorage( map, format, sendheaders, storage, -1 );
+
+  max_memory = msTmpMemoryMaxSize( map );
+  if( max_memory > 0 ) {
+    status = msOGRWriteFromQueryStorage( map, format, sendheaders, "memory",
+                                         max_memory );
+    if( status != MS_DONE )
+      return status;
+
+    if( map->debug )
+      msDebug( "msOGRWriteFromQuery(): result larger than %.0f bytes, "
+               "writing it to disk.\n", max_memory );
+  }
+
+  return msOGRWriteFromQueryStorage( map, format, sendheaders, "filesystem", -1 );
 #endif /* def USE_OGR */
 }
 
@@ -116,6 +116,9 @@ struct defaultOutputFormatEntry defaultoutputformats[] = {
   {"kml","KML","application/vnd.google-earth.kml+xml"},
   {"kmz","KMZ","application/vnd.google-earth.kmz"},
 #endif
+  {"mvt","MVT","application/x-protobuf"},
+  {"geojson","GEOJSON","application/json; subtype=geojson"},
+  {"utfgrid","UTFGRID","application/json"},
   {NULL,NULL,NULL}
 };
 
@@ -346,6 +349,33 @@ outputFormatObj *msCreateDefaultOutputFormat( mapObj *map,
     format->renderer = MS_RENDER_WITH_IMAGEMAP;
   }
 
+  if( strcasecmp(driver,"MVT") == 0 ) {
+    if(!name) name="mvt";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("application/x-protobuf");
+    format->extension = msStrdup("pbf");
+    format->imagemode = MS_IMAGEMODE_FEATURE;
+    format->renderer = MS_RENDER_WITH_MVT;
+  }
+
+  if( strcasecmp(driver,"GEOJSON") == 0 ) {
+    if(!name) name="geojson";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("application/json; subtype=geojson");
+    format->extension = msStrdup("json");
+    format->imagemode = MS_IMAGEMODE_FEATURE;
+    format->renderer = MS_RENDER_WITH_GEOJSON;
+  }
+
+  if( strcasecmp(driver,"UTFGRID") == 0 ) {
+    if(!name) name="utfgrid";
+    format = msAllocOutputFormat( map, name, driver );
+    format->mimetype = msStrdup("application/json");
+    format->extension = msStrdup("json");
+    format->imagemode = MS_IMAGEMODE_RGB;
+    format->renderer = MS_RENDER_WITH_UTFGRID;
+  }
+
   if( strcasecmp(driver,"template") == 0 ) {
     if(!name) name="template";
     format = msAllocOutputFormat( map, name, driver );
@@ -1077,6 +1107,12 @@ int msInitializeRendererVTable(outputFormatObj *format)
     case MS_RENDER_WITH_OGR:
       return msPopulateRendererVTableOGR(format->vtable);
 #endif
+    case MS_RENDER_WITH_MVT:
+      return msPopulateRendererVTableMVT(format->vtable);
+    case MS_RENDER_WITH_GEOJSON:
+      return msPopulateRendererVTableGeoJSON(format->vtable);
+    case MS_RENDER_WITH_UTFGRID:
+      return msPopulateRendererVTableUTFGrid(format->vtable);
     default:
       msSetError(MS_MISCERR, "unsupported RendererVtable renderer %d",
                  "msInitializeRendererVTable()",format->renderer);
@@ -211,6 +211,7 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
 {
   int status = MS_DONE, force_ows_mode = 0;
   owsRequestObj ows_request;
+  void *cache_capture = NULL;
 
   if (!request) {
     return status;
@@ -238,6 +239,13 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
     } else {
       status = MS_DONE;
     }
+  } else if (ows_request.request && EQUAL(ows_request.request, "GetCapabilities") &&
+             msOWSCapabilitiesCacheBegin(map, request, ows_request.service, &cache_capture)) {
+    status = MS_SUCCESS; /* served from the cache */
+  } else if (ows_request.request && EQUAL(ows_request.request, "GetLegendGraphic") &&
+             EQUAL(ows_request.service, "WMS") &&
+             msOWSLegendGraphicCacheBegin(map, request, &cache_capture)) {
+    status = MS_SUCCESS; /* served from the cache */
   } else if (EQUAL(ows_request.service, "WMS")) {
 #ifdef USE_WMS_SVR
     status = msWMSDispatch(map, request, &ows_request, MS_FALSE);
@@ -277,6 +285,8 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
     status = MS_FAILURE;
   }
 
+  msOWSCacheEnd(map, cache_capture, status);
+
   msOWSClearRequestObj(&ows_request);
   return status;
 }
@@ -115,6 +115,14 @@ typedef struct {
 
 MS_DLL_EXPORT int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode);
 
+/* mapowscache.c */
+MS_DLL_EXPORT int msOWSCapabilitiesCacheBegin(mapObj *map, cgiRequestObj *request,
+    const char *service, void **capture);
+MS_DLL_EXPORT int msOWSLegendGraphicCacheBegin(mapObj *map, cgiRequestObj *request,
+    void **capture);
+MS_DLL_EXPORT void msOWSCacheEnd(mapObj *map, void *capture, int status);
+MS_DLL_EXPORT void msOWSCacheCleanup(void);
+
 MS_DLL_EXPORT const char * msOWSLookupMetadata(hashTableObj *metadata,
     const char *namespaces, const char *name);
 MS_DLL_EXPORT const char * msOWSLookupMetadataWithLanguage(hashTableObj *metadata,
@@ -388,6 +396,7 @@ MS_DLL_EXPORT int msGMLWriteQuery(mapObj *map, char *filename, const char *names
 
 #ifdef USE_WFS_SVR
 MS_DLL_EXPORT int msGMLWriteWFSQuery(mapObj *map, FILE *stream, char *wfs_namespace, int outputformat);
+MS_DLL_EXPORT int msGMLWriteWFSQueryStream(mapObj *map, FILE *stream, char *wfs_namespace, int outputformat, int *numfeatures);
 #endif
 
 
@@ -0,0 +1,680 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Cache of generated OWS GetCapabilities and GetLegendGraphic
+ *           responses
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** GetCapabilities documents of large mapfiles take a long time to build and
+** only change when the mapfile does. When the "capabilities_cache" metadata
+** (ows_, wms_, wfs_, wcs_ or sos_ prefixed) is "true" the complete response
+** is kept in a small process-wide cache, keyed on the service, the mapfile,
+** the online resource and the request parameters (which carry the version,
+** language, updatesequence and any runtime substitution). An entry is
+** dropped as soon as the mapfile or one of its INCLUDEd files has a new
+** modification time or size.
+**
+** With "capabilities_cache_path" set to a directory the responses are also
+** written there so that a restarted server (or a plain CGI) can serve them
+** without generating them again.
+**
+** WMS GetLegendGraphic responses are cached the same way with the
+** "legend_cache" and "legend_cache_path" metadata (wms_ or ows_ prefixed).
+** The request parameters (layer, style, rule, scale, size, format and
+** SLD_BODY) are part of the key, the symbolset and fontset files are
+** dependencies along with the mapfile. Requests referencing an external
+** SLD document are not cached since its changes could not be seen.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
+
+#include "mapserver.h"
+#include "mapthread.h"
+
+#define OWS_CAPCACHE_SIZE 16
+#define OWS_LEGENDCACHE_SIZE 64
+#define OWS_CAPCACHE_MAX_DEPENDENCIES 64
+#define OWS_CAPCACHE_MAX_INCLUDE_DEPTH 5 /* same as the lexer */
+#define OWS_CAPCACHE_SIGNATURE "MSCAPCACHE 1\n"
+
+typedef struct {
+  char *path;
+  long mtime;
+  long size;
+} owsCapCacheDependency;
+
+typedef struct {
+  char *key;
+  int numdependencies;
+  owsCapCacheDependency *dependencies;
+  unsigned char *data; /* the full response, headers included */
+  int size;
+} owsCapCacheEntry;
+
+typedef struct {
+  const char *name; /* metadata and file name prefix */
+  int numentries;
+  owsCapCacheEntry *entries;
+  int next; /* entry to replace when full */
+} owsCapCache;
+
+typedef struct {
+  owsCapCache *cache;
+  owsCapCacheEntry entry; /* what is being generated */
+  char *path; /* file to persist it to, or NULL */
+  msIOContext forward; /* the stdout context in place before */
+  bufferObj data;
+} owsCapCacheCapture;
+
+static owsCapCacheEntry capcache_entries[OWS_CAPCACHE_SIZE];
+static owsCapCacheEntry legendcache_entries[OWS_LEGENDCACHE_SIZE];
+static owsCapCache capcache = {"capabilities", OWS_CAPCACHE_SIZE, capcache_entries, 0};
+static owsCapCache legendcache = {"legend", OWS_LEGENDCACHE_SIZE, legendcache_entries, 0};
+
+static void owsCapCacheFreeEntry(owsCapCacheEntry *entry)
+{
+  int i;
+
+  for(i=0; i<entry->numdependencies; i++)
+    msFree(entry->dependencies[i].path);
+  msFree(entry->dependencies);
+  msFree(entry->key);
+  msFree(entry->data);
+  memset(entry, 0, sizeof(owsCapCacheEntry));
+}
+
+/*
+** Namespaces to look the cache metadata up in, NULL for services we do not
+** know about.
+*/
+static const char *owsCapCacheNamespaces(const char *service)
+{
+  if(EQUAL(service, "WMS")) return "MO";
+  if(EQUAL(service, "WFS")) return "FO";
+  if(EQUAL(service, "WCS")) return "CO";
+  if(EQUAL(service, "SOS")) return "SO";
+  return NULL;
+}
+
+/************************************************************************/
+/*                      Cache key and dependencies                      */
+/************************************************************************/
+
+static void owsCapCacheAppendKey(bufferObj *key, const char *name, const char *value)
+{
+  msBufferAppend(key, (void *)name, strlen(name));
+  msBufferAppend(key, "=", 1);
+  if(value)
+    msBufferAppend(key, (void *)value, strlen(value));
+  msBufferAppend(key, "\n", 1);
+}
+
+static int owsCapCacheHasIpLists(mapObj *map, const char *namespaces)
+{
+  int i;
+
+  if(msOWSLookupMetadata(&(map->web.metadata), namespaces, "allowed_ip_list") ||
+      msOWSLookupMetadata(&(map->web.metadata), namespaces, "denied_ip_list"))
+    return MS_TRUE;
+
+  for(i=0; i<map->numlayers; i++) {
+    if(msOWSLookupMetadata(&(GET_LAYER(map, i)->metadata), namespaces, "allowed_ip_list") ||
+        msOWSLookupMetadata(&(GET_LAYER(map, i)->metadata), namespaces, "denied_ip_list"))
+      return MS_TRUE;
+  }
+  return MS_FALSE;
+}
+
+static int owsCapCacheCompareParams(const void *a, const void *b)
+{
+  const char * const *pa = (const char * const *)a;
+  const char * const *pb = (const char * const *)b;
+  int status = strcasecmp(pa[0], pb[0]);
+
+  return (status != 0) ? status : strcmp(pa[1], pb[1]);
+}
+
+/*
+** Everything the generated document depends on apart from the mapfile
+** contents.
+*/
+static char *owsCapCacheBuildKey(mapObj *map, cgiRequestObj *request,
+                                 const char *service, const char *namespaces)
+{
+  bufferObj key;
+  const char *value;
+  char ch = '\0', *keystring;
+
+  msBufferInit(&key);
+  owsCapCacheAppendKey(&key, "service", service);
+  owsCapCacheAppendKey(&key, "mapfile", map->mapfile);
+
+  /* the online resource, see msOWSGetOnlineResource() */
+  if((value = msOWSLookupMetadata(&(map->web.metadata), namespaces, "onlineresource")) != NULL) {
+    owsCapCacheAppendKey(&key, "onlineresource", value);
+  } else {
+    owsCapCacheAppendKey(&key, "SERVER_NAME", getenv("SERVER_NAME"));
+    owsCapCacheAppendKey(&key, "SERVER_PORT", getenv("SERVER_PORT"));
+    owsCapCacheAppendKey(&key, "SCRIPT_NAME", getenv("SCRIPT_NAME"));
+    owsCapCacheAppendKey(&key, "HTTPS", getenv("HTTPS"));
+  }
+
+  /* layers can be hidden from some clients */
+  if(owsCapCacheHasIpLists(map, namespaces))
+    owsCapCacheAppendKey(&key, "REMOTE_ADDR", getenv("REMOTE_ADDR"));
+
+  if(request->type == MS_POST_REQUEST && request->postrequest) {
+    owsCapCacheAppendKey(&key, "postrequest", request->postrequest);
+  } else if(request->NumParams > 0) {
+    /* parameter order does not matter, and names are case insensitive */
+    const char **params = (const char **)msSmallMalloc(sizeof(char *)*2*request->NumParams);
+    int i;
+
+    for(i=0; i<request->NumParams; i++) {
+      params[2*i] = request->ParamNames[i];
+      params[2*i+1] = request->ParamValues[i] ? request->ParamValues[i] : "";
+    }
+    qsort(params, request->NumParams, sizeof(char *)*2, owsCapCacheCompareParams);
+    for(i=0; i<request->NumParams; i++) {
+      char *name = msStrdup(params[2*i]);
+      msStringToLower(name);
+      owsCapCacheAppendKey(&key, name, params[2*i+1]);
+      msFree(name);
+    }
+    msFree(params);
+  }
+
+  msBufferAppend(&key, &ch, 1);
+  keystring = msStrdup((char *)key.data);
+  msBufferFree(&key);
+  return keystring;
+}
+
+static int owsCapCacheStat(const char *path, long *mtime, long *size)
+{
+  struct stat st;
+
+  if(stat(path, &st) != 0)
+    return MS_FAILURE;
+  *mtime = (long)st.st_mtime;
+  *size = (long)st.st_size;
+  return MS_SUCCESS;
+}
+
+/*
+** Records path and the files it INCLUDEs. The mapfile is only tokenized far
+** enough to skip comments and strings, include paths are relative to the
+** map path like in the lexer.
+*/
+static int owsCapCacheAddDependency(owsCapCacheEntry *entry, const char *mappath,
+                                    const char *path, int depth)
+{
+  owsCapCacheDependency *dependency;
+  FILE *stream;
+  char *text, *p;
+  long mtime, size;
+  int i;
+
+  for(i=0; i<entry->numdependencies; i++) {
+    if(strcmp(entry->dependencies[i].path, path) == 0)
+      return MS_SUCCESS;
+  }
+
+  if(entry->numdependencies == OWS_CAPCACHE_MAX_DEPENDENCIES ||
+      depth > OWS_CAPCACHE_MAX_INCLUDE_DEPTH ||
+      owsCapCacheStat(path, &mtime, &size) != MS_SUCCESS ||
+      (stream = fopen(path, "rb")) == NULL)
+    return MS_FAILURE;
+
+  text = (char *)msSmallMalloc(size+1);
+  size = (long)fread(text, 1, size, stream);
+  text[size] = '\0';
+  fclose(stream);
+
+  dependency = &(entry->dependencies[entry->numdependencies++]);
+  dependency->path = msStrdup(path);
+  dependency->mtime = mtime;
+  dependency->size = size;
+
+  for(p=text; *p; p++) {
+    if(*p == '#') {
+      while(p[1] && p[1] != '\n') p++;
+    } else if(*p == '"' || *p == '\'') {
+      char quote = *p;
+      while(p[1] && p[1] != quote) {
+        if(p[1] == '\\' && p[2]) p++;
+        p++;
+      }
+      if(p[1]) p++;
+    } else if(isalpha((unsigned char)*p) || *p == '_') {
+      char *word = p, *include;
+      char szPath[MS_MAXPATHLEN];
+      int status;
+
+      while(isalnum((unsigned char)p[1]) || p[1] == '_') p++;
+      if(p+1-word != 7 || strncasecmp(word, "INCLUDE", 7) != 0)
+        continue;
+
+      while(p[1] == ' ' || p[1] == '\t' || p[1] == '\r' || p[1] == '\n') p++;
+      if(p[1] != '"' && p[1] != '\'')
+        continue;
+      include = p+2;
+      for(p=include; *p && *p != include[-1]; p++);
+      if(*p == '\0') break;
+      *p = '\0';
+
+      status = MS_FAILURE;
+      if(msBuildPath(szPath, mappath, include) != NULL)
+        status = owsCapCacheAddDependency(entry, mappath, szPath, depth+1);
+      if(status != MS_SUCCESS) {
+        msFree(text);
+        return MS_FAILURE;
+      }
+    }
+  }
+
+  msFree(text);
+  return MS_SUCCESS;
+}
+
+static int owsCapCacheIsCurrent(owsCapCacheEntry *entry)
+{
+  long mtime, size;
+  int i;
+
+  for(i=0; i<entry->numdependencies; i++) {
+    if(owsCapCacheStat(entry->dependencies[i].path, &mtime, &size) != MS_SUCCESS ||
+        mtime != entry->dependencies[i].mtime || size != entry->dependencies[i].size)
+      return MS_FALSE;
+  }
+  return MS_TRUE;
+}
+
+/************************************************************************/
+/*                          Disk persistence                            */
+/*                                                                      */
+/*      One file per key, named after a hash of it. The file starts     */
+/*      with the key and the dependencies so that hash collisions and   */
+/*      stale files are detected, the response follows.                 */
+/************************************************************************/
+
+static char *owsCapCacheGetPath(mapObj *map, owsCapCache *cache, const char *namespaces,
+                                const char *key)
+{
+  const char *directory;
+  char szPath[MS_MAXPATHLEN], filename[64], name[64];
+  unsigned int h1 = 2166136261U, h2 = 5381;
+  const unsigned char *p;
+
+  snprintf(name, sizeof(name), "%s_cache_path", cache->name);
+  if((directory = msOWSLookupMetadata(&(map->web.metadata), namespaces, name)) == NULL)
+    return NULL;
+
+  for(p=(const unsigned char *)key; *p; p++) {
+    h1 = (h1 ^ *p) * 16777619U;
+    h2 = h2*33 + *p;
+  }
+  snprintf(filename, sizeof(filename), "%s_%08x%08x.cache", cache->name, h1, h2);
+
+  if(msBuildPath3(szPath, map->mappath, directory, filename) == NULL)
+    return NULL;
+  return msStrdup(szPath);
+}
+
+static int owsCapCacheRead(const char *path, const char *key, owsCapCacheEntry *entry)
+{
+  FILE *stream;
+  char line[MS_MAXPATHLEN+64];
+  int i, keylen;
+
+  memset(entry, 0, sizeof(owsCapCacheEntry));
+  if((stream = fopen(path, "rb")) == NULL)
+    return MS_FAILURE;
+
+  if(fgets(line, sizeof(line), stream) == NULL || strcmp(line, OWS_CAPCACHE_SIGNATURE) != 0 ||
+      fgets(line, sizeof(line), stream) == NULL || (keylen = atoi(line)) != (int)strlen(key))
+    goto failure;
+
+  entry->key = (char *)msSmallMalloc(keylen+1);
+  if(fread(entry->key, 1, keylen, stream) != (size_t)keylen)
+    goto failure;
+  entry->key[keylen] = '\0';
+  if(strcmp(entry->key, key) != 0)
+    goto failure;
+
+  if(fgets(line, sizeof(line), stream) == NULL ||
+      (entry->numdependencies = atoi(line)) <= 0 ||
+      entry->numdependencies > OWS_CAPCACHE_MAX_DEPENDENCIES)
+    goto failure;
+  entry->dependencies = (owsCapCacheDependency *)msSmallCalloc(entry->numdependencies, sizeof(owsCapCacheDependency));
+  for(i=0; i<entry->numdependencies; i++) {
+    int offset = 0;
+    if(fgets(line, sizeof(line), stream) == NULL ||
+        sscanf(line, "%ld %ld %n", &(entry->dependencies[i].mtime), &(entry->dependencies[i].size), &offset) != 2 ||
+        offset == 0)
+      goto failure;
+    line[strcspn(line, "\r\n")] = '\0';
+    entry->dependencies[i].path = msStrdup(line+offset);
+  }
+
+  if(fgets(line, sizeof(line), stream) == NULL || (entry->size = atoi(line)) <= 0)
+    goto failure;
+  entry->data = (unsigned char *)msSmallMalloc(entry->size);
+  if(fread(entry->data, 1, entry->size, stream) != (size_t)entry->size)
+    goto failure;
+
+  fclose(stream);
+  return MS_SUCCESS;
+
+failure:
+  fclose(stream);
+  owsCapCacheFreeEntry(entry);
+  return MS_FAILURE;
+}
+
+static void owsCapCacheWrite(const char *path, owsCapCacheEntry *entry)
+{
+  FILE *stream;
+  char *tmppath;
+  size_t tmppathlen = strlen(path)+32;
+  int i, status;
+
+  /* write under another name first, concurrent readers only see complete files */
+  tmppath = (char *)msSmallMalloc(tmppathlen);
+  snprintf(tmppath, tmppathlen, "%s.%d.%d.tmp", path, (int)getpid(), msGetThreadId());
+  if((stream = fopen(tmppath, "wb")) == NULL) {
+    msDebug("msOWSCacheEnd(): unable to write %s\n", tmppath);
+    msFree(tmppath);
+    return;
+  }
+
+  status = (fputs(OWS_CAPCACHE_SIGNATURE, stream) >= 0 &&
+            fprintf(stream, "%d\n", (int)strlen(entry->key)) > 0 &&
+            fputs(entry->key, stream) >= 0 &&
+            fprintf(stream, "%d\n", entry->numdependencies) > 0);
+  for(i=0; status && i<entry->numdependencies; i++)
+    status = (fprintf(stream, "%ld %ld %s\n", entry->dependencies[i].mtime,
+                      entry->dependencies[i].size, entry->dependencies[i].path) > 0);
+  status = status && fprintf(stream, "%d\n", entry->size) > 0 &&
+           fwrite(entry->data, 1, entry->size, stream) == (size_t)entry->size;
+  status = (fclose(stream) == 0) && status;
+
+  if(status && rename(tmppath, path) != 0) {
+    /* rename() does not replace an existing file on windows */
+    remove(path);
+    status = (rename(tmppath, path) == 0);
+  }
+  if(!status) {
+    msDebug("msOWSCacheEnd(): unable to write %s\n", path);
+    remove(tmppath);
+  }
+  msFree(tmppath);
+}
+
+/************************************************************************/
+/*                         Response capture                             */
+/************************************************************************/
+
+static int owsCapCacheCaptureWrite(void *cbData, void *data, int byteCount)
+{
+  owsCapCacheCapture *capture = (owsCapCacheCapture *)cbData;
+
+  msBufferAppend(&(capture->data), data, byteCount);
+  return msIO_contextWrite(&(capture->forward), data, byteCount);
+}
+
+/* the cache takes over entry */
+static void owsCapCacheStore(owsCapCache *cache, owsCapCacheEntry *entry)
+{
+  int i;
+
+  msAcquireLock(TLOCK_CAPCACHE);
+
+  for(i=0; i<cache->numentries; i++) {
+    if(cache->entries[i].key && strcmp(cache->entries[i].key, entry->key) == 0)
+      break;
+  }
+  if(i == cache->numentries) { /* replace the oldest entry */
+    i = cache->next;
+    cache->next = (cache->next + 1) % cache->numentries;
+  }
+  owsCapCacheFreeEntry(&(cache->entries[i]));
+  cache->entries[i] = *entry;
+
+  msReleaseLock(TLOCK_CAPCACHE);
+}
+
+/*
+** Dependency on a file named in the mapfile (symbolset, fontset), relative
+** to the map path.
+*/
+static int owsCapCacheAddMapDependency(owsCapCacheEntry *entry, mapObj *map,
+                                       const char *filename)
+{
+  char szPath[MS_MAXPATHLEN];
+
+  if(!filename)
+    return MS_SUCCESS;
+  if(msBuildPath(szPath, map->mappath, filename) == NULL)
+    return MS_FAILURE;
+  return owsCapCacheAddDependency(entry, map->mappath, szPath, 0);
+}
+
+/*
+** Writes the response from the cache and returns MS_TRUE, or sets
+** *capture to record the response being generated.
+*/
+static int owsCapCacheBegin(mapObj *map, cgiRequestObj *request, owsCapCache *cache,
+                            const char *service, const char *namespaces, void **capture)
+{
+  owsCapCacheCapture *newcapture;
+  owsCapCacheEntry entry;
+  msIOContext *context, tee;
+  const char *value;
+  char *key, *path, name[64];
+  unsigned char *data = NULL;
+  int i, size = 0;
+
+  snprintf(name, sizeof(name), "%s_cache", cache->name);
+  value = msOWSLookupMetadata(&(map->web.metadata), namespaces, name);
+  if(!value || strcasecmp(value, "true") != 0)
+    return MS_FALSE;
+
+  /* headers do not go through the stream under apache */
+  context = msIO_getHandler(stdout);
+  if(!context || strcmp(context->label, "apache") == 0)
+    return MS_FALSE;
+
+  key = owsCapCacheBuildKey(map, request, service, namespaces);
+
+  msAcquireLock(TLOCK_CAPCACHE);
+  for(i=0; i<cache->numentries; i++) {
+    owsCapCacheEntry *cached = &(cache->entries[i]);
+    if(cached->key && strcmp(cached->key, key) == 0) {
+      if(owsCapCacheIsCurrent(cached)) {
+        size = cached->size;
+        data = (unsigned char *)msSmallMalloc(size);
+        memcpy(data, cached->data, size);
+      } else {
+        owsCapCacheFreeEntry(cached);
+      }
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_CAPCACHE);
+
+  path = owsCapCacheGetPath(map, cache, namespaces, key);
+
+  if(!data && path && owsCapCacheRead(path, key, &entry) == MS_SUCCESS) {
+    if(owsCapCacheIsCurrent(&entry)) {
+      size = entry.size;
+      data = (unsigned char *)msSmallMalloc(size);
+      memcpy(data, entry.data, size);
+      owsCapCacheStore(cache, &entry);
+    } else {
+      owsCapCacheFreeEntry(&entry);
+    }
+  }
+
+  if(data) {
+    if(map->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msOWSCacheBegin(): %s %s served from the cache.\n", service, cache->name);
+    msIO_fwrite(data, 1, size, stdout);
+    msFree(data);
+    msFree(path);
+    msFree(key);
+    return MS_TRUE;
+  }
+
+  /* record the dependencies before generating, a later change has to be seen */
+  newcapture = (owsCapCacheCapture *)msSmallCalloc(1, sizeof(owsCapCacheCapture));
+  newcapture->cache = cache;
+  newcapture->entry.key = key;
+  newcapture->entry.dependencies = (owsCapCacheDependency *)msSmallCalloc(OWS_CAPCACHE_MAX_DEPENDENCIES, sizeof(owsCapCacheDependency));
+  if(owsCapCacheAddDependency(&(newcapture->entry), map->mappath, map->mapfile, 0) != MS_SUCCESS ||
+      (cache == &legendcache &&
+       (owsCapCacheAddMapDependency(&(newcapture->entry), map, map->symbolset.filename) != MS_SUCCESS ||
+        owsCapCacheAddMapDependency(&(newcapture->entry), map, map->fontset.filename) != MS_SUCCESS))) {
+    owsCapCacheFreeEntry(&(newcapture->entry));
+    msFree(newcapture);
+    msFree(path);
+    return MS_FALSE;
+  }
+  newcapture->path = path;
+  newcapture->forward = *context;
+  msBufferInit(&(newcapture->data));
+
+  tee.label = "ows_cache";
+  tee.write_channel = MS_TRUE;
+  tee.readWriteFunc = owsCapCacheCaptureWrite;
+  tee.cbData = newcapture;
+  msIO_installHandlers(msIO_getHandler(stdin), &tee, msIO_getHandler(stderr));
+
+  *capture = newcapture;
+  return MS_FALSE;
+}
+
+/************************************************************************/
+/*                     msOWSCapabilitiesCacheBegin()                    */
+/*                                                                      */
+/*      Called before a GetCapabilities request is dispatched. Returns  */
+/*      MS_TRUE if the response was written from the cache. Otherwise   */
+/*      *capture may be set to record the response being generated, it */
+/*      must then be passed to msOWSCacheEnd().                         */
+/************************************************************************/
+
+int msOWSCapabilitiesCacheBegin(mapObj *map, cgiRequestObj *request,
+                                const char *service, void **capture)
+{
+  const char *namespaces;
+
+  *capture = NULL;
+
+  if(!map || !map->mapfile || !request || !service ||
+      (namespaces = owsCapCacheNamespaces(service)) == NULL)
+    return MS_FALSE;
+
+  return owsCapCacheBegin(map, request, &capcache, service, namespaces, capture);
+}
+
+/************************************************************************/
+/*                    msOWSLegendGraphicCacheBegin()                    */
+/*                                                                      */
+/*      Same as msOWSCapabilitiesCacheBegin() for WMS GetLegendGraphic  */
+/*      requests.                                                       */
+/************************************************************************/
+
+int msOWSLegendGraphicCacheBegin(mapObj *map, cgiRequestObj *request, void **capture)
+{
+  int i;
+
+  *capture = NULL;
+
+  if(!map || !map->mapfile || !request)
+    return MS_FALSE;
+
+  /* the legend would follow an SLD document we can not check */
+  for(i=0; i<request->NumParams; i++) {
+    if(strcasecmp(request->ParamNames[i], "SLD") == 0)
+      return MS_FALSE;
+  }
+
+  return owsCapCacheBegin(map, request, &legendcache, "WMS", "MO", capture);
+}
+
+/************************************************************************/
+/*                            msOWSCacheEnd()                           */
+/*                                                                      */
+/*      Restores the output and keeps the response if status is        */
+/*      MS_SUCCESS.                                                     */
+/************************************************************************/
+
+void msOWSCacheEnd(mapObj *map, void *capture, int status)
+{
+  owsCapCacheCapture *c = (owsCapCacheCapture *)capture;
+
+  if(!c)
+    return;
+
+  msIO_installHandlers(msIO_getHandler(stdin), &(c->forward), msIO_getHandler(stderr));
+
+  if(status == MS_SUCCESS && c->data.size > 0) {
+    c->entry.data = c->data.data;
+    c->entry.size = (int)c->data.size;
+    if(c->path)
+      owsCapCacheWrite(c->path, &(c->entry));
+    if(map && map->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msOWSCacheEnd(): cached a %d bytes %s response.\n", c->entry.size, c->cache->name);
+    owsCapCacheStore(c->cache, &(c->entry));
+  } else {
+    owsCapCacheFreeEntry(&(c->entry));
+    msBufferFree(&(c->data));
+  }
+
+  msFree(c->path);
+  msFree(c);
+}
+
+/************************************************************************/
+/*                          msOWSCacheCleanup()                         */
+/************************************************************************/
+
+void msOWSCacheCleanup(void)
+{
+  int i;
+
+  msAcquireLock(TLOCK_CAPCACHE);
+  for(i=0; i<capcache.numentries; i++)
+    owsCapCacheFreeEntry(&(capcache.entries[i]));
+  capcache.next = 0;
+  for(i=0; i<legendcache.numentries; i++)
+    owsCapCacheFreeEntry(&(legendcache.entries[i]));
+  legendcache.next = 0;
+  msReleaseLock(TLOCK_CAPCACHE);
+}
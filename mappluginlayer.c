@@ -172,6 +172,7 @@ copyVirtualTable(layerVTableObj *dest,
   dest->LayerCreateItems = src->LayerCreateItems ? src->LayerCreateItems : dest->LayerCreateItems;
   dest->LayerGetNumFeatures = src->LayerGetNumFeatures ? src->LayerGetNumFeatures : dest->LayerGetNumFeatures;
   dest->LayerGetAutoProjection = src->LayerGetAutoProjection ? src->LayerGetAutoProjection: dest->LayerGetAutoProjection;
+  dest->LayerBuildSQLSpatialFilter = src->LayerBuildSQLSpatialFilter ? src->LayerBuildSQLSpatialFilter : dest->LayerBuildSQLSpatialFilter;
 }
 
 int
@@ -106,6 +106,8 @@ msPostGISLayerInfo *msPostGISCreateLayerInfo(void)
   layerinfo->rownum = 0;
   layerinfo->version = 0;
   layerinfo->paging = MS_TRUE;
+  layerinfo->nearest = MS_FALSE;
+  layerinfo->nearestlimit = 0;
   return layerinfo;
 }
 
@@ -1872,11 +1874,13 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
   char *strWhere = 0;
   char *strLimit = 0;
   char *strOffset = 0;
+  char *strOrder = 0;
   size_t strRectLength = 0;
   size_t strFilterLength = 0;
   size_t strUidLength = 0;
   size_t strLimitLength = 0;
   size_t strOffsetLength = 0;
+  size_t strOrderLength = 0;
   size_t bufferSize = 0;
   int insert_and = 0;
   msPostGISLayerInfo *layerinfo;
@@ -1902,6 +1906,31 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
     strLimitLength = strlen(strLimit);
   }
 
+  /* Populate strOrder (and tighten strLimit) for a nearest neighbour query. */
+  if ( layerinfo->nearest && layerinfo->geomcolumn ) {
+    char *strSRID = 0;
+    static char *strOrderTemplate = " order by ST_Distance(%s, ST_SetSRID(ST_MakePoint(%.15g,%.15g),%s))";
+
+    strSRID = msPostGISBuildSQLSRID(layer);
+    if ( ! strSRID ) {
+      if (strLimit) free(strLimit);
+      return NULL;
+    }
+
+    strOrder = (char*)msSmallMalloc(strlen(strOrderTemplate) + strlen(layerinfo->geomcolumn) + strlen(strSRID) + 2*32);
+    sprintf(strOrder, strOrderTemplate, layerinfo->geomcolumn, layerinfo->nearestpoint.x, layerinfo->nearestpoint.y, strSRID);
+    strOrderLength = strlen(strOrder);
+    free(strSRID);
+
+    if ( layerinfo->nearestlimit > 0 && (! strLimit || layerinfo->nearestlimit < layer->maxfeatures) ) {
+      static char *strLimitTemplate = " limit %d";
+      if (strLimit) free(strLimit);
+      strLimit = msSmallMalloc(strlen(strLimitTemplate) + 12);
+      sprintf(strLimit, strLimitTemplate, layerinfo->nearestlimit);
+      strLimitLength = strlen(strLimit);
+    }
+  }
+
   /* Populate strOffset, if necessary. */
   if ( layerinfo->paging && layer->startindex > 0 ) {
     static char *strOffsetTemplate = " offset %d";
@@ -1955,7 +1984,7 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
   }
 
   bufferSize = strRectLength + 5 + strFilterLength + 5 + strUidLength
-               + strLimitLength + strOffsetLength;
+               + strOrderLength + strLimitLength + strOffsetLength + 5;
   strWhere = (char*)msSmallMalloc(bufferSize);
   *strWhere = '\0';
   if ( strRect ) {
@@ -1979,6 +2008,13 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
     free(strUid);
     insert_and++;
   }
+  if ( strOrder ) {
+    if ( ! insert_and ) {
+      strlcat(strWhere, "true", bufferSize); /* the clauses below follow a 'where' */
+    }
+    strlcat(strWhere, strOrder, bufferSize);
+    free(strOrder);
+  }
   if ( strLimit ) {
     strlcat(strWhere, strLimit, bufferSize);
     free(strLimit);
@@ -2565,6 +2601,43 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 #endif
 }
 
+/*
+** msPostGISLayerWhichShapesNearest()
+**
+** Runs the msPostGISLayerWhichShapes() query with the features ordered by
+** their distance to point, and when maxresults is positive at most that many
+** of them. The caller must then use every feature it gets back, a limit
+** is only safe if no later test (class expression, template...) can reject any.
+*/
+int msPostGISLayerWhichShapesNearest(layerObj *layer, rectObj rect, pointObj *point, int maxresults)
+{
+#ifdef USE_POSTGIS
+  msPostGISLayerInfo *layerinfo = NULL;
+  int status;
+
+  assert(layer != NULL);
+  assert(layer->layerinfo != NULL);
+
+  layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+
+  layerinfo->nearest = MS_TRUE;
+  layerinfo->nearestpoint = *point;
+  layerinfo->nearestlimit = maxresults;
+
+  status = msPostGISLayerWhichShapes(layer, rect, MS_TRUE);
+
+  layerinfo->nearest = MS_FALSE;
+  layerinfo->nearestlimit = 0;
+
+  return status;
+#else
+  msSetError( MS_MISCERR,
+              "PostGIS support is not available.",
+              "msPostGISLayerWhichShapesNearest()");
+  return MS_FAILURE;
+#endif
+}
+
 /*
 ** msPostGISLayerNextShape()
 **
@@ -3301,6 +3374,106 @@ char *msPostGISEscapeSQLParam(layerObj *layer, const char *pszString)
 #endif
 }
 
+/*
+** msPostGISBuildSQLSpatialFilter()
+**
+** Registered vtable->LayerBuildSQLSpatialFilter function. The operators
+** that imply intersecting bounding boxes get a && test first, so the
+** spatial index is used before the exact predicate.
+**
+** Returns malloc'ed char* that must be freed by caller.
+*/
+char *msPostGISBuildSQLSpatialFilter(layerObj *layer, const char *pszOperator, shapeObj *shape, double dfDistance)
+{
+#ifdef USE_POSTGIS
+  msPostGISLayerInfo *layerinfo = NULL;
+  char *strWKT = NULL, *strSRID = NULL, *strGeom = NULL, *strFilter = NULL;
+  const char *strFunction = NULL;
+  int bNegate = MS_FALSE, bBox = MS_TRUE;
+  size_t sz;
+
+  if (!layer || !pszOperator || !shape)
+    return NULL;
+
+  if (strcasecmp(pszOperator, "BBOX") == 0 || strcasecmp(pszOperator, "Intersects") == 0 ||
+      strcasecmp(pszOperator, "Intersect") == 0)
+    strFunction = "ST_Intersects";
+  else if (strcasecmp(pszOperator, "Equals") == 0)
+    strFunction = "ST_Equals";
+  else if (strcasecmp(pszOperator, "Touches") == 0)
+    strFunction = "ST_Touches";
+  else if (strcasecmp(pszOperator, "Crosses") == 0)
+    strFunction = "ST_Crosses";
+  else if (strcasecmp(pszOperator, "Within") == 0)
+    strFunction = "ST_Within";
+  else if (strcasecmp(pszOperator, "Contains") == 0)
+    strFunction = "ST_Contains";
+  else if (strcasecmp(pszOperator, "Overlaps") == 0)
+    strFunction = "ST_Overlaps";
+  else if (strcasecmp(pszOperator, "Disjoint") == 0) {
+    strFunction = "ST_Intersects";
+    bNegate = MS_TRUE;
+    bBox = MS_FALSE;
+  } else if (strcasecmp(pszOperator, "DWithin") == 0) {
+    strFunction = "ST_DWithin"; /* uses the index by itself */
+    bBox = MS_FALSE;
+  } else if (strcasecmp(pszOperator, "Beyond") == 0) {
+    strFunction = "ST_DWithin";
+    bNegate = MS_TRUE;
+    bBox = MS_FALSE;
+  } else
+    return NULL;
+
+  if (!msPostGISLayerIsOpen(layer) && msPostGISLayerOpen(layer) != MS_SUCCESS)
+    return NULL;
+
+  layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+  if (!layerinfo->geomcolumn && msPostGISParseData(layer) != MS_SUCCESS)
+    return NULL;
+
+  if (layer->debug) {
+    msDebug("msPostGISBuildSQLSpatialFilter called: %s\n", pszOperator);
+  }
+
+  strWKT = msShapeToWKT(shape);
+  if (!strWKT)
+    return NULL;
+
+  strSRID = msPostGISBuildSQLSRID(layer);
+  if (!strSRID) {
+    free(strWKT);
+    return NULL;
+  }
+
+  /* the WKT is made of numbers only, there is nothing to escape */
+  sz = strlen(strWKT) + strlen(strSRID) + 32;
+  strGeom = (char*)msSmallMalloc(sz);
+  snprintf(strGeom, sz, "ST_GeomFromText('%s',%s)", strWKT, strSRID);
+  free(strWKT);
+  free(strSRID);
+
+  sz = 2 * strlen(layerinfo->geomcolumn) + 2 * strlen(strGeom) + strlen(strFunction) + 64;
+  strFilter = (char*)msSmallMalloc(sz);
+  if (strcasecmp(strFunction, "ST_DWithin") == 0)
+    snprintf(strFilter, sz, "(%s%s(%s,%s,%.15g))", bNegate ? "NOT " : "", strFunction,
+             layerinfo->geomcolumn, strGeom, MS_MAX(dfDistance, 0));
+  else if (bBox)
+    snprintf(strFilter, sz, "(%s && %s AND %s(%s,%s))", layerinfo->geomcolumn, strGeom,
+             strFunction, layerinfo->geomcolumn, strGeom);
+  else
+    snprintf(strFilter, sz, "(%s%s(%s,%s))", bNegate ? "NOT " : "", strFunction,
+             layerinfo->geomcolumn, strGeom);
+  free(strGeom);
+
+  return strFilter;
+#else
+  msSetError( MS_MISCERR,
+              "PostGIS support is not available.",
+              "msPostGISBuildSQLSpatialFilter()");
+  return NULL;
+#endif
+}
+
 void msPostGISEnablePaging(layerObj *layer, int value)
 {
 #ifdef USE_POSTGIS
@@ -3375,6 +3548,7 @@ int msPostGISLayerInitializeVirtualTable(layerObj *layer)
   /* layer->vtable->LayerGetAutoProjection, use defaut*/
 
   layer->vtable->LayerEscapeSQLParam = msPostGISEscapeSQLParam;
+  layer->vtable->LayerBuildSQLSpatialFilter = msPostGISBuildSQLSpatialFilter;
   layer->vtable->LayerEnablePaging = msPostGISEnablePaging;
   layer->vtable->LayerGetPaging = msPostGISGetPaging;
 
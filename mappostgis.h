@@ -64,6 +64,9 @@ typedef struct {
   int         endian;      /* Endianness of the mapserver host */
   int         version;     /* PostGIS version of the database */
   int         paging;      /* Driver handling of pagination, enabled by default */
+  int         nearest;     /* Order the features by distance to nearestpoint (nearest neighbour query) */
+  pointObj    nearestpoint;
+  int         nearestlimit; /* Limit on the number of nearest features, 0 for none */
 }
 msPostGISLayerInfo;
 
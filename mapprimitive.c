@@ -102,6 +102,7 @@ void msInitShape(shapeObj *shape)
   shape->numvalues = 0;
 
   shape->geometry = NULL;
+  shape->preparedgeometry = NULL;
   shape->renderer_cache = NULL;
 
   /* annotation component */
@@ -145,6 +146,7 @@ int msCopyShape(shapeObj *from, shapeObj *to)
   }
 
   to->geometry = NULL; /* GEOS code will build automatically if necessary */
+  to->preparedgeometry = NULL;
   to->scratch = from->scratch;
 
   return(0);
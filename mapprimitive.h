@@ -74,6 +74,7 @@ typedef struct {
   lineObj *line;
   char **values;
   void *geometry;
+  void *preparedgeometry; /* see msGEOSPrepare() */
   void *renderer_cache;
 #endif
 
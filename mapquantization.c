@@ -45,6 +45,7 @@
  */
 
 #include "mapserver.h"
+#include "mapthread.h"
 #include <stdlib.h>
 
 #define PAM_GETR(p) ((p).r)
@@ -106,9 +107,6 @@ static acolorhist_vector pam_computeacolorhist
 static acolorhash_table pam_computeacolorhash
 (rgbaPixel** apixels, int cols, int rows, int maxacolors, int* acolorsP);
 static acolorhash_table pam_allocacolorhash (void);
-static int pam_addtoacolorhash
-(acolorhash_table acht, rgbaPixel *acolorP, int value);
-static int pam_lookupacolor (acolorhash_table acht, rgbaPixel* acolorP);
 static void pam_freeacolorhist (acolorhist_vector achv);
 static void pam_freeacolorhash (acolorhash_table acht);
 
@@ -195,72 +193,247 @@ int msQuantizeRasterBuffer(rasterBufferObj *rb,
 }
 
 
+/* maximal number of pixels sampled by msQuantizeRasterBufferFast() */
+#define QUANTIZE_SAMPLES 65536
+/* number of k-means refinement passes run on the sampled histogram */
+#define QUANTIZE_KMEANS_PASSES 2
+
+/* index of the palette entry closest to the given color */
+static int nearestPaletteEntry(int r, int g, int b, int a, const int *pr, const int *pg,
+                               const int *pb, const int *pa, int num_entries)
+{
+  int dists[256];
+  int i, ind = 0, dist;
+  /*
+   ** distances fit in an int (4*255*255), and computing them all in a
+   ** separate loop lets the compiler vectorize it.
+   */
+  for ( i = 0; i < num_entries; ++i ) {
+    dists[i] = ( r - pr[i] ) * ( r - pr[i] ) +
+               ( g - pg[i] ) * ( g - pg[i] ) +
+               ( b - pb[i] ) * ( b - pb[i] ) +
+               ( a - pa[i] ) * ( a - pa[i] );
+  }
+  dist = dists[0];
+  for ( i = 1; i < num_entries; ++i ) {
+    if ( dists[i] < dist ) {
+      ind = i;
+      dist = dists[i];
+    }
+  }
+  return ind;
+}
+
+/**
+ * Compute a palette for the given RGBA rasterBuffer, like msQuantizeRasterBuffer(),
+ * but from a histogram of at most QUANTIZE_SAMPLES regularly sampled pixels, whose
+ * median cut palette is then refined with a few k-means passes. rb is never modified,
+ * i.e. the palette never needs rescaling and *palette_scaling_maxval is always 255.
+ */
+int msQuantizeRasterBufferFast(rasterBufferObj *rb,
+                               unsigned int *reqcolors, rgbaPixel *palette,
+                               unsigned int *palette_scaling_maxval)
+{
+  rgbaPixel *samples;
+  acolorhist_vector achv, acolormap;
+  unsigned int npixels = rb->width*rb->height, step, i;
+  int nsamples = 0, colors, newcolors, pass, x;
+  unsigned char maxval = 255, mask;
+
+  assert(rb->type == MS_BUFFER_BYTE_RGBA);
+
+  *palette_scaling_maxval = 255;
+
+  /* avoid a step that only ever lands on the same few columns */
+  step = MS_MAX(1, npixels / QUANTIZE_SAMPLES);
+  while(step > 1 && rb->width % step == 0)
+    step++;
+
+  samples = (rgbaPixel*)msSmallMalloc((npixels/step+1)*sizeof(rgbaPixel));
+  for(i=0; i<npixels; i+=step) {
+    samples[nsamples++] = *(rgbaPixel*)(&(rb->data.rgba.pixels[(i/rb->width)*rb->data.rgba.row_step + (i%rb->width)*4]));
+  }
+
+  /* too many distinct colors in the sample: lower its depth (and only its) */
+  /* by one more bit on each pass, all the samples are equal once no bit is left */
+  for ( mask = 0xFF; ; ) {
+    achv = pam_computeacolorhist( &samples, nsamples, 1, MAXCOLORS, &colors );
+    if ( achv != (acolorhist_vector) 0 )
+      break;
+    mask = (unsigned char)(mask << 1);
+    for ( x = 0; x < nsamples; ++x ) {
+      samples[x].r &= mask;
+      samples[x].g &= mask;
+      samples[x].b &= mask;
+      samples[x].a &= mask;
+    }
+  }
+
+  newcolors = MS_MIN(colors, *reqcolors);
+  acolormap = mediancut(achv, colors, nsamples, maxval, newcolors);
+
+  /* k-means refinement: move each palette entry to the mean of the colors it represents */
+  for ( pass = 0; pass < QUANTIZE_KMEANS_PASSES && newcolors < colors; ++pass ) {
+    int pr[256], pg[256], pb[256], pa[256];
+    double sr[256], sg[256], sb[256], sa[256], sw[256];
+    for ( x = 0; x < newcolors; ++x ) {
+      pr[x] = acolormap[x].acolor.r;
+      pg[x] = acolormap[x].acolor.g;
+      pb[x] = acolormap[x].acolor.b;
+      pa[x] = acolormap[x].acolor.a;
+      sr[x] = sg[x] = sb[x] = sa[x] = sw[x] = 0;
+    }
+    for ( x = 0; x < colors; ++x ) {
+      rgbaPixel *c = &achv[x].acolor;
+      int ind = nearestPaletteEntry(c->r, c->g, c->b, c->a, pr, pg, pb, pa, newcolors);
+      sr[ind] += c->r * (double)achv[x].value;
+      sg[ind] += c->g * (double)achv[x].value;
+      sb[ind] += c->b * (double)achv[x].value;
+      sa[ind] += c->a * (double)achv[x].value;
+      sw[ind] += achv[x].value;
+    }
+    for ( x = 0; x < newcolors; ++x ) {
+      if ( sw[x] > 0 ) {
+        PAM_ASSIGN( acolormap[x].acolor, (int)(sr[x] / sw[x] + 0.5), (int)(sg[x] / sw[x] + 0.5),
+                    (int)(sb[x] / sw[x] + 0.5), (int)(sa[x] / sw[x] + 0.5) );
+      }
+    }
+  }
+
+  *reqcolors = newcolors;
+  for (x = 0; x < newcolors; ++x) {
+    palette[x] = acolormap[x].acolor;
+    /* averaging may not keep the pixels premultiplied */
+    palette[x].r = MS_MIN(palette[x].r, palette[x].a);
+    palette[x].g = MS_MIN(palette[x].g, palette[x].a);
+    palette[x].b = MS_MIN(palette[x].b, palette[x].a);
+  }
+
+  pam_freeacolorhist(achv);
+  free(acolormap);
+  free(samples);
+  return MS_SUCCESS;
+}
+
+/* size (log2) of the direct mapped color cache used by msClassifyRasterBuffer() */
+#define CLASSIFY_CACHE_BITS 14
+
 int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb)
 {
-  register int ind;
-  unsigned char *outrow,*pQ;
-  register rgbaPixel *pP;
-  acolorhash_table acht;
-  int usehash, row, col;
+  int pr[256], pg[256], pb[256], pa[256];
+  unsigned int *cache_keys;
+  unsigned char *cache_inds, *cache_set;
+  unsigned char *pQ;
+  rgbaPixel *pP;
+  unsigned int key, last_key = 0;
+  int i, row, col, ind = 0, have_last = 0;
+
   /*
    ** Step 4: map the colors in the image to their closest match in the
-   ** new colormap, and write 'em out.
+   ** new colormap, and write 'em out. Runs of identical pixels and a
+   ** direct mapped cache of previous matches save most of the searches.
    */
-  acht = pam_allocacolorhash( );
-  usehash = 1;
+  for ( i = 0; i < qrb->data.palette.num_entries; ++i ) {
+    pr[i] = PAM_GETR( qrb->data.palette.palette[i] );
+    pg[i] = PAM_GETG( qrb->data.palette.palette[i] );
+    pb[i] = PAM_GETB( qrb->data.palette.palette[i] );
+    pa[i] = PAM_GETA( qrb->data.palette.palette[i] );
+  }
+  cache_keys = (unsigned int*)msSmallMalloc((1<<CLASSIFY_CACHE_BITS) * sizeof(unsigned int));
+  cache_inds = (unsigned char*)msSmallMalloc(1<<CLASSIFY_CACHE_BITS);
+  cache_set = (unsigned char*)msSmallCalloc(1,1<<CLASSIFY_CACHE_BITS);
 
   for ( row = 0; row < qrb->height; ++row ) {
-    outrow = &(qrb->data.palette.pixels[row*qrb->width]);
-    col = 0;
-    pP = (rgbaPixel*)(&(rb->data.rgba.pixels[row * rb->data.rgba.row_step]));;
-    pQ = outrow;
-    do {
-      /* Check hash table to see if we have already matched this color. */
-      ind = pam_lookupacolor( acht, pP );
-      if ( ind == -1 ) {
-        /* No; search acolormap for closest match. */
-        register int i, r1, g1, b1, a1, r2, g2, b2, a2;
-        register long dist, newdist;
-
-        r1 = PAM_GETR( *pP );
-        g1 = PAM_GETG( *pP );
-        b1 = PAM_GETB( *pP );
-        a1 = PAM_GETA( *pP );
-        dist = 2000000000;
-        for ( i = 0; i < qrb->data.palette.num_entries; ++i ) {
-          r2 = PAM_GETR( qrb->data.palette.palette[i] );
-          g2 = PAM_GETG( qrb->data.palette.palette[i] );
-          b2 = PAM_GETB( qrb->data.palette.palette[i] );
-          a2 = PAM_GETA( qrb->data.palette.palette[i] );
-          /* GRR POSSIBLE BUG */
-          newdist = ( r1 - r2 ) * ( r1 - r2 ) +  /* may overflow? */
-                    ( g1 - g2 ) * ( g1 - g2 ) +
-                    ( b1 - b2 ) * ( b1 - b2 ) +
-                    ( a1 - a2 ) * ( a1 - a2 );
-          if ( newdist < dist ) {
-            ind = i;
-            dist = newdist;
-          }
-        }
-        if ( usehash ) {
-          if ( pam_addtoacolorhash( acht, pP, ind ) < 0 ) {
-            usehash = 0;
-          }
+    pP = (rgbaPixel*)(&(rb->data.rgba.pixels[row * rb->data.rgba.row_step]));
+    pQ = &(qrb->data.palette.pixels[row*qrb->width]);
+    for ( col = 0; col < rb->width; ++col, ++pP, ++pQ ) {
+      unsigned int slot;
+      memcpy(&key, pP, sizeof(unsigned int));
+      if ( !have_last || key != last_key ) {
+        slot = (key * 2654435761u) >> (32 - CLASSIFY_CACHE_BITS);
+        if ( cache_set[slot] && cache_keys[slot] == key ) {
+          ind = cache_inds[slot];
+        } else {
+          ind = nearestPaletteEntry( PAM_GETR( *pP ), PAM_GETG( *pP ), PAM_GETB( *pP ), PAM_GETA( *pP ),
+                                     pr, pg, pb, pa, qrb->data.palette.num_entries );
+          cache_set[slot] = 1;
+          cache_keys[slot] = key;
+          cache_inds[slot] = ind;
         }
+        last_key = key;
+        have_last = 1;
       }
-
-      /*          *pP = acolormap[ind].acolor;  */
       *pQ = (unsigned char)ind;
+    }
+  }
+
+  free(cache_keys);
+  free(cache_inds);
+  free(cache_set);
+  return MS_SUCCESS;
+}
+
+/*
+ ** Palettes computed for formats with QUANTIZE_REUSE enabled, kept across
+ ** requests so that following images only need to be classified.
+ */
+#define PALETTE_CACHE_SIZE 16
 
-      ++col;
-      ++pP;
-      ++pQ;
+typedef struct {
+  char *key;
+  unsigned int num_entries;
+  rgbaPixel palette[256];
+} paletteCacheEntry;
 
-    } while ( col != rb->width );
+static paletteCacheEntry palette_cache[PALETTE_CACHE_SIZE];
+static int palette_cache_next = 0;
+
+/* copy the palette cached for key, returns MS_FALSE if there is none */
+int msGetCachedPalette(const char *key, rgbaPixel *palette, unsigned int *num_entries)
+{
+  int i, found = MS_FALSE;
+  msAcquireLock( TLOCK_QUANTIZE );
+  for ( i = 0; i < PALETTE_CACHE_SIZE; ++i ) {
+    if ( palette_cache[i].key && !strcmp( palette_cache[i].key, key ) ) {
+      memcpy( palette, palette_cache[i].palette, palette_cache[i].num_entries * sizeof(rgbaPixel) );
+      *num_entries = palette_cache[i].num_entries;
+      found = MS_TRUE;
+      break;
+    }
   }
-  pam_freeacolorhash(acht);
+  msReleaseLock( TLOCK_QUANTIZE );
+  return found;
+}
 
-  return MS_SUCCESS;
+/* store a palette for key, replacing the oldest entry once the cache is full */
+void msSetCachedPalette(const char *key, rgbaPixel *palette, unsigned int num_entries)
+{
+  paletteCacheEntry *entry;
+  msAcquireLock( TLOCK_QUANTIZE );
+  entry = &palette_cache[palette_cache_next];
+  palette_cache_next = (palette_cache_next + 1) % PALETTE_CACHE_SIZE;
+  msFree( entry->key );
+  entry->key = msStrdup( key );
+  entry->num_entries = num_entries;
+  memcpy( entry->palette, palette, num_entries * sizeof(rgbaPixel) );
+  msReleaseLock( TLOCK_QUANTIZE );
+}
+
+/*
+ ** drop all the cached palettes. entries of an edited mapfile are never used
+ ** again (its modification time is part of the key), this is for changes
+ ** that do not touch the mapfile, e.g. styles modified through mapscript.
+ */
+void msPaletteCacheCleanup(void)
+{
+  int i;
+  msAcquireLock( TLOCK_QUANTIZE );
+  for ( i = 0; i < PALETTE_CACHE_SIZE; ++i ) {
+    msFree( palette_cache[i].key );
+    palette_cache[i].key = NULL;
+  }
+  palette_cache_next = 0;
+  msReleaseLock( TLOCK_QUANTIZE );
 }
 
 
@@ -669,27 +842,6 @@ pam_allocacolorhash( )
 
 
 
-static int
-pam_addtoacolorhash( acht, acolorP, value )
-acolorhash_table acht;
-rgbaPixel* acolorP;
-int value;
-{
-  register int hash;
-  register acolorhist_list achl;
-
-  achl = (acolorhist_list) msSmallMalloc( sizeof(struct acolorhist_list_item) );
-
-  hash = pam_hashapixel( *acolorP );
-  achl->ch.acolor = *acolorP;
-  achl->ch.value = value;
-  achl->next = acht[hash];
-  acht[hash] = achl;
-  return 0;
-}
-
-
-
 static acolorhist_vector
 pam_acolorhashtoacolorhist( acht, maxacolors )
 acolorhash_table acht;
@@ -722,24 +874,6 @@ int maxacolors;
 
 
 
-static int
-pam_lookupacolor( acht, acolorP )
-acolorhash_table acht;
-rgbaPixel* acolorP;
-{
-  int hash;
-  acolorhist_list achl;
-
-  hash = pam_hashapixel( *acolorP );
-  for ( achl = acht[hash]; achl != (acolorhist_list) 0; achl = achl->next )
-    if ( PAM_EQUAL( achl->ch.acolor, *acolorP ) )
-      return achl->ch.value;
-
-  return -1;
-}
-
-
-
 static void
 pam_freeacolorhist( achv )
 acolorhist_vector achv;
@@ -28,6 +28,7 @@
  ****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
 
 
 
@@ -987,12 +988,172 @@ query_error:
   return MS_FAILURE;
 }
 
-int msQueryByRect(mapObj *map)
+/*
+** Multi-layer queries (by rect, point or shape) query each layer on its own
+** through a queryLayerFunc, which leaves what it finds in the layer resultcache.
+** Skipped layers aren't failures.
+*/
+typedef int (*queryLayerFunc)(mapObj *map, int l);
+
+typedef struct {
+  queryLayerFunc func;
+  mapObj *map;
+  int layer;
+  int status;
+  int threadid; /* the thread running msQueryLayers() */
+  int foreign; /* set when the layer was queried by another thread... */
+  errorObj error; /* ...which leaves its error here */
+} queryLayerJobObj;
+
+static void queryLayerJob(void *arg)
 {
-  int l; /* counters */
-  int start, stop=0;
+  queryLayerJobObj *job = (queryLayerJobObj *) arg;
+  errorObj *error;
+
+  job->status = job->func(job->map, job->layer);
+
+  if(msGetThreadId() != job->threadid) { /* the error list is per thread, hand over the error */
+    job->foreign = MS_TRUE;
+    if(job->status != MS_SUCCESS) {
+      error = msGetErrorObj();
+      job->error.code = error->code;
+      strlcpy(job->error.routine, error->routine, sizeof(job->error.routine));
+      strlcpy(job->error.message, error->message, sizeof(job->error.message));
+    }
+    msResetErrorList();
+  }
+}
+
+static void discardQueryResults(layerObj *lp)
+{
+  if(lp->resultcache) {
+    if(lp->resultcache->results) free(lp->resultcache->results);
+    free(lp->resultcache);
+    lp->resultcache = NULL;
+    msLayerClose(lp);
+  }
+}
+
+/* number of threads msQueryLayers() may use, 1 to query the layers in order */
+static int queryLayersThreads(mapObj *map, int start, int stop, int sharedmaxfeatures)
+{
+  int l, nthreads = 1;
+  const char *value;
+
+  if((value = msGetConfigOption(map, "MS_QUERY_THREADS")) != NULL)
+    nthreads = atoi(value);
+  if(nthreads <= 1 || start == stop)
+    return 1;
+
+  if(map->query.startindex > 1 || (sharedmaxfeatures && map->query.maxfeatures > 0))
+    return 1;
+  for(l=start; l>=stop; l--)
+    if(GET_LAYER(map, l)->startindex > 1) return 1;
 
+  return nthreads;
+}
+
+/*
+** Runs func on the layers start down to stop, taking care of what ties the
+** layers together: map->query.maxfeatures (one budget for all the layers when
+** sharedmaxfeatures is set, a limit for each layer otherwise), paging and, with
+** firstmatch, stopping at the first layer that found something.
+**
+** CONFIG "MS_QUERY_THREADS" "n" lets up to n threads query the layers at once,
+** each layer on its own connection, so a query over several remote layers
+** takes about as long as the slowest of them. The results are then merged in
+** layer order, which gives the same answer as querying them one after the
+** other. Paged queries and a shared maxfeatures budget depend on that order
+** and are always run sequentially. GEOS calls are serialized by mapgeos.c.
+*/
+static int msQueryLayers(mapObj *map, queryLayerFunc func, int start, int stop, int sharedmaxfeatures, int firstmatch)
+{
+  int l, i, njobs, nthreads, found = MS_FALSE, status = MS_SUCCESS;
   layerObj *lp;
+  queryLayerJobObj *jobs;
+  void **args;
+
+  nthreads = queryLayersThreads(map, start, stop, sharedmaxfeatures);
+  if(nthreads == 1) {
+    for(l=start; l>=stop; l--) {
+      lp = (GET_LAYER(map, l));
+      /* Set the global maxfeatures */
+      if (map->query.maxfeatures == 0)
+        break; /* nothing else to do */
+      else if (map->query.maxfeatures > 0)
+        lp->maxfeatures = map->query.maxfeatures;
+
+      /* using mapscript, the map->query.startindex will be unset... */
+      if (lp->startindex > 1 && map->query.startindex < 0)
+        map->query.startindex = lp->startindex;
+
+      if(func(map, l) != MS_SUCCESS)
+        return(MS_FAILURE);
+
+      if(lp->resultcache) {
+        if(sharedmaxfeatures && map->query.maxfeatures > 0)
+          map->query.maxfeatures -= lp->resultcache->numresults;
+        if(firstmatch && lp->resultcache->numresults > 0)
+          break; /* no need to search any further */
+      }
+    }
+    return(MS_SUCCESS);
+  }
+
+  if(map->query.maxfeatures == 0)
+    return(MS_SUCCESS); /* nothing to do */
+
+  njobs = start-stop+1;
+  jobs = (queryLayerJobObj *) msSmallCalloc(njobs, sizeof(queryLayerJobObj));
+  args = (void **) msSmallMalloc(njobs*sizeof(void *));
+  for(i=0; i<njobs; i++) {
+    lp = GET_LAYER(map, start-i);
+    if(map->query.maxfeatures > 0)
+      lp->maxfeatures = map->query.maxfeatures;
+    jobs[i].func = func;
+    jobs[i].map = map;
+    jobs[i].layer = start-i;
+    jobs[i].threadid = msGetThreadId();
+    args[i] = &jobs[i];
+  }
+
+  if(map->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msQueryLayers(): querying %d layers with up to %d threads.\n", njobs, nthreads);
+  msRunThreadJobs(queryLayerJob, args, njobs, nthreads);
+
+  for(i=0; i<njobs; i++) { /* in layer order */
+    lp = GET_LAYER(map, jobs[i].layer);
+    if(status != MS_SUCCESS || (firstmatch && found)) {
+      discardQueryResults(lp); /* wouldn't have been queried */
+      continue;
+    }
+    if(jobs[i].status != MS_SUCCESS) {
+      if(jobs[i].foreign) {
+        if(jobs[i].error.code != MS_NOERR)
+          msSetError(jobs[i].error.code, "%s", jobs[i].error.routine, jobs[i].error.message);
+        else
+          msSetError(MS_QUERYERR, "Query of layer %d failed.", "msQueryLayers()", jobs[i].layer);
+      }
+      status = MS_FAILURE;
+      continue;
+    }
+    if(lp->resultcache && lp->resultcache->numresults > 0)
+      found = MS_TRUE;
+  }
+
+  free(args);
+  free(jobs);
+  return(status);
+}
+
+/*
+** Queries a single layer of a MS_QUERY_BY_RECT query, see msQueryLayers(). With
+** a func the features found are handed to it rather than added to the result
+** cache, which then only counts them.
+*/
+static int queryByRectLayerFeatures(mapObj *map, int l, msQueryFeatureFunc func, void *data)
+{
+  layerObj *lp = GET_LAYER(map, l);
 
   char status;
   shapeObj shape, searchshape;
@@ -1004,195 +1165,205 @@ int msQueryByRect(mapObj *map)
   int *classgroup = NULL;
   double minfeaturesize = -1;
 
-  if(map->query.type != MS_QUERY_BY_RECT) {
-    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByRect()");
-    return(MS_FAILURE);
-  }
-
   msInitShape(&shape);
   msInitShape(&searchshape);
 
-  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
-    start = map->numlayers-1;
-  else
-    start = stop = map->query.layer;
-
-  for(l=start; l>=stop; l--) {
-    lp = (GET_LAYER(map, l));
-    /* Set the global maxfeatures */
-    if (map->query.maxfeatures == 0)
-      break; /* nothing else to do */
-    else if (map->query.maxfeatures > 0)
-      lp->maxfeatures = map->query.maxfeatures;
-
-    /* using mapscript, the map->query.startindex will be unset... */
-    if (lp->startindex > 1 && map->query.startindex < 0)
-      map->query.startindex = lp->startindex;
-    
-    /* conditions may have changed since this layer last drawn, so set
-       layer->project true to recheck projection needs (Bug #673) */
-    lp->project = MS_TRUE;
+  /* conditions may have changed since this layer last drawn, so set
+     layer->project true to recheck projection needs (Bug #673) */
+  lp->project = MS_TRUE;
 
-    /* free any previous search results, do it now in case one of the next few tests fail */
-    if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
-      free(lp->resultcache);
-      lp->resultcache = NULL;
-    }
+  /* free any previous search results, do it now in case one of the next few tests fail */
+  if(lp->resultcache) {
+    if(lp->resultcache->results) free(lp->resultcache->results);
+    free(lp->resultcache);
+    lp->resultcache = NULL;
+  }
 
-    if(!msIsLayerQueryable(lp)) continue;
-    if(lp->status == MS_OFF) continue;
+  if(!msIsLayerQueryable(lp)) return MS_SUCCESS;
+  if(lp->status == MS_OFF) return MS_SUCCESS;
 
-    if(map->scaledenom > 0) {
-      if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) continue;
-      if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) continue;
-    }
+  if(map->scaledenom > 0) {
+    if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) return MS_SUCCESS;
+    if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) return MS_SUCCESS;
+  }
 
-    if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
-      if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) continue;
-      if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) continue;
-    }
+  if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
+    if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) return MS_SUCCESS;
+    if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) return MS_SUCCESS;
+  }
 
-    searchrect = map->query.rect;
-    if(lp->tolerance > 0) {
-      layer_tolerance = lp->tolerance;
+  searchrect = map->query.rect;
+  if(lp->tolerance > 0) {
+    layer_tolerance = lp->tolerance;
 
-      if(lp->toleranceunits == MS_PIXELS)
-        tolerance = layer_tolerance * msAdjustExtent(&(map->extent), map->width, map->height);
-      else
-        tolerance = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
+    if(lp->toleranceunits == MS_PIXELS)
+      tolerance = layer_tolerance * msAdjustExtent(&(map->extent), map->width, map->height);
+    else
+      tolerance = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
 
-      searchrect.minx -= tolerance;
-      searchrect.maxx += tolerance;
-      searchrect.miny -= tolerance;
-      searchrect.maxy += tolerance;
-    }
+    searchrect.minx -= tolerance;
+    searchrect.maxx += tolerance;
+    searchrect.miny -= tolerance;
+    searchrect.maxy += tolerance;
+  }
 
-    msRectToPolygon(searchrect, &searchshape);
+  /* Raster layers are handled specially. */
+  if( lp->type == MS_LAYER_RASTER ) {
+    if( msRasterQueryByRect( map, lp, searchrect ) == MS_FAILURE)
+      return MS_FAILURE;
 
-    /* Raster layers are handled specially. */
-    if( lp->type == MS_LAYER_RASTER ) {
-      if( msRasterQueryByRect( map, lp, searchrect ) == MS_FAILURE)
-        return MS_FAILURE;
+    return MS_SUCCESS;
+  }
 
-      continue;
-    }
+  /* Paging could have been disabled before */
+  paging = msLayerGetPaging(lp);
+  msLayerClose(lp); /* reset */
+  status = msLayerOpen(lp);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
+  msLayerEnablePaging(lp, paging);
 
-    /* Paging could have been disabled before */
-    paging = msLayerGetPaging(lp);
-    msLayerClose(lp); /* reset */
-    status = msLayerOpen(lp);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
-    msLayerEnablePaging(lp, paging);
+  /* build item list, we want *all* items */
+  status = msLayerWhichItems(lp, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
 
-    /* build item list, we want *all* items */
-    status = msLayerWhichItems(lp, MS_TRUE, NULL);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
+  msRectToPolygon(searchrect, &searchshape);
 
 #ifdef USE_PROJ
-    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-      msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
-    else
-      lp->project = MS_FALSE;
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+    msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+  else
+    lp->project = MS_FALSE;
 #endif
-    status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
-    if(status == MS_DONE) { /* no overlap */
-      msLayerClose(lp);
-      continue;
-    } else if(status != MS_SUCCESS) {
-      msLayerClose(lp);
-      return(MS_FAILURE);
-    }
-
-    lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
-    initResultCache( lp->resultcache);
+  status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
+  if(status == MS_DONE) { /* no overlap */
+    msFreeShape(&searchshape);
+    msLayerClose(lp);
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    msFreeShape(&searchshape);
+    msLayerClose(lp);
+    return(MS_FAILURE);
+  }
 
-    nclasses = 0;
-    classgroup = NULL;
-    if (lp->classgroup && lp->numclasses > 0)
-      classgroup = msAllocateValidClassGroups(lp, &nclasses);
+  lp->resultcache = (resultCacheObj *)msSmallMalloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
+  initResultCache( lp->resultcache);
 
-    if (lp->minfeaturesize > 0)
-      minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
+  nclasses = 0;
+  classgroup = NULL;
+  if (lp->classgroup && lp->numclasses > 0)
+    classgroup = msAllocateValidClassGroups(lp, &nclasses);
 
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+  if (lp->minfeaturesize > 0)
+    minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-      /* Check if the shape size is ok to be drawn */
-      if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
-        if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
-          if( lp->debug >= MS_DEBUGLEVEL_V )
-            msDebug("msQueryByRect(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-          msFreeShape(&shape);
-          continue;
-        }
-      }
+  while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
-      shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
-      if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+    /* Check if the shape size is ok to be drawn */
+    if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
+      if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
+        if( lp->debug >= MS_DEBUGLEVEL_V )
+          msDebug("msQueryByRect(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
         msFreeShape(&shape);
         continue;
       }
+    }
 
-      if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
-        msFreeShape(&shape);
-        continue;
-      }
+    shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
+    if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+      msFreeShape(&shape);
+      continue;
+    }
+
+    if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
+      msFreeShape(&shape);
+      continue;
+    }
 
 #ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-        msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
-        lp->project = MS_FALSE;
+    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+      msProjectShape(&(lp->projection), &(map->projection), &shape);
+    else
+      lp->project = MS_FALSE;
 #endif
 
-      if(msRectContained(&shape.bounds, &searchrect) == MS_TRUE) { /* if the whole shape is in, don't intersect */
-        status = MS_TRUE;
-      } else {
-        switch(shape.type) { /* make sure shape actually intersects the qrect (ADD FUNCTIONS SPECIFIC TO RECTOBJ) */
-          case MS_SHAPE_POINT:
-            status = msIntersectMultipointPolygon(&shape, &searchshape);
-            break;
-          case MS_SHAPE_LINE:
-            status = msIntersectPolylinePolygon(&shape, &searchshape);
-            break;
-          case MS_SHAPE_POLYGON:
-            status = msIntersectPolygons(&shape, &searchshape);
-            break;
-          default:
-            break;
-        }
+    if(msRectContained(&shape.bounds, &searchrect) == MS_TRUE) { /* if the whole shape is in, don't intersect */
+      status = MS_TRUE;
+    } else {
+      switch(shape.type) { /* make sure shape actually intersects the qrect (ADD FUNCTIONS SPECIFIC TO RECTOBJ) */
+        case MS_SHAPE_POINT:
+          status = msIntersectMultipointPolygon(&shape, &searchshape);
+          break;
+        case MS_SHAPE_LINE:
+          status = msIntersectPolylinePolygon(&shape, &searchshape);
+          break;
+        case MS_SHAPE_POLYGON:
+          status = msIntersectPolygons(&shape, &searchshape);
+          break;
+        default:
+          break;
       }
+    }
 
-      if(status == MS_TRUE) {
-        /* Should we skip this feature? */
-        if (!paging && map->query.startindex > 1) {
-          --map->query.startindex;
+    if(status == MS_TRUE) {
+      /* Should we skip this feature? */
+      if (!paging && map->query.startindex > 1) {
+        --map->query.startindex;
+        msFreeShape(&shape);
+        continue;
+      }
+      if(func) {
+        if(func(map, lp, &shape, data) != MS_SUCCESS) {
           msFreeShape(&shape);
-          continue;
+          status = MS_FAILURE;
+          break;
         }
+        lp->resultcache->numresults++;
+      } else
         addResult(lp->resultcache, &shape);
-        --map->query.maxfeatures;
-      }
-      msFreeShape(&shape);
-
-      /* check shape count */
-      if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
-        status = MS_DONE;
-        break;
-      }
-      
-    } /* next shape */
+    }
+    msFreeShape(&shape);
 
-    if (classgroup)
-      msFree(classgroup);
+    /* check shape count */
+    if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
+      status = MS_DONE;
+      break;
+    }
+  } /* next shape */
+
+  msFreeShape(&searchshape);
+  if (classgroup)
+    msFree(classgroup);
 
-    if(status != MS_DONE) return(MS_FAILURE);
+  if(status != MS_DONE) return(MS_FAILURE);
 
-    if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
-  } /* next layer */
+  if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
 
-  msFreeShape(&searchshape);
+  return(MS_SUCCESS);
+}
+
+static int queryByRectLayer(mapObj *map, int l)
+{
+  return queryByRectLayerFeatures(map, l, NULL, NULL);
+}
+
+int msQueryByRect(mapObj *map)
+{
+  int l; /* counters */
+  int start, stop=0;
+
+  if(map->query.type != MS_QUERY_BY_RECT) {
+    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByRect()");
+    return(MS_FAILURE);
+  }
+
+  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
+    start = map->numlayers-1;
+  else
+    start = stop = map->query.layer;
+
+  /* map->query.maxfeatures is shared by all layers */
+  if(msQueryLayers(map, queryByRectLayer, start, stop, MS_TRUE, MS_FALSE) != MS_SUCCESS)
+    return(MS_FAILURE);
 
   /* was anything found? */
   for(l=start; l>=stop; l--) {
@@ -1204,14 +1375,145 @@ int msQueryByRect(mapObj *map)
   return(MS_FAILURE);
 }
 
-static int is_duplicate(resultCacheObj *resultcache, int shapeindex, int tileindex)
+/*
+** Same selection as msQueryByRect() but each feature found is handed to func
+** (in map projection, with all its items) as soon as it is read, instead of
+** being kept in the layer result cache to be fetched again later. Memory use
+** doesn't grow with the number of features and output can start right away.
+** The layers are queried in the same order as msQueryByRect() (highest index
+** first, which matters with maxfeatures) and no results are left behind,
+** numresults is set to the number of features handed to func. Finding nothing
+** isn't an error here.
+*/
+int msQueryByRectStream(mapObj *map, msQueryFeatureFunc func, void *data, int *numresults)
+{
+  int l, start, stop=0, status;
+  layerObj *lp;
+
+  *numresults = 0;
+
+  if(map->query.type != MS_QUERY_BY_RECT) {
+    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByRectStream()");
+    return(MS_FAILURE);
+  }
+
+  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
+    start = map->numlayers-1;
+  else
+    start = stop = map->query.layer;
+
+  for(l=start; l>=stop; l--) {
+    lp = (GET_LAYER(map, l));
+    if (map->query.maxfeatures == 0)
+      break; /* nothing else to do */
+    else if (map->query.maxfeatures > 0)
+      lp->maxfeatures = map->query.maxfeatures;
+
+    /* using mapscript, the map->query.startindex will be unset... */
+    if (lp->startindex > 1 && map->query.startindex < 0)
+      map->query.startindex = lp->startindex;
+
+    status = queryByRectLayerFeatures(map, l, func, data);
+
+    if(lp->resultcache) {
+      *numresults += lp->resultcache->numresults;
+      if(map->query.maxfeatures > 0)
+        map->query.maxfeatures -= lp->resultcache->numresults;
+      msQueryFree(map, l); /* holds a count only */
+      msLayerClose(lp);
+    }
+
+    if(status != MS_SUCCESS)
+      return(MS_FAILURE);
+  }
+
+  return(MS_SUCCESS);
+}
+
+/*
+** Set of the (tileindex, shapeindex) pairs held in a result cache, kept next to
+** the cache while several selection shapes can find the same feature. An open
+** addressing hash table, so checking a candidate doesn't mean scanning every
+** result found so far.
+*/
+typedef struct {
+  long shapeindex;
+  int tileindex;
+  int used;
+} resultSetEntryObj;
+
+typedef struct {
+  resultSetEntryObj *entries;
+  int size; /* a power of 2 */
+  int numentries;
+} resultSetObj;
+
+static void initResultSet(resultSetObj *set)
+{
+  set->entries = NULL;
+  set->size = 0;
+  set->numentries = 0;
+}
+
+static void freeResultSet(resultSetObj *set)
+{
+  msFree(set->entries);
+  initResultSet(set);
+}
+
+static unsigned int resultSetHash(long shapeindex, int tileindex)
+{
+  unsigned long h = (unsigned long) shapeindex * 2654435761UL;
+  h ^= (unsigned long) tileindex * 40503UL + (h >> 16);
+  return (unsigned int) h;
+}
+
+static resultSetEntryObj *resultSetFind(resultSetObj *set, long shapeindex, int tileindex)
+{
+  unsigned int i;
+  resultSetEntryObj *entry;
+
+  i = resultSetHash(shapeindex, tileindex) & (set->size-1);
+  for(;;) {
+    entry = &(set->entries[i]);
+    if(!entry->used || (entry->shapeindex == shapeindex && entry->tileindex == tileindex))
+      return entry;
+    i = (i+1) & (set->size-1);
+  }
+}
+
+static int is_duplicate(resultSetObj *set, long shapeindex, int tileindex)
+{
+  if(set->numentries == 0) return(MS_FALSE);
+  return resultSetFind(set, shapeindex, tileindex)->used;
+}
+
+static void resultSetAdd(resultSetObj *set, long shapeindex, int tileindex)
 {
   int i;
+  resultSetEntryObj *entry;
+
+  if(2*(set->numentries+1) > set->size) { /* keep the table at most half full */
+    resultSetObj grown;
 
-  for(i=0; i<resultcache->numresults; i++)
-    if(resultcache->results[i].shapeindex == shapeindex && resultcache->results[i].tileindex == tileindex) return(MS_TRUE);
+    grown.size = (set->size == 0) ? 64 : set->size*2;
+    grown.numentries = 0;
+    grown.entries = (resultSetEntryObj *) msSmallCalloc(grown.size, sizeof(resultSetEntryObj));
+    for(i=0; i<set->size; i++) {
+      if(set->entries[i].used)
+        *resultSetFind(&grown, set->entries[i].shapeindex, set->entries[i].tileindex) = set->entries[i];
+    }
+    grown.numentries = set->numentries;
+    msFree(set->entries);
+    *set = grown;
+  }
 
-  return(MS_FALSE);
+  entry = resultSetFind(set, shapeindex, tileindex);
+  if(entry->used) return;
+  entry->shapeindex = shapeindex;
+  entry->tileindex = tileindex;
+  entry->used = MS_TRUE;
+  set->numentries++;
 }
 
 int msQueryByFeatures(mapObj *map)
@@ -1225,6 +1527,7 @@ int msQueryByFeatures(mapObj *map)
 
   rectObj searchrect;
   shapeObj shape, selectshape;
+  resultSetObj resultset;
   int nclasses = 0;
   int *classgroup = NULL;
   double minfeaturesize = -1;
@@ -1257,6 +1560,7 @@ int msQueryByFeatures(mapObj *map)
 
   msInitShape(&shape); /* initialize a few things */
   msInitShape(&selectshape);
+  initResultSet(&resultset);
 
   for(l=start; l>=stop; l--) {
     if(l == map->query.slayer) continue; /* skip the selection layer */
@@ -1325,12 +1629,14 @@ int msQueryByFeatures(mapObj *map)
       if(status != MS_SUCCESS) {
         msLayerClose(lp);
         msLayerClose(slp);
+        freeResultSet(&resultset);
         return(MS_FAILURE);
       }
 
       if(selectshape.type != MS_SHAPE_POLYGON && selectshape.type != MS_SHAPE_LINE) {
         msLayerClose(lp);
         msLayerClose(slp);
+        freeResultSet(&resultset);
         msSetError(MS_QUERYERR, "Selection features MUST be polygons or lines.", "msQueryByFeatures()");
         return(MS_FAILURE);
       }
@@ -1365,6 +1671,7 @@ int msQueryByFeatures(mapObj *map)
       } else if(status != MS_SUCCESS) {
         msLayerClose(lp);
         msLayerClose(slp);
+        freeResultSet(&resultset);
         return(MS_FAILURE);
       }
 
@@ -1386,7 +1693,10 @@ int msQueryByFeatures(mapObj *map)
       while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
         /* check for dups when there are multiple selection shapes */
-        if(i > 0 && is_duplicate(lp->resultcache, shape.index, shape.tileindex)) continue;
+        if(i > 0 && is_duplicate(&resultset, shape.index, shape.tileindex)) {
+          msFreeShape(&shape);
+          continue;
+        }
 
 
         /* Check if the shape size is ok to be drawn */
@@ -1493,6 +1803,8 @@ int msQueryByFeatures(mapObj *map)
             continue;
           }
           addResult(lp->resultcache, &shape);
+          if(slp->resultcache->numresults > 1)
+            resultSetAdd(&resultset, shape.index, shape.tileindex);
         }
         msFreeShape(&shape);
 
@@ -1506,11 +1818,16 @@ int msQueryByFeatures(mapObj *map)
       if (classgroup)
         msFree(classgroup);
 
-      if(status != MS_DONE) return(MS_FAILURE);
+      if(status != MS_DONE) {
+        freeResultSet(&resultset);
+        return(MS_FAILURE);
+      }
 
       msFreeShape(&selectshape);
     } /* next selection shape */
 
+    freeResultSet(&resultset);
+
     if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
   } /* next layer */
 
@@ -1524,31 +1841,17 @@ int msQueryByFeatures(mapObj *map)
   return(MS_FAILURE);
 }
 
-/* msQueryByPoint()
- *
- * With mode=MS_QUERY_SINGLE:
- *   Set maxresults = 0 to have a single result across all layers (the closest
- *     shape from the first layer that finds a match).
- *   Set maxresults = 1 to have up to one result per layer (the closest shape
- *     from each layer).
- *
- * With mode=MS_QUERY_MULTIPLE:
- *   Set maxresults = 0 to have an unlimited number of results.
- *   Set maxresults > 0 to limit the number of results per layer (the shapes
- *     returned are the first ones found in each layer and are not necessarily
- *     the closest ones).
- */
-int msQueryByPoint(mapObj *map)
+/*
+** Queries a single layer of a MS_QUERY_BY_POINT query, see msQueryLayers().
+*/
+static int queryByPointLayer(mapObj *map, int l)
 {
-  int l;
-  int start, stop=0;
+  layerObj *lp = GET_LAYER(map, l);
 
   double d, t;
   double layer_tolerance;
 
-  layerObj *lp;
-
-  int paging;
+  int paging, nearest, limit;
   char status;
   rectObj rect, searchrect;
   shapeObj shape;
@@ -1556,196 +1859,224 @@ int msQueryByPoint(mapObj *map)
   int *classgroup = NULL;
   double minfeaturesize = -1;
 
-  if(map->query.type != MS_QUERY_BY_POINT) {
-    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByPoint()");
-    return(MS_FAILURE);
-  }
-
   msInitShape(&shape);
 
-  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
-    start = map->numlayers-1;
-  else
-    start = stop = map->query.layer;
-
-  for(l=start; l>=stop; l--) {
-    lp = (GET_LAYER(map, l));
-    if (map->query.maxfeatures == 0)
-      break; /* nothing else to do */
-    else if (map->query.maxfeatures > 0)
-      lp->maxfeatures = map->query.maxfeatures;
-
-    /* using mapscript, the map->query.startindex will be unset... */
-    if (lp->startindex > 1 && map->query.startindex < 0)
-      map->query.startindex = lp->startindex;
-    
-    /* conditions may have changed since this layer last drawn, so set
-       layer->project true to recheck projection needs (Bug #673) */
-    lp->project = MS_TRUE;
+  /* conditions may have changed since this layer last drawn, so set
+     layer->project true to recheck projection needs (Bug #673) */
+  lp->project = MS_TRUE;
 
-    /* free any previous search results, do it now in case one of the next few tests fail */
-    if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
-      free(lp->resultcache);
-      lp->resultcache = NULL;
-    }
+  /* free any previous search results, do it now in case one of the next few tests fail */
+  if(lp->resultcache) {
+    if(lp->resultcache->results) free(lp->resultcache->results);
+    free(lp->resultcache);
+    lp->resultcache = NULL;
+  }
 
-    if(!msIsLayerQueryable(lp)) continue;
-    if(lp->status == MS_OFF) continue;
+  if(!msIsLayerQueryable(lp)) return MS_SUCCESS;
+  if(lp->status == MS_OFF) return MS_SUCCESS;
 
-    if(map->scaledenom > 0) {
-      if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) continue;
-      if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) continue;
-    }
+  if(map->scaledenom > 0) {
+    if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) return MS_SUCCESS;
+    if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) return MS_SUCCESS;
+  }
 
-    if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
-      if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) continue;
-      if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) continue;
-    }
+  if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
+    if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) return MS_SUCCESS;
+    if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) return MS_SUCCESS;
+  }
 
-    /* Raster layers are handled specially.  */
-    if( lp->type == MS_LAYER_RASTER ) {
-      if( msRasterQueryByPoint( map, lp, map->query.mode, map->query.point, map->query.buffer, map->query.maxresults ) == MS_FAILURE )
-        return MS_FAILURE;
-      continue;
-    }
+  /* Raster layers are handled specially.  */
+  if( lp->type == MS_LAYER_RASTER ) {
+    if( msRasterQueryByPoint( map, lp, map->query.mode, map->query.point, map->query.buffer, map->query.maxresults ) == MS_FAILURE )
+      return MS_FAILURE;
+    return MS_SUCCESS;
+  }
 
-    /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
-    if(lp->tolerance == -1) {
-      if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
-        layer_tolerance = 3;
-      else
-        layer_tolerance = 0;
-    } else
-      layer_tolerance = lp->tolerance;
+  /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
+  if(lp->tolerance == -1) {
+    if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
+      layer_tolerance = 3;
+    else
+      layer_tolerance = 0;
+  } else
+    layer_tolerance = lp->tolerance;
 
-    if(map->query.buffer <= 0) { /* use layer tolerance */
-      if(lp->toleranceunits == MS_PIXELS)
-        t = layer_tolerance * MS_MAX(MS_CELLSIZE(map->extent.minx, map->extent.maxx, map->width),
-                                     MS_CELLSIZE(map->extent.miny, map->extent.maxy, map->height));
-      else
-        t = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
-    } else /* use buffer distance */
-      t = map->query.buffer;
+  if(map->query.buffer <= 0) { /* use layer tolerance */
+    if(lp->toleranceunits == MS_PIXELS)
+      t = layer_tolerance * MS_MAX(MS_CELLSIZE(map->extent.minx, map->extent.maxx, map->width),
+                                   MS_CELLSIZE(map->extent.miny, map->extent.maxy, map->height));
+    else
+      t = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
+  } else /* use buffer distance */
+    t = map->query.buffer;
 
-    rect.minx = map->query.point.x - t;
-    rect.maxx = map->query.point.x + t;
-    rect.miny = map->query.point.y - t;
-    rect.maxy = map->query.point.y + t;
+  rect.minx = map->query.point.x - t;
+  rect.maxx = map->query.point.x + t;
+  rect.miny = map->query.point.y - t;
+  rect.maxy = map->query.point.y + t;
 
-    /* Paging could have been disabled before */
-    paging = msLayerGetPaging(lp);
-    msLayerClose(lp); /* reset */
-    status = msLayerOpen(lp);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
-    msLayerEnablePaging(lp, paging);
+  /* Paging could have been disabled before */
+  paging = msLayerGetPaging(lp);
+  msLayerClose(lp); /* reset */
+  status = msLayerOpen(lp);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
+  msLayerEnablePaging(lp, paging);
 
-    /* build item list, we want *all* items */
-    status = msLayerWhichItems(lp, MS_TRUE, NULL);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
+  /* build item list, we want *all* items */
+  status = msLayerWhichItems(lp, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
 
-    /* identify target shapes */
-    searchrect = rect;
+  /* identify target shapes, nearest first if only the closest one(s) are wanted */
+  searchrect = rect;
+  nearest = (map->query.mode == MS_QUERY_SINGLE || map->query.maxresults > 0) && map->query.startindex <= 1;
 #ifdef USE_PROJ
-    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-      msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
-    else
-      lp->project = MS_FALSE;
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection))) {
+    msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+    nearest = MS_FALSE; /* distances in the layer projection won't order the ones computed below */
+  } else
+    lp->project = MS_FALSE;
 #endif
+  if(nearest) {
+    /* the driver may stop at the first results only if none of them can be rejected below */
+    limit = (map->query.mode == MS_QUERY_SINGLE) ? 1 : map->query.maxresults;
+    if(!lp->template || lp->minfeaturesize > 0) limit = 0;
+    status = msLayerWhichShapesNearest(lp, searchrect, &(map->query.point), t, limit, &nearest);
+  } else
     status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
-    if(status == MS_DONE) { /* no overlap */
-      msLayerClose(lp);
-      continue;
-    } else if(status != MS_SUCCESS) {
-      msLayerClose(lp);
-      return(MS_FAILURE);
-    }
-
-    lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
-    initResultCache( lp->resultcache);
-
-    nclasses = 0;
-    classgroup = NULL;
-    if (lp->classgroup && lp->numclasses > 0)
-      classgroup = msAllocateValidClassGroups(lp, &nclasses);
+  if(status == MS_DONE) { /* no overlap */
+    msLayerClose(lp);
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    msLayerClose(lp);
+    return(MS_FAILURE);
+  }
 
-    if (lp->minfeaturesize > 0)
-      minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
+  lp->resultcache = (resultCacheObj *)msSmallMalloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
+  initResultCache( lp->resultcache);
 
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+  nclasses = 0;
+  classgroup = NULL;
+  if (lp->classgroup && lp->numclasses > 0)
+    classgroup = msAllocateValidClassGroups(lp, &nclasses);
 
-      /* Check if the shape size is ok to be drawn */
-      if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
-        if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
-          if( lp->debug >= MS_DEBUGLEVEL_V )
-            msDebug("msQueryByPoint(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-          msFreeShape(&shape);
-          continue;
-        }
-      }
+  if (lp->minfeaturesize > 0)
+    minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-      shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
-      if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
-        msFreeShape(&shape);
-        continue;
-      }
+  while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
-      if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
+    /* Check if the shape size is ok to be drawn */
+    if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
+      if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
+        if( lp->debug >= MS_DEBUGLEVEL_V )
+          msDebug("msQueryByPoint(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
         msFreeShape(&shape);
         continue;
       }
+    }
+
+    shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
+    if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+      msFreeShape(&shape);
+      continue;
+    }
+
+    if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
+      msFreeShape(&shape);
+      continue;
+    }
 
 #ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-        msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
-        lp->project = MS_FALSE;
+    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+      msProjectShape(&(lp->projection), &(map->projection), &shape);
+    else
+      lp->project = MS_FALSE;
 #endif
 
-      d = msDistancePointToShape(&(map->query.point), &shape);
-      if( d <= t ) { /* found one */
-
-        /* Should we skip this feature? */
-        if (!paging && map->query.startindex > 1) {
-          --map->query.startindex;
-          msFreeShape(&shape);
-          continue;
-        }
+    d = msDistancePointToShape(&(map->query.point), &shape);
+    if( d <= t ) { /* found one */
 
-        if(map->query.mode == MS_QUERY_SINGLE) {
-          lp->resultcache->numresults = 0;
-          addResult(lp->resultcache, &shape);
-          t = d; /* next one must be closer */
-        } else {
-          addResult(lp->resultcache, &shape);
-        }
+      /* Should we skip this feature? */
+      if (!paging && map->query.startindex > 1) {
+        --map->query.startindex;
+        msFreeShape(&shape);
+        continue;
       }
 
+      if(map->query.mode == MS_QUERY_SINGLE) {
+        lp->resultcache->numresults = 0;
+        addResult(lp->resultcache, &shape);
+        t = d; /* next one must be closer */
+      } else {
+        addResult(lp->resultcache, &shape);
+      }
+    } else if(nearest) { /* the remaining shapes are further away still */
       msFreeShape(&shape);
+      status = MS_DONE;
+      break;
+    }
 
-      if(map->query.mode == MS_QUERY_MULTIPLE && map->query.maxresults > 0 && lp->resultcache->numresults == map->query.maxresults) {
-        status = MS_DONE;   /* got enough results for this layer */
-        break;
-      }
+    msFreeShape(&shape);
 
-      /* check shape count */
-      if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
-        status = MS_DONE;
-        break;
-      }
-    } /* next shape */
+    if(nearest && map->query.mode == MS_QUERY_SINGLE && lp->resultcache->numresults > 0) {
+      status = MS_DONE;   /* that was the closest one */
+      break;
+    }
 
-    if (classgroup)
-      msFree(classgroup);
+    if(map->query.mode == MS_QUERY_MULTIPLE && map->query.maxresults > 0 && lp->resultcache->numresults == map->query.maxresults) {
+      status = MS_DONE;   /* got enough results for this layer */
+      break;
+    }
 
-    if(status != MS_DONE) return(MS_FAILURE);
+    /* check shape count */
+    if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
+      status = MS_DONE;
+      break;
+    }
+  } /* next shape */
 
-    if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
+  if (classgroup)
+    msFree(classgroup);
 
-    if((lp->resultcache->numresults > 0) && (map->query.mode == MS_QUERY_SINGLE) && (map->query.maxresults == 0))
-      break;   /* no need to search any further */
-  } /* next layer */
+  if(status != MS_DONE) return(MS_FAILURE);
+
+  if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
+
+  return(MS_SUCCESS);
+}
+
+/* msQueryByPoint()
+ *
+ * With mode=MS_QUERY_SINGLE:
+ *   Set maxresults = 0 to have a single result across all layers (the closest
+ *     shape from the first layer that finds a match).
+ *   Set maxresults = 1 to have up to one result per layer (the closest shape
+ *     from each layer).
+ *
+ * With mode=MS_QUERY_MULTIPLE:
+ *   Set maxresults = 0 to have an unlimited number of results.
+ *   Set maxresults > 0 to limit the number of results per layer (the shapes
+ *     returned are the closest ones from each layer, nearest first, unless the
+ *     layer is reprojected or startindex is used, in which case they are the
+ *     first ones found).
+ */
+int msQueryByPoint(mapObj *map)
+{
+  int l;
+  int start, stop=0;
+
+  if(map->query.type != MS_QUERY_BY_POINT) {
+    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByPoint()");
+    return(MS_FAILURE);
+  }
+
+  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
+    start = map->numlayers-1;
+  else
+    start = stop = map->query.layer;
+
+  /* a single result over all layers comes from the first layer with a match */
+  if(msQueryLayers(map, queryByPointLayer, start, stop, MS_FALSE, (map->query.mode == MS_QUERY_SINGLE && map->query.maxresults == 0)) != MS_SUCCESS)
+    return(MS_FAILURE);
 
   /* was anything found? */
   for(l=start; l>=stop; l--) {
@@ -1757,270 +2088,291 @@ int msQueryByPoint(mapObj *map)
   return(MS_FAILURE);
 }
 
-int msQueryByShape(mapObj *map)
+/*
+** Queries a single layer of a MS_QUERY_BY_SHAPE query, see msQueryLayers().
+*/
+static int queryByShapeLayer(mapObj *map, int l)
 {
-  int start, stop=0, l;
-  shapeObj shape, *qshape=NULL;
-  layerObj *lp;
+  layerObj *lp = GET_LAYER(map, l);
+  shapeObj shape, *qshape = map->query.shape;
   char status;
   double distance, tolerance, layer_tolerance;
-  rectObj searchrect;
+  rectObj searchrect, qrect;
 
   int nclasses = 0;
   int *classgroup = NULL;
   double minfeaturesize = -1;
 
-  if(map->query.type != MS_QUERY_BY_SHAPE) {
-    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByShape()");
-    return(MS_FAILURE);
-  }
+  msInitShape(&shape);
 
-  if(!(map->query.shape)) {
-    msSetError(MS_QUERYERR, "Query shape is not defined.", "msQueryByShape()");
-    return(MS_FAILURE);
+  /* conditions may have changed since this layer last drawn, so set
+     layer->project true to recheck projection needs (Bug #673) */
+  lp->project = MS_TRUE;
+
+  /* free any previous search results, do it now in case one of the next few tests fail */
+  if(lp->resultcache) {
+    if(lp->resultcache->results) free(lp->resultcache->results);
+    free(lp->resultcache);
+    lp->resultcache = NULL;
   }
-  if(map->query.shape->type != MS_SHAPE_POLYGON && map->query.shape->type != MS_SHAPE_LINE && map->query.shape->type != MS_SHAPE_POINT) {
-    msSetError(MS_QUERYERR, "Query shape MUST be a polygon, line or point.", "msQueryByShape()");
-    return(MS_FAILURE);
+
+  if(!msIsLayerQueryable(lp)) return MS_SUCCESS;
+  if(lp->status == MS_OFF) return MS_SUCCESS;
+
+  if(map->scaledenom > 0) {
+    if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) return MS_SUCCESS;
+    if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) return MS_SUCCESS;
   }
 
-  msInitShape(&shape);
-  qshape = map->query.shape; /* for brevity */
+  if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
+    if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) return MS_SUCCESS;
+    if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) return MS_SUCCESS;
+  }
 
-  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
-    start = map->numlayers-1;
-  else
-    start = stop = map->query.layer;
+  /* Raster layers are handled specially. */
+  if( lp->type == MS_LAYER_RASTER ) {
+    if( msRasterQueryByShape(map, lp, qshape) == MS_FAILURE )
+      return MS_FAILURE;
+    return MS_SUCCESS;
+  }
 
-  msComputeBounds(qshape); /* make sure an accurate extent exists */
+  /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
+  if(lp->tolerance == -1) {
+    if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
+      layer_tolerance = 3;
+    else
+      layer_tolerance = 0;
+  } else
+    layer_tolerance = lp->tolerance;
 
-  for(l=start; l>=stop; l--) { /* each layer */
-    lp = (GET_LAYER(map, l));
-    if (map->query.maxfeatures == 0)
-      break; /* nothing else to do */
-    else if (map->query.maxfeatures > 0)
-      lp->maxfeatures = map->query.maxfeatures;
+  if(lp->toleranceunits == MS_PIXELS)
+    tolerance = layer_tolerance * msAdjustExtent(&(map->extent), map->width, map->height);
+  else
+    tolerance = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
 
-    /* using mapscript, the map->query.startindex will be unset... */
-    if (lp->startindex > 1 && map->query.startindex < 0)
-      map->query.startindex = lp->startindex;
+  msLayerClose(lp); /* reset */
+  status = msLayerOpen(lp);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
+  /* disable driver paging */
+  msLayerEnablePaging(lp, MS_FALSE);
 
-    /* conditions may have changed since this layer last drawn, so set
-       layer->project true to recheck projection needs (Bug #673) */
-    lp->project = MS_TRUE;
+  /* build item list, we want *all* items */
+  status = msLayerWhichItems(lp, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
 
-    /* free any previous search results, do it now in case one of the next few tests fail */
-    if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
-      free(lp->resultcache);
-      lp->resultcache = NULL;
-    }
+  /* identify target shapes */
+  searchrect = qshape->bounds;
 
-    if(!msIsLayerQueryable(lp)) continue;
-    if(lp->status == MS_OFF) continue;
+  searchrect.minx -= tolerance; /* expand the search box to account for layer tolerances (e.g. buffered searches) */
+  searchrect.maxx += tolerance;
+  searchrect.miny -= tolerance;
+  searchrect.maxy += tolerance;
+  qrect = searchrect; /* candidates must overlap it, in map coordinates */
 
-    if(map->scaledenom > 0) {
-      if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) continue;
-      if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) continue;
-    }
+#ifdef USE_PROJ
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+    msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+  else
+    lp->project = MS_FALSE;
+#endif
 
-    if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
-      if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) continue;
-      if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) continue;
-    }
+  status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
+  if(status == MS_DONE) { /* no overlap */
+    msLayerClose(lp);
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    msLayerClose(lp);
+    return(MS_FAILURE);
+  }
 
-    /* Raster layers are handled specially. */
-    if( lp->type == MS_LAYER_RASTER ) {
-      if( msRasterQueryByShape(map, lp, qshape) == MS_FAILURE )
-        return MS_FAILURE;
-      continue;
-    }
+  lp->resultcache = (resultCacheObj *)msSmallMalloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
+  initResultCache( lp->resultcache);
 
-    /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
-    if(lp->tolerance == -1) {
-      if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
-        layer_tolerance = 3;
-      else
-        layer_tolerance = 0;
-    } else
-      layer_tolerance = lp->tolerance;
+  nclasses = 0;
+  classgroup = NULL;
+  if (lp->classgroup && lp->numclasses > 0)
+    classgroup = msAllocateValidClassGroups(lp, &nclasses);
 
-    if(lp->toleranceunits == MS_PIXELS)
-      tolerance = layer_tolerance * msAdjustExtent(&(map->extent), map->width, map->height);
-    else
-      tolerance = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
+  if (lp->minfeaturesize > 0)
+    minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    msLayerClose(lp); /* reset */
-    status = msLayerOpen(lp);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
-    /* disable driver paging */
-    msLayerEnablePaging(lp, MS_FALSE);
+  while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
-    /* build item list, we want *all* items */
-    status = msLayerWhichItems(lp, MS_TRUE, NULL);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
+    /* Check if the shape size is ok to be drawn */
+    if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
+      if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
+        if( lp->debug >= MS_DEBUGLEVEL_V )
+          msDebug("msQueryByShape(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
+        msFreeShape(&shape);
+        continue;
+      }
+    }
 
-    /* identify target shapes */
-    searchrect = qshape->bounds;
+    shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
+    if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+      msFreeShape(&shape);
+      continue;
+    }
 
-    searchrect.minx -= tolerance; /* expand the search box to account for layer tolerances (e.g. buffered searches) */
-    searchrect.maxx += tolerance;
-    searchrect.miny -= tolerance;
-    searchrect.maxy += tolerance;
+    if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
+      msFreeShape(&shape);
+      continue;
+    }
 
 #ifdef USE_PROJ
     if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-      msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+      msProjectShape(&(lp->projection), &(map->projection), &shape);
     else
       lp->project = MS_FALSE;
 #endif
 
-    status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
-    if(status == MS_DONE) { /* no overlap */
-      msLayerClose(lp);
+    /* cheap test first, a shape can't be any closer to the query shape than its bounds are */
+    msComputeBounds(&shape);
+    if(msRectOverlap(&shape.bounds, &qrect) != MS_TRUE) {
+      msFreeShape(&shape);
       continue;
-    } else if(status != MS_SUCCESS) {
-      msLayerClose(lp);
-      return(MS_FAILURE);
     }
 
-    lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
-    initResultCache( lp->resultcache);
-
-    nclasses = 0;
-    classgroup = NULL;
-    if (lp->classgroup && lp->numclasses > 0)
-      classgroup = msAllocateValidClassGroups(lp, &nclasses);
-
-    if (lp->minfeaturesize > 0)
-      minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
-
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
-
-      /* Check if the shape size is ok to be drawn */
-      if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
-        if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
-          if( lp->debug >= MS_DEBUGLEVEL_V )
-            msDebug("msQueryByShape(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-          msFreeShape(&shape);
-          continue;
+#ifdef USE_GEOS
+    if(tolerance == 0 && qshape->preparedgeometry && qshape->type != MS_SHAPE_POINT) /* just test for intersection */
+      status = (msGEOSIntersects(qshape, &shape) == MS_TRUE) ? MS_TRUE : MS_FALSE;
+    else
+#endif
+    switch(qshape->type) { /* may eventually support types other than polygon or line */
+      case MS_SHAPE_POLYGON:
+        switch(shape.type) { /* make sure shape actually intersects the shape */
+          case MS_SHAPE_POINT:
+            if(tolerance == 0) /* just test for intersection */
+              status = msIntersectMultipointPolygon(&shape, qshape);
+            else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          case MS_SHAPE_LINE:
+            if(tolerance == 0) { /* just test for intersection */
+              status = msIntersectPolylinePolygon(&shape, qshape);
+            } else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          case MS_SHAPE_POLYGON:
+            if(tolerance == 0) /* just test for intersection */
+              status = msIntersectPolygons(&shape, qshape);
+            else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          default:
+            break;
         }
-      }
+        break;
+      case MS_SHAPE_LINE:
+        switch(shape.type) { /* make sure shape actually intersects the selectshape */
+          case MS_SHAPE_POINT:
+            if(tolerance == 0) { /* just test for intersection */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance == 0) status = MS_TRUE;
+            } else {
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          case MS_SHAPE_LINE:
+            if(tolerance == 0) { /* just test for intersection */
+              status = msIntersectPolylines(&shape, qshape);
+            } else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          case MS_SHAPE_POLYGON:
+            if(tolerance == 0) /* just test for intersection */
+              status = msIntersectPolylinePolygon(qshape, &shape);
+            else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          default:
+            status = MS_FALSE;
+            break;
+        }
+        break;
+      case MS_SHAPE_POINT:
+        distance = msDistanceShapeToShape(qshape, &shape);
+        status = MS_FALSE;
+        if(tolerance == 0 && distance == 0) status = MS_TRUE; /* shapes intersect */
+        else if(distance < tolerance) status = MS_TRUE; /* shapes are close enough */
+        break;
+      default:
+        break; /* should never get here as we test for selection shape type explicitly earlier */
+    }
 
-      shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
-      if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+    if(status == MS_TRUE) {
+      /* Should we skip this feature? */
+      if (!msLayerGetPaging(lp) && map->query.startindex > 1) {
+        --map->query.startindex;
         msFreeShape(&shape);
         continue;
       }
+      addResult(lp->resultcache, &shape);
+    }
+    msFreeShape(&shape);
 
-      if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
-        msFreeShape(&shape);
-        continue;
-      }
+    /* check shape count */
+    if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
+      status = MS_DONE;
+      break;
+    }
+  } /* next shape */
 
-#ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-        msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
-        lp->project = MS_FALSE;
-#endif
+  if (classgroup)
+    msFree(classgroup);
 
-      switch(qshape->type) { /* may eventually support types other than polygon or line */
-        case MS_SHAPE_POLYGON:
-          switch(shape.type) { /* make sure shape actually intersects the shape */
-            case MS_SHAPE_POINT:
-              if(tolerance == 0) /* just test for intersection */
-                status = msIntersectMultipointPolygon(&shape, qshape);
-              else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            case MS_SHAPE_LINE:
-              if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylinePolygon(&shape, qshape);
-              } else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            case MS_SHAPE_POLYGON:
-              if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolygons(&shape, qshape);
-              else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            default:
-              break;
-          }
-          break;
-        case MS_SHAPE_LINE:
-          switch(shape.type) { /* make sure shape actually intersects the selectshape */
-            case MS_SHAPE_POINT:
-              if(tolerance == 0) { /* just test for intersection */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance == 0) status = MS_TRUE;
-              } else {
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            case MS_SHAPE_LINE:
-              if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylines(&shape, qshape);
-              } else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            case MS_SHAPE_POLYGON:
-              if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolylinePolygon(qshape, &shape);
-              else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            default:
-              status = MS_FALSE;
-              break;
-          }
-          break;
-        case MS_SHAPE_POINT:
-          distance = msDistanceShapeToShape(qshape, &shape);
-          status = MS_FALSE;
-          if(tolerance == 0 && distance == 0) status = MS_TRUE; /* shapes intersect */
-          else if(distance < tolerance) status = MS_TRUE; /* shapes are close enough */
-          break;
-        default:
-          break; /* should never get here as we test for selection shape type explicitly earlier */
-      }
+  if(status != MS_DONE) return(MS_FAILURE);
 
-      if(status == MS_TRUE) {
-        /* Should we skip this feature? */
-        if (!msLayerGetPaging(lp) && map->query.startindex > 1) {
-          --map->query.startindex;
-          msFreeShape(&shape);
-          continue;
-        }
-        addResult(lp->resultcache, &shape);
-      }
-      msFreeShape(&shape);
+  if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
 
-      /* check shape count */
-      if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
-        status = MS_DONE;
-        break;
-      }
-    } /* next shape */
+  return(MS_SUCCESS);
+}
 
-    if(status != MS_DONE) return(MS_FAILURE);
+int msQueryByShape(mapObj *map)
+{
+  int start, stop=0, l;
+  shapeObj *qshape=NULL;
 
-    if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
-  } /* next layer */
+  if(map->query.type != MS_QUERY_BY_SHAPE) {
+    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByShape()");
+    return(MS_FAILURE);
+  }
+
+  if(!(map->query.shape)) {
+    msSetError(MS_QUERYERR, "Query shape is not defined.", "msQueryByShape()");
+    return(MS_FAILURE);
+  }
+  if(map->query.shape->type != MS_SHAPE_POLYGON && map->query.shape->type != MS_SHAPE_LINE && map->query.shape->type != MS_SHAPE_POINT) {
+    msSetError(MS_QUERYERR, "Query shape MUST be a polygon, line or point.", "msQueryByShape()");
+    return(MS_FAILURE);
+  }
+
+  qshape = map->query.shape; /* for brevity */
+
+  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
+    start = map->numlayers-1;
+  else
+    start = stop = map->query.layer;
+
+  msComputeBounds(qshape); /* make sure an accurate extent exists */
+#ifdef USE_GEOS
+  if(queryLayersThreads(map, start, stop, MS_FALSE) == 1) /* a prepared geometry can't be shared between threads */
+    msGEOSPrepare(qshape); /* tested against every candidate of every layer */
+#endif
+
+  if(msQueryLayers(map, queryByShapeLayer, start, stop, MS_FALSE, MS_FALSE) != MS_SUCCESS)
+    return(MS_FAILURE);
 
   /* was anything found? */
   for(l=start; l>=stop; l--) {
@@ -120,15 +120,7 @@ static int msGetClass_String( layerObj *layer, colorObj *color, const char *pixe
         /*      Regular expression.  Rarely used for raster.                    */
         /* -------------------------------------------------------------------- */
       case(MS_REGEX):
-        if(!layer->class[i]->expression.compiled) {
-          if(ms_regcomp(&(layer->class[i]->expression.regex), layer->class[i]->expression.string, MS_REG_EXTENDED|MS_REG_NOSUB) != 0) { /* compile the expression  */
-            msSetError(MS_REGEXERR, "Invalid regular expression.", "msGetClass()");
-            return(-1);
-          }
-          layer->class[i]->expression.compiled = MS_TRUE;
-        }
-
-        if(ms_regexec(&(layer->class[i]->expression.regex), pixel_value, 0, NULL, 0) == 0) return(i); /* got a match */
+        if(msEvalRegexExpression(&(layer->class[i]->expression), pixel_value) == MS_TRUE) return(i); /* got a match */
         break;
 
         /* -------------------------------------------------------------------- */
@@ -151,7 +143,7 @@ static int msGetClass_String( layerObj *layer, colorObj *color, const char *pixe
         p.expr->curtoken = p.expr->tokens; /* reset */
         p.type = MS_PARSE_TYPE_BOOLEAN;
 
-        status = yyparse(&p);
+        status = msExecuteExpression(&p);
 
         if (status != 0) {
           msSetError(MS_PARSEERR, "Failed to parse expression: %s", "msGetClass_FloatRGB", expression->string);
@@ -357,12 +349,6 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
   if(layer->debug > 0 || map->debug > 1)
     msDebug( "msDrawRasterLayerLow(%s): entering.\n", layer->name );
 
-  if(!layer->data && !layer->tileindex) {
-    if(layer->debug == MS_TRUE)
-      msDebug( "msDrawRasterLayerLow(%s): layer data and tileindex NULL ... doing nothing.", layer->name );
-    return(0);
-  }
-
   if((layer->status != MS_ON) && (layer->status != MS_DEFAULT)) {
     if(layer->debug == MS_TRUE)
       msDebug( "msDrawRasterLayerLow(%s): not status ON or DEFAULT, doing nothing.", layer->name );
@@ -399,6 +385,25 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
     }
   }
 
+  /* density layers are computed from another layer, not read from a file */
+  if(msLayerGetProcessingKey(layer, "KERNELDENSITY_SOURCE") != NULL) {
+    void *kernel_density_cleanup_ptr = NULL;
+    if(msComputeKernelDensityDataset(map, image, layer, (void**)&hDS, &kernel_density_cleanup_ptr) != MS_SUCCESS)
+      return MS_FAILURE;
+    msAcquireLock( TLOCK_GDAL );
+    status = msDrawRasterLayerGDAL(map, layer, image, rb, hDS );
+    GDALClose( hDS );
+    msReleaseLock( TLOCK_GDAL );
+    msCleanupKernelDensityDataset(map, image, layer, kernel_density_cleanup_ptr);
+    return (status == -1) ? MS_FAILURE : MS_SUCCESS;
+  }
+
+  if(!layer->data && !layer->tileindex) {
+    if(layer->debug == MS_TRUE)
+      msDebug( "msDrawRasterLayerLow(%s): layer data and tileindex NULL ... doing nothing.", layer->name );
+    return(0);
+  }
+
   if(layer->tileindex) { /* we have an index file */
 
     msInitShape(&tshp);
@@ -384,6 +384,8 @@ extern "C" {
 #define MS_RENDER_WITH_IMAGEMAP 5
 #define MS_RENDER_WITH_TEMPLATE 8 /* query results only */
 #define MS_RENDER_WITH_OGR 16
+#define MS_RENDER_WITH_MVT 17
+#define MS_RENDER_WITH_GEOJSON 18
 
 #define MS_RENDER_WITH_PLUGIN 100
 #define MS_RENDER_WITH_CAIRO_RASTER   101
@@ -393,6 +395,7 @@ extern "C" {
 #define MS_RENDER_WITH_AGG 105
 #define MS_RENDER_WITH_GD 106
 #define MS_RENDER_WITH_KML 107
+#define MS_RENDER_WITH_UTFGRID 108
 
 #ifndef SWIG
 
@@ -402,6 +405,9 @@ extern "C" {
 #define MS_RENDERER_TEMPLATE(format) ((format)->renderer == MS_RENDER_WITH_TEMPLATE)
 #define MS_RENDERER_KML(format) ((format)->renderer == MS_RENDER_WITH_KML)
 #define MS_RENDERER_OGR(format) ((format)->renderer == MS_RENDER_WITH_OGR)
+#define MS_RENDERER_MVT(format) ((format)->renderer == MS_RENDER_WITH_MVT)
+#define MS_RENDERER_GEOJSON(format) ((format)->renderer == MS_RENDER_WITH_GEOJSON)
+#define MS_RENDERER_UTFGRID(format) ((format)->renderer == MS_RENDER_WITH_UTFGRID)
 
 #define MS_RENDERER_PLUGIN(format) ((format)->renderer > MS_RENDER_WITH_PLUGIN)
 
@@ -670,6 +676,8 @@ extern "C" {
 
   typedef tokenListNodeObj * tokenListNodeObjPtr;
 
+  typedef struct exprProgramObj exprProgramObj; /* see mapexpr.c */
+
   typedef struct {
     char *string;
     int type;
@@ -680,6 +688,7 @@ extern "C" {
     /* logical expression options */
     tokenListNodeObjPtr tokens;
     tokenListNodeObjPtr curtoken;
+    exprProgramObj *program; /* compiled form of the tokens, NULL if yyparse() is needed */
 
     /* regular expression options */
     ms_regex_t regex; /* compiled regular expression to be matched */
@@ -1583,6 +1592,8 @@ extern "C" {
 #ifndef SWIG
     char **items;
     void *iteminfo; /* connection specific information necessary to retrieve values */
+    void *classtable; /* class lookup table built by msShapeGetClass() */
+    void *bindingplan; /* bound style and label members, built by msBindLayerToShape() */
     expressionObj filter; /* connection specific attribute filter */
     int bandsitemindex;
     int filteritemindex;
@@ -1752,6 +1763,8 @@ extern "C" {
     unsigned char encryption_key[MS_ENCRYPTION_KEY_SIZE]; /* 128bits encryption key */
 
     queryObj query;
+
+    char *mapfile; /* absolute path of the file the map was loaded from */
 #endif
   };
 
@@ -1786,6 +1799,7 @@ extern "C" {
     char* (*LayerEscapePropertyName)(layerObj *layer, const char* pszString);
     void (*LayerEnablePaging)(layerObj *layer, int value);
     int (*LayerGetPaging)(layerObj *layer);
+    char* (*LayerBuildSQLSpatialFilter)(layerObj *layer, const char *pszOperator, shapeObj *shape, double dfDistance);
   };
 #endif /*SWIG*/
 
@@ -1930,6 +1944,7 @@ extern "C" {
   MS_DLL_EXPORT char *msWriteLegendToString(legendObj *legend);
   MS_DLL_EXPORT char *msWriteClusterToString(clusterObj *cluster);
   MS_DLL_EXPORT int msEvalRegex(char *e, char *s);
+  MS_DLL_EXPORT void msRegexCacheCleanup(void);
 #ifdef USE_MSFREE
   MS_DLL_EXPORT void msFree(void *p);
 #else
@@ -1996,6 +2011,9 @@ extern "C" {
   MS_DLL_EXPORT int msQueryByShape(mapObj *map);
   MS_DLL_EXPORT int msQueryByFilter(mapObj *map);
 
+  typedef int (*msQueryFeatureFunc)(mapObj *map, layerObj *layer, shapeObj *shape, void *data);
+  MS_DLL_EXPORT int msQueryByRectStream(mapObj *map, msQueryFeatureFunc func, void *data, int *numresults);
+
   MS_DLL_EXPORT int msGetQueryResultBounds(mapObj *map, rectObj *bounds);
   MS_DLL_EXPORT int msIsLayerQueryable(layerObj *lp);
   MS_DLL_EXPORT void msQueryFree(mapObj *map, int qlayer); /* todo: rename */
@@ -2033,6 +2051,7 @@ extern "C" {
   MS_DLL_EXPORT char *msEncodeUrl(const char*);
   MS_DLL_EXPORT char *msEncodeHTMLEntities(const char *string);
   MS_DLL_EXPORT void msDecodeHTMLEntities(const char *string);
+  MS_DLL_EXPORT char *msEscapeJSONString(const char *string);
   MS_DLL_EXPORT int msIsXMLTagValid(const char *string);
   MS_DLL_EXPORT char *msStringConcatenate(char *pszDest, const char *pszSrc);
   MS_DLL_EXPORT char *msJoinStrings(char **array, int arrayLength, const char *delimeter);
@@ -2201,6 +2220,7 @@ extern "C" {
   MS_DLL_EXPORT int msLayerIsOpen(layerObj *layer);
   MS_DLL_EXPORT void msLayerClose(layerObj *layer);
   MS_DLL_EXPORT int msLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery);
+  MS_DLL_EXPORT int msLayerWhichShapesNearest(layerObj *layer, rectObj rect, pointObj *point, double maxdistance, int maxresults, int *ordered);
   MS_DLL_EXPORT int msLayerGetItemIndex(layerObj *layer, char *item);
   MS_DLL_EXPORT int msLayerWhichItems(layerObj *layer, int get_all, char *metadata);
   MS_DLL_EXPORT int msLayerNextShape(layerObj *layer, shapeObj *shape);
@@ -2208,6 +2228,9 @@ extern "C" {
   MS_DLL_EXPORT int msLayerSetItems(layerObj *layer, char **items, int numitems);
   MS_DLL_EXPORT int msLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record);
   MS_DLL_EXPORT int msLayerGetExtent(layerObj *layer, rectObj *extent);
+  MS_DLL_EXPORT int msLayerUpdateCachedExtent(layerObj *layer, rectObj *extent);
+  MS_DLL_EXPORT int msLayerGetCachedExtent(layerObj *layer, rectObj *extent); /* in mapextentcache.c */
+  MS_DLL_EXPORT int msLayerSetCachedExtent(layerObj *layer, rectObj *extent);
   MS_DLL_EXPORT int msLayerSetExtent( layerObj *layer, double minx, double miny, double maxx, double maxy);
   MS_DLL_EXPORT int msLayerGetAutoStyle(mapObj *map, layerObj *layer, classObj *c, shapeObj* shape);
   MS_DLL_EXPORT int msLayerGetFeatureStyle(mapObj *map, layerObj *layer, classObj *c, shapeObj* shape);
@@ -2221,6 +2244,11 @@ extern "C" {
 
   MS_DLL_EXPORT int msLayerSupportsCommonFilters(layerObj *layer);
   MS_DLL_EXPORT int msTokenizeExpression(expressionObj *expression, char **list, int *listsize);
+#ifndef SWIG
+  MS_DLL_EXPORT int msCompileExpression(expressionObj *expression);
+  MS_DLL_EXPORT void msFreeExpressionProgram(expressionObj *expression);
+  MS_DLL_EXPORT int msExecuteExpression(parseObj *p);
+#endif
 
   MS_DLL_EXPORT int msLayerSetTimeFilter(layerObj *lp, const char *timestring,
                                          const char *timefield);
@@ -2250,6 +2278,7 @@ extern "C" {
 
   MS_DLL_EXPORT char *msLayerEscapeSQLParam(layerObj *layer, const char* pszString);
   MS_DLL_EXPORT char *msLayerEscapePropertyName(layerObj *layer, const char* pszString);
+  MS_DLL_EXPORT char *msLayerBuildSQLSpatialFilter(layerObj *layer, const char *pszOperator, shapeObj *shape, double dfDistance);
 
   /* These are special because SWF is using these */
   int msOGRLayerNextShape(layerObj *layer, shapeObj *shape);
@@ -2273,6 +2302,7 @@ extern "C" {
   MS_DLL_EXPORT int msSDELayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msOGRLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msPostGISLayerInitializeVirtualTable(layerObj *layer);
+  MS_DLL_EXPORT int msPostGISLayerWhichShapesNearest(layerObj *layer, rectObj rect, pointObj *point, int maxresults);
   MS_DLL_EXPORT int msOracleSpatialLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msWFSLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msGraticuleLayerInitializeVirtualTable(layerObj *layer);
@@ -2398,6 +2428,11 @@ extern "C" {
   MS_DLL_EXPORT int *msGetGDALBandList( layerObj *layer, void *hDS, int max_bands, int *band_count );
   MS_DLL_EXPORT double msGetGDALNoDataValue( layerObj *layer, void *hBand, int *pbGotNoData );
 
+  /* in mapkerneldensity.c */
+  MS_DLL_EXPORT int msComputeKernelDensity(mapObj *map, layerObj *layer, int width, int height, unsigned char *values);
+  MS_DLL_EXPORT int msComputeKernelDensityDataset(mapObj *map, imageObj *image, layerObj *layer, void **hDSvoid, void **cleanup_ptr);
+  MS_DLL_EXPORT int msCleanupKernelDensityDataset(mapObj *map, imageObj *image, layerObj *layer, void *cleanup_ptr);
+
   /* in mapchart.c */
   MS_DLL_EXPORT int msDrawChartLayer(mapObj *map, layerObj *layer, imageObj *image);
 
@@ -2422,10 +2457,15 @@ extern "C" {
   MS_DLL_EXPORT int getRgbColor(mapObj *map,int i,int *r,int *g,int *b); /* maputil.c */
 
   MS_DLL_EXPORT int msBindLayerToShape(layerObj *layer, shapeObj *shape, int querymapMode);
+  MS_DLL_EXPORT void msFreeBindingPlan(layerObj *layer);
   MS_DLL_EXPORT int msValidateContexts(mapObj *map);
   MS_DLL_EXPORT int msEvalContext(mapObj *map, layerObj *layer, char *context);
   MS_DLL_EXPORT int msEvalExpression(layerObj *layer, shapeObj *shape, expressionObj *expression, int itemindex);
+#ifndef SWIG
+  MS_DLL_EXPORT int msEvalRegexExpression(expressionObj *expression, const char *value);
+#endif
   MS_DLL_EXPORT int msShapeGetClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgroup, int numclasses);
+  MS_DLL_EXPORT void msFreeClassTable(layerObj *layer);
   MS_DLL_EXPORT int msShapeGetAnnotation(layerObj *layer, shapeObj *shape);
   MS_DLL_EXPORT int msShapeCheckSize(shapeObj *shape, double minfeaturesize);
   MS_DLL_EXPORT int msAdjustImage(rectObj rect, int *width, int *height);
@@ -2475,6 +2515,7 @@ extern "C" {
   MS_DLL_EXPORT char *msTmpFile(mapObj *map, const char *mappath, const char *tmppath, const char *ext);
   MS_DLL_EXPORT char *msTmpPath(mapObj *map, const char *mappath, const char *tmppath);
   MS_DLL_EXPORT char *msTmpFilename(const char *ext);
+  MS_DLL_EXPORT double msTmpMemoryMaxSize(mapObj *map);
   MS_DLL_EXPORT void msForceTmpFileBase( const char *new_base );
 
 
@@ -2533,6 +2574,9 @@ extern "C" {
   /*      prototypes for functions in mapgdal.c                           */
   /* ==================================================================== */
   MS_DLL_EXPORT int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename );
+  MS_DLL_EXPORT int msSaveRasterLayerGDAL( mapObj *map, layerObj *layer, int nBlockLines,
+      char *filename );
+  MS_DLL_EXPORT int msGDALStreamFile( const char *filename, const char *pszCaller );
   MS_DLL_EXPORT int msInitDefaultGDALOutputFormat( outputFormatObj *format );
 
   /* ==================================================================== */
@@ -2542,6 +2586,17 @@ extern "C" {
   MS_DLL_EXPORT int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format,
                                          int sendheaders );
 
+  /* ==================================================================== */
+  /*      prototypes for functions in mapmvt.c                            */
+  /* ==================================================================== */
+  MS_DLL_EXPORT int msMVTWriteTile( mapObj *map, int sendheaders );
+
+  /* ==================================================================== */
+  /*      prototypes for functions in mapgeojson.c                        */
+  /* ==================================================================== */
+  MS_DLL_EXPORT int msGeoJSONWriteFromQuery( mapObj *map, outputFormatObj *format,
+                                             int sendheaders );
+
   /* ==================================================================== */
   /*      Public prototype for mapogr.cpp functions.                      */
   /* ==================================================================== */
@@ -2605,6 +2660,7 @@ extern "C" {
   MS_DLL_EXPORT void msGEOSSetup(void);
   MS_DLL_EXPORT void msGEOSCleanup(void);
   MS_DLL_EXPORT void msGEOSFreeGeometry(shapeObj *shape);
+  MS_DLL_EXPORT int msGEOSPrepare(shapeObj *shape);
 
   MS_DLL_EXPORT shapeObj *msGEOSShapeFromWKT(const char *string);
   MS_DLL_EXPORT char *msGEOSShapeToWKT(shapeObj *shape);
@@ -2785,6 +2841,9 @@ extern "C" {
   MS_DLL_EXPORT int msPopulateRendererVTableGD( rendererVTableObj *renderer );
   MS_DLL_EXPORT int msPopulateRendererVTableKML( rendererVTableObj *renderer );
   MS_DLL_EXPORT int msPopulateRendererVTableOGR( rendererVTableObj *renderer );
+  MS_DLL_EXPORT int msPopulateRendererVTableMVT( rendererVTableObj *renderer );
+  MS_DLL_EXPORT int msPopulateRendererVTableGeoJSON( rendererVTableObj *renderer );
+  MS_DLL_EXPORT int msPopulateRendererVTableUTFGrid( rendererVTableObj *renderer );
 #ifdef USE_CAIRO
   MS_DLL_EXPORT void msCairoCleanup(void);
 #endif
@@ -2804,7 +2863,12 @@ extern "C" {
   int msQuantizeRasterBuffer(rasterBufferObj *rb, unsigned int *reqcolors, rgbaPixel *palette,
                              rgbaPixel *forced_palette, int num_forced_palette_entries,
                              unsigned int *palette_scaling_maxval);
+  int msQuantizeRasterBufferFast(rasterBufferObj *rb, unsigned int *reqcolors, rgbaPixel *palette,
+                                 unsigned int *palette_scaling_maxval);
   int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb);
+  int msGetCachedPalette(const char *key, rgbaPixel *palette, unsigned int *num_entries);
+  void msSetCachedPalette(const char *key, rgbaPixel *palette, unsigned int num_entries);
+  MS_DLL_EXPORT void msPaletteCacheCleanup(void);
   int msSaveRasterBuffer(mapObj *map, rasterBufferObj *data, FILE *stream, outputFormatObj *format);
   int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer, outputFormatObj *format);
   int msLoadMSRasterBufferFromFile(char *path, rasterBufferObj *rb);
@@ -2819,6 +2883,15 @@ extern "C" {
   MS_DLL_EXPORT void msBufferFree(bufferObj *buffer);
   MS_DLL_EXPORT void msBufferAppend(bufferObj *buffer, void *data, size_t length);
 
+  /* ==================================================================== */
+  /*      prototypes for functions in mapcoords.c                         */
+  /* ==================================================================== */
+  MS_DLL_EXPORT int msFormatDouble(char *buffer, size_t size, double value, int precision);
+  MS_DLL_EXPORT void msBufferAppendDouble(bufferObj *buffer, double value, int precision);
+  MS_DLL_EXPORT void msBufferAppendLineCoords(bufferObj *buffer, lineObj *line, int precision,
+      const char *prefix, const char *coordsep,
+      const char *suffix, const char *separator);
+
   typedef struct {
     int charWidth, charHeight;
   } fontMetrics;
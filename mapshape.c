@@ -1629,6 +1629,7 @@ int msShapefileOpen(shapefileObj *shpfile, char *mode, char *filename, int log_f
 
   /* initialize a few things */
   shpfile->status = NULL;
+  shpfile->nearest = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_FALSE;
 
@@ -1705,6 +1706,7 @@ int msShapefileCreate(shapefileObj *shpfile, char *filename, int type)
 
   /* initialize a few other things */
   shpfile->status = NULL;
+  shpfile->nearest = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_TRUE;
 
@@ -1718,6 +1720,8 @@ void msShapefileClose(shapefileObj *shpfile)
     if(shpfile->hSHP) msSHPClose(shpfile->hSHP);
     if(shpfile->hDBF) msDBFClose(shpfile->hDBF);
     if(shpfile->status) free(shpfile->status);
+    msTreeNearestFree(shpfile->nearest);
+    shpfile->nearest = NULL;
     shpfile->isopen = MS_FALSE;
   }
 }
@@ -1735,6 +1739,10 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
     free(shpfile->status);
     shpfile->status = NULL;
   }
+  if(shpfile->nearest) {
+    msTreeNearestFree(shpfile->nearest);
+    shpfile->nearest = NULL;
+  }
 
   shpfile->statusbounds = rect; /* save the search extent */
 
@@ -1787,6 +1795,23 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
   return(MS_SUCCESS); /* success */
 }
 
+/*
+** Same as msShapefileWhichShapes() but the selected shapes are then returned
+** by msSHPLayerNextShape() in order of increasing distance to point, skipping
+** those further away than maxdistance (-1 for no limit).
+*/
+int msShapefileWhichShapesNearest(shapefileObj *shpfile, rectObj rect, pointObj *point, double maxdistance, int debug)
+{
+  int status;
+
+  status = msShapefileWhichShapes(shpfile, rect, debug);
+  if(status != MS_SUCCESS) return status;
+
+  shpfile->nearest = msTreeNearestCreate(shpfile, point, maxdistance, debug);
+
+  return MS_SUCCESS;
+}
+
 /* Return the absolute path to the given layer's tileindex file's directory */
 void msTileIndexAbsoluteDir(char *tiFileAbsDir, layerObj *layer)
 {
@@ -2545,7 +2570,10 @@ int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
   }
 
   do {
-    i = msGetNextBit(shpfile->status, shpfile->lastshape + 1, shpfile->numshapes);
+    if(shpfile->nearest)
+      i = msTreeNearestNext(shpfile->nearest, NULL);
+    else
+      i = msGetNextBit(shpfile->status, shpfile->lastshape + 1, shpfile->numshapes);
     shpfile->lastshape = i;
     if(i == -1) return(MS_DONE); /* nothing else to read */
 
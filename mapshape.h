@@ -168,6 +168,10 @@ extern "C" {
     rectObj statusbounds; /* holds extent associated with the status vector */
 
     int isopen;
+
+#ifndef SWIG
+    struct treeNearestObj *nearest; /* when set, shapes are read back nearest first, see msShapefileWhichShapesNearest() */
+#endif
 #ifdef SWIG
     %mutable;
 #endif
@@ -186,6 +190,7 @@ extern "C" {
   MS_DLL_EXPORT int msShapefileCreate(shapefileObj *shpfile, char *filename, int type);
   MS_DLL_EXPORT void msShapefileClose(shapefileObj *shpfile);
   MS_DLL_EXPORT int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug);
+  MS_DLL_EXPORT int msShapefileWhichShapesNearest(shapefileObj *shpfile, rectObj rect, pointObj *point, double maxdistance, int debug);
 
   /* SHP/SHX function prototypes */
   MS_DLL_EXPORT SHPHandle msSHPOpen( const char * pszShapeFile, const char * pszAccess );
@@ -1174,6 +1174,57 @@ char *msEncodeHTMLEntities(const char *string)
   return newstring;
 }
 
+/* msEscapeJSONString()
+**
+** Return a copy of string that can be used between double quotes in a
+** JSON document: '"' and '\\' are backslash escaped and control characters
+** are written as \uXXXX escapes. UTF-8 sequences are left untouched.
+**/
+char *msEscapeJSONString(const char *string)
+{
+  int i;
+  char *newstring;
+  const char *c;
+
+  if(string == NULL)
+    return NULL;
+
+  /* worst case is every character written as a \uXXXX escape */
+  newstring = (char*)msSmallMalloc(strlen(string)*6+1);
+
+  for(i=0, c=string; *c != '\0'; c++) {
+    switch(*c) {
+      case '"':
+      case '\\':
+        newstring[i++] = '\\';
+        newstring[i++] = *c;
+        break;
+      case '\n':
+        newstring[i++] = '\\';
+        newstring[i++] = 'n';
+        break;
+      case '\r':
+        newstring[i++] = '\\';
+        newstring[i++] = 'r';
+        break;
+      case '\t':
+        newstring[i++] = '\\';
+        newstring[i++] = 't';
+        break;
+      default:
+        if((unsigned char)*c < 0x20) {
+          sprintf(newstring+i, "\\u%04x", (unsigned char)*c);
+          i += 6;
+        } else
+          newstring[i++] = *c;
+    }
+  }
+
+  newstring[i++] = '\0';
+
+  return newstring;
+}
+
 
 /* msDecodeHTMLEntities()
 **
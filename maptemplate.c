@@ -262,6 +262,15 @@ int msReturnTemplateQuery(mapservObj *mapserv, char *queryFormat, char **papszBu
       return status;
     }
 
+    if( MS_RENDERER_GEOJSON(outputFormat) ) {
+      if( mapserv != NULL )
+        checkWebScale(mapserv);
+
+      status = msGeoJSONWriteFromQuery(map, outputFormat, mapserv == NULL || mapserv->sendheaders);
+
+      return status;
+    }
+
     if( !MS_RENDERER_TEMPLATE(outputFormat) ) { /* got an image format, return the query results that way */
       outputFormatObj *tempOutputFormat = map->outputformat; /* save format */
 
@@ -1924,8 +1933,8 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
   int tagOffset, tagLength;
 
   char *argValue=NULL;
-  char *pointFormat1=NULL, *pointFormat2=NULL;
-  int pointFormatLength;
+  char *coordsep;
+  bufferObj coordsBuffer;
 
   /*
   ** Pointers to static strings, naming convention is:
@@ -1948,7 +1957,7 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
   char *projectionString=NULL;
 
   shapeObj tShape;
-  char *coords=NULL, point[128];
+  char *coords=NULL;
 
 
   if(!*line) {
@@ -2057,13 +2066,6 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
       if(argValue) projectionString = argValue;
     }
 
-    /* build the per point format strings (version 1 contains the coordinate seperator, version 2 doesn't) */
-    pointFormatLength = strlen("xh") + strlen("xf") + strlen("yh") + strlen("yf") + strlen("cs") + 10 + 1;
-    pointFormat1 = (char *) msSmallMalloc(pointFormatLength);
-    snprintf(pointFormat1, pointFormatLength, "%s%%.%dlf%s%s%%.%dlf%s%s", xh, precision, xf, yh, precision, yf, cs);
-    pointFormat2 = (char *) msSmallMalloc(pointFormatLength);
-    snprintf(pointFormat2, pointFormatLength, "%s%%.%dlf%s%s%%.%dlf%s", xh, precision, xf, yh, precision, yf);
-
     /* make a copy of the original shape or compute a centroid if necessary */
     msInitShape(&tShape);
     if(centroid == MS_TRUE) {
@@ -2156,7 +2158,20 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     ** build the coordinate string
     */
 
-    if(strlen(sh) > 0) coords = msStringConcatenate(coords, sh);
+    if(scale_x != 1.0 || scale_y != 1.0) {
+      for(i=0; i<tShape.numlines; i++) {
+        for(p=0; p<tShape.line[i].numpoints; p++) {
+          tShape.line[i].point[p].x *= scale_x;
+          tShape.line[i].point[p].y *= scale_y;
+        }
+      }
+    }
+
+    /* each point is xh x xf yh y yf, points are separated by cs */
+    coordsep = msStringConcatenate(msStrdup(xf), yh);
+    msBufferInit(&coordsBuffer);
+
+    if(strlen(sh) > 0) msBufferAppend(&coordsBuffer, sh, strlen(sh));
 
     /* do we need to handle inner/outer rings */
     if(tShape.type == MS_SHAPE_POLYGON && strlen(orh) > 0 && strlen(irh) > 0) {
@@ -2169,34 +2184,25 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
         int *inners;
         if( outers[i] ) {
           /* this is an outer ring */
-          if((!firstPart) && (strlen(ps) > 0)) coords = msStringConcatenate(coords, ps);
+          if((!firstPart) && (strlen(ps) > 0)) msBufferAppend(&coordsBuffer, ps, strlen(ps));
           firstPart = 0;
-          if(strlen(ph) > 0) coords = msStringConcatenate(coords, ph);
-          coords = msStringConcatenate(coords, orh);
-          for(p=0; p<tShape.line[i].numpoints-1; p++) {
-            snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-            coords = msStringConcatenate(coords, point);
-          }
-          snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-          coords = msStringConcatenate(coords, point);
-          coords = msStringConcatenate(coords, orf);
+          if(strlen(ph) > 0) msBufferAppend(&coordsBuffer, ph, strlen(ph));
+          msBufferAppend(&coordsBuffer, orh, strlen(orh));
+          msBufferAppendLineCoords(&coordsBuffer, &(tShape.line[i]), precision, xh, coordsep, yf, cs);
+          msBufferAppend(&coordsBuffer, orf, strlen(orf));
 
           inners = msGetInnerList(&tShape, i, outers);
           /* loop over rings looking for inners to this outer */
           for(j=0; j<tShape.numlines; j++) {
             if( inners[j] ) {
               /* j is an inner ring of i */
-              coords = msStringConcatenate(coords, irh);
-              for(p=0; p<tShape.line[j].numpoints-1; p++) {
-                snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y);
-                coords = msStringConcatenate(coords, point);
-              }
-              snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y);
-              coords = msStringConcatenate(coords, irf);
+              msBufferAppend(&coordsBuffer, irh, strlen(irh));
+              msBufferAppendLineCoords(&coordsBuffer, &(tShape.line[j]), precision, xh, coordsep, yf, cs);
+              msBufferAppend(&coordsBuffer, irf, strlen(irf));
             }
           }
           free( inners );
-          if(strlen(pf) > 0) coords = msStringConcatenate(coords, pf);
+          if(strlen(pf) > 0) msBufferAppend(&coordsBuffer, pf, strlen(pf));
         }
       } /* end of loop over outer rings */
       free( outers );
@@ -2209,21 +2215,21 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
             (tShape.type == MS_SHAPE_POLYGON && tShape.line[i].numpoints < 3))
           continue;
 
-        if(strlen(ph) > 0) coords = msStringConcatenate(coords, ph);
+        if(strlen(ph) > 0) msBufferAppend(&coordsBuffer, ph, strlen(ph));
 
-        for(p=0; p<tShape.line[i].numpoints-1; p++) {
-          snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-          coords = msStringConcatenate(coords, point);
-        }
-        snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-        coords = msStringConcatenate(coords, point);
+        msBufferAppendLineCoords(&coordsBuffer, &(tShape.line[i]), precision, xh, coordsep, yf, cs);
 
-        if(strlen(pf) > 0) coords = msStringConcatenate(coords, pf);
+        if(strlen(pf) > 0) msBufferAppend(&coordsBuffer, pf, strlen(pf));
 
-        if((i < tShape.numlines-1) && (strlen(ps) > 0)) coords = msStringConcatenate(coords, ps);
+        if((i < tShape.numlines-1) && (strlen(ps) > 0)) msBufferAppend(&coordsBuffer, ps, strlen(ps));
       }
     }
-    if(strlen(sf) > 0) coords = msStringConcatenate(coords, sf);
+    if(strlen(sf) > 0) msBufferAppend(&coordsBuffer, sf, strlen(sf));
+
+    /* terminate the string, the buffer is handed over to coords */
+    msBufferAppend(&coordsBuffer, "", 1);
+    coords = (char *) coordsBuffer.data;
+    free(coordsep);
 
     msFreeShape(&tShape);
 
@@ -2244,10 +2250,6 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     tag = NULL;
     msFreeHashTable(tagArgs);
     tagArgs=NULL;
-    free(pointFormat1);
-    pointFormat1 = NULL;
-    free(pointFormat2);
-    pointFormat2 = NULL;
     free(coords);
     coords = NULL;
 
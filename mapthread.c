@@ -59,6 +59,13 @@ possible to implement for other thread libraries if needed.
         Releases the indicated mutex.  If the lock id is invalid, or if the
         mutex is not currently held by this thread then results are undefined.
 
+  void msRunThreadJobs(msThreadJobFunc, void **args, int njobs, int max):
+        Runs the job function once for each of the njobs arguments, using up
+        to max threads (the calling thread being one of them), and returns
+        once all jobs are done.  Jobs must be independent of each other and
+        of any shared mapserver state.  Without USE_THREAD the jobs are run
+        sequentially in the calling thread.
+
 It is incredibly important to ensure that any mutex that is acquired is
 released as soon as possible.  Any flow of control that could result in a
 mutex not being release is going to be a disaster.
@@ -144,7 +151,8 @@ static int thread_debug = 0;
 
 static char *lock_names[] = {
   NULL, "PARSER", "GDAL", "ERROROBJ", "PROJ", "TTF", "POOL", "SDE",
-  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", NULL
+  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ",
+  "OGR", "TIME", "FRIBIDI", "QUANTIZE", "REGEX", "CAPCACHE", "GEOS", NULL
 };
 #endif
 
@@ -227,6 +235,77 @@ void msReleaseLock( int nLockId )
   pthread_mutex_unlock( mutex_locks + nLockId );
 }
 
+/************************************************************************/
+/*                          msRunThreadJobs()                           */
+/************************************************************************/
+
+typedef struct {
+  msThreadJobFunc func;
+  void **args;
+  int njobs;
+  int next;
+  pthread_mutex_t lock;
+} msThreadJobQueue;
+
+static void msThreadJobRun( msThreadJobQueue *queue )
+
+{
+  while( 1 ) {
+    int job;
+    pthread_mutex_lock( &queue->lock );
+    job = queue->next++;
+    pthread_mutex_unlock( &queue->lock );
+    if( job >= queue->njobs )
+      break;
+    queue->func( queue->args[job] );
+  }
+}
+
+static void *msThreadJobWorker( void *arg )
+
+{
+  msThreadJobRun( (msThreadJobQueue*) arg );
+  msResetErrorList(); /* drop this thread's entry of the error list */
+  return NULL;
+}
+
+void msRunThreadJobs( msThreadJobFunc func, void **args, int njobs,
+                      int max_threads )
+
+{
+  msThreadJobQueue queue;
+  pthread_t *threads;
+  int i, nthreads;
+
+  nthreads = MS_MIN( njobs, max_threads ) - 1;
+  threads = (nthreads > 0) ? (pthread_t*) msSmallMalloc( nthreads * sizeof(pthread_t) ) : NULL;
+
+  queue.func = func;
+  queue.args = args;
+  queue.njobs = njobs;
+  queue.next = 0;
+  pthread_mutex_init( &queue.lock, NULL );
+
+  for( i = 0; i < nthreads; i++ ) {
+    if( pthread_create( threads + i, NULL, msThreadJobWorker, &queue ) != 0 )
+      break;
+  }
+  nthreads = i;
+
+  if( thread_debug )
+    fprintf( stderr, "msRunThreadJobs(%d jobs, %d threads) (posix)\n",
+             njobs, nthreads + 1 );
+
+  /* the calling thread works too, and picks up whatever is left */
+  msThreadJobRun( &queue );
+
+  for( i = 0; i < nthreads; i++ )
+    pthread_join( threads[i], NULL );
+
+  pthread_mutex_destroy( &queue.lock );
+  msFree( threads );
+}
+
 #endif /* defined(USE_THREAD) && !defined(_WIN32) */
 
 /************************************************************************/
@@ -315,4 +394,95 @@ void msReleaseLock( int nLockId )
   ReleaseMutex( mutex_locks[nLockId] );
 }
 
+/************************************************************************/
+/*                          msRunThreadJobs()                           */
+/************************************************************************/
+
+typedef struct {
+  msThreadJobFunc func;
+  void **args;
+  int njobs;
+  volatile LONG next;
+} msThreadJobQueue;
+
+static void msThreadJobRun( msThreadJobQueue *queue )
+
+{
+  while( 1 ) {
+    int job = (int) InterlockedIncrement( &queue->next ) - 1;
+    if( job >= queue->njobs )
+      break;
+    queue->func( queue->args[job] );
+  }
+}
+
+static DWORD WINAPI msThreadJobWorker( LPVOID arg )
+
+{
+  msThreadJobRun( (msThreadJobQueue*) arg );
+  msResetErrorList(); /* drop this thread's entry of the error list */
+  return 0;
+}
+
+void msRunThreadJobs( msThreadJobFunc func, void **args, int njobs,
+                      int max_threads )
+
+{
+  msThreadJobQueue queue;
+  HANDLE *threads;
+  int i, nthreads;
+
+  nthreads = MS_MIN( njobs, max_threads ) - 1;
+  threads = (nthreads > 0) ? (HANDLE*) msSmallMalloc( nthreads * sizeof(HANDLE) ) : NULL;
+
+  queue.func = func;
+  queue.args = args;
+  queue.njobs = njobs;
+  queue.next = 0;
+
+  for( i = 0; i < nthreads; i++ ) {
+    threads[i] = CreateThread( NULL, 0, msThreadJobWorker, &queue, 0, NULL );
+    if( threads[i] == NULL )
+      break;
+  }
+  nthreads = i;
+
+  if( thread_debug )
+    fprintf( stderr, "msRunThreadJobs(%d jobs, %d threads) (win32)\n",
+             njobs, nthreads + 1 );
+
+  /* the calling thread works too, and picks up whatever is left */
+  msThreadJobRun( &queue );
+
+  for( i = 0; i < nthreads; i++ ) {
+    WaitForSingleObject( threads[i], INFINITE );
+    CloseHandle( threads[i] );
+  }
+  msFree( threads );
+}
+
 #endif /* defined(USE_THREAD) && defined(_WIN32) */
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          NO THREAD SUPPORT                           */
+/* ==================================================================== */
+/************************************************************************/
+
+#if !defined(USE_THREAD)
+
+/************************************************************************/
+/*                          msRunThreadJobs()                           */
+/************************************************************************/
+
+void msRunThreadJobs( msThreadJobFunc func, void **args, int njobs,
+                      int max_threads )
+
+{
+  int i;
+
+  for( i = 0; i < njobs; i++ )
+    func( args[i] );
+}
+
+#endif /* !defined(USE_THREAD) */
@@ -46,6 +46,15 @@ extern "C" {
 #define msReleaseLock(x)
 #endif
 
+  /*
+  ** Run njobs independent jobs, spread over at most max_threads worker
+  ** threads (the calling thread included). Jobs must not touch shared
+  ** mapserver state, and must report their status through their argument.
+  ** Without thread support the jobs are simply run one after another.
+  */
+  typedef void (*msThreadJobFunc)(void *arg);
+  void msRunThreadJobs(msThreadJobFunc func, void **args, int njobs, int max_threads);
+
   /*
   ** lock ids - note there is a corresponding lock_names[] array in
   ** mapthread.c that needs to be extended when new ids are added.
@@ -67,8 +76,12 @@ extern "C" {
 #define TLOCK_OGR       14
 #define TLOCK_TIME      15
 #define TLOCK_FRIBIDI   16
+#define TLOCK_QUANTIZE  17
+#define TLOCK_REGEX     18
+#define TLOCK_CAPCACHE  19
+#define TLOCK_GEOS      20
 
-#define TLOCK_STATIC_MAX 20
+#define TLOCK_STATIC_MAX 21
 #define TLOCK_MAX       100
 
 #ifdef __cplusplus
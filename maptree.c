@@ -776,3 +776,254 @@ void msFilterTreeSearch(shapefileObj *shp, ms_bitarray status, rectObj search_re
   }
 
 }
+
+/* -------------------------------------------------------------------- */
+/*      Nearest neighbour search.  A best-first walk of the disk tree:  */
+/*      tree nodes and shape bounds are queued by their distance to the */
+/*      search point (a lower bound for anything below them) and shapes */
+/*      by their exact distance, so shapes come off the queue in order  */
+/*      of increasing distance.  Only the shapes flagged in the         */
+/*      shapefile's status array are considered.                        */
+/* -------------------------------------------------------------------- */
+#define MS_NEAREST_NODE   0
+#define MS_NEAREST_BOUNDS 1
+#define MS_NEAREST_SHAPE  2
+
+/* size of a node header on disk: offset, rect and numshapes */
+#define MS_NEAREST_NODE_HEADER (sizeof(ms_int32) + sizeof(rectObj) + sizeof(ms_int32))
+
+typedef struct {
+  double distance;
+  int type;
+  long offset; /* file offset of a tree node */
+  ms_int32 id; /* shape index */
+} treeNearestEntry;
+
+struct treeNearestObj {
+  shapefileObj *shp;
+  pointObj point;
+  double maxdistance; /* entries further away are never queued, -1 for no limit */
+  SHPTreeHandle disktree;
+
+  treeNearestEntry *queue; /* binary heap */
+  int numentries, maxentries;
+};
+
+static double nearestRectDistance(pointObj *p, rectObj *rect)
+{
+  double dx=0, dy=0;
+
+  if(p->x < rect->minx) dx = rect->minx - p->x;
+  else if(p->x > rect->maxx) dx = p->x - rect->maxx;
+  if(p->y < rect->miny) dy = rect->miny - p->y;
+  else if(p->y > rect->maxy) dy = p->y - rect->maxy;
+
+  return sqrt(dx*dx + dy*dy);
+}
+
+/*
+** Queue order: distance first, then anything that may still hold a closer
+** shape before an actual shape, and equally distant shapes from the highest
+** index down, which is the one a linear scan would have kept last.
+*/
+static int nearestEntryBefore(treeNearestEntry *a, treeNearestEntry *b)
+{
+  if(a->distance != b->distance) return (a->distance < b->distance);
+  if(a->type != b->type) return (a->type < b->type);
+  return (a->id > b->id);
+}
+
+static void nearestPush(treeNearestObj *nearest, double distance, int type, long offset, ms_int32 id)
+{
+  int i, parent;
+  treeNearestEntry entry;
+
+  if(nearest->maxdistance >= 0 && distance > nearest->maxdistance) return;
+
+  if(nearest->numentries == nearest->maxentries) {
+    nearest->maxentries = (nearest->maxentries == 0) ? 64 : nearest->maxentries*2;
+    nearest->queue = (treeNearestEntry *) msSmallRealloc(nearest->queue, nearest->maxentries*sizeof(treeNearestEntry));
+  }
+
+  entry.distance = distance;
+  entry.type = type;
+  entry.offset = offset;
+  entry.id = id;
+
+  i = nearest->numentries++;
+  while(i > 0) {
+    parent = (i-1)/2;
+    if(!nearestEntryBefore(&entry, &(nearest->queue[parent]))) break;
+    nearest->queue[i] = nearest->queue[parent];
+    i = parent;
+  }
+  nearest->queue[i] = entry;
+}
+
+static treeNearestEntry nearestPop(treeNearestObj *nearest)
+{
+  int i, child;
+  treeNearestEntry top, last;
+
+  top = nearest->queue[0];
+  last = nearest->queue[--nearest->numentries];
+
+  i = 0;
+  while((child = 2*i+1) < nearest->numentries) {
+    if(child+1 < nearest->numentries && nearestEntryBefore(&(nearest->queue[child+1]), &(nearest->queue[child])))
+      child++;
+    if(!nearestEntryBefore(&(nearest->queue[child]), &last)) break;
+    nearest->queue[i] = nearest->queue[child];
+    i = child;
+  }
+  if(nearest->numentries > 0) nearest->queue[i] = last;
+
+  return top;
+}
+
+static void nearestPushBounds(treeNearestObj *nearest, ms_int32 id)
+{
+  rectObj bounds;
+
+  if(id < 0 || id >= nearest->shp->numshapes || !msGetBit(nearest->shp->status, id)) return;
+  if(msSHPReadBounds(nearest->shp->hSHP, id, &bounds) != MS_SUCCESS) return;
+
+  nearestPush(nearest, nearestRectDistance(&(nearest->point), &bounds), MS_NEAREST_BOUNDS, 0, id);
+}
+
+/* reads the header of the node at the current file position */
+static int nearestReadNodeHeader(SHPTreeHandle disktree, ms_int32 *offset, rectObj *rect, ms_int32 *numshapes)
+{
+  if(fread(offset, 4, 1, disktree->fp) != 1) return MS_FAILURE;
+  if(fread(rect, sizeof(rectObj), 1, disktree->fp) != 1) return MS_FAILURE;
+  if(fread(numshapes, 4, 1, disktree->fp) != 1) return MS_FAILURE;
+
+  if ( disktree->needswap ) {
+    SwapWord ( 4, offset );
+    SwapWord ( 8, &rect->minx );
+    SwapWord ( 8, &rect->miny );
+    SwapWord ( 8, &rect->maxx );
+    SwapWord ( 8, &rect->maxy );
+    SwapWord ( 4, numshapes );
+  }
+
+  return MS_SUCCESS;
+}
+
+/* queues the shapes held by a node and the node's children */
+static void nearestExpandNode(treeNearestObj *nearest, long position)
+{
+  int i;
+  ms_int32 offset, numshapes, numsubnodes, id;
+  rectObj rect;
+  SHPTreeHandle disktree = nearest->disktree;
+
+  if(fseek(disktree->fp, position, SEEK_SET) != 0) return;
+  if(nearestReadNodeHeader(disktree, &offset, &rect, &numshapes) != MS_SUCCESS) return;
+
+  for(i=0; i<numshapes; i++) {
+    if(fread(&id, 4, 1, disktree->fp) != 1) return;
+    if ( disktree->needswap ) SwapWord ( 4, &id );
+    nearestPushBounds(nearest, id);
+  }
+
+  if(fread(&numsubnodes, 4, 1, disktree->fp) != 1) return;
+  if ( disktree->needswap ) SwapWord ( 4, &numsubnodes );
+
+  /* sub-nodes follow one another, each one followed by its own descendants */
+  position = ftell(disktree->fp);
+  for(i=0; i<numsubnodes; i++) {
+    if(fseek(disktree->fp, position, SEEK_SET) != 0) return;
+    if(nearestReadNodeHeader(disktree, &offset, &rect, &numshapes) != MS_SUCCESS) return;
+    nearestPush(nearest, nearestRectDistance(&(nearest->point), &rect), MS_NEAREST_NODE, position, 0);
+    position += MS_NEAREST_NODE_HEADER + numshapes*sizeof(ms_int32) + sizeof(ms_int32) + offset;
+  }
+}
+
+/*
+** Starts a nearest neighbour search of the shapes flagged in shp->status (see
+** msShapefileWhichShapes()) around point. Shapes further away than maxdistance
+** are never returned, use -1 for no limit. The .qix index is used when there is
+** one, otherwise the candidates are ordered by their bounds.
+*/
+treeNearestObj *msTreeNearestCreate(shapefileObj *shp, pointObj *point, double maxdistance, int debug)
+{
+  int i;
+  char *filename, *sourcename, *s;
+  treeNearestObj *nearest;
+
+  if(!shp || !shp->status) return NULL;
+
+  nearest = (treeNearestObj *) msSmallCalloc(1, sizeof(treeNearestObj));
+  nearest->shp = shp;
+  nearest->point = *point;
+  nearest->maxdistance = maxdistance;
+
+  /* deal with case where sourcename is of the form 'file.shp' */
+  sourcename = msStrdup(shp->source);
+  s = strstr(sourcename, ".shp");
+  if( s ) *s = '\0';
+  filename = (char *) msSmallMalloc(strlen(sourcename)+strlen(MS_INDEX_EXTENSION)+1);
+  sprintf(filename, "%s%s", sourcename, MS_INDEX_EXTENSION);
+  nearest->disktree = msSHPDiskTreeOpen(filename, debug);
+  free(filename);
+  free(sourcename);
+
+  if(nearest->disktree) {
+    nearestPush(nearest, 0, MS_NEAREST_NODE, ftell(nearest->disktree->fp), 0); /* the root */
+  } else {
+    i = msGetNextBit(shp->status, 0, shp->numshapes);
+    while(i >= 0) {
+      nearestPushBounds(nearest, i);
+      i = msGetNextBit(shp->status, i+1, shp->numshapes);
+    }
+  }
+
+  if(debug)
+    msDebug("msTreeNearestCreate(): nearest neighbour search of %s %s the spatial index.\n", shp->source, nearest->disktree?"using":"without");
+
+  return nearest;
+}
+
+/*
+** Returns the index of the next nearest shape, and its distance to the search
+** point when distance is not NULL, or -1 once there is none left.
+*/
+int msTreeNearestNext(treeNearestObj *nearest, double *distance)
+{
+  treeNearestEntry entry;
+  shapeObj shape;
+
+  if(!nearest) return -1;
+
+  while(nearest->numentries > 0) {
+    entry = nearestPop(nearest);
+
+    switch(entry.type) {
+      case MS_NEAREST_SHAPE:
+        if(distance) *distance = entry.distance;
+        return entry.id;
+      case MS_NEAREST_BOUNDS:
+        msInitShape(&shape);
+        msSHPReadShape(nearest->shp->hSHP, entry.id, &shape);
+        if(shape.type != MS_SHAPE_NULL)
+          nearestPush(nearest, msDistancePointToShape(&(nearest->point), &shape), MS_NEAREST_SHAPE, 0, entry.id);
+        msFreeShape(&shape);
+        break;
+      case MS_NEAREST_NODE:
+        nearestExpandNode(nearest, entry.offset);
+        break;
+    }
+  }
+
+  return -1;
+}
+
+void msTreeNearestFree(treeNearestObj *nearest)
+{
+  if(!nearest) return;
+
+  if(nearest->disktree) msSHPDiskTreeClose(nearest->disktree);
+  msFree(nearest->queue);
+  msFree(nearest);
+}
@@ -69,6 +69,9 @@ extern "C" {
   } SHPTreeInfo;
   typedef SHPTreeInfo * SHPTreeHandle;
 
+  /* state of a nearest neighbour search, see msTreeNearestCreate() */
+  typedef struct treeNearestObj treeNearestObj;
+
 #define MS_LSB_ORDER -1
 #define MS_MSB_ORDER -2
 #define MS_NATIVE_ORDER 0
@@ -92,6 +95,10 @@ extern "C" {
 
   MS_DLL_EXPORT void msFilterTreeSearch(shapefileObj *shp, ms_bitarray status, rectObj search_rect);
 
+  MS_DLL_EXPORT treeNearestObj *msTreeNearestCreate(shapefileObj *shp, pointObj *point, double maxdistance, int debug);
+  MS_DLL_EXPORT int msTreeNearestNext(treeNearestObj *nearest, double *distance);
+  MS_DLL_EXPORT void msTreeNearestFree(treeNearestObj *nearest);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,676 @@
+/**********************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  UTFGrid interactivity renderer
+ * Author:   Steve Lime and the MapServer team.
+ *
+ **********************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ **********************************************************************/
+
+/*
+** The UTFGrid renderer goes through the normal drawing pipeline, but instead
+** of colors it burns the id of the feature being drawn into a grid that is
+** UTFRESOLUTION (default 4) times coarser than the requested image. The
+** grid is written as JSON (see the UTFGrid 1.3 specification) with the key
+** and attributes of every feature that is still visible in the grid.
+**
+** Layer metadata:
+**   utfgrid_item           item used as the feature key, features of the
+**                          layer sharing a key share their grid id
+**                          (default: draw order)
+**
+** When the grid holds features of several layers, every key is written as
+** "<layer name>:<key>" so the keys stay unique.
+**   utfgrid_include_items  attributes written in "data", "all" (default),
+**                          "none" or a comma separated list of item names
+*/
+
+#include "mapserver.h"
+
+typedef struct {
+  char *key;
+  char *data; /* JSON object with the feature attributes, NULL if none */
+  int layerindex;
+} utfgridFeature;
+
+typedef struct {
+  int resolution;
+  int width, height;          /* grid size */
+  unsigned int *grid;         /* feature ids, 0 is no feature */
+
+  utfgridFeature *features;   /* feature of id i is features[i-1] */
+  int numfeatures, maxfeatures;
+  hashTableObj *keys;         /* "layerindex:key" -> id for item keyed features */
+
+  /* layer being drawn, its items are resolved at the first shape */
+  layerObj *layer;
+  int itemsresolved;
+  int keyitemindex;
+  int *dataitems;
+  int numdataitems;
+
+  unsigned int current;       /* id of the shape being drawn, 0 outside shapes */
+  bufferObj scratch;
+} utfgridObj;
+
+#define UTFGRID_RENDERER(image) ((utfgridObj*) (image)->img.plugin)
+
+/* same metrics as the agg raster fonts so label placement does not change */
+static fontMetrics utfgridRasterFontSizes[] = {
+  {5,10}, {5,11}, {6,11}, {7,12}, {7,12}
+};
+
+/************************************************************************/
+/*                          grid rasterization                          */
+/************************************************************************/
+
+/* mark the cells whose center is inside the box, given in grid units */
+static void utfgridFillBox(utfgridObj *u, double minx, double miny, double maxx, double maxy)
+{
+  int i, j, i0, i1, j0, j1;
+
+  i0 = (int)ceil(minx-0.5);
+  i1 = (int)floor(maxx-0.5);
+  if(i0 > i1) /* smaller than a cell, keep the cell under its center */
+    i0 = i1 = (int)floor((minx+maxx)*0.5);
+  j0 = (int)ceil(miny-0.5);
+  j1 = (int)floor(maxy-0.5);
+  if(j0 > j1)
+    j0 = j1 = (int)floor((miny+maxy)*0.5);
+
+  i0 = MS_MAX(i0, 0);
+  j0 = MS_MAX(j0, 0);
+  i1 = MS_MIN(i1, u->width-1);
+  j1 = MS_MIN(j1, u->height-1);
+
+  for(j=j0; j<=j1; j++)
+    for(i=i0; i<=i1; i++)
+      u->grid[j*u->width+i] = u->current;
+}
+
+static int utfgridCompareDouble(const void *a, const void *b)
+{
+  double da = *(const double*)a, db = *(const double*)b;
+  return (da < db) ? -1 : (da > db);
+}
+
+/* even-odd scanline fill, sampled at the center of every grid cell */
+static void utfgridFillPolygon(utfgridObj *u, shapeObj *p)
+{
+  int i, j, k, n, total = 0, row0, row1;
+  double miny = HUGE_VAL, maxy = -HUGE_VAL, res = u->resolution;
+  double *xs;
+
+  for(i=0; i<p->numlines; i++) {
+    total += p->line[i].numpoints;
+    for(j=0; j<p->line[i].numpoints; j++) {
+      miny = MS_MIN(miny, p->line[i].point[j].y);
+      maxy = MS_MAX(maxy, p->line[i].point[j].y);
+    }
+  }
+  if(total < 3)
+    return;
+
+  row0 = MS_MAX((int)ceil(miny/res-0.5), 0);
+  row1 = MS_MIN((int)floor(maxy/res-0.5), u->height-1);
+  xs = (double*)msSmallMalloc(sizeof(double)*(total+p->numlines));
+
+  for(j=row0; j<=row1; j++) {
+    double ys = (j+0.5)*res;
+    n = 0;
+    for(i=0; i<p->numlines; i++) {
+      lineObj *line = &(p->line[i]);
+      for(k=0; k<line->numpoints; k++) {
+        pointObj *a = &(line->point[k]);
+        pointObj *b = &(line->point[(k+1) % line->numpoints]);
+        if((a->y <= ys && b->y > ys) || (b->y <= ys && a->y > ys))
+          xs[n++] = a->x + (ys - a->y) * (b->x - a->x) / (b->y - a->y);
+      }
+    }
+    if(n < 2)
+      continue;
+    qsort(xs, n, sizeof(double), utfgridCompareDouble);
+    for(k=0; k+1<n; k+=2) {
+      int c0 = MS_MAX((int)ceil(xs[k]/res-0.5), 0);
+      int c1 = MS_MIN((int)ceil(xs[k+1]/res-0.5)-1, u->width-1);
+      for(i=c0; i<=c1; i++)
+        u->grid[j*u->width+i] = u->current;
+    }
+  }
+
+  free(xs);
+}
+
+/* sweep a square brush of the line width along every segment */
+static void utfgridDrawLine(utfgridObj *u, shapeObj *p, double width)
+{
+  int i, j, s, steps;
+  double hw = MS_MAX(width*0.5/u->resolution, 0.5);
+
+  for(i=0; i<p->numlines; i++) {
+    lineObj *line = &(p->line[i]);
+    for(j=0; j<line->numpoints; j++) {
+      double x0 = line->point[j].x/u->resolution, y0 = line->point[j].y/u->resolution;
+      double x1 = x0, y1 = y0;
+      if(j+1 < line->numpoints) {
+        x1 = line->point[j+1].x/u->resolution;
+        y1 = line->point[j+1].y/u->resolution;
+      } else if(line->numpoints > 1)
+        continue;
+      steps = (int)ceil(MS_MAX(fabs(x1-x0), fabs(y1-y0))*2);
+      for(s=0; s<=steps; s++) {
+        double t = (steps > 0) ? (double)s/steps : 0;
+        double x = x0 + (x1-x0)*t, y = y0 + (y1-y0)*t;
+        utfgridFillBox(u, x-hw, y-hw, x+hw, y+hw);
+      }
+    }
+  }
+}
+
+static void utfgridDrawMarker(utfgridObj *u, double x, double y, double w, double h)
+{
+  double r = u->resolution;
+  utfgridFillBox(u, (x-w*0.5)/r, (y-h*0.5)/r, (x+w*0.5)/r, (y+h*0.5)/r);
+}
+
+/************************************************************************/
+/*                           feature table                              */
+/************************************************************************/
+
+static void utfgridResolveItems(utfgridObj *u, layerObj *layer)
+{
+  const char *value;
+  int i, j;
+
+  u->keyitemindex = -1;
+  msFree(u->dataitems);
+  u->dataitems = NULL;
+  u->numdataitems = 0;
+
+  if((value = msLookupHashTable(&(layer->metadata), "utfgrid_item")) != NULL) {
+    for(i=0; i<layer->numitems; i++) {
+      if(strcasecmp(layer->items[i], value) == 0) {
+        u->keyitemindex = i;
+        break;
+      }
+    }
+  }
+
+  value = msLookupHashTable(&(layer->metadata), "utfgrid_include_items");
+  if(value == NULL || strcasecmp(value, "all") == 0) {
+    u->dataitems = (int*)msSmallMalloc(sizeof(int)*MS_MAX(layer->numitems,1));
+    for(i=0; i<layer->numitems; i++)
+      u->dataitems[u->numdataitems++] = i;
+  } else if(strcasecmp(value, "none") != 0) {
+    int numtokens;
+    char **tokens = msStringSplit(value, ',', &numtokens);
+    u->dataitems = (int*)msSmallMalloc(sizeof(int)*MS_MAX(numtokens,1));
+    for(j=0; j<numtokens; j++) {
+      for(i=0; i<layer->numitems; i++) {
+        if(strcasecmp(layer->items[i], tokens[j]) == 0) {
+          u->dataitems[u->numdataitems++] = i;
+          break;
+        }
+      }
+    }
+    msFreeCharArray(tokens, numtokens);
+  }
+
+  u->itemsresolved = MS_TRUE;
+}
+
+static char *utfgridFeatureData(utfgridObj *u, layerObj *layer, shapeObj *shape)
+{
+  int i;
+  char *data;
+
+  if(u->numdataitems == 0 || !shape->values)
+    return NULL;
+
+  u->scratch.size = 0;
+  msBufferAppend(&u->scratch, "{", 1);
+  for(i=0; i<u->numdataitems; i++) {
+    int index = u->dataitems[i];
+    char *name, *value;
+    if(index >= shape->numvalues)
+      continue;
+    name = msEscapeJSONString(layer->items[index]);
+    value = msEscapeJSONString(shape->values[index] ? shape->values[index] : "");
+    if(u->scratch.size > 1)
+      msBufferAppend(&u->scratch, ",", 1);
+    msBufferAppend(&u->scratch, "\"", 1);
+    msBufferAppend(&u->scratch, name, strlen(name));
+    msBufferAppend(&u->scratch, "\":\"", 3);
+    msBufferAppend(&u->scratch, value, strlen(value));
+    msBufferAppend(&u->scratch, "\"", 1);
+    free(name);
+    free(value);
+  }
+  msBufferAppend(&u->scratch, "}", 2); /* includes the terminating nul */
+
+  data = (char*)msSmallMalloc(u->scratch.size);
+  memcpy(data, u->scratch.data, u->scratch.size);
+  return data;
+}
+
+static unsigned int utfgridAddFeature(utfgridObj *u, char *key, char *data, int layerindex)
+{
+  if(u->numfeatures == u->maxfeatures) {
+    u->maxfeatures = MS_MAX(64, u->maxfeatures*2);
+    u->features = (utfgridFeature*)msSmallRealloc(u->features, sizeof(utfgridFeature)*u->maxfeatures);
+  }
+  u->features[u->numfeatures].key = key;
+  u->features[u->numfeatures].data = data;
+  u->features[u->numfeatures].layerindex = layerindex;
+  return ++u->numfeatures;
+}
+
+/************************************************************************/
+/*                          renderer callbacks                          */
+/************************************************************************/
+
+imageObj *utfgridCreateImage(int width, int height, outputFormatObj *format, colorObj *bg)
+{
+  imageObj *image;
+  utfgridObj *u;
+
+  image = (imageObj*)msSmallCalloc(1, sizeof(imageObj));
+  u = (utfgridObj*)msSmallCalloc(1, sizeof(utfgridObj));
+
+  u->resolution = atoi(msGetOutputFormatOption(format, "UTFRESOLUTION", "4"));
+  if(u->resolution < 1)
+    u->resolution = 1;
+  u->width = (width + u->resolution - 1) / u->resolution;
+  u->height = (height + u->resolution - 1) / u->resolution;
+  u->grid = (unsigned int*)msSmallCalloc((size_t)u->width*u->height, sizeof(unsigned int));
+  u->keys = msCreateHashTable();
+  u->keyitemindex = -1;
+  msBufferInit(&u->scratch);
+
+  image->img.plugin = (void*)u;
+  return image;
+}
+
+int utfgridFreeImage(imageObj *image)
+{
+  utfgridObj *u = UTFGRID_RENDERER(image);
+  int i;
+
+  for(i=0; i<u->numfeatures; i++) {
+    msFree(u->features[i].key);
+    msFree(u->features[i].data);
+  }
+  msFree(u->features);
+  msFree(u->grid);
+  msFree(u->dataitems);
+  msFreeHashTable(u->keys);
+  msBufferFree(&u->scratch);
+  free(u);
+  image->img.plugin = NULL;
+  return MS_SUCCESS;
+}
+
+int utfgridStartLayer(imageObj *img, mapObj *map, layerObj *layer)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  u->layer = layer;
+  u->itemsresolved = MS_FALSE;
+  u->current = 0;
+  return MS_SUCCESS;
+}
+
+int utfgridEndLayer(imageObj *img, mapObj *map, layerObj *layer)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  u->layer = NULL;
+  u->current = 0;
+  return MS_SUCCESS;
+}
+
+int utfgridStartShape(imageObj *img, shapeObj *shape)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  layerObj *layer = u->layer;
+  char key[32], *value;
+
+  u->current = 0;
+  if(!layer)
+    return MS_SUCCESS;
+  if(!u->itemsresolved)
+    utfgridResolveItems(u, layer);
+
+  if(u->keyitemindex >= 0) {
+    /* features of a layer with the same key share their id, the same */
+    /* key in another layer is another feature                          */
+    const char *id;
+    char *hashkey;
+    value = (u->keyitemindex < shape->numvalues && shape->values[u->keyitemindex]) ? shape->values[u->keyitemindex] : "";
+    snprintf(key, sizeof(key), "%d:", layer->index);
+    hashkey = msStringConcatenate(msStrdup(key), value);
+    if((id = msLookupHashTable(u->keys, hashkey)) != NULL) {
+      u->current = atoi(id);
+    } else {
+      u->current = utfgridAddFeature(u, msStrdup(value), utfgridFeatureData(u, layer, shape), layer->index);
+      snprintf(key, sizeof(key), "%u", u->current);
+      msInsertHashTable(u->keys, hashkey, key);
+    }
+    msFree(hashkey);
+  } else {
+    snprintf(key, sizeof(key), "%d", u->numfeatures+1);
+    u->current = utfgridAddFeature(u, msStrdup(key), utfgridFeatureData(u, layer, shape), layer->index);
+  }
+  return MS_SUCCESS;
+}
+
+int utfgridEndShape(imageObj *img, shapeObj *shape)
+{
+  UTFGRID_RENDERER(img)->current = 0;
+  return MS_SUCCESS;
+}
+
+int utfgridRenderPolygon(imageObj *img, shapeObj *p, colorObj *color)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  if(u->current)
+    utfgridFillPolygon(u, p);
+  return MS_SUCCESS;
+}
+
+int utfgridRenderPolygonTiled(imageObj *img, shapeObj *p, imageObj *tile)
+{
+  return utfgridRenderPolygon(img, p, NULL);
+}
+
+int utfgridRenderLine(imageObj *img, shapeObj *p, strokeStyleObj *style)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  if(u->current)
+    utfgridDrawLine(u, p, style->width);
+  return MS_SUCCESS;
+}
+
+int utfgridRenderVectorSymbol(imageObj *img, double x, double y, symbolObj *symbol, symbolStyleObj *style)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  if(u->current)
+    utfgridDrawMarker(u, x, y, symbol->sizex*style->scale, symbol->sizey*style->scale);
+  return MS_SUCCESS;
+}
+
+int utfgridRenderPixmapSymbol(imageObj *img, double x, double y, symbolObj *symbol, symbolStyleObj *style)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  if(u->current && symbol->pixmap_buffer)
+    utfgridDrawMarker(u, x, y, symbol->pixmap_buffer->width*style->scale, symbol->pixmap_buffer->height*style->scale);
+  return MS_SUCCESS;
+}
+
+int utfgridRenderTruetypeSymbol(imageObj *img, double x, double y, symbolObj *symbol, symbolStyleObj *style)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  if(u->current)
+    utfgridDrawMarker(u, x, y, style->scale, style->scale);
+  return MS_SUCCESS;
+}
+
+int utfgridRenderGlyphs(imageObj *img, double x, double y, labelStyleObj *style, char *text)
+{
+  /* labels are not part of the grid */
+  return MS_SUCCESS;
+}
+
+int utfgridRenderBitmapGlyphs(imageObj *img, double x, double y, labelStyleObj *style, char *text)
+{
+  return MS_SUCCESS;
+}
+
+int utfgridGetTruetypeTextBBox(rendererVTableObj *renderer, char **fonts, int numfonts, double size, char *string,
+                               rectObj *rect, double **advances, int bAdjustBaseline)
+{
+  rect->minx = rect->miny = rect->maxx = rect->maxy = 0.0;
+  if(advances) {
+    int i, numglyphs = msGetNumGlyphs(string);
+    *advances = (double*)msSmallMalloc(numglyphs * sizeof(double));
+    for(i=0; i<numglyphs; i++)
+      (*advances)[i] = size;
+  }
+  return MS_SUCCESS;
+}
+
+int utfgridRenderTile(imageObj *img, imageObj *tile, double x, double y)
+{
+  return MS_SUCCESS;
+}
+
+int utfgridInitializeRasterBuffer(rasterBufferObj *rb, int width, int height, int mode)
+{
+  /* raster layers are drawn into a scratch buffer that is then ignored */
+  rb->type = MS_BUFFER_BYTE_RGBA;
+  rb->width = width;
+  rb->height = height;
+  rb->data.rgba.pixel_step = 4;
+  rb->data.rgba.row_step = 4*width;
+  rb->data.rgba.pixels = (unsigned char*)msSmallCalloc((size_t)width*height, 4);
+  rb->data.rgba.r = rb->data.rgba.pixels;
+  rb->data.rgba.g = rb->data.rgba.pixels+1;
+  rb->data.rgba.b = rb->data.rgba.pixels+2;
+  rb->data.rgba.a = (mode == MS_IMAGEMODE_RGBA) ? rb->data.rgba.pixels+3 : NULL;
+  return MS_SUCCESS;
+}
+
+int utfgridMergeRasterBuffer(imageObj *dest, rasterBufferObj *overlay, double opacity, int srcX, int srcY, int dstX, int dstY, int width, int height)
+{
+  return MS_SUCCESS;
+}
+
+int utfgridFreeSymbol(symbolObj *symbol)
+{
+  return MS_SUCCESS;
+}
+
+int utfgridCleanup(void *renderer_data)
+{
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                           utfgridSaveImage()                         */
+/*                                                                      */
+/*      Ids are renumbered in the order they are met in the grid so     */
+/*      features that were drawn over completely are not written.       */
+/************************************************************************/
+
+/* append the UTF-8 encoding of the grid character of code */
+static void utfgridAppendCode(bufferObj *buf, unsigned int code)
+{
+  unsigned char c[4];
+
+  code += 32;
+  if(code >= 34) code++; /* skip '"' */
+  if(code >= 92) code++; /* skip '\' */
+  if(code >= 0xD800) code += 0x800; /* skip the UTF-16 surrogates */
+
+  if(code < 0x80) {
+    c[0] = code;
+    msBufferAppend(buf, c, 1);
+  } else if(code < 0x800) {
+    c[0] = 0xC0 | (code >> 6);
+    c[1] = 0x80 | (code & 0x3F);
+    msBufferAppend(buf, c, 2);
+  } else if(code < 0x10000) {
+    c[0] = 0xE0 | (code >> 12);
+    c[1] = 0x80 | ((code >> 6) & 0x3F);
+    c[2] = 0x80 | (code & 0x3F);
+    msBufferAppend(buf, c, 3);
+  } else {
+    c[0] = 0xF0 | (code >> 18);
+    c[1] = 0x80 | ((code >> 12) & 0x3F);
+    c[2] = 0x80 | ((code >> 6) & 0x3F);
+    c[3] = 0x80 | (code & 0x3F);
+    msBufferAppend(buf, c, 4);
+  }
+}
+
+/* escaped key of a feature, prefixed by its layer name when several layers share the grid */
+static char *utfgridFeatureKey(mapObj *map, utfgridFeature *feature, int prefixed)
+{
+  char *key, *escaped;
+  layerObj *layer;
+
+  if(!prefixed)
+    return msEscapeJSONString(feature->key);
+
+  layer = (map && feature->layerindex >= 0 && feature->layerindex < map->numlayers) ? GET_LAYER(map, feature->layerindex) : NULL;
+  if(layer && layer->name) {
+    key = msStrdup(layer->name);
+  } else {
+    key = (char*)msSmallMalloc(32);
+    snprintf(key, 32, "%d", feature->layerindex);
+  }
+  key = msStringConcatenate(key, ":");
+  key = msStringConcatenate(key, feature->key);
+  escaped = msEscapeJSONString(key);
+  free(key);
+  return escaped;
+}
+
+int utfgridSaveImage(imageObj *img, mapObj *map, FILE *fp, outputFormatObj *format)
+{
+  utfgridObj *u = UTFGRID_RENDERER(img);
+  unsigned int *codes, *used, numused = 0;
+  int i, j, first, prefixed;
+  bufferObj buf;
+  char *escaped;
+
+  /* code of every feature id, 0 until the id is met in the grid */
+  codes = (unsigned int*)msSmallCalloc(u->numfeatures+1, sizeof(unsigned int));
+  used = (unsigned int*)msSmallMalloc(sizeof(unsigned int)*(u->numfeatures+1));
+
+  msBufferInit(&buf);
+  msBufferAppend(&buf, "{\"grid\":[", 9);
+  for(j=0; j<u->height; j++) {
+    unsigned int *row = u->grid + (size_t)j*u->width;
+    msBufferAppend(&buf, (j > 0) ? ",\"" : "\"", (j > 0) ? 2 : 1);
+    for(i=0; i<u->width; i++) {
+      unsigned int id = row[i];
+      if(id && !codes[id]) {
+        used[numused++] = id;
+        codes[id] = numused;
+      }
+      utfgridAppendCode(&buf, id ? codes[id] : 0);
+    }
+    msBufferAppend(&buf, "\"", 1);
+  }
+
+  /* keys are only unique within a layer */
+  prefixed = MS_FALSE;
+  for(i=1; i<numused; i++) {
+    if(u->features[used[i]-1].layerindex != u->features[used[0]-1].layerindex) {
+      prefixed = MS_TRUE;
+      break;
+    }
+  }
+
+  msBufferAppend(&buf, "],\"keys\":[\"\"", 12);
+  for(i=0; i<numused; i++) {
+    escaped = utfgridFeatureKey(map, &(u->features[used[i]-1]), prefixed);
+    msBufferAppend(&buf, ",\"", 2);
+    msBufferAppend(&buf, escaped, strlen(escaped));
+    msBufferAppend(&buf, "\"", 1);
+    free(escaped);
+  }
+
+  msBufferAppend(&buf, "],\"data\":{", 10);
+  first = MS_TRUE;
+  for(i=0; i<numused; i++) {
+    utfgridFeature *feature = &(u->features[used[i]-1]);
+    if(!feature->data)
+      continue;
+    escaped = utfgridFeatureKey(map, feature, prefixed);
+    if(!first)
+      msBufferAppend(&buf, ",", 1);
+    msBufferAppend(&buf, "\"", 1);
+    msBufferAppend(&buf, escaped, strlen(escaped));
+    msBufferAppend(&buf, "\":", 2);
+    msBufferAppend(&buf, feature->data, strlen(feature->data));
+    free(escaped);
+    first = MS_FALSE;
+  }
+  msBufferAppend(&buf, "}}\n", 3);
+
+  msIO_fwrite(buf.data, 1, buf.size, fp);
+
+  msBufferFree(&buf);
+  free(codes);
+  free(used);
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                   msPopulateRendererVTableUTFGrid()                  */
+/************************************************************************/
+
+int msPopulateRendererVTableUTFGrid( rendererVTableObj *renderer )
+{
+  int i;
+
+  renderer->supports_transparent_layers = 1;
+  renderer->supports_pixel_buffer = 0;
+  renderer->supports_bitmap_fonts = 1;
+  for(i=0; i<5; i++)
+    renderer->bitmapFontMetrics[i] = &(utfgridRasterFontSizes[i]);
+  renderer->supports_clipping = 0;
+  renderer->use_imagecache = 0;
+  renderer->default_transform_mode = MS_TRANSFORM_SIMPLIFY;
+
+  renderer->startLayer = &utfgridStartLayer;
+  renderer->endLayer = &utfgridEndLayer;
+  renderer->startShape = &utfgridStartShape;
+  renderer->endShape = &utfgridEndShape;
+
+  renderer->renderLine = &utfgridRenderLine;
+  renderer->renderPolygon = &utfgridRenderPolygon;
+  renderer->renderPolygonTiled = &utfgridRenderPolygonTiled;
+  renderer->renderLineTiled = NULL;
+  renderer->renderGlyphs = &utfgridRenderGlyphs;
+  renderer->renderBitmapGlyphs = &utfgridRenderBitmapGlyphs;
+  renderer->renderVectorSymbol = &utfgridRenderVectorSymbol;
+  renderer->renderEllipseSymbol = &utfgridRenderVectorSymbol;
+  renderer->renderSVGSymbol = &utfgridRenderVectorSymbol;
+  renderer->renderPixmapSymbol = &utfgridRenderPixmapSymbol;
+  renderer->renderTruetypeSymbol = &utfgridRenderTruetypeSymbol;
+  renderer->renderTile = &utfgridRenderTile;
+  renderer->getTruetypeTextBBox = &utfgridGetTruetypeTextBBox;
+
+  renderer->loadImageFromFile = msLoadMSRasterBufferFromFile;
+  renderer->initializeRasterBuffer = &utfgridInitializeRasterBuffer;
+  renderer->mergeRasterBuffer = &utfgridMergeRasterBuffer;
+
+  renderer->createImage = &utfgridCreateImage;
+  renderer->saveImage = &utfgridSaveImage;
+  renderer->freeImage = &utfgridFreeImage;
+  renderer->freeSymbol = &utfgridFreeSymbol;
+  renderer->cleanup = &utfgridCleanup;
+
+  return MS_SUCCESS;
+}
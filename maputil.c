@@ -123,154 +123,142 @@ static int bindColorAttribute(colorObj *attribute, char *value)
   return MS_FAILURE; /* shouldn't get here */
 }
 
-static void bindStyle(layerObj *layer, shapeObj *shape, styleObj *style, int drawmode)
+/*
+** Binding plan: the bound style and label properties of all the classes of a
+** layer, with the index of their item and how the attribute value converts,
+** so that msBindLayerToShape() only visits what is actually bound. The plan
+** is built on first use and freed with the layer item info since it depends
+** on the item indexes.
+*/
+enum MS_BINDING_TYPE { MS_BINDING_DOUBLE, MS_BINDING_INTEGER, MS_BINDING_COLOR, MS_BINDING_SYMBOL, MS_BINDING_FONT, MS_BINDING_POSITION, MS_BINDING_ALPHA };
+
+typedef struct {
+  int type;
+  int labels; /* bound when drawing labels, otherwise when drawing features */
+  int query; /* also bound in query mode */
+  int index; /* item index */
+  void *target; /* the bound member, or the style/label object */
+  double defaultvalue; /* value used if the attribute does not convert */
+} bindingPlanEntryObj;
+
+typedef struct {
+  int numclasses; /* layer->numclasses the plan was built for */
+  int numentries;
+  bindingPlanEntryObj *entries;
+} bindingPlanObj;
+
+static void addBinding(bindingPlanObj *plan, int type, int labels, int query, int index, void *target, double defaultvalue)
 {
-  assert(MS_DRAW_FEATURES(drawmode));
-  if(style->numbindings > 0) {
-    if(style->bindings[MS_STYLE_BINDING_SYMBOL].index != -1) {
-      style->symbol = msGetSymbolIndex(&(layer->map->symbolset), shape->values[style->bindings[MS_STYLE_BINDING_SYMBOL].index], MS_TRUE);
-      if(style->symbol == -1) style->symbol = 0; /* a reasonable default (perhaps should throw an error?) */
-    }
-    if(style->bindings[MS_STYLE_BINDING_ANGLE].index != -1) {
-      style->angle = 360.0;
-      bindDoubleAttribute(&style->angle, shape->values[style->bindings[MS_STYLE_BINDING_ANGLE].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_SIZE].index != -1) {
-      style->size = 1;
-      bindDoubleAttribute(&style->size, shape->values[style->bindings[MS_STYLE_BINDING_SIZE].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_WIDTH].index != -1) {
-      style->width = 1;
-      bindDoubleAttribute(&style->width, shape->values[style->bindings[MS_STYLE_BINDING_WIDTH].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_COLOR].index != -1 && !MS_DRAW_QUERY(drawmode)) {
-      MS_INIT_COLOR(style->color, -1,-1,-1,255);
-      bindColorAttribute(&style->color, shape->values[style->bindings[MS_STYLE_BINDING_COLOR].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_OUTLINECOLOR].index != -1 && !MS_DRAW_QUERY(drawmode)) {
-      MS_INIT_COLOR(style->outlinecolor, -1,-1,-1,255);
-      bindColorAttribute(&style->outlinecolor, shape->values[style->bindings[MS_STYLE_BINDING_OUTLINECOLOR].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_OUTLINEWIDTH].index != -1) {
-      style->outlinewidth = 1;
-      bindDoubleAttribute(&style->outlinewidth, shape->values[style->bindings[MS_STYLE_BINDING_OUTLINEWIDTH].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_OPACITY].index != -1) {
-      style->opacity = 100;
-      bindIntegerAttribute(&style->opacity, shape->values[style->bindings[MS_STYLE_BINDING_OPACITY].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_OFFSET_X].index != -1) {
-      style->offsetx = 0;
-      bindDoubleAttribute(&style->offsetx, shape->values[style->bindings[MS_STYLE_BINDING_OFFSET_X].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_OFFSET_Y].index != -1) {
-      style->offsety = 0;
-      bindDoubleAttribute(&style->offsety, shape->values[style->bindings[MS_STYLE_BINDING_OFFSET_Y].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_POLAROFFSET_PIXEL].index != -1) {
-      style->polaroffsetpixel = 0;
-      bindDoubleAttribute(&style->polaroffsetpixel, shape->values[style->bindings[MS_STYLE_BINDING_POLAROFFSET_PIXEL].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_POLAROFFSET_ANGLE].index != -1) {
-      style->polaroffsetangle = 0;
-      bindDoubleAttribute(&style->polaroffsetangle, shape->values[style->bindings[MS_STYLE_BINDING_POLAROFFSET_ANGLE].index]);
-    }
-    if(style->bindings[MS_STYLE_BINDING_OUTLINEWIDTH].index != -1) {
-      style->outlinewidth = 1;
-      bindDoubleAttribute(&style->outlinewidth, shape->values[style->bindings[MS_STYLE_BINDING_OUTLINEWIDTH].index]);
-    }
-    if(style->opacity < 100 || style->color.alpha != 255 ) {
-      int alpha;
-      alpha = MS_NINT(style->opacity*2.55);
-      style->color.alpha = alpha;
-      style->outlinecolor.alpha = alpha;
-      style->backgroundcolor.alpha = alpha;
-      style->mincolor.alpha = alpha;
-      style->maxcolor.alpha = alpha;
-    }
-  }
+  bindingPlanEntryObj *entry;
+
+  if(index == -1) return; /* not bound */
+
+  plan->entries = (bindingPlanEntryObj*)msSmallRealloc(plan->entries, sizeof(bindingPlanEntryObj)*(plan->numentries+1));
+  entry = &(plan->entries[plan->numentries++]);
+  entry->type = type;
+  entry->labels = labels;
+  entry->query = query;
+  entry->index = index;
+  entry->target = target;
+  entry->defaultvalue = defaultvalue;
 }
 
-static void bindLabel(layerObj *layer, shapeObj *shape, labelObj *label, int drawmode)
+static void addStyleBindings(bindingPlanObj *plan, styleObj *style, int labels)
 {
-  int i;
-  assert(MS_DRAW_LABELS(drawmode));
+  attributeBindingObj *bindings = style->bindings;
+
+  if(style->numbindings <= 0) return;
+
+  addBinding(plan, MS_BINDING_SYMBOL, labels, MS_TRUE, bindings[MS_STYLE_BINDING_SYMBOL].index, style, 0);
+  addBinding(plan, MS_BINDING_DOUBLE, labels, MS_TRUE, bindings[MS_STYLE_BINDING_ANGLE].index, &style->angle, 360.0);
+  addBinding(plan, MS_BINDING_DOUBLE, labels, MS_TRUE, bindings[MS_STYLE_BINDING_SIZE].index, &style->size, 1);
+  addBinding(plan, MS_BINDING_DOUBLE, labels, MS_TRUE, bindings[MS_STYLE_BINDING_WIDTH].index, &style->width, 1);
+  addBinding(plan, MS_BINDING_COLOR, labels, MS_FALSE, bindings[MS_STYLE_BINDING_COLOR].index, &style->color, 0);
+  addBinding(plan, MS_BINDING_COLOR, labels, MS_FALSE, bindings[MS_STYLE_BINDING_OUTLINECOLOR].index, &style->outlinecolor, 0);
+  addBinding(plan, MS_BINDING_DOUBLE, labels, MS_TRUE, bindings[MS_STYLE_BINDING_OUTLINEWIDTH].index, &style->outlinewidth, 1);
+  addBinding(plan, MS_BINDING_INTEGER, labels, MS_TRUE, bindings[MS_STYLE_BINDING_OPACITY].index, &style->opacity, 100);
+  addBinding(plan, MS_BINDING_DOUBLE, labels, MS_TRUE, bindings[MS_STYLE_BINDING_OFFSET_X].index, &style->offsetx, 0);
+  addBinding(plan, MS_BINDING_DOUBLE, labels, MS_TRUE, bindings[MS_STYLE_BINDING_OFFSET_Y].index, &style->offsety, 0);
+  addBinding(plan, MS_BINDING_DOUBLE, labels, MS_TRUE, bindings[MS_STYLE_BINDING_POLAROFFSET_PIXEL].index, &style->polaroffsetpixel, 0);
+  addBinding(plan, MS_BINDING_DOUBLE, labels, MS_TRUE, bindings[MS_STYLE_BINDING_POLAROFFSET_ANGLE].index, &style->polaroffsetangle, 0);
+
+  /* opacity is applied to the colors once all the members are bound */
+  addBinding(plan, MS_BINDING_ALPHA, labels, MS_TRUE, 0, style, 0);
+}
 
-  /* check the label styleObj's (TODO: do we need to use querymapMode here? */
-  for(i=0; i<label->numstyles; i++) {
-    /* force MS_DRAWMODE_FEATURES for label styles */
-    bindStyle(layer, shape, label->styles[i], drawmode|MS_DRAWMODE_FEATURES);
-  }
+static bindingPlanObj *buildBindingPlan(layerObj *layer)
+{
+  bindingPlanObj *plan = (bindingPlanObj*)msSmallCalloc(1, sizeof(bindingPlanObj));
+  int i, j, k;
 
-  if(label->numbindings > 0) {
-    if(label->bindings[MS_LABEL_BINDING_ANGLE].index != -1) {
-      label->angle = 0.0;
-      bindDoubleAttribute(&label->angle, shape->values[label->bindings[MS_LABEL_BINDING_ANGLE].index]);
-    }
+  plan->numclasses = layer->numclasses;
 
-    if(label->bindings[MS_LABEL_BINDING_SIZE].index != -1) {
-      label->size = 1;
-      bindDoubleAttribute(&label->size, shape->values[label->bindings[MS_LABEL_BINDING_SIZE].index]);
-    }
+  for(i=0; i<layer->numclasses; i++) {
+    classObj *class = layer->class[i];
 
-    if(label->bindings[MS_LABEL_BINDING_COLOR].index != -1) {
-      MS_INIT_COLOR(label->color, -1,-1,-1,255);
-      bindColorAttribute(&label->color, shape->values[label->bindings[MS_LABEL_BINDING_COLOR].index]);
-    }
+    for(j=0; j<class->numstyles; j++)
+      addStyleBindings(plan, class->styles[j], MS_FALSE);
 
-    if(label->bindings[MS_LABEL_BINDING_OUTLINECOLOR].index != -1) {
-      MS_INIT_COLOR(label->outlinecolor, -1,-1,-1,255);
-      bindColorAttribute(&label->outlinecolor, shape->values[label->bindings[MS_LABEL_BINDING_OUTLINECOLOR].index]);
-    }
+    for(j=0; j<class->numlabels; j++) {
+      labelObj *label = class->labels[j];
+      attributeBindingObj *bindings = label->bindings;
 
-    if(label->bindings[MS_LABEL_BINDING_FONT].index != -1) {
-      msFree(label->font);
-      label->font = msStrdup(shape->values[label->bindings[MS_LABEL_BINDING_FONT].index]);
-    }
+      for(k=0; k<label->numstyles; k++)
+        addStyleBindings(plan, label->styles[k], MS_TRUE);
 
-    if(label->bindings[MS_LABEL_BINDING_PRIORITY].index != -1) {
-      label->priority = MS_DEFAULT_LABEL_PRIORITY;
-      bindIntegerAttribute(&label->priority, shape->values[label->bindings[MS_LABEL_BINDING_PRIORITY].index]);
-    }
+      if(label->numbindings <= 0) continue;
 
-    if(label->bindings[MS_LABEL_BINDING_SHADOWSIZEX].index != -1) {
-      label->shadowsizex = 1;
-      bindIntegerAttribute(&label->shadowsizex, shape->values[label->bindings[MS_LABEL_BINDING_SHADOWSIZEX].index]);
-    }
-    if(label->bindings[MS_LABEL_BINDING_SHADOWSIZEY].index != -1) {
-      label->shadowsizey = 1;
-      bindIntegerAttribute(&label->shadowsizey, shape->values[label->bindings[MS_LABEL_BINDING_SHADOWSIZEY].index]);
+      addBinding(plan, MS_BINDING_DOUBLE, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_ANGLE].index, &label->angle, 0.0);
+      addBinding(plan, MS_BINDING_DOUBLE, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_SIZE].index, &label->size, 1);
+      addBinding(plan, MS_BINDING_COLOR, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_COLOR].index, &label->color, 0);
+      addBinding(plan, MS_BINDING_COLOR, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_OUTLINECOLOR].index, &label->outlinecolor, 0);
+      addBinding(plan, MS_BINDING_FONT, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_FONT].index, label, 0);
+      addBinding(plan, MS_BINDING_INTEGER, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_PRIORITY].index, &label->priority, MS_DEFAULT_LABEL_PRIORITY);
+      addBinding(plan, MS_BINDING_INTEGER, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_SHADOWSIZEX].index, &label->shadowsizex, 1);
+      addBinding(plan, MS_BINDING_INTEGER, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_SHADOWSIZEY].index, &label->shadowsizey, 1);
+      addBinding(plan, MS_BINDING_POSITION, MS_TRUE, MS_TRUE, bindings[MS_LABEL_BINDING_POSITION].index, &label->position, 0);
     }
+  }
 
-    if(label->bindings[MS_LABEL_BINDING_POSITION].index != -1) {
-      int tmpPosition;
-      bindIntegerAttribute(&tmpPosition, shape->values[label->bindings[MS_LABEL_BINDING_POSITION].index]);
-      if(tmpPosition != 0) { /* is this test sufficient? */
-        label->position = tmpPosition;
-      } else { /* Integer binding failed, look for strings like cc, ul, lr, etc... */
-        if(strlen(shape->values[label->bindings[MS_LABEL_BINDING_POSITION].index]) == 2) {
-          char *vp = shape->values[label->bindings[MS_LABEL_BINDING_POSITION].index];
-          if(!strncasecmp(vp,"ul",2))
-            label->position = MS_UL;
-          else if(!strncasecmp(vp,"lr",2))
-            label->position = MS_LR;
-          else if(!strncasecmp(vp,"ur",2))
-            label->position = MS_UR;
-          else if(!strncasecmp(vp,"ll",2))
-            label->position = MS_LL;
-          else if(!strncasecmp(vp,"cr",2))
-            label->position = MS_CR;
-          else if(!strncasecmp(vp,"cl",2))
-            label->position = MS_CL;
-          else if(!strncasecmp(vp,"uc",2))
-            label->position = MS_UC;
-          else if(!strncasecmp(vp,"lc",2))
-            label->position = MS_LC;
-          else if(!strncasecmp(vp,"cc",2))
-            label->position = MS_CC;
-        }
-      }
-    }
+  return plan;
+}
+
+void msFreeBindingPlan(layerObj *layer)
+{
+  bindingPlanObj *plan = (bindingPlanObj*)layer->bindingplan;
+
+  if(!plan) return;
+  msFree(plan->entries);
+  free(plan);
+  layer->bindingplan = NULL;
+}
+
+static void bindPositionAttribute(int *position, char *value)
+{
+  int tmpPosition = 0;
+
+  bindIntegerAttribute(&tmpPosition, value);
+  if(tmpPosition != 0) { /* is this test sufficient? */
+    *position = tmpPosition;
+  } else if(value && strlen(value) == 2) { /* Integer binding failed, look for strings like cc, ul, lr, etc... */
+    if(!strncasecmp(value,"ul",2))
+      *position = MS_UL;
+    else if(!strncasecmp(value,"lr",2))
+      *position = MS_LR;
+    else if(!strncasecmp(value,"ur",2))
+      *position = MS_UR;
+    else if(!strncasecmp(value,"ll",2))
+      *position = MS_LL;
+    else if(!strncasecmp(value,"cr",2))
+      *position = MS_CR;
+    else if(!strncasecmp(value,"cl",2))
+      *position = MS_CL;
+    else if(!strncasecmp(value,"uc",2))
+      *position = MS_UC;
+    else if(!strncasecmp(value,"lc",2))
+      *position = MS_LC;
+    else if(!strncasecmp(value,"cc",2))
+      *position = MS_CC;
   }
 }
 
@@ -279,25 +267,68 @@ static void bindLabel(layerObj *layer, shapeObj *shape, labelObj *label, int dra
 */
 int msBindLayerToShape(layerObj *layer, shapeObj *shape, int drawmode)
 {
-  int i, j;
+  bindingPlanObj *plan;
+  int i;
 
   if(!layer || !shape) return MS_FAILURE;
 
-  for(i=0; i<layer->numclasses; i++) {
-    /* check the styleObj's */
-    if(MS_DRAW_FEATURES(drawmode)) {
-      for(j=0; j<layer->class[i]->numstyles; j++) {
-        bindStyle(layer, shape, layer->class[i]->styles[j], drawmode);
-      }
-    }
+  plan = (bindingPlanObj*)layer->bindingplan;
+  if(plan && plan->numclasses != layer->numclasses) {
+    msFreeBindingPlan(layer);
+    plan = NULL;
+  }
+  if(!plan)
+    layer->bindingplan = plan = buildBindingPlan(layer);
 
-    /* check the labelObj's */
-    if(MS_DRAW_LABELS(drawmode)) {
-      for(j=0; j<layer->class[i]->numlabels; j++) {
-        bindLabel(layer, shape, layer->class[i]->labels[j], drawmode);
+  for(i=0; i<plan->numentries; i++) {
+    bindingPlanEntryObj *entry = &(plan->entries[i]);
+
+    if(entry->labels ? !MS_DRAW_LABELS(drawmode) : !MS_DRAW_FEATURES(drawmode)) continue;
+    if(!entry->query && MS_DRAW_QUERY(drawmode)) continue;
+
+    switch(entry->type) {
+      case MS_BINDING_DOUBLE:
+        *(double*)entry->target = entry->defaultvalue;
+        bindDoubleAttribute((double*)entry->target, shape->values[entry->index]);
+        break;
+      case MS_BINDING_INTEGER:
+        *(int*)entry->target = (int)entry->defaultvalue;
+        bindIntegerAttribute((int*)entry->target, shape->values[entry->index]);
+        break;
+      case MS_BINDING_COLOR:
+        MS_INIT_COLOR(*(colorObj*)entry->target, -1,-1,-1,255);
+        bindColorAttribute((colorObj*)entry->target, shape->values[entry->index]);
+        break;
+      case MS_BINDING_SYMBOL: {
+        styleObj *style = (styleObj*)entry->target;
+        style->symbol = msGetSymbolIndex(&(layer->map->symbolset), shape->values[entry->index], MS_TRUE);
+        if(style->symbol == -1) style->symbol = 0; /* a reasonable default (perhaps should throw an error?) */
+        break;
+      }
+      case MS_BINDING_FONT: {
+        labelObj *label = (labelObj*)entry->target;
+        msFree(label->font);
+        label->font = msStrdup(shape->values[entry->index]);
+        break;
+      }
+      case MS_BINDING_POSITION:
+        bindPositionAttribute((int*)entry->target, shape->values[entry->index]);
+        break;
+      case MS_BINDING_ALPHA: {
+        styleObj *style = (styleObj*)entry->target;
+        if(style->opacity < 100 || style->color.alpha != 255 ) {
+          int alpha;
+          alpha = MS_NINT(style->opacity*2.55);
+          style->color.alpha = alpha;
+          style->outlinecolor.alpha = alpha;
+          style->backgroundcolor.alpha = alpha;
+          style->mincolor.alpha = alpha;
+          style->maxcolor.alpha = alpha;
+        }
+        break;
       }
     }
-  } /* next classObj */
+  }
 
   return MS_SUCCESS;
 }
@@ -475,7 +506,7 @@ int msEvalExpression(layerObj *layer, shapeObj *shape, expressionObj *expression
       p.expr->curtoken = p.expr->tokens; /* reset */
       p.type = MS_PARSE_TYPE_BOOLEAN;
 
-      status = yyparse(&p);
+      status = msExecuteExpression(&p);
 
       if (status != 0) {
         msSetError(MS_PARSEERR, "Failed to parse expression: %s", "msEvalExpression", expression->string);
@@ -495,28 +526,34 @@ int msEvalExpression(layerObj *layer, shapeObj *shape, expressionObj *expression
         return MS_FALSE;
       }
 
-      if(!expression->compiled) {
-        if(expression->flags & MS_EXP_INSENSITIVE) {
-          if(ms_regcomp(&(expression->regex), expression->string, MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE) != 0) { /* compile the expression */
-            msSetError(MS_REGEXERR, "Invalid regular expression.", "msEvalExpression()");
-            return MS_FALSE;
-          }
-        } else {
-          if(ms_regcomp(&(expression->regex), expression->string, MS_REG_EXTENDED|MS_REG_NOSUB) != 0) { /* compile the expression */
-            msSetError(MS_REGEXERR, "Invalid regular expression.", "msEvalExpression()");
-            return MS_FALSE;
-          }
-        }
-        expression->compiled = MS_TRUE;
-      }
-
-      if(ms_regexec(&(expression->regex), shape->values[itemindex], 0, NULL, 0) == 0) return MS_TRUE; /* got a match */
+      if(msEvalRegexExpression(expression, shape->values[itemindex]) == MS_TRUE) return MS_TRUE; /* got a match */
       break;
   }
 
   return MS_FALSE;
 }
 
+/* msEvalRegexExpression()
+ *
+ * Matches a value against a MS_REGEX expression. The regular expression is
+ * compiled on first use and kept with the expression until it is freed.
+ */
+int msEvalRegexExpression(expressionObj *expression, const char *value)
+{
+  if(!expression->compiled) {
+    int flags = MS_REG_EXTENDED|MS_REG_NOSUB;
+    if(expression->flags & MS_EXP_INSENSITIVE) flags |= MS_REG_ICASE;
+    if(ms_regcomp(&(expression->regex), expression->string, flags) != 0) { /* compile the expression */
+      msSetError(MS_REGEXERR, "Invalid regular expression.", "msEvalRegexExpression()");
+      return MS_FALSE;
+    }
+    expression->compiled = MS_TRUE;
+  }
+
+  if(ms_regexec(&(expression->regex), value, 0, NULL, 0) == 0) return MS_TRUE; /* got a match */
+  return MS_FALSE;
+}
+
 int *msAllocateValidClassGroups(layerObj *lp, int *nclasses)
 {
   int *classgroup = NULL;
@@ -546,39 +583,447 @@ int *msAllocateValidClassGroups(layerObj *lp, int *nclasses)
 
 }
 
+/*
+** Class lookup table (used by msShapeGetClass())
+**
+** Layers with many classes of the form EXPRESSION "value" (with a CLASSITEM),
+** ("[ITEM]" = "value"), ([ITEM] = 12) or ([ITEM] >= 10 AND [ITEM] < 20) all
+** testing the same item get a table giving, for a value of that item, the
+** list of those classes it matches. The remaining classes are still evaluated
+** in order so the first matching class wins, as before.
+*/
+
+#define MS_CLASSTABLE_MIN_CLASSES 4
+
+typedef struct classTableEntry {
+  char *key;
+  int *classes;
+  int numclasses;
+  struct classTableEntry *next;
+} classTableEntryObj;
+
+typedef struct {
+  double min, max;
+  int mininclusive, maxinclusive;
+} classTableRangeObj;
+
+typedef struct {
+  int numclasses; /* layer->numclasses the table was built for */
+  int itemindex; /* item tested by the keyed classes, -1 if the layer has no table */
+  int numeric;
+  char *keyed; /* one flag per class, set if the class is decided by the table */
+  int *others; /* the other classes, in order */
+  int numothers;
+
+  /* string equality */
+  classTableEntryObj **buckets;
+  int numbuckets;
+
+  /* numeric ranges: cell 2*i+1 is the value breaks[i], cell 2*i the values between breaks[i-1] and breaks[i] */
+  double *breaks;
+  int numbreaks;
+  int **cells;
+  int *numcellclasses;
+} classTableObj;
+
+static unsigned int classTableHash(const char *key)
+{
+  unsigned int hash = 5381;
+  while(*key)
+    hash = hash*33 + (unsigned char)*key++;
+  return hash;
+}
+
+static void classTableRangeCompare(classTableRangeObj *range, int token, double value, int reverse)
+{
+  if(reverse) { /* value op [ITEM] */
+    switch(token) {
+      case MS_TOKEN_COMPARISON_GT: token = MS_TOKEN_COMPARISON_LT; break;
+      case MS_TOKEN_COMPARISON_LT: token = MS_TOKEN_COMPARISON_GT; break;
+      case MS_TOKEN_COMPARISON_GE: token = MS_TOKEN_COMPARISON_LE; break;
+      case MS_TOKEN_COMPARISON_LE: token = MS_TOKEN_COMPARISON_GE; break;
+    }
+  }
+  switch(token) {
+    case MS_TOKEN_COMPARISON_GT:
+    case MS_TOKEN_COMPARISON_GE:
+      if(value > range->min || (value == range->min && token == MS_TOKEN_COMPARISON_GT)) {
+        range->min = value;
+        range->mininclusive = (token == MS_TOKEN_COMPARISON_GE);
+      }
+      break;
+    case MS_TOKEN_COMPARISON_LT:
+    case MS_TOKEN_COMPARISON_LE:
+      if(value < range->max || (value == range->max && token == MS_TOKEN_COMPARISON_LT)) {
+        range->max = value;
+        range->maxinclusive = (token == MS_TOKEN_COMPARISON_LE);
+      }
+      break;
+    default: /* EQ, IEQ */
+      classTableRangeCompare(range, MS_TOKEN_COMPARISON_GE, value, MS_FALSE);
+      classTableRangeCompare(range, MS_TOKEN_COMPARISON_LE, value, MS_FALSE);
+      break;
+  }
+}
+
+/* strip parentheses enclosing the whole token range [first, last] */
+static void classTableStripParens(tokenListNodeObjPtr *tokens, int *first, int *last)
+{
+  while(*last - *first >= 2 && tokens[*first]->token == '(' && tokens[*last]->token == ')') {
+    int i, depth = 0;
+    for(i=*first; i<*last; i++) {
+      if(tokens[i]->token == '(') depth++;
+      else if(tokens[i]->token == ')') depth--;
+      if(depth == 0) return; /* the first parenthesis closes before the end */
+    }
+    (*first)++;
+    (*last)--;
+  }
+}
+
+/*
+** Recognize [ITEM] op number or "[ITEM]" = "string" (either way round) in
+** tokens[first..last]. Returns the item index or -1.
+*/
+static int classTableParseComparison(tokenListNodeObjPtr *tokens, int first, int last, int *numeric, classTableRangeObj *range, char **key)
+{
+  tokenListNodeObjPtr binding, literal;
+  int op, reverse;
+
+  classTableStripParens(tokens, &first, &last);
+  if(last - first != 2) return -1;
+
+  op = tokens[first+1]->token;
+  reverse = (tokens[first]->token == MS_TOKEN_LITERAL_NUMBER || tokens[first]->token == MS_TOKEN_LITERAL_STRING);
+  binding = tokens[reverse ? last : first];
+  literal = tokens[reverse ? first : last];
+
+  if((binding->token == MS_TOKEN_BINDING_DOUBLE || binding->token == MS_TOKEN_BINDING_INTEGER) && literal->token == MS_TOKEN_LITERAL_NUMBER) {
+    if(op != MS_TOKEN_COMPARISON_EQ && op != MS_TOKEN_COMPARISON_IEQ && op != MS_TOKEN_COMPARISON_GT &&
+        op != MS_TOKEN_COMPARISON_LT && op != MS_TOKEN_COMPARISON_GE && op != MS_TOKEN_COMPARISON_LE)
+      return -1;
+    *numeric = MS_TRUE;
+    classTableRangeCompare(range, op, literal->tokenval.dblval, reverse);
+  } else if(binding->token == MS_TOKEN_BINDING_STRING && literal->token == MS_TOKEN_LITERAL_STRING && op == MS_TOKEN_COMPARISON_EQ) {
+    *numeric = MS_FALSE;
+    *key = literal->tokenval.strval;
+  } else {
+    return -1;
+  }
+  return binding->tokenval.bindval.index;
+}
+
+/*
+** Returns the item index tested by the class expression, or -1 if the class
+** cannot be decided by a lookup.
+*/
+static int classTableParseClass(layerObj *layer, classObj *class, int *numeric, classTableRangeObj *range, char **key)
+{
+  expressionObj *expression = &(class->expression);
+  tokenListNodeObjPtr tokens[16], node;
+  int i, j, n = 0, itemindex, numeric2;
+
+  range->min = -HUGE_VAL;
+  range->max = HUGE_VAL;
+  range->mininclusive = range->maxinclusive = MS_TRUE;
+
+  if(!expression->string) return -1;
+
+  if(expression->type == MS_STRING) {
+    if(layer->classitemindex < 0 || (expression->flags & MS_EXP_INSENSITIVE)) return -1;
+    *numeric = MS_FALSE;
+    *key = expression->string;
+    return layer->classitemindex;
+  }
+  if(expression->type != MS_EXPRESSION) return -1;
+
+  for(node=expression->tokens; node; node=node->next) {
+    if(n == 16) return -1;
+    tokens[n++] = node;
+  }
+  if(n == 0) return -1;
+
+  i = 0;
+  n--;
+  classTableStripParens(tokens, &i, &n);
+
+  /* a single comparison */
+  if((itemindex = classTableParseComparison(tokens, i, n, numeric, range, key)) >= 0)
+    return itemindex;
+
+  /* or two numeric comparisons on the same item */
+  for(j=i; j<=n && tokens[j]->token != MS_TOKEN_LOGICAL_AND; j++);
+  if(j > n) return -1;
+  if((itemindex = classTableParseComparison(tokens, i, j-1, numeric, range, key)) < 0 || !*numeric) return -1;
+  if(classTableParseComparison(tokens, j+1, n, &numeric2, range, key) != itemindex || !numeric2) return -1;
+  return itemindex;
+}
+
+static int classTableRangeContains(classTableRangeObj *range, double value)
+{
+  if(value < range->min || (value == range->min && !range->mininclusive)) return MS_FALSE;
+  if(value > range->max || (value == range->max && !range->maxinclusive)) return MS_FALSE;
+  return MS_TRUE;
+}
+
+static int classTableCompareDoubles(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+void msFreeClassTable(layerObj *layer)
+{
+  classTableObj *table = (classTableObj*)layer->classtable;
+  int i;
+
+  if(!table) return;
+
+  for(i=0; i<table->numbuckets; i++) {
+    classTableEntryObj *entry = table->buckets[i], *next;
+    for(; entry; entry=next) {
+      next = entry->next;
+      msFree(entry->key);
+      msFree(entry->classes);
+      free(entry);
+    }
+  }
+  msFree(table->buckets);
+  for(i=0; i<2*table->numbreaks+1 && table->cells; i++)
+    msFree(table->cells[i]);
+  msFree(table->cells);
+  msFree(table->numcellclasses);
+  msFree(table->breaks);
+  msFree(table->keyed);
+  msFree(table->others);
+  free(table);
+  layer->classtable = NULL;
+}
+
+static void classTableAddClass(int **classes, int *numclasses, int iclass)
+{
+  *classes = (int*)msSmallRealloc(*classes, sizeof(int)*(*numclasses+1));
+  (*classes)[(*numclasses)++] = iclass;
+}
+
+static classTableObj *msBuildClassTable(layerObj *layer)
+{
+  classTableObj *table = (classTableObj*)msSmallCalloc(1, sizeof(classTableObj));
+  classTableRangeObj *ranges;
+  int *itemindexes, *numeric;
+  char **keys;
+  int i, j, count, bestcount = 0;
+
+  table->numclasses = layer->numclasses;
+  table->itemindex = -1;
+
+  ranges = (classTableRangeObj*)msSmallMalloc(sizeof(classTableRangeObj)*layer->numclasses);
+  itemindexes = (int*)msSmallMalloc(sizeof(int)*layer->numclasses);
+  numeric = (int*)msSmallMalloc(sizeof(int)*layer->numclasses);
+  keys = (char**)msSmallMalloc(sizeof(char*)*layer->numclasses);
+
+  for(i=0; i<layer->numclasses; i++)
+    itemindexes[i] = classTableParseClass(layer, layer->class[i], &numeric[i], &ranges[i], &keys[i]);
+
+  /* use the item and kind of test shared by the most classes */
+  for(i=0; i<layer->numclasses; i++) {
+    if(itemindexes[i] < 0) continue;
+    for(count=0, j=i; j<layer->numclasses; j++)
+      if(itemindexes[j] == itemindexes[i] && numeric[j] == numeric[i]) count++;
+    if(count > bestcount) {
+      bestcount = count;
+      table->itemindex = itemindexes[i];
+      table->numeric = numeric[i];
+    }
+  }
+
+  if(bestcount < MS_CLASSTABLE_MIN_CLASSES) {
+    table->itemindex = -1;
+  } else {
+    table->keyed = (char*)msSmallCalloc(layer->numclasses, sizeof(char));
+    table->others = (int*)msSmallMalloc(sizeof(int)*layer->numclasses);
+    for(i=0; i<layer->numclasses; i++) {
+      table->keyed[i] = (itemindexes[i] == table->itemindex && numeric[i] == table->numeric);
+      if(!table->keyed[i]) table->others[table->numothers++] = i;
+    }
+
+    if(table->numeric) {
+      table->breaks = (double*)msSmallMalloc(sizeof(double)*2*bestcount);
+      for(i=0; i<layer->numclasses; i++) {
+        if(!table->keyed[i]) continue;
+        if(ranges[i].min != -HUGE_VAL) table->breaks[table->numbreaks++] = ranges[i].min;
+        if(ranges[i].max != HUGE_VAL) table->breaks[table->numbreaks++] = ranges[i].max;
+      }
+      qsort(table->breaks, table->numbreaks, sizeof(double), classTableCompareDoubles);
+      for(i=0, j=0; i<table->numbreaks; i++)
+        if(j == 0 || table->breaks[i] != table->breaks[j-1]) table->breaks[j++] = table->breaks[i];
+      table->numbreaks = j;
+
+      table->cells = (int**)msSmallCalloc(2*table->numbreaks+1, sizeof(int*));
+      table->numcellclasses = (int*)msSmallCalloc(2*table->numbreaks+1, sizeof(int));
+      for(j=0; j<2*table->numbreaks+1; j++) {
+        double value; /* a value within the cell */
+        if(j%2 == 1)
+          value = table->breaks[j/2];
+        else if(table->numbreaks == 0)
+          value = 0;
+        else if(j == 0)
+          value = table->breaks[0] - 1;
+        else if(j == 2*table->numbreaks)
+          value = table->breaks[table->numbreaks-1] + 1;
+        else
+          value = (table->breaks[j/2-1] + table->breaks[j/2])/2;
+        for(i=0; i<layer->numclasses; i++)
+          if(table->keyed[i] && classTableRangeContains(&ranges[i], value))
+            classTableAddClass(&(table->cells[j]), &(table->numcellclasses[j]), i);
+      }
+    } else {
+      for(table->numbuckets=16; table->numbuckets<2*bestcount; table->numbuckets*=2);
+      table->buckets = (classTableEntryObj**)msSmallCalloc(table->numbuckets, sizeof(classTableEntryObj*));
+      for(i=0; i<layer->numclasses; i++) {
+        classTableEntryObj *entry;
+        int bucket;
+        if(!table->keyed[i]) continue;
+        bucket = classTableHash(keys[i]) & (table->numbuckets-1);
+        for(entry=table->buckets[bucket]; entry && strcmp(entry->key, keys[i]) != 0; entry=entry->next);
+        if(!entry) {
+          entry = (classTableEntryObj*)msSmallCalloc(1, sizeof(classTableEntryObj));
+          entry->key = msStrdup(keys[i]);
+          entry->next = table->buckets[bucket];
+          table->buckets[bucket] = entry;
+        }
+        classTableAddClass(&(entry->classes), &(entry->numclasses), i);
+      }
+    }
+
+    if(layer->debug)
+      msDebug("msShapeGetClass(): layer %s, %d of %d classes looked up on item %s.\n", layer->name, bestcount, layer->numclasses, layer->items ? layer->items[table->itemindex] : "");
+  }
+
+  free(ranges);
+  free(itemindexes);
+  free(numeric);
+  free(keys);
+  return table;
+}
+
+/*
+** Sets the classes of the table matching the shape (in order) and returns
+** MS_SUCCESS, or MS_FAILURE if the table cannot be used.
+*/
+static int msClassTableLookup(classTableObj *table, shapeObj *shape, const int **classes, int *numclasses)
+{
+  const char *value;
+
+  *classes = NULL;
+  *numclasses = 0;
+  if(table->itemindex >= shape->numvalues || !shape->values[table->itemindex]) return MS_FAILURE;
+  value = shape->values[table->itemindex];
+
+  if(table->numeric) {
+    double x = atof(value);
+    int lo = 0, hi = table->numbreaks, cell;
+    if(x != x) return MS_SUCCESS; /* NaN matches no range */
+    while(lo < hi) { /* first break >= x */
+      int mid = (lo+hi)/2;
+      if(table->breaks[mid] < x) lo = mid+1;
+      else hi = mid;
+    }
+    cell = (lo < table->numbreaks && table->breaks[lo] == x) ? 2*lo+1 : 2*lo;
+    *classes = table->cells[cell];
+    *numclasses = table->numcellclasses[cell];
+  } else {
+    classTableEntryObj *entry = table->buckets[classTableHash(value) & (table->numbuckets-1)];
+    for(; entry; entry=entry->next) {
+      if(strcmp(entry->key, value) == 0) {
+        *classes = entry->classes;
+        *numclasses = entry->numclasses;
+        break;
+      }
+    }
+  }
+  return MS_SUCCESS;
+}
+
+/* the usual class tests, the expression being known to match if evaluate is MS_FALSE */
+static int msShapeMatchesClass(layerObj *layer, mapObj *map, shapeObj *shape, int iclass, int evaluate)
+{
+  if (iclass < 0 || iclass >= layer->numclasses)
+    return MS_FALSE; /* this should never happen but just in case */
+
+  if(map->scaledenom > 0) { /* verify scaledenom here  */
+    if((layer->class[iclass]->maxscaledenom > 0) && (map->scaledenom > layer->class[iclass]->maxscaledenom))
+      return MS_FALSE; /* can skip this one, next class */
+    if((layer->class[iclass]->minscaledenom > 0) && (map->scaledenom <= layer->class[iclass]->minscaledenom))
+      return MS_FALSE; /* can skip this one, next class */
+  }
+
+  /* verify the minfeaturesize */
+  if ((shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) && (layer->class[iclass]->minfeaturesize > 0)) {
+    double minfeaturesize = Pix2LayerGeoref(map, layer,
+                                            layer->class[iclass]->minfeaturesize);
+    if (msShapeCheckSize(shape, minfeaturesize) == MS_FALSE)
+      return MS_FALSE; /* skip this one, next class */
+  }
+
+  if(layer->class[iclass]->status == MS_DELETE)
+    return MS_FALSE;
+
+  return !evaluate || msEvalExpression(layer, shape, &(layer->class[iclass]->expression), layer->classitemindex) == MS_TRUE;
+}
+
 int msShapeGetClass(layerObj *layer, mapObj *map, shapeObj *shape, int *classgroup, int numclasses)
 {
-  int i, iclass;
+  int i, j, iclass, nmatches;
+  const int *matches;
+  classTableObj *table;
 
   if (layer->numclasses > 0) {
     if (classgroup == NULL || numclasses <=0)
       numclasses = layer->numclasses;
 
+    table = (classTableObj*)layer->classtable;
+    if(table && table->numclasses != layer->numclasses) {
+      msFreeClassTable(layer);
+      table = NULL;
+    }
+    if(!table && layer->numclasses >= MS_CLASSTABLE_MIN_CLASSES)
+      layer->classtable = table = msBuildClassTable(layer);
+
+    if(table && table->itemindex >= 0 && msClassTableLookup(table, shape, &matches, &nmatches) == MS_SUCCESS) {
+      if(classgroup == NULL) { /* merge the matches with the classes outside the table */
+        for(i=0, j=0; i<nmatches || j<table->numothers;) {
+          if(j == table->numothers || (i < nmatches && matches[i] < table->others[j])) {
+            if(msShapeMatchesClass(layer, map, shape, matches[i++], MS_FALSE))
+              return(matches[i-1]);
+          } else {
+            if(msShapeMatchesClass(layer, map, shape, table->others[j++], MS_TRUE))
+              return(table->others[j-1]);
+          }
+        }
+      } else {
+        for(i=0; i<numclasses; i++) {
+          iclass = classgroup[i];
+          if(iclass >= 0 && iclass < layer->numclasses && table->keyed[iclass]) {
+            for(j=0; j<nmatches && matches[j] != iclass; j++);
+            if(j == nmatches) continue;
+            if(msShapeMatchesClass(layer, map, shape, iclass, MS_FALSE))
+              return(iclass);
+          } else if(msShapeMatchesClass(layer, map, shape, iclass, MS_TRUE)) {
+            return(iclass);
+          }
+        }
+      }
+      return(-1); /* no match */
+    }
+
     for(i=0; i<numclasses; i++) {
       if (classgroup)
         iclass = classgroup[i];
       else
         iclass = i;
 
-      if (iclass < 0 || iclass >= layer->numclasses)
-        continue; /* this should never happen but just in case */
-
-      if(map->scaledenom > 0) { /* verify scaledenom here  */
-        if((layer->class[iclass]->maxscaledenom > 0) && (map->scaledenom > layer->class[iclass]->maxscaledenom))
-          continue; /* can skip this one, next class */
-        if((layer->class[iclass]->minscaledenom > 0) && (map->scaledenom <= layer->class[iclass]->minscaledenom))
-          continue; /* can skip this one, next class */
-      }
-
-      /* verify the minfeaturesize */
-      if ((shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) && (layer->class[iclass]->minfeaturesize > 0)) {
-        double minfeaturesize = Pix2LayerGeoref(map, layer,
-                                                layer->class[iclass]->minfeaturesize);
-        if (msShapeCheckSize(shape, minfeaturesize) == MS_FALSE)
-          continue; /* skip this one, next class */
-      }
-
-      if(layer->class[iclass]->status != MS_DELETE && msEvalExpression(layer, shape, &(layer->class[iclass]->expression), layer->classitemindex) == MS_TRUE)
+      if(msShapeMatchesClass(layer, map, shape, iclass, MS_TRUE))
         return(iclass);
     }
   }
@@ -628,7 +1073,7 @@ static char *evalTextExpression(expressionObj *expr, shapeObj *shape)
       p.expr->curtoken = p.expr->tokens; /* reset */
       p.type = MS_PARSE_TYPE_STRING;
 
-      status = yyparse(&p);
+      status = msExecuteExpression(&p);
 
       if (status != 0) {
         msSetError(MS_PARSEERR, "Failed to process text expression: %s", "evalTextExpression", expr->string);
@@ -1451,6 +1896,26 @@ char *msTmpPath(mapObj *map, const char *mappath, const char *tmppath)
   return strdup(fullPath);
 }
 
+/**********************************************************************
+ *                          msTmpMemoryMaxSize()
+ *
+ * Return the size in bytes up to which temporary output files (GDAL
+ * images, OGR datasources) are kept in memory under /vsimem/ instead
+ * of the temporary directory. Set by the MS_TEMP_MEMORY_MAXSIZE config
+ * option, 0 to always use the disk. Defaults to 64MB.
+ **********************************************************************/
+double msTmpMemoryMaxSize(mapObj *map)
+{
+  const char *value = NULL;
+
+  if(map)
+    value = msGetConfigOption(map, "MS_TEMP_MEMORY_MAXSIZE");
+  if(value == NULL)
+    return 64*1024*1024;
+
+  return MS_MAX(0, atof(value));
+}
+
 /**********************************************************************
  *                          msTmpFilename()
  *
@@ -1922,6 +2387,12 @@ void msCleanup(int signal)
 
   msTimeCleanup();
 
+  msPaletteCacheCleanup();
+
+  msRegexCacheCleanup();
+
+  msOWSCacheCleanup();
+
   msIO_Cleanup();
 
   msResetErrorList();
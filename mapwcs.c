@@ -1546,6 +1546,55 @@ static int msWCSGetCoverage_ImageCRSSetup(
   return MS_SUCCESS;
 }
 
+/************************************************************************/
+/*                     msWCSGetCoverageBlockLines()                     */
+/*                                                                      */
+/*      Returns the number of lines to draw at a time when the          */
+/*      coverage should be written by blocks (see                       */
+/*      msSaveRasterLayerGDAL()), or 0 to draw it in a single image.    */
+/*      Blocks are used when the output buffer would be larger than     */
+/*      the wcs_getcoverage_maxmemory metadata (bytes, layer or web).   */
+/************************************************************************/
+
+int msWCSGetCoverageBlockLines(mapObj *map, layerObj *lp)
+{
+  const char *value;
+  outputFormatObj *format = map->outputformat;
+  double maxmemory, linesize;
+  GDALDriverH hDriver;
+  int cancreate;
+
+  value = msOWSLookupMetadata2(&(lp->metadata), &(map->web.metadata), "CO", "getcoverage_maxmemory");
+  if(value == NULL || (maxmemory = atof(value)) <= 0)
+    return 0;
+
+  /* only raw data written by a GDAL driver, no mask nor rotation */
+  if(format == NULL || !MS_RENDERER_RAWDATA(format) || strncasecmp(format->driver, "GDAL/", 5) != 0
+      || lp->mask || map->gt.need_geotransform || map->height < 4)
+    return 0;
+
+  linesize = (double) map->width * format->bands;
+  if(format->imagemode == MS_IMAGEMODE_INT16)
+    linesize *= 2;
+  else if(format->imagemode == MS_IMAGEMODE_FLOAT32)
+    linesize *= 4;
+
+  if(linesize * map->height <= maxmemory)
+    return 0;
+
+  msAcquireLock(TLOCK_GDAL);
+  hDriver = GDALGetDriverByName(format->driver+5);
+  cancreate = (hDriver != NULL && GDALGetMetadataItem(hDriver, GDAL_DCAP_CREATE, NULL) != NULL);
+  msReleaseLock(TLOCK_GDAL);
+  if(!cancreate) {
+    if(map->debug)
+      msDebug("msWCSGetCoverageBlockLines(): %s can not write by blocks, using a single image.\n", format->driver);
+    return 0;
+  }
+
+  return MS_MAX(2, (int) (maxmemory / linesize));
+}
+
 /************************************************************************/
 /*                          msWCSGetCoverage()                          */
 /************************************************************************/
@@ -1555,7 +1604,7 @@ static int msWCSGetCoverage(mapObj *map, cgiRequestObj *request,
 {
   imageObj   *image;
   layerObj   *lp;
-  int         status, i;
+  int         status, i, blocklines;
   const char *value;
   outputFormatObj *format;
   char *bandlist=NULL;
@@ -1926,6 +1975,36 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage()", par
   msSetOutputFormatOption(map->outputformat, "BAND_COUNT", numbands);
   free( bandlist );
 
+  /* large WCS 1.0 coverages are drawn and written by blocks of lines */
+  if( strncmp(params->version, "1.1",3) != 0
+      && (blocklines = msWCSGetCoverageBlockLines(map, lp)) > 0 ) {
+    const char *fo_filename = msGetOutputFormatOption( format, "FILENAME", NULL );
+    char *filename;
+
+    if(map->debug)
+      msDebug("msWCSGetCoverage(): writing %dx%d coverage by blocks of %d lines.\n",
+              map->width, map->height, blocklines);
+
+    /* the whole coverage is written before any header is sent */
+    filename = msTmpFile(map, map->mappath, NULL,
+                         format->extension ? format->extension : "img.tmp");
+    status = msSaveRasterLayerGDAL(map, lp, blocklines, filename);
+    if( status == MS_SUCCESS ) {
+      if( fo_filename )
+        msIO_setHeader("Content-Disposition","attachment; filename=%s",
+                       fo_filename );
+      msIO_setHeader("Content-Type",MS_IMAGE_MIME_TYPE(map->outputformat));
+      msIO_sendHeaders();
+
+      status = msGDALStreamFile(filename, "msWCSGetCoverage()");
+    }
+    free(filename);
+    msApplyOutputFormat(&(map->outputformat), NULL, MS_NOOVERRIDE, MS_NOOVERRIDE, MS_NOOVERRIDE);
+    if( status != MS_SUCCESS )
+      return msWCSException(map, NULL, NULL, params->version );
+    return status;
+  }
+
   /* create the image object  */
   if(!map->outputformat) {
     msSetError(MS_WCSERR, "The map outputformat is missing!", "msWCSGetCoverage()");
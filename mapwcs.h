@@ -101,6 +101,7 @@ void msWCSSetDefaultBandsRangeSetInfo( wcsParamsObj *params,
                                        coverageMetadataObj *cm,
                                        layerObj *lp );
 const char *msWCSGetRequestParameter(cgiRequestObj *request, char *name);
+int msWCSGetCoverageBlockLines(mapObj *map, layerObj *lp);
 
 /* -------------------------------------------------------------------- */
 /*      Some WCS 1.1 specific functions from mapwcs11.c                 */
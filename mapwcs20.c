@@ -1603,6 +1603,29 @@ static int msWCSWriteDocument20(mapObj* map, xmlDocPtr psDoc)
   return MS_SUCCESS;
 }
 
+/************************************************************************/
+/*                   msWCSSendFileHeaders20()                           */
+/*                                                                      */
+/*      Sends the http headers of a coverage returned as a single       */
+/*      file, without gml.                                              */
+/************************************************************************/
+
+static void msWCSSendFileHeaders20(mapObj* map, const char *fo_filename)
+{
+  msIO_setHeader("Content-Type",MS_IMAGE_MIME_TYPE(map->outputformat));
+  msIO_setHeader("Content-Description","coverage data");
+  msIO_setHeader("Content-Transfer-Encoding","binary");
+
+  if( fo_filename != NULL ) {
+    msIO_setHeader("Content-ID","coverage/%s",fo_filename);
+    msIO_setHeader("Content-Disposition","INLINE; filename=%s",fo_filename);
+  } else {
+    msIO_setHeader("Content-ID","coverage/wcs.%s",MS_IMAGE_EXTENSION(map->outputformat));
+    msIO_setHeader("Content-Disposition","INLINE");
+  }
+  msIO_sendHeaders();
+}
+
 /************************************************************************/
 /*                   msWCSWriteFile20()                                 */
 /*                                                                      */
@@ -1693,18 +1716,7 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
                       "Content-Disposition: INLINE\r\n\r\n",
                       MS_IMAGE_EXTENSION(map->outputformat));
     } else {
-      msIO_setHeader("Content-Type",MS_IMAGE_MIME_TYPE(map->outputformat));
-      msIO_setHeader("Content-Description","coverage data");
-      msIO_setHeader("Content-Transfer-Encoding","binary");
-
-      if( fo_filename != NULL ) {
-        msIO_setHeader("Content-ID","coverage/%s",fo_filename);
-        msIO_setHeader("Content-Disposition","INLINE; filename=%s",fo_filename);
-      } else {
-        msIO_setHeader("Content-ID","coverage/wcs.%s",MS_IMAGE_EXTENSION(map->outputformat));
-        msIO_setHeader("Content-Disposition","INLINE");
-      }
-      msIO_sendHeaders();
+      msWCSSendFileHeaders20(map, fo_filename);
     }
 
     status = msSaveImage(map, image, NULL);
@@ -3135,7 +3147,7 @@ int msWCSGetCoverage20(mapObj *map, cgiRequestObj *request,
   rectObj subsets, bbox;
   projectionObj imageProj;
 
-  int status, i;
+  int status, i, blocklines;
   double x_1, x_2, y_1, y_2;
   char *coverageName, *bandlist=NULL, numbands[8];
 
@@ -3479,6 +3491,32 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     msLayerSetProcessingKey(layer, "CLOSE_CONNECTION", "NORMAL");
   }
 
+  /* large coverages without gml are drawn and written by blocks of lines */
+  if(params->multipart == MS_FALSE
+      && (blocklines = msWCSGetCoverageBlockLines(map, layer)) > 0) {
+    char *filename;
+
+    if(map->debug)
+      msDebug("msWCSGetCoverage20(): writing %dx%d coverage by blocks of %d lines.\n",
+              map->width, map->height, blocklines);
+
+    /* the whole coverage is written before any header is sent */
+    filename = msTmpFile(map, map->mappath, NULL,
+                         map->outputformat->extension ? map->outputformat->extension : "img.tmp");
+    status = msSaveRasterLayerGDAL(map, layer, blocklines, filename);
+    if(status == MS_SUCCESS) {
+      msWCSSendFileHeaders20(map, msGetOutputFormatOption(map->outputformat, "FILENAME", NULL));
+      status = msGDALStreamFile(filename, "msWCSGetCoverage20()");
+    }
+    free(filename);
+
+    msFree(bandlist);
+    msWCSClearCoverageMetadata20(&cm);
+    if(status != MS_SUCCESS)
+      return msWCSException(map, NULL, NULL, params->version);
+    return MS_SUCCESS;
+  }
+
   /* create the image object  */
   if (!map->outputformat) {
     msWCSClearCoverageMetadata20(&cm);
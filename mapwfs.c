@@ -1335,7 +1335,8 @@ this request. Check wfs/ows_enable_request settings.", "msWFSDescribeFeatureType
 ** msWFSGetFeature_GMLPreamble()
 **
 ** Generate the GML preamble up to the first feature for the builtin
-** WFS GML support.
+** WFS GML support. iNumberOfFeatures is -1 when the count isn't known
+** before the features are written (streaming).
 */
 
 typedef struct {
@@ -1483,12 +1484,16 @@ static int msWFSGetFeature_GMLPreamble( mapObj *map,
                  now->tm_year+1900, now->tm_mon+1, now->tm_mday,
                  now->tm_hour, now->tm_min, now->tm_sec);
 
-        msIO_printf("   xsi:schemaLocation=\"%s %sSERVICE=WFS&amp;VERSION=%s&amp;REQUEST=DescribeFeatureType&amp;TYPENAME=%s&amp;OUTPUTFORMAT=%s  http://www.opengis.net/wfs http://schemas.opengis.net/wfs/1.1.0/wfs.xsd\" timeStamp=\"%s\" numberOfFeatures=\"%d\">\n",
+        msIO_printf("   xsi:schemaLocation=\"%s %sSERVICE=WFS&amp;VERSION=%s&amp;REQUEST=DescribeFeatureType&amp;TYPENAME=%s&amp;OUTPUTFORMAT=%s  http://www.opengis.net/wfs http://schemas.opengis.net/wfs/1.1.0/wfs.xsd\" timeStamp=\"%s\"",
                     gmlinfo->user_namespace_uri_encoded,
                     gmlinfo->script_url_encoded, encoded,
                     encoded_typename,
                     gmlinfo->output_schema_format,
-                    timestring, iNumberOfFeatures);
+                    timestring);
+        /* numberOfFeatures is optional, left out when not known yet */
+        if (iNumberOfFeatures >= 0)
+          msIO_printf(" numberOfFeatures=\"%d\"", iNumberOfFeatures);
+        msIO_printf(">\n");
       } else
         msIO_printf("   xsi:schemaLocation=\"%s %sSERVICE=WFS&amp;VERSION=%s&amp;REQUEST=DescribeFeatureType&amp;TYPENAME=%s&amp;OUTPUTFORMAT=%s  http://www.opengis.net/wfs http://schemas.opengis.net/wfs/1.1.0/wfs.xsd\">\n",
                     gmlinfo->user_namespace_uri_encoded,
@@ -1524,10 +1529,11 @@ static int msWFSGetFeature_GMLPostfix( mapObj *map,
                                        int outputformat,
                                        int maxfeatures,
                                        int iResultTypeHits,
-                                       int iNumberOfFeatures )
+                                       int iNumberOfFeatures,
+                                       int bBoundsWritten )
 
 {
-  if (((iNumberOfFeatures==0) || (maxfeatures == 0)) && iResultTypeHits == 0) {
+  if (((iNumberOfFeatures==0) || (maxfeatures == 0)) && iResultTypeHits == 0 && !bBoundsWritten) {
     msIO_printf("   <gml:boundedBy>\n");
     if(outputformat == OWS_GML3)
       msIO_printf("      <gml:Null>missing</gml:Null>\n");
@@ -1553,6 +1559,46 @@ static int msWFSGetFeature_GMLPostfix( mapObj *map,
   return MS_SUCCESS;
 }
 
+/*
+** msWFSGetFeature_GMLStream()
+**
+** Runs the GetFeature query, or one query for each of the nLayers layers of
+** panLayers (each with its own rect), writing the features as they are read.
+*/
+static int msWFSGetFeature_GMLStream( mapObj *map,
+                                      WFSGMLInfo *gmlinfo,
+                                      int outputformat,
+                                      int *panLayers,
+                                      rectObj *pasRects,
+                                      int nLayers,
+                                      int *piNumberOfFeatures )
+
+{
+  int i, n;
+
+  /* the extent of the features isn't known before they are all written */
+  msIO_printf("   <gml:boundedBy>\n");
+  if(outputformat == OWS_GML3)
+    msIO_printf("      <gml:Null>unknown</gml:Null>\n");
+  else
+    msIO_printf("      <gml:null>unknown</gml:null>\n");
+  msIO_printf("   </gml:boundedBy>\n");
+
+  *piNumberOfFeatures = 0;
+  for(i=0; (panLayers) ? (i<nLayers) : (i<1); i++) {
+    if (panLayers) {
+      map->query.rect = pasRects[i];
+      map->query.layer = panLayers[i];
+    }
+    if (msGMLWriteWFSQueryStream(map, stdout, (char *) gmlinfo->user_namespace_prefix,
+                                 outputformat, &n) != MS_SUCCESS)
+      return MS_FAILURE;
+    *piNumberOfFeatures += n;
+  }
+
+  return MS_SUCCESS;
+}
+
 /*
 ** msWFSGetFeature()
 */
@@ -1571,6 +1617,10 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req, ow
   int bBBOXSet = 0;
   char *sBBoxSrs = NULL;
   int bFeatureIdSet = 0;
+  int bStreaming = 0;
+  int *panStreamLayers = NULL;
+  rectObj *pasStreamRects = NULL;
+  int nStreamLayers = 0;
 
   const char *value;
   const char *tmpmaxfeatures = NULL;
@@ -2023,6 +2073,14 @@ int msWFSGetFeature(mapObj *map, wfsParamsObj *paramsObj, cgiRequestObj *req, ow
     bFeatureIdSet = 1;
   }
 
+  /* A plain BBOX query with GML output can be streamed: features are then */
+  /* written as the query reads them instead of being fetched again once */
+  /* the query is done, but the bounds of the collection are unknown. */
+  value = msOWSLookupMetadata(&(map->web.metadata), "FO", "getfeature_streaming");
+  if (value && strcasecmp(value, "true") == 0 && psFormat == NULL &&
+      iResultTypeHits == 0 && maxfeatures != 0 && !bFilterSet && !bFeatureIdSet)
+    bStreaming = 1;
+
 #ifdef USE_OGR
   if (bFilterSet && pszFilter && strlen(pszFilter) > 0) {
     char **tokens = NULL;
@@ -2286,6 +2344,10 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
         map object and should be used*/
       if(!paramsObj->pszSrs)
         pszMapSRS = msOWSGetEPSGProj(&(map->projection), &(map->web.metadata), "FO", MS_TRUE);
+      if (bStreaming) {
+        panStreamLayers = (int *) msSmallMalloc(sizeof(int)*map->numlayers);
+        pasStreamRects = (rectObj *) msSmallMalloc(sizeof(rectObj)*map->numlayers);
+      }
       for(j=0; j<map->numlayers; j++) {
         layerObj *lp;
         rectObj ext;
@@ -2304,6 +2366,8 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
               if (status != 0) {
                 msSetError(MS_WFSERR, "msLoadProjectionString() failed: %s",
                            "msWFSGetFeature()", pszMapSRS);
+                msFree(panStreamLayers);
+                msFree(pasStreamRects);
                 return msWFSException(map, "mapserv", "NoApplicableCode",
                                       paramsObj->pszVersion);
               }
@@ -2331,7 +2395,11 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
           }
           map->query.rect = bbox;
           map->query.layer = j;
-          if(msQueryByRect(map) != MS_SUCCESS) {
+          if (bStreaming) { /* queried while writing */
+            panStreamLayers[nStreamLayers] = j;
+            pasStreamRects[nStreamLayers] = bbox;
+            nStreamLayers++;
+          } else if(msQueryByRect(map) != MS_SUCCESS) {
             errorObj   *ms_error;
             ms_error = msGetErrorObj();
 
@@ -2368,7 +2436,7 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
       map->query.mode = MS_QUERY_MULTIPLE;
       map->query.rect = bbox;
 
-      if(msQueryByRect(map) != MS_SUCCESS) {
+      if(!bStreaming && msQueryByRect(map) != MS_SUCCESS) { /* else queried while writing */
         errorObj   *ms_error;
         ms_error = msGetErrorObj();
 
@@ -2401,11 +2469,14 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
       msIO_setHeader("Content-Type",output_mime_type);
     msIO_sendHeaders();
 
+    /* when streaming the features are counted as they are written */
     status = msWFSGetFeature_GMLPreamble( map, req, &gmlinfo, paramsObj,
                                  outputformat,
                                  iResultTypeHits,
-                                 iNumberOfFeatures );
+                                 bStreaming ? -1 : iNumberOfFeatures );
     if(status != MS_SUCCESS) {
+      msFree(panStreamLayers);
+      msFree(pasStreamRects);
       return MS_FAILURE;
     }
   }
@@ -2413,13 +2484,22 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
   /* handle case of maxfeatures = 0 */
   /*internally use a start index that start with 0 as the first index*/
   if( psFormat == NULL ) {
-    if(maxfeatures != 0 && iResultTypeHits == 0)
+    if(bStreaming) {
+      status = msWFSGetFeature_GMLStream(map, &gmlinfo, outputformat,
+                                         panStreamLayers, pasStreamRects, nStreamLayers,
+                                         &iNumberOfFeatures);
+      msFree(panStreamLayers);
+      msFree(pasStreamRects);
+    } else if(maxfeatures != 0 && iResultTypeHits == 0)
       status = msGMLWriteWFSQuery(map, stdout,
                                   (char *) gmlinfo.user_namespace_prefix,
                                   outputformat);
   } else {
     mapservObj *mapserv = msAllocMapServObj();
 
+    msFree(panStreamLayers); /* only used by the GML stream */
+    msFree(pasStreamRects);
+
     /* Setup dummy mapserv object */
     mapserv->sendheaders = MS_TRUE;
     mapserv->map = map;
@@ -2443,7 +2523,8 @@ this request. Check wfs/ows_enable_request settings.", "msWFSGetFeature()",
   if( psFormat == NULL && status == MS_SUCCESS ) {
     msWFSGetFeature_GMLPostfix( map, req, &gmlinfo, paramsObj,
                                 outputformat,
-                                maxfeatures, iResultTypeHits, iNumberOfFeatures );
+                                maxfeatures, iResultTypeHits, iNumberOfFeatures,
+                                bStreaming );
   }
 
   /*
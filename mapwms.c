@@ -1092,7 +1092,9 @@ int msWMSLoadGetMapParams(mapObj *map, int nVersion,
                strncasecmp(format->driver, "CAIRO/", 6) != 0 &&
                strncasecmp(format->driver, "OGL/", 4) != 0 &&
                strncasecmp(format->driver, "KML", 3) != 0 &&
-               strncasecmp(format->driver, "KMZ", 3) != 0)) {
+               strncasecmp(format->driver, "KMZ", 3) != 0 &&
+               strcasecmp(format->driver, "MVT") != 0 &&
+               strcasecmp(format->driver, "UTFGRID") != 0)) {
             msSetError(MS_IMGERR,
                        "Unsupported output format (%s).",
                        "msWMSLoadGetMapParams()",
@@ -3668,6 +3670,16 @@ int msWMSGetMap(mapObj *map, int nVersion, char **names, char **values, int nume
     if (!msIntegerInArray(GET_LAYER(map, i)->index, ows_request->enabled_layers, ows_request->numlayers))
       GET_LAYER(map, i)->status = MS_OFF;
 
+  /* vector tiles are encoded straight from the layers, no image is drawn */
+  if (MS_RENDERER_MVT(map->outputformat)) {
+    if( (http_max_age = msOWSLookupMetadata(&(map->web.metadata), "MO", "http_max_age")) ) {
+      msIO_setHeader("Cache-Control","max-age=%s", http_max_age);
+    }
+    if (msMVTWriteTile(map, MS_TRUE) != MS_SUCCESS)
+      return msWMSException(map, nVersion, NULL, wms_exception_format);
+    return(MS_SUCCESS);
+  }
+
   if (sldrequested && sldspatialfilter) {
     /* set the quermap style so that only selected features will be retruned */
     map->querymap.status = MS_ON;
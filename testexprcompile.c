@@ -0,0 +1,124 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Check compiled expressions (mapexpr.c) against yyparse()
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+
+extern int yyparse(parseObj *);
+
+static char *expressions[] = {
+  "([a] = [b])",
+  "([a] != [b])",
+  "([a] > [b])",
+  "([a] < [b])",
+  "([a] >= [b])",
+  "([a] <= [b])",
+  "([a] = 1)",
+  "([a] != 1)",
+  "([a] >= 1)",
+  "([a] <= 1)",
+  "([a] + 1 > [b])",
+  "([a] * 2 <= [b])",
+  "(([a] >= [b]) OR ([a] < [b]))",
+  "(NOT ([a] = [b]))",
+  "([a] IN \"1,2,nan\")",
+  NULL
+};
+
+static char *values[] = { "1", "2", "0", "-1.5", "nan", "-nan", "NaN", "inf", "-inf", NULL };
+
+static int evaluate(expressionObj *expression, shapeObj *shape, int compiled, int *result)
+{
+  parseObj p;
+
+  p.shape = shape;
+  p.expr = expression;
+  p.expr->curtoken = p.expr->tokens;
+  p.type = MS_PARSE_TYPE_BOOLEAN;
+
+  if((compiled ? msExecuteExpression(&p) : yyparse(&p)) != 0)
+    return MS_FAILURE;
+  *result = p.result.intval;
+  return MS_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+  char *items[] = { "a", "b" };
+  int numitems = 2;
+  int i, j, k, failures = 0;
+  expressionObj expression;
+  shapeObj shape;
+
+  msInitShape(&shape);
+  shape.numvalues = 2;
+  shape.values = (char **)msSmallMalloc(2*sizeof(char *));
+
+  for(i=0; expressions[i]; i++) {
+    initExpression(&expression);
+    msLoadExpressionString(&expression, expressions[i]);
+    if(msTokenizeExpression(&expression, items, &numitems) != MS_SUCCESS || !expression.program) {
+      printf("FAIL: %s is not compiled\n", expressions[i]);
+      failures++;
+      freeExpression(&expression);
+      continue;
+    }
+
+    for(j=0; values[j]; j++) {
+      for(k=0; values[k]; k++) {
+        int compiled, parsed;
+        shape.values[0] = values[j];
+        shape.values[1] = values[k];
+        if(evaluate(&expression, &shape, MS_TRUE, &compiled) != MS_SUCCESS ||
+            evaluate(&expression, &shape, MS_FALSE, &parsed) != MS_SUCCESS) {
+          printf("FAIL: %s with a=%s b=%s does not evaluate\n", expressions[i], values[j], values[k]);
+          failures++;
+        } else if(compiled != parsed) {
+          printf("FAIL: %s with a=%s b=%s: compiled %d, yyparse() %d\n",
+                 expressions[i], values[j], values[k], compiled, parsed);
+          failures++;
+        }
+      }
+    }
+    freeExpression(&expression);
+  }
+
+  shape.values[0] = shape.values[1] = NULL;
+  shape.numvalues = 0;
+  free(shape.values);
+  shape.values = NULL;
+  msFreeShape(&shape);
+  msCleanup(0);
+
+  if(failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("all compiled expressions match yyparse()\n");
+  return 0;
+}